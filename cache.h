@@ -16,4 +16,35 @@
 #include <cpu.h>
 #include <stdint.h>
 
+/* Cache-inhibited (device memory) accesses */
+static inline uint8_t ci_read_8(volatile void *addr)
+{
+	return *(volatile uint8_t *) addr;
+}
+
+static inline uint16_t ci_read_16(volatile void *addr)
+{
+	return *(volatile uint16_t *) addr;
+}
+
+static inline uint32_t ci_read_32(volatile void *addr)
+{
+	return *(volatile uint32_t *) addr;
+}
+
+static inline void ci_write_8(volatile void *addr, uint8_t data)
+{
+	*(volatile uint8_t *) addr = data;
+}
+
+static inline void ci_write_16(volatile void *addr, uint16_t data)
+{
+	*(volatile uint16_t *) addr = data;
+}
+
+static inline void ci_write_32(volatile void *addr, uint32_t data)
+{
+	*(volatile uint32_t *) addr = data;
+}
+
 #endif
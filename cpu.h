@@ -14,6 +14,8 @@
 #define __CPU_H
 
 #ifndef __ASSEMBLER__
+#include <stdint.h>
+
 #define STRINGIFY(x...) #x
 #define EXPAND(x) STRINGIFY(x)
 
@@ -37,6 +39,26 @@ static inline void flush_cache(void* r, long n)
 #define dsb(opt) do { asm volatile("dsb " # opt ::: "memory"); } while (0)
 #define dmb(opt) do { asm volatile("dmb " # opt ::: "memory"); } while (0)
 
+/* Order device register accesses */
+#define eieio() dmb(osh)
+
+/* Generic timer virtual count and its frequency in Hz */
+static inline uint64_t get_ticks(void)
+{
+	uint64_t val;
+
+	asm volatile("mrs %0, cntvct_el0" : "=r" (val));
+	return val;
+}
+
+static inline uint64_t get_tick_freq(void)
+{
+	uint64_t val;
+
+	asm volatile("mrs %0, cntfrq_el0" : "=r" (val));
+	return val;
+}
+
 #endif /* __ASSEMBLER__ */
 
 #endif
@@ -23,6 +23,7 @@
 #include <core/helpers.h>
 
 #include "helpers.h"
+#include "virtio-iommu.h"
 
 #if 1
 // #include <FreeRTOS.h>
@@ -38,11 +39,243 @@ void *SLOF_alloc_mem(size_t size)
     return malloc(size);
 }
 
+#define MEM_MAX_REPORTED 64
+#define MEM_ALLOC_BUCKETS 256
+
+/*
+ * cma_free() takes no size, the memory statistics need the sizes kept.
+ * The allocations are hashed by address, freeing one looks at its bucket
+ * only.
+ */
+static struct mem_alloc {
+    struct mem_alloc *next;
+    void *addr;		/* As handed out */
+    uintptr_t base;	/* As allocated, below addr if aligned up */
+    size_t size;	/* As allocated, including the alignment */
+} *mem_allocs[MEM_ALLOC_BUCKETS];
+static uint64_t mem_used;
+
+static struct mem_alloc **mem_alloc_bucket(void *addr)
+{
+    uintptr_t a = (uintptr_t)addr >> 3;
+
+    return &mem_allocs[(a ^ a >> 8 ^ a >> 16) & (MEM_ALLOC_BUCKETS - 1)];
+}
+
+/*
+ * Hot-plugged memory, handed out in pages by SLOF_alloc_mem_aligned() once
+ * the CMA is exhausted; SLOF_alloc_mem() is malloc() and cannot take it.
+ * Like SLOF_translate_my_address(), it expects memory to be identity
+ * mapped. Adjacent ranges are merged, so the table limits the holes
+ * between them, not the amount of memory.
+ */
+#define MEM_MAX_RANGES 64
+#define MEM_PAGE_SIZE 4096ull
+
+static struct mem_range {
+    uint8_t *addr;
+    uint64_t pages;
+    uint64_t used;	/* Pages allocated */
+    uint8_t *map;	/* One bit per page, set if allocated */
+} mem_ranges[MEM_MAX_RANGES];
+static uint64_t mem_added;
+
+static int mem_page_busy(const struct mem_range *r, uint64_t i)
+{
+    return r->map[i / 8] & (1 << (i % 8));
+}
+
+static void mem_page_set(struct mem_range *r, uint64_t i, int busy)
+{
+    if (busy)
+        r->map[i / 8] |= 1 << (i % 8);
+    else
+        r->map[i / 8] &= ~(1 << (i % 8));
+}
+
+static void mem_range_mark(struct mem_range *r, uint64_t first, uint64_t n,
+                           int busy)
+{
+    uint64_t i;
+
+    for (i = first; i < first + n; i++)
+        mem_page_set(r, i, busy);
+    r->used = busy ? r->used + n : r->used - n;
+}
+
+/* Append the pages of "hi", which starts where "lo" ends, to "lo" */
+static int mem_range_join(struct mem_range *lo, struct mem_range *hi)
+{
+    uint64_t pages = lo->pages + hi->pages, i;
+    uint8_t *map = realloc(lo->map, (pages + 7) / 8);
+
+    if (!map)
+        return -1;
+    lo->map = map;
+    for (i = 0; i < hi->pages; i++)
+        mem_page_set(lo, lo->pages + i, mem_page_busy(hi, i));
+    lo->pages = pages;
+    lo->used += hi->used;
+    free(hi->map);
+    hi->map = NULL;
+    return 0;
+}
+
+static void *mem_range_alloc(size_t size, size_t align, uint64_t *pa)
+{
+    uint64_t n = (size + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE, i, run;
+    struct mem_range *r;
+    uint8_t *addr;
+    int k;
+
+    for (k = 0; k < MEM_MAX_RANGES; k++) {
+        r = &mem_ranges[k];
+        if (!r->map || r->pages - r->used < n)
+            continue;
+        /* Runs of free pages start on an aligned page only */
+        for (i = 0, run = 0; i < r->pages; i++) {
+            if (mem_page_busy(r, i))
+                run = 0;
+            else if (run || !((uintptr_t)(r->addr + i * MEM_PAGE_SIZE) &
+                              (align - 1)))
+                run++;
+            if (run < n)
+                continue;
+            mem_range_mark(r, i + 1 - n, n, 1);
+            addr = r->addr + (i + 1 - n) * MEM_PAGE_SIZE;
+            if (pa)
+                *pa = (uint64_t)addr;
+            return addr;
+        }
+    }
+    return NULL;
+}
+
+static struct mem_range *mem_range_of(void *addr)
+{
+    uint8_t *p = addr;
+    int k;
+
+    for (k = 0; k < MEM_MAX_RANGES; k++)
+        if (mem_ranges[k].map && p >= mem_ranges[k].addr &&
+            p < mem_ranges[k].addr + mem_ranges[k].pages * MEM_PAGE_SIZE)
+            return &mem_ranges[k];
+    return NULL;
+}
+
+/* Free ranges reported to a balloon and not allocated since */
+static struct mem_reported {
+    void *addr;
+    uint64_t len;
+} mem_reported[MEM_MAX_REPORTED];
+
+/*
+ * The CMA takes no alignment. Most allocations come out aligned anyway,
+ * the others are retried with room to align their start.
+ */
+static void *mem_cma_alloc(struct mem_alloc *a, size_t align, uint64_t *pa)
+{
+    uintptr_t off;
+
+    a->base = cma_alloc(slof_cma, a->size, pa);
+    if (!a->base || !(a->base & (align - 1)))
+        return (void *)a->base;
+
+    cma_free(slof_cma, a->base);
+    a->size += align - 1;
+    a->base = cma_alloc(slof_cma, a->size, pa);
+    if (!a->base)
+        return NULL;
+    off = -a->base & (align - 1);
+    *pa += off;
+    return (void *)(a->base + off);
+}
+
+/* Allocate from the CMA, then from hot-plugged memory. align is a power of 2 */
+static void *mem_alloc(size_t size, size_t align, uint64_t *pa)
+{
+    struct mem_alloc *a = malloc(sizeof(*a)), **b;
+    uint64_t addr_pa;
+
+    if (!a)
+        return NULL;
+    if (!align)
+        align = 1;
+
+    a->size = size;
+    a->addr = mem_cma_alloc(a, align, &addr_pa);
+    if (!a->addr) {
+        a->size = size;
+        a->addr = mem_range_alloc(size, align, &addr_pa);
+        a->base = (uintptr_t)a->addr;
+    }
+    if (!a->addr) {
+        free(a);
+        return NULL;
+    }
+
+    b = mem_alloc_bucket(a->addr);
+    a->next = *b;
+    *b = a;
+    mem_used += a->size;
+    if (pa)
+        *pa = addr_pa;
+    return a->addr;
+}
+
+static void mem_free(void *addr)
+{
+    struct mem_range *r = mem_range_of(addr);
+    struct mem_alloc **pp, *a;
+
+    for (pp = mem_alloc_bucket(addr); (a = *pp); pp = &a->next)
+        if (a->addr == addr)
+            break;
+    if (!a)
+        return;
+
+    *pp = a->next;
+    mem_used -= a->size;
+    if (r)
+        mem_range_mark(r, ((uint8_t *)addr - r->addr) / MEM_PAGE_SIZE,
+                       (a->size + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE, 0);
+    else
+        cma_free(slof_cma, a->base);
+    free(a);
+}
+
+/* Forget reported ranges overlapping [addr, addr + len), they are in use */
+static void mem_unreport(void *addr, uint64_t len)
+{
+    uint8_t *start = addr, *r;
+    int i;
+
+    for (i = 0; i < MEM_MAX_REPORTED; i++) {
+        r = mem_reported[i].addr;
+        if (r && r < start + len && start < r + mem_reported[i].len)
+            mem_reported[i].addr = NULL;
+    }
+}
+
+static int mem_is_reported(void *addr, uint64_t len)
+{
+    int i;
+
+    for (i = 0; i < MEM_MAX_REPORTED; i++)
+        if (mem_reported[i].addr == addr && mem_reported[i].len == len)
+            return 1;
+    return 0;
+}
+
 void *SLOF_alloc_mem_aligned(size_t size, size_t alignment, uint64_t *pa)
 {
+    void *addr;
+
     assert(slof_cma);
-    return (void*)cma_alloc(slof_cma, size, pa);
-    // return aligned_alloc(size, alignment);
+    addr = mem_alloc(size, alignment, pa);
+    if (addr)
+        mem_unreport(addr, size);
+    return addr;
 }
 
 void SLOF_free_mem(void *addr, long size)
@@ -53,23 +286,203 @@ void SLOF_free_mem(void *addr, long size)
 void SLOF_free_mem_aligned(void *addr)
 {
     assert(slof_cma);
-    cma_free(slof_cma, (vaddr_t)addr);
+    mem_free(addr);
 }
 
 long SLOF_dma_map_in(void *virt, long size, int cacheable)
 {
-	// FIXME Empty as only used if IOMMU and VIRTIO_VERSION1 are supported
-	(void) size;
-	(void) cacheable;
-	return (long) virt;
+	// Identity unless a virtio-iommu is open
+	return virtioiommu_dma_map_in(virt, size, cacheable);
 }
 
 void SLOF_dma_map_out(long phys, void *virt, long size)
 {
-	// FIXME Empty as only used if IOMMU and VIRTIO_VERSION1 are supported
-	(void) size;
-	(void) phys;
-	(void) virt;
+	virtioiommu_dma_map_out(phys, virt, size);
+}
+
+void *SLOF_translate_my_address(void *addr)
+{
+	// FIXME PCI BARs are expected to be identity mapped
+	return addr;
+}
+
+int SLOF_get_cpu(void)
+{
+	// FIXME Report the calling CPU once the platform exposes it
+	return 0;
+}
+
+int SLOF_irq_set_affinity(void *dev_base, uint16_t vector, int cpu)
+{
+	// FIXME Interrupt routing is not available on this platform yet
+	(void) dev_base;
+	(void) vector;
+	(void) cpu;
+	return -1;
+}
+
+/* The DMA arena and hot-plugged memory are all the drivers see */
+int SLOF_get_mem_stats(uint64_t *total, uint64_t *free)
+{
+    if (!slof_cma)
+        return -1;
+    *total = CMA_SIZE + mem_added;
+    *free = *total - mem_used;
+    return 0;
+}
+
+/*
+ * Take free ranges of at least min_len bytes out of the allocators so they
+ * can be reported to a balloon device. Ranges already reported and not
+ * allocated since are skipped.
+ */
+int SLOF_isolate_free_ranges(uint64_t min_len, void **addr, uint64_t *len,
+			     int max)
+{
+    void *skipped[MEM_MAX_REPORTED];
+    int i, n = 0, nr_skipped = 0;
+    void *p;
+
+    if (!slof_cma)
+        return 0;
+
+    /* Allocating the ranges takes them out of the allocator, in pages */
+    while (n < max && (p = mem_alloc(min_len, MEM_PAGE_SIZE, NULL))) {
+        if (!mem_is_reported(p, min_len)) {
+            addr[n] = p;
+            len[n++] = min_len;
+        } else if (nr_skipped < MEM_MAX_REPORTED) {
+            skipped[nr_skipped++] = p;
+        } else {
+            mem_free(p);
+            break;
+        }
+    }
+
+    for (i = 0; i < nr_skipped; i++)
+        mem_free(skipped[i]);
+    return n;
+}
+
+/* Give isolated ranges back to the allocators, marked as reported */
+void SLOF_release_free_ranges(void **addr, const uint64_t *len, int nr)
+{
+    int i, j;
+
+    for (i = 0; i < nr; i++) {
+        mem_free(addr[i]);
+        for (j = 0; j < MEM_MAX_REPORTED; j++)
+            if (!mem_reported[j].addr) {
+                mem_reported[j].addr = addr[i];
+                mem_reported[j].len = len[i];
+                break;
+            }
+    }
+}
+
+/*
+ * Hand hot-plugged memory to SLOF_alloc_mem_aligned(), merged with the
+ * ranges right below and above it
+ */
+int SLOF_add_mem_range(void *addr, uint64_t len)
+{
+    struct mem_range new, *lo = NULL, *hi = NULL, *r = NULL;
+    uint8_t *end;
+    int k;
+
+    if (len < MEM_PAGE_SIZE)
+        return -1;
+
+    new.addr = addr;
+    new.pages = len / MEM_PAGE_SIZE;
+    new.used = 0;
+    new.map = calloc(1, (new.pages + 7) / 8);
+    if (!new.map)
+        return -1;
+    end = new.addr + new.pages * MEM_PAGE_SIZE;
+
+    for (k = 0; k < MEM_MAX_RANGES; k++) {
+        if (!mem_ranges[k].map) {
+            if (!r)
+                r = &mem_ranges[k];
+            continue;
+        }
+        if (mem_ranges[k].addr + mem_ranges[k].pages * MEM_PAGE_SIZE == new.addr)
+            lo = &mem_ranges[k];
+        else if (mem_ranges[k].addr == end)
+            hi = &mem_ranges[k];
+    }
+
+    if (lo && !mem_range_join(lo, &new)) {
+        r = lo;
+    } else if (r) {
+        *r = new;
+    } else {
+        free(new.map);
+        return -1;
+    }
+    if (hi)
+        mem_range_join(r, hi);
+
+    mem_added += len / MEM_PAGE_SIZE * MEM_PAGE_SIZE;
+    return 0;
+}
+
+/*
+ * Take a range back from SLOF_alloc_mem_aligned(), only if none of it is in
+ * use. It may be part of a larger range, which is split then.
+ */
+int SLOF_remove_mem_range(void *addr, uint64_t len)
+{
+    struct mem_range *r = mem_range_of(addr), *t = NULL;
+    uint64_t first, n = len / MEM_PAGE_SIZE, i, used = 0;
+    int k;
+
+    if (!r || !n || ((uint8_t *)addr - r->addr) % MEM_PAGE_SIZE)
+        return -1;
+    first = ((uint8_t *)addr - r->addr) / MEM_PAGE_SIZE;
+    if (first + n > r->pages)
+        return -1;
+    for (i = first; i < first + n; i++)
+        if (mem_page_busy(r, i))
+            return -1;
+
+    if (first && first + n < r->pages) {
+        /* The pages above the hole become a range of their own */
+        for (k = 0; k < MEM_MAX_RANGES && !t; k++)
+            if (!mem_ranges[k].map)
+                t = &mem_ranges[k];
+        if (!t)
+            return -1;
+        t->pages = r->pages - first - n;
+        t->map = calloc(1, (t->pages + 7) / 8);
+        if (!t->map)
+            return -1;
+        t->addr = r->addr + (first + n) * MEM_PAGE_SIZE;
+        for (i = 0; i < t->pages; i++)
+            if (mem_page_busy(r, first + n + i)) {
+                mem_page_set(t, i, 1);
+                used++;
+            }
+        t->used = used;
+        r->used -= used;
+        r->pages = first;
+    } else if (first + n < r->pages) {
+        /* The hole is at the bottom, move the rest down in the map */
+        for (i = 0; i < r->pages - n; i++)
+            mem_page_set(r, i, mem_page_busy(r, i + n));
+        r->addr += n * MEM_PAGE_SIZE;
+        r->pages -= n;
+    } else if (first) {
+        r->pages = first;
+    } else {
+        free(r->map);
+        r->map = NULL;
+    }
+
+    mem_added -= n * MEM_PAGE_SIZE;
+    mem_unreport(addr, len);
+    return 0;
 }
 
 /**
@@ -36,6 +36,14 @@ extern void SLOF_pci_config_write32(long offset, long value);
 extern void SLOF_pci_config_write16(long offset, long value);
 extern void SLOF_pci_config_write8(long offset, long value);
 extern void *SLOF_translate_my_address(void *addr);
+extern int SLOF_get_cpu(void);
+extern int SLOF_irq_set_affinity(void *dev_base, uint16_t vector, int cpu);
+extern int SLOF_get_mem_stats(uint64_t *total, uint64_t *free);
+extern int SLOF_isolate_free_ranges(uint64_t min_len, void **addr,
+				    uint64_t *len, int max);
+extern void SLOF_release_free_ranges(void **addr, const uint64_t *len, int nr);
+extern int SLOF_add_mem_range(void *addr, uint64_t len);
+extern int SLOF_remove_mem_range(void *addr, uint64_t len);
 extern int write_mm_log(char *data, unsigned int len, unsigned short type);
 extern void SLOF_set_chosen_int(const char *s, long val);
 extern void SLOF_set_chosen_bytes(const char *s, const char *addr, size_t size);
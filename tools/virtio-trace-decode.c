@@ -0,0 +1,125 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Hosted decoder for virtqueue trace dumps, see virtio-trace.h.
+ *
+ * Usage: virtio-trace-decode <dump> [freq-hz]
+ *
+ * Prints one line per record, oldest first, with the time since the first
+ * record and since the previous one. "used" records also show the latency
+ * since the matching "add" or "refill" of the same queue and head.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../virtio-trace.h"
+
+static const char *event_name(uint8_t type)
+{
+	switch (type) {
+	case VT_ADD:	return "add";
+	case VT_KICK:	return "kick";
+	case VT_USED:	return "used";
+	case VT_IRQ:	return "irq";
+	case VT_REFILL:	return "refill";
+	default:	return "?";
+	}
+}
+
+/* Ticks to nanoseconds */
+static double to_ns(uint64_t ticks, uint64_t freq)
+{
+	return (double) ticks * 1e9 / freq;
+}
+
+int main(int argc, char *argv[])
+{
+	struct virtio_trace_buf *tb;
+	struct virtio_trace_event *ev;
+	uint64_t freq, first = 0, prev = 0;
+	uint32_t start, count, i, j;
+	FILE *f;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <dump> [freq-hz]\n", argv[0]);
+		return 1;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	tb = malloc(sizeof(*tb));
+	if (!tb || fread(tb, 1, offsetof(struct virtio_trace_buf, ev), f) !=
+	    offsetof(struct virtio_trace_buf, ev)) {
+		fprintf(stderr, "%s: short read\n", argv[1]);
+		return 1;
+	}
+
+	if (tb->magic != VIRTIO_TRACE_MAGIC || tb->version != VIRTIO_TRACE_VERSION ||
+	    tb->event_size != sizeof(*ev)) {
+		fprintf(stderr, "%s: not a version %d trace dump\n", argv[1],
+			VIRTIO_TRACE_VERSION);
+		return 1;
+	}
+
+	if (tb->entries != VIRTIO_TRACE_ENTRIES) {
+		fprintf(stderr, "%s: dump has %u entries, decoder built for %u\n",
+			argv[1], tb->entries, VIRTIO_TRACE_ENTRIES);
+		return 1;
+	}
+
+	if (fread(tb->ev, sizeof(*ev), tb->entries, f) != tb->entries) {
+		fprintf(stderr, "%s: short read\n", argv[1]);
+		return 1;
+	}
+	fclose(f);
+
+	freq = argc > 2 ? strtoull(argv[2], NULL, 0) : tb->freq;
+	if (!freq) {
+		fprintf(stderr, "%s: counter frequency unknown, pass it\n", argv[1]);
+		return 1;
+	}
+
+	count = tb->pos < tb->entries ? tb->pos : tb->entries;
+	start = tb->pos - count;
+
+	printf("%12s %10s %-6s %5s %5s %10s %10s\n",
+	       "time_ns", "delta_ns", "event", "queue", "head", "len", "lat_ns");
+
+	for (i = 0; i < count; i++) {
+		ev = &tb->ev[(start + i) & (tb->entries - 1)];
+		if (!i)
+			first = prev = ev->ts;
+
+		printf("%12.0f %10.0f %-6s %5u %5u %10u", to_ns(ev->ts - first, freq),
+		       to_ns(ev->ts - prev, freq), event_name(ev->type),
+		       ev->queue, ev->head, ev->len);
+		prev = ev->ts;
+
+		if (ev->type == VT_USED) {
+			/* Look back for the submission of the same chain */
+			for (j = i; j-- > 0;) {
+				struct virtio_trace_event *sub;
+
+				sub = &tb->ev[(start + j) & (tb->entries - 1)];
+				if ((sub->type == VT_ADD || sub->type == VT_REFILL) &&
+				    sub->queue == ev->queue && sub->head == ev->head) {
+					printf(" %10.0f", to_ns(ev->ts - sub->ts, freq));
+					break;
+				}
+			}
+		}
+		printf("\n");
+	}
+
+	free(tb);
+	return 0;
+}
@@ -0,0 +1,518 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Driver for the virtio memory balloon, see the Virtio Spec 1.2 chapter 5.5.
+ *
+ * virtioballoon_poll() moves the balloon towards the size the host asks
+ * for, one request of at most BALLOON_PFNS pages per call, and answers
+ * statistics requests. Pages for the balloon come from the aligned
+ * allocator and go back to it on deflate.
+ *
+ * Free page reporting hands large free ranges of the allocators to the
+ * host without taking them from the guest for good: the allocator isolates
+ * the ranges, the device discards their backing and the ranges go back
+ * into circulation marked as reported. Free page hinting is not driven.
+ *
+ * Requests are synchronous and like the core, the driver is not thread
+ * safe.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <cpu.h>
+#include <helpers.h>
+#include <byteorder.h>
+#include "virtio-balloon.h"
+#include "virtio-internal.h"
+#include "virtio-ring.h"
+
+#define DRIVER_FEATURE_SUPPORT	(VIRTIO_BALLOON_F_MUST_TELL_HOST | \
+				 VIRTIO_BALLOON_F_STATS_VQ | \
+				 VIRTIO_BALLOON_F_DEFLATE_ON_OOM | \
+				 VIRTIO_BALLOON_F_REPORTING)
+
+/* The config space is little endian, legacy devices included */
+static uint32_t virtioballoon_get_config(struct virtio_balloon *b, int offset)
+{
+	uint32_t val = virtio_get_config(&b->vdev, offset, sizeof(uint32_t));
+
+	return virtio_is_modern(&b->vdev) ? val : le32_to_cpu(val);
+}
+
+static void virtioballoon_set_config(struct virtio_balloon *b, int offset,
+				     uint32_t val)
+{
+	if (!virtio_is_modern(&b->vdev))
+		val = cpu_to_le32(val);
+	virtio_set_config(&b->vdev, offset, sizeof(uint32_t), val);
+}
+
+/* Hand descriptor chain 0 to the device and wait until it is used */
+static int virtioballoon_send(struct virtio_balloon *b, int q, uint32_t bytes)
+{
+	struct virtio_device *vdev = &b->vdev;
+	struct vqs *vq = &vdev->vq[q];
+	uint16_t idx;
+
+	idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, idx)] = 0;
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	virtio_stats_posted(vdev, vq, bytes);
+
+	__virtio_queue_notify(vdev, q);
+
+	if (virtio_wait_used(vdev, vq, NULL, VIRTIO_TIMEOUT) < 0) {
+		b->broken = 1;
+		return -ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+/* Tell the device about the pages in b->pfns */
+static int virtioballoon_send_pfns(struct virtio_balloon *b, int q, uint32_t n)
+{
+	struct virtio_device *vdev = &b->vdev;
+	struct vqs *vq = &vdev->vq[q];
+
+	__virtio_free_desc(vq, 0, vdev->features);
+	if (__virtio_fill_desc(vq, 0, vdev->features, (uint64_t) b->pfns,
+			       n * sizeof(b->pfns[0]), 0, 0))
+		return -EIO;
+
+	return virtioballoon_send(b, q, n * sizeof(b->pfns[0]));
+}
+
+/* Free the "n" pages added last, and the chunks they leave empty */
+static void virtioballoon_pop(struct virtio_balloon *b, uint32_t n)
+{
+	struct virtio_balloon_chunk *c;
+
+	while ((c = b->chunks)) {
+		if (!n && c->nr)
+			break;
+		if (!c->nr) {
+			b->chunks = c->next;
+			SLOF_free_mem(c, sizeof(*c));
+			continue;
+		}
+		c->nr--;
+		SLOF_free_mem_aligned(c->pages[c->nr].va);
+		n--;
+	}
+}
+
+static int virtioballoon_inflate(struct virtio_balloon *b, uint32_t pages)
+{
+	struct virtio_device *vdev = &b->vdev;
+	struct virtio_balloon_chunk *c;
+	uint64_t pa;
+	uint32_t n = 0;
+	void *va;
+	int rc;
+
+	if (pages > BALLOON_PFNS)
+		pages = BALLOON_PFNS;
+
+	while (n < pages) {
+		c = b->chunks;
+		if (!c || c->nr == BALLOON_CHUNK_PAGES) {
+			c = SLOF_alloc_mem(sizeof(*c));
+			if (!c)
+				break;
+			c->nr = 0;
+			c->next = b->chunks;
+			b->chunks = c;
+		}
+
+		va = SLOF_alloc_mem_aligned(BALLOON_PAGE_SIZE, BALLOON_PAGE_SIZE, &pa);
+		if (!va)
+			break;
+		c->pages[c->nr].va = va;
+		c->pages[c->nr].pa = pa;
+		c->nr++;
+		b->pfns[n++] = virtio_cpu_to_modern32(vdev, pa >> VIRTIO_BALLOON_PFN_SHIFT);
+	}
+	if (!n) {
+		virtioballoon_pop(b, 0);
+		return -ENOMEM;
+	}
+
+	/*
+	 * Whatever the host did with the pages of a failed request, their
+	 * contents are not needed, the allocator can have them back.
+	 */
+	rc = virtioballoon_send_pfns(b, BALLOON_VQ_INFLATE, n);
+	if (rc) {
+		virtioballoon_pop(b, n);
+		return rc;
+	}
+
+	b->actual += n;
+	virtioballoon_set_config(b, offsetof(struct virtio_balloon_config, actual),
+				 b->actual);
+
+	return n;
+}
+
+/* Take pages back, from the most recently filled chunk only */
+static int __virtioballoon_deflate(struct virtio_balloon *b, uint32_t pages)
+{
+	struct virtio_device *vdev = &b->vdev;
+	struct virtio_balloon_chunk *c;
+	uint32_t i, n;
+	int rc;
+
+	while ((c = b->chunks) && !c->nr) {
+		b->chunks = c->next;
+		SLOF_free_mem(c, sizeof(*c));
+	}
+	if (!c || !pages)
+		return 0;
+
+	n = pages < c->nr ? pages : c->nr;
+	if (n > BALLOON_PFNS)
+		n = BALLOON_PFNS;
+	c->nr -= n;
+	for (i = 0; i < n; i++)
+		b->pfns[i] = virtio_cpu_to_modern32(vdev,
+			c->pages[c->nr + i].pa >> VIRTIO_BALLOON_PFN_SHIFT);
+
+	rc = virtioballoon_send_pfns(b, BALLOON_VQ_DEFLATE, n);
+	if (rc && b->tell_host) {
+		/* The pages may not be used before the host knows */
+		c->nr += n;
+		return rc;
+	}
+
+	for (i = 0; i < n; i++)
+		SLOF_free_mem_aligned(c->pages[c->nr + i].va);
+
+	b->actual -= n;
+	if (!rc)
+		virtioballoon_set_config(b, offsetof(struct virtio_balloon_config,
+						     actual), b->actual);
+
+	return rc ? rc : (int) n;
+}
+
+/**
+ * Take pages back from the balloon, e.g. when an allocation fails. Unless
+ * VIRTIO_BALLOON_F_DEFLATE_ON_OOM was negotiated, the balloon does not
+ * shrink below the size the host asks for.
+ * @param   b      the device
+ * @param   pages  number of pages wanted
+ * @return  number of pages returned to the allocator, or negative errno
+ */
+int virtioballoon_deflate(struct virtio_balloon *b, uint32_t pages)
+{
+	uint32_t target;
+
+	if (b->broken)
+		return -EIO;
+
+	if (!b->deflate_on_oom) {
+		target = virtioballoon_get_config(b,
+			offsetof(struct virtio_balloon_config, num_pages));
+		if (b->actual <= target)
+			return 0;
+		if (pages > b->actual - target)
+			pages = b->actual - target;
+	}
+
+	return __virtioballoon_deflate(b, pages);
+}
+
+/*
+ * Fill in the statistics buffer and give it to the device
+ * @return  0, or -1 if there are no values or the buffer could not be
+ *          mapped, and it was kept
+ */
+static int virtioballoon_post_stats(struct virtio_balloon *b)
+{
+	struct virtio_device *vdev = &b->vdev;
+	struct vqs *vq = &vdev->vq[b->stats_vq];
+	uint64_t total, free;
+	uint16_t idx;
+	int n = 0;
+
+	if (SLOF_get_mem_stats(&total, &free))
+		return -1;
+	b->stats[n].tag = virtio_cpu_to_modern16(vdev, VIRTIO_BALLOON_S_MEMTOT);
+	b->stats[n++].val = virtio_cpu_to_modern64(vdev, total);
+	b->stats[n].tag = virtio_cpu_to_modern16(vdev, VIRTIO_BALLOON_S_MEMFREE);
+	b->stats[n++].val = virtio_cpu_to_modern64(vdev, free);
+	b->stats[n].tag = virtio_cpu_to_modern16(vdev, VIRTIO_BALLOON_S_AVAIL);
+	b->stats[n++].val = virtio_cpu_to_modern64(vdev, free);
+
+	__virtio_free_desc(vq, 0, vdev->features);
+	if (__virtio_fill_desc(vq, 0, vdev->features, (uint64_t) b->stats,
+			       n * sizeof(b->stats[0]), 0, 0))
+		return -1;
+
+	idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, idx)] = 0;
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	virtio_stats_posted(vdev, vq, n * sizeof(b->stats[0]));
+
+	return 0;
+}
+
+/*
+ * The device returns the statistics buffer when it wants fresh values.
+ * A buffer kept for lack of values is tried again on every call.
+ */
+static void virtioballoon_service_stats(struct virtio_balloon *b)
+{
+	struct virtio_device *vdev = &b->vdev;
+	uint32_t len;
+
+	if (b->stats_vq < 0)
+		return;
+	if (!b->stats_held &&
+	    virtio_get_used(vdev, &vdev->vq[b->stats_vq], &len) < 0)
+		return;
+
+	b->stats_held = !!virtioballoon_post_stats(b);
+	if (!b->stats_held)
+		__virtio_queue_notify(vdev, b->stats_vq);
+}
+
+static void virtioballoon_vq_interrupt(struct virtio_device *dev, struct vqs *vq,
+				       void *arg)
+{
+	virtioballoon_service_stats(arg);
+}
+
+void virtioballoon_handle_interrupt(struct virtio_balloon *b)
+{
+	virtio_handle_interrupt(&b->vdev);
+}
+
+/**
+ * Answer statistics requests and move the balloon one step towards the
+ * size the host asks for.
+ * @return  number of pages moved, or negative errno
+ */
+int virtioballoon_poll(struct virtio_balloon *b)
+{
+	uint32_t target;
+
+	if (b->broken)
+		return -EIO;
+
+	virtioballoon_service_stats(b);
+
+	target = virtioballoon_get_config(b,
+		offsetof(struct virtio_balloon_config, num_pages));
+	if (target > b->actual)
+		return virtioballoon_inflate(b, target - b->actual);
+	if (target < b->actual)
+		return __virtioballoon_deflate(b, b->actual - target);
+
+	return 0;
+}
+
+/**
+ * Report the free ranges of the allocators to the host, which may then
+ * reclaim their backing memory. Only ranges not reported before and of
+ * at least BALLOON_REPORT_MIN bytes are considered.
+ * @return  number of ranges reported, or negative errno
+ */
+int virtioballoon_report_free(struct virtio_balloon *b)
+{
+	struct virtio_device *vdev = &b->vdev;
+	struct vqs *vq;
+	uint32_t bytes;
+	int i, n, rc, err, total = 0;
+
+	if (b->report_vq < 0)
+		return -ENODEV;
+	if (b->broken)
+		return -EIO;
+
+	vq = &vdev->vq[b->report_vq];
+	for (;;) {
+		n = SLOF_isolate_free_ranges(BALLOON_REPORT_MIN, b->report_addr,
+					     b->report_len, b->report_max);
+		if (n <= 0)
+			break;
+
+		bytes = 0;
+		err = 0;
+		for (i = 0; i < n; i++) {
+			__virtio_free_desc(vq, i, vdev->features);
+			err |= __virtio_fill_desc(vq, i, vdev->features,
+						  (uint64_t) b->report_addr[i],
+						  b->report_len[i], VRING_DESC_F_WRITE |
+						  (i + 1 < n ? VRING_DESC_F_NEXT : 0), i + 1);
+			bytes += b->report_len[i];
+		}
+
+		/*
+		 * The device could not reach a range, do not post the chain.
+		 * The ranges count as reported until they are allocated again.
+		 */
+		if (err) {
+			__virtio_free_descs(vq, 0, n, vdev->features);
+			SLOF_release_free_ranges(b->report_addr, b->report_len, n);
+			return -EIO;
+		}
+
+		/* On timeout the ranges stay isolated, the device may use them */
+		rc = virtioballoon_send(b, b->report_vq, bytes);
+		if (rc)
+			return rc;
+
+		SLOF_release_free_ranges(b->report_addr, b->report_len, n);
+		for (i = 0; i < n; i++)
+			b->reported += b->report_len[i];
+		total += n;
+	}
+
+	return total;
+}
+
+static int virtioballoon_init(struct virtio_balloon *b)
+{
+	struct virtio_device *vdev = &b->vdev;
+	uint64_t features;
+	struct vqs *vq;
+	int status = VIRTIO_STAT_ACKNOWLEDGE | VIRTIO_STAT_DRIVER;
+	int q;
+
+	virtio_set_status(vdev, status);
+
+	/* Device features are all accepted, see which ones were offered */
+	if (virtio_is_modern(vdev)) {
+		if (virtio_negotiate_guest_features(vdev, VIRTIO_F_VERSION_1 |
+						    DRIVER_FEATURE_SUPPORT))
+			goto dev_error;
+		features = vdev->features;
+		virtio_get_status(vdev, &status);
+	} else {
+		features = virtio_get_host_features(vdev) & DRIVER_FEATURE_SUPPORT;
+		virtio_set_guest_features(vdev, features);
+	}
+	b->tell_host = !!(features & VIRTIO_BALLOON_F_MUST_TELL_HOST);
+	b->deflate_on_oom = !!(features & VIRTIO_BALLOON_F_DEFLATE_ON_OOM);
+
+	/* Queues of features not negotiated do not take a number */
+	q = BALLOON_VQ_DEFLATE + 1;
+	b->stats_vq = features & VIRTIO_BALLOON_F_STATS_VQ ? q++ : -1;
+	if (features & VIRTIO_BALLOON_F_FREE_PAGE_HINT)
+		q++;
+	b->report_vq = features & VIRTIO_BALLOON_F_REPORTING ? q++ : -1;
+
+	if (!virtio_queue_init_vq(vdev, BALLOON_VQ_INFLATE) ||
+	    !virtio_queue_init_vq(vdev, BALLOON_VQ_DEFLATE))
+		goto dev_error;
+
+	if (b->stats_vq >= 0) {
+		if (!virtio_queue_init_vq(vdev, b->stats_vq))
+			goto dev_error;
+		/* The device waits for a first buffer before it asks for more */
+		b->stats_held = !!virtioballoon_post_stats(b);
+		virtio_queue_set_handler(vdev, b->stats_vq,
+					 virtioballoon_vq_interrupt, b);
+	}
+
+	if (b->report_vq >= 0) {
+		vq = virtio_queue_init_vq(vdev, b->report_vq);
+		if (!vq)
+			goto dev_error;
+		b->report_max = vq->size < BALLOON_REPORT_RANGES ?
+				vq->size : BALLOON_REPORT_RANGES;
+	}
+
+	/* Free memory is not poisoned, reported pages may come back as zeros */
+	if (features & VIRTIO_BALLOON_F_PAGE_POISON)
+		virtioballoon_set_config(b, offsetof(struct virtio_balloon_config,
+						     poison_val), 0);
+
+	status |= VIRTIO_STAT_DRIVER_OK;
+	virtio_set_status(vdev, status);
+
+	if (b->stats_vq >= 0)
+		virtio_queue_notify(vdev, b->stats_vq);
+
+	return 0;
+
+dev_error:
+	status |= VIRTIO_STAT_FAILED;
+	virtio_set_status(vdev, status);
+	return -1;
+}
+
+static void virtioballoon_free(struct virtio_balloon *b)
+{
+	struct virtio_device *vdev = &b->vdev;
+	struct virtio_balloon_chunk *c;
+	uint32_t i;
+
+	/* After the reset the host no longer holds the pages */
+	while ((c = b->chunks)) {
+		for (i = 0; i < c->nr; i++)
+			SLOF_free_mem_aligned(c->pages[i].va);
+		b->chunks = c->next;
+		SLOF_free_mem(c, sizeof(*c));
+	}
+
+	virtio_queue_term_vq(vdev, &vdev->vq[BALLOON_VQ_INFLATE], BALLOON_VQ_INFLATE);
+	virtio_queue_term_vq(vdev, &vdev->vq[BALLOON_VQ_DEFLATE], BALLOON_VQ_DEFLATE);
+	if (b->stats_vq >= 0)
+		virtio_queue_term_vq(vdev, &vdev->vq[b->stats_vq], b->stats_vq);
+	if (b->report_vq >= 0)
+		virtio_queue_term_vq(vdev, &vdev->vq[b->report_vq], b->report_vq);
+	SLOF_free_mem(b, sizeof(*b));
+}
+
+struct virtio_balloon *virtioballoon_open(struct virtio_device *dev)
+{
+	struct virtio_balloon *b;
+
+	if (!dev)
+		return NULL;
+
+	b = SLOF_alloc_mem(sizeof(*b));
+	if (!b) {
+		printf("Unable to allocate virtio-balloon driver\n");
+		return NULL;
+	}
+	memset(b, 0, sizeof(*b));
+	b->stats_vq = -1;
+	b->report_vq = -1;
+
+	/* make a copy of the device structure */
+	memcpy(&b->vdev, dev, sizeof(struct virtio_device));
+
+	virtio_reset_device(&b->vdev);
+	virtio_set_status(&b->vdev, VIRTIO_STAT_ACKNOWLEDGE);
+
+	if (virtioballoon_init(b)) {
+		virtioballoon_free(b);
+		return NULL;
+	}
+
+	return b;
+}
+
+void virtioballoon_close(struct virtio_balloon *b)
+{
+	if (!b)
+		return;
+
+	/* Quiesce and reset device */
+	virtio_set_status(&b->vdev, VIRTIO_STAT_FAILED);
+	virtio_reset_device(&b->vdev);
+
+	virtioballoon_free(b);
+}
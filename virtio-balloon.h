@@ -0,0 +1,101 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#ifndef _VIRTIO_BALLOON_H
+#define _VIRTIO_BALLOON_H
+
+#include <stdint.h>
+#include "virtio.h"
+
+/*
+ * The stats and reporting queues follow the deflate queue, each only if
+ * its feature was negotiated, so their numbers are kept in the driver.
+ */
+enum {
+	BALLOON_VQ_INFLATE = 0,	/* Pages given to the host */
+	BALLOON_VQ_DEFLATE = 1,	/* Pages taken back */
+};
+
+/* VIRTIO_BALLOON Feature bits */
+#define VIRTIO_BALLOON_F_MUST_TELL_HOST		(1 << 0)
+#define VIRTIO_BALLOON_F_STATS_VQ		(1 << 1)
+#define VIRTIO_BALLOON_F_DEFLATE_ON_OOM		(1 << 2)
+#define VIRTIO_BALLOON_F_FREE_PAGE_HINT		(1 << 3)
+#define VIRTIO_BALLOON_F_PAGE_POISON		(1 << 4)
+#define VIRTIO_BALLOON_F_REPORTING		(1 << 5)
+
+#define VIRTIO_BALLOON_PFN_SHIFT	12
+
+/*
+ * As per VirtIO spec Version 1.2: 5.5.4 Device configuration layout.
+ * The fields are little endian even on legacy devices.
+ */
+struct virtio_balloon_config {
+	uint32_t num_pages;
+	uint32_t actual;
+	uint32_t free_page_hint_cmd_id;
+	uint32_t poison_val;
+} __attribute__((packed));
+
+struct virtio_balloon_stat {
+	uint16_t tag;
+	uint64_t val;
+} __attribute__((packed));
+
+/* Statistics tags */
+#define VIRTIO_BALLOON_S_SWAP_IN	0
+#define VIRTIO_BALLOON_S_SWAP_OUT	1
+#define VIRTIO_BALLOON_S_MAJFLT		2
+#define VIRTIO_BALLOON_S_MINFLT		3
+#define VIRTIO_BALLOON_S_MEMFREE	4
+#define VIRTIO_BALLOON_S_MEMTOT		5
+#define VIRTIO_BALLOON_S_AVAIL		6
+
+/* Driver limits */
+#define BALLOON_PAGE_SIZE	(1 << VIRTIO_BALLOON_PFN_SHIFT)
+#define BALLOON_PFNS		256	/* Pages per inflate or deflate request */
+#define BALLOON_CHUNK_PAGES	254	/* Pages tracked per chunk */
+#define BALLOON_NR_STATS	3
+#define BALLOON_REPORT_MIN	(2 * 1024 * 1024)	/* Smallest range reported */
+#define BALLOON_REPORT_RANGES	32	/* Ranges per report request */
+
+struct virtio_balloon_page {
+	void *va;
+	uint64_t pa;
+};
+
+/* Pages in the balloon, their contents are gone so they cannot link them */
+struct virtio_balloon_chunk {
+	struct virtio_balloon_chunk *next;
+	uint32_t nr;
+	struct virtio_balloon_page pages[BALLOON_CHUNK_PAGES];
+};
+
+struct virtio_balloon {
+	struct virtio_device vdev;
+	int8_t stats_vq;	/* Queue numbers, -1 if not negotiated */
+	int8_t report_vq;
+	uint8_t tell_host;	/* Deflate before reusing pages */
+	uint8_t deflate_on_oom;
+	uint8_t broken;		/* A request timed out, the queues are unusable */
+	uint8_t stats_held;	/* Statistics buffer not posted, no values yet */
+	uint16_t report_max;	/* Ranges per report request */
+	uint32_t actual;	/* Pages in the balloon */
+	uint64_t reported;	/* Bytes of free memory reported */
+	struct virtio_balloon_chunk *chunks;
+	uint32_t pfns[BALLOON_PFNS];
+	struct virtio_balloon_stat stats[BALLOON_NR_STATS];
+	void *report_addr[BALLOON_REPORT_RANGES];
+	uint64_t report_len[BALLOON_REPORT_RANGES];
+};
+
+extern struct virtio_balloon *virtioballoon_open(struct virtio_device *dev);
+extern void virtioballoon_close(struct virtio_balloon *b);
+extern int virtioballoon_poll(struct virtio_balloon *b);
+extern void virtioballoon_handle_interrupt(struct virtio_balloon *b);
+extern int virtioballoon_deflate(struct virtio_balloon *b, uint32_t pages);
+extern int virtioballoon_report_free(struct virtio_balloon *b);
+
+#endif /* _VIRTIO_BALLOON_H */
@@ -12,17 +12,22 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <errno.h>
 #include <cpu.h>
 #include <helpers.h>
 #include <byteorder.h>
 #include "virtio.h"
 #include "virtio-blk.h"
 #include "virtio-internal.h"
+#include "virtio-ring.h"
 
 #define DEFAULT_SECTOR_SIZE 512
 //#define DRIVER_FEATURE_SUPPORT  (VIRTIO_BLK_F_BLK_SIZE | VIRTIO_F_VERSION_1)
 #define DRIVER_FEATURE_SUPPORT  (VIRTIO_F_VERSION_1)
 
+/* How long virtioblk_suspend() waits for pending requests */
+#define VIRTIOBLK_QUIESCE_MS	1000
+
 /**
  * Initialize virtio-block device.
  * @param  dev  pointer to virtio device information
@@ -45,7 +50,7 @@ virtioblk_init(struct virtio_device *dev)
 	status |= VIRTIO_STAT_DRIVER;
 	virtio_set_status(dev, status);
 
-	if (dev->features & VIRTIO_F_VERSION_1) {
+	if (virtio_is_modern(dev)) {
 		/* Negotiate features and sets FEATURES_OK if successful */
 		if (virtio_negotiate_guest_features(dev, DRIVER_FEATURE_SUPPORT))
 			goto dev_error;
@@ -57,7 +62,7 @@ virtioblk_init(struct virtio_device *dev)
 	}
 
 	vq = virtio_queue_init_vq(dev, 0);
-	if (!vq)
+	if (!vq || virtio_queue_set_slots(dev, 0, vq->size / 3, 3))
 		goto dev_error;
 
 	/* Tell HV that setup succeeded */
@@ -94,6 +99,31 @@ virtioblk_shutdown(struct virtio_device *dev)
 	virtio_reset_device(dev);
 }
 
+/**
+ * Suspend the virtio-block device once the pending requests completed.
+ * @param  dev  pointer to virtio device information
+ * @return 0 on success, -EBUSY if requests are still pending, or an error
+ *         of virtio_suspend()
+ */
+int
+virtioblk_suspend(struct virtio_device *dev)
+{
+	if (virtio_queue_quiesce(dev, 0, VIRTIOBLK_QUIESCE_MS))
+		return -EBUSY;
+
+	return virtio_suspend(dev);
+}
+
+/**
+ * Resume the virtio-block device after virtioblk_suspend().
+ * @param  dev  pointer to virtio device information
+ */
+int
+virtioblk_resume(struct virtio_device *dev)
+{
+	return virtio_resume(dev);
+}
+
 static void fill_blk_hdr(struct virtio_blk_req *blkhdr, bool is_modern,
                          uint32_t type, uint32_t ioprio, uint32_t sector)
 {
@@ -108,20 +138,12 @@ static void fill_blk_hdr(struct virtio_blk_req *blkhdr, bool is_modern,
 	}
 }
 
-/**
- * Read / write blocks
- * @param  reg  pointer to "reg" property
- * @param  buf  pointer to destination buffer
- * @param  blocknum  block number of the first block that should be transfered
- * @param  cnt  amount of blocks that should be transfered
- * @param  type  VIRTIO_BLK_T_OUT for write, VIRTIO_BLK_T_IN for read transfers
- * @return number of blocks that have been transfered successfully
- */
-int
-virtioblk_transfer(struct virtio_device *dev, struct virtio_blk_req_data *data, char *buf, uint64_t blocknum,
-                   long cnt, unsigned int type)
+static int
+__virtioblk_transfer(struct virtio_device *dev, struct virtio_blk_req_data *data,
+		     char *buf, uint64_t blocknum, long cnt, unsigned int type,
+		     struct virtio_completion *c)
 {
-	int id;
+	int id, slot, err;
 	uint64_t capacity;
 	struct vqs *vq = &dev->vq[0];
 	uint16_t avail_idx;
@@ -132,48 +154,139 @@ virtioblk_transfer(struct virtio_device *dev, struct virtio_blk_req_data *data,
 			offset_of(struct virtio_blk_cfg, capacity),
 			sizeof(capacity));
 	if (blocknum + cnt - 1 > capacity) {
-		puts("virtioblk_transfer: Access beyond end of device!");
-		return 0;
+		virtio_log(VIRTIO_LOG_ERR, VLOG_BLK_BEYOND_END, blocknum, cnt);
+		return -EINVAL;
 	}
 
 	blk_size = virtio_get_config(dev,
 			offset_of(struct virtio_blk_cfg, blk_size),
 			sizeof(blk_size));
 	if (blk_size % DEFAULT_SECTOR_SIZE) {
-		fprintf(stderr, "virtio-blk: Unaligned sector size %d\n", blk_size);
-		return 0;
+		virtio_log(VIRTIO_LOG_ERR, VLOG_BLK_UNALIGNED, blk_size,
+			   DEFAULT_SECTOR_SIZE);
+		return -EINVAL;
 	}
-	avail_idx = virtio_modern16_to_cpu(dev, vq->avail->idx) % vq->size;
+	/* Requests complete in any order, a slot is free once its chain was used */
+	slot = virtio_queue_get_slot(vq);
+	if (slot < 0)
+		return -EAGAIN;
 
 	/* Set up header */
-	fill_blk_hdr(data->blkhdr, dev->features, type,
+	fill_blk_hdr(data->blkhdr, virtio_is_modern(dev), type,
 		     1, blocknum * blk_size / DEFAULT_SECTOR_SIZE);
 
 	/* Determine descriptor index */
-	id = (avail_idx * 3) % vq->size;
+	id = slot * 3;
+	__virtio_free_desc(vq, id, dev->features);
+	__virtio_free_desc(vq, id + 1, dev->features);
+	__virtio_free_desc(vq, id + 2, dev->features);
 
 	/* Set up virtqueue descriptor for header */
-	virtio_fill_desc(vq, id, dev->features,  (uint64_t)data->blkhdr_pa,
-			 sizeof(struct virtio_blk_req),
-			 VRING_DESC_F_NEXT, id + 1);
+	err = __virtio_fill_desc(vq, id, dev->features,  (uint64_t)data->blkhdr_pa,
+				 sizeof(struct virtio_blk_req),
+				 VRING_DESC_F_NEXT, id + 1);
 
 	/* Set up virtqueue descriptor for data */
-	virtio_fill_desc(vq, id + 1, dev->features, (uint64_t)buf,
-			 cnt * blk_size,
-			 VRING_DESC_F_NEXT | ((type & 1) ? 0 : VRING_DESC_F_WRITE),
-			 id + 2);
+	err |= __virtio_fill_desc(vq, id + 1, dev->features, (uint64_t)buf,
+				  cnt * blk_size,
+				  VRING_DESC_F_NEXT | ((type & 1) ? 0 : VRING_DESC_F_WRITE),
+				  id + 2);
 
 	/* Set up virtqueue descriptor for status */
-	virtio_fill_desc(vq, id + 2, dev->features,
-			 (uint64_t)data->status_pa, 1,
-			 VRING_DESC_F_WRITE, 0);
+	err |= __virtio_fill_desc(vq, id + 2, dev->features,
+				  (uint64_t)data->status_pa, 1,
+				  VRING_DESC_F_WRITE, 0);
+
+	/* The device could not reach a buffer, do not post the chain */
+	if (err) {
+		__virtio_free_descs(vq, id, 3, dev->features);
+		virtio_queue_put_slot(vq, slot);
+		return -EIO;
+	}
 
-	vq->avail->ring[avail_idx % vq->size] = virtio_cpu_to_modern16 (dev, id);
+	if (c) {
+		c->priv = data;
+		virtio_queue_track(vq, id, c);
+	}
+
+	avail_idx = virtio_modern16_to_cpu(dev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, avail_idx)] = virtio_cpu_to_modern16 (dev, id);
 	mb();
 	vq->avail->idx = virtio_cpu_to_modern16(dev, avail_idx + 1);
+	virtio_stats_posted(dev, vq, (type & 1) ? cnt * blk_size : 0);
 
 	/* Tell HV that the queue is ready */
-	virtio_queue_notify(dev, 0);
+	__virtio_queue_notify(dev, 0);
 
 	return 0;
 }
+
+/**
+ * Read / write blocks
+ * @param  reg  pointer to "reg" property
+ * @param  buf  pointer to destination buffer
+ * @param  blocknum  block number of the first block that should be transfered
+ * @param  cnt  amount of blocks that should be transfered
+ * @param  type  VIRTIO_BLK_T_OUT for write, VIRTIO_BLK_T_IN for read transfers
+ * @return 0 if the request was queued, -EAGAIN if too many requests are in
+ *         flight, -EIO if a buffer could not be mapped for the device,
+ *         another negative error code if the request is invalid.
+ *         The request's slot is free again once its used chain has been
+ *         consumed with virtio_get_used().
+ */
+int
+virtioblk_transfer(struct virtio_device *dev, struct virtio_blk_req_data *data, char *buf, uint64_t blocknum,
+                   long cnt, unsigned int type)
+{
+	return __virtioblk_transfer(dev, data, buf, blocknum, cnt, type, NULL);
+}
+
+/**
+ * Queue a block transfer which completes through "c". Up to a third of
+ * the queue size requests may be in flight, each with its own "data".
+ * Requires virtioblk_enable_async(); completions are delivered by
+ * virtioblk_complete().
+ * @return 0 if the request was queued, -EAGAIN if too many requests are in
+ *         flight, -EIO if a buffer could not be mapped for the device,
+ *         another negative error code if the request is invalid
+ */
+int
+virtioblk_transfer_async(struct virtio_device *dev, struct virtio_blk_req_data *data,
+			 char *buf, uint64_t blocknum, long cnt, unsigned int type,
+			 struct virtio_completion *c)
+{
+	virtio_completion_init(c);
+	return __virtioblk_transfer(dev, data, buf, blocknum, cnt, type, c);
+}
+
+/**
+ * Switch the device to completion based requests, see
+ * virtioblk_transfer_async()
+ * @return 0 on success, -1 if memory allocation failed
+ */
+int
+virtioblk_enable_async(struct virtio_device *dev)
+{
+	return virtio_queue_set_completions(dev, 0, 1);
+}
+
+/**
+ * Complete the finished asynchronous requests, to be called from the
+ * queue handler (see virtio_queue_set_handler()) or a polling task.
+ * @return number of requests completed
+ */
+int
+virtioblk_complete(struct virtio_device *dev)
+{
+	struct virtio_completion *c;
+	struct virtio_blk_req_data *data;
+	int n = 0;
+
+	while ((c = virtio_queue_harvest(dev, &dev->vq[0]))) {
+		data = c->priv;
+		virtio_complete(c, *data->status == VIRTIO_BLK_S_OK ? 0 : -EIO);
+		n++;
+	}
+
+	return n;
+}
@@ -76,12 +76,25 @@ struct virtio_blk_req_data {
 #define VIRTIO_BLK_T_FLUSH_OUT		5
 #define VIRTIO_BLK_T_BARRIER		0x80000000
 
+/* Request status */
+#define VIRTIO_BLK_S_OK			0
+#define VIRTIO_BLK_S_IOERR		1
+#define VIRTIO_BLK_S_UNSUPP		2
+
 /* VIRTIO_BLK Feature bits */
 #define VIRTIO_BLK_F_BLK_SIZE       (1 << 6)
 
 extern int virtioblk_init(struct virtio_device *dev);
 extern void virtioblk_shutdown(struct virtio_device *dev);
+extern int virtioblk_suspend(struct virtio_device *dev);
+extern int virtioblk_resume(struct virtio_device *dev);
 extern int virtioblk_transfer(struct virtio_device *dev, struct virtio_blk_req_data *data, char *buf,
                               uint64_t blocknum, long cnt, unsigned int type);
+extern int virtioblk_enable_async(struct virtio_device *dev);
+extern int virtioblk_transfer_async(struct virtio_device *dev,
+				    struct virtio_blk_req_data *data, char *buf,
+				    uint64_t blocknum, long cnt, unsigned int type,
+				    struct virtio_completion *c);
+extern int virtioblk_complete(struct virtio_device *dev);
 
 #endif  /* _VIRTIO_BLK_H */
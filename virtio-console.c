@@ -0,0 +1,724 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Driver for the virtio console device, see the Virtio Spec 1.2 chapter 5.3.
+ *
+ * Writes are copied into a small ring of transmit buffers per port. A flush
+ * hands all filled buffers to the device as a single descriptor chain with
+ * a single notification, so many short writes cost one exit instead of one
+ * each. In log sink mode a write never waits: it only appends, buffers go
+ * out when they are full or on virtiocon_flush()/virtiocon_poll(), and data
+ * which does not fit is dropped and reported once there is room again.
+ *
+ * Like the core, the driver is not thread safe: one task owns the device
+ * and calls all functions below, virtiocon_poll() included.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <helpers.h>
+#include "virtio-console.h"
+#include "virtio-internal.h"
+#include "virtio-ring.h"
+
+#define DRIVER_FEATURE_SUPPORT	(VIRTIO_F_VERSION_1 | VIRTIO_CONSOLE_F_MULTIPORT)
+
+#define TX_MASK		(CONSOLE_TX_BUFS - 1)
+
+static uint8_t *tx_buf(struct virtio_console_port *port, int i)
+{
+	return port->tx_mem + i * CONSOLE_TX_BUF_SIZE;
+}
+
+/*
+ * Take back the transmit buffers the device is done with
+ * @return  number of chains taken back
+ */
+static int virtiocon_tx_reclaim(struct virtio_console_port *port)
+{
+	struct virtio_device *vdev = &port->con->vdev;
+	struct vqs *vq = &vdev->vq[CONSOLE_VQ_PORT_TX(port->id)];
+	uint32_t len;
+	int id, i, n = 0;
+
+	while ((id = virtio_get_used(vdev, vq, &len)) >= 0) {
+		id = vq_wrap(vq, id);
+		for (i = 0; i < port->tx_chain[id]; i++)
+			port->tx_busy[(id + i) & TX_MASK] = 0;
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * Hand the filled buffers to the device, one chain and one notification.
+ * Buffers the device cannot reach stay filled, @return -EIO then.
+ */
+static int __virtiocon_flush(struct virtio_console_port *port)
+{
+	struct virtio_device *vdev = &port->con->vdev;
+	struct vqs *vq = &vdev->vq[CONSOLE_VQ_PORT_TX(port->id)];
+	uint32_t len, bytes = 0;
+	uint16_t idx;
+	int count, i, k;
+
+	count = (port->tx_fill - port->tx_head) & TX_MASK;
+	if (port->tx_len)
+		count++;
+	if (!count || !port->present)
+		return 0;
+
+	for (k = 0; k < count; k++) {
+		i = (port->tx_head + k) & TX_MASK;
+		len = i == port->tx_fill ? port->tx_len : CONSOLE_TX_BUF_SIZE;
+		bytes += len;
+
+		__virtio_free_desc(vq, i, vdev->features);
+		if (__virtio_fill_desc(vq, i, vdev->features, (uint64_t) tx_buf(port, i),
+				       len, k < count - 1 ? VRING_DESC_F_NEXT : 0,
+				       (i + 1) & TX_MASK)) {
+			__virtio_free_descs(vq, port->tx_head, k + 1, vdev->features);
+			return -EIO;
+		}
+	}
+	for (k = 0; k < count; k++)
+		port->tx_busy[(port->tx_head + k) & TX_MASK] = 1;
+	port->tx_chain[port->tx_head] = count;
+
+	idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, port->tx_head);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	virtio_stats_posted(vdev, vq, bytes);
+
+	__virtio_queue_notify(vdev, CONSOLE_VQ_PORT_TX(port->id));
+
+	port->tx_head = port->tx_fill = (port->tx_head + count) & TX_MASK;
+	port->tx_len = 0;
+
+	return bytes;
+}
+
+/* Bytes virtiocon_append() can take without waiting for the device */
+static uint32_t virtiocon_tx_room(struct virtio_console_port *port)
+{
+	uint32_t room = 0;
+	int i = port->tx_fill;
+
+	if (port->tx_busy[i])
+		return 0;
+
+	room = CONSOLE_TX_BUF_SIZE - port->tx_len;
+	for (i = (i + 1) & TX_MASK; i != port->tx_head && !port->tx_busy[i];
+	     i = (i + 1) & TX_MASK)
+		room += CONSOLE_TX_BUF_SIZE;
+
+	return room;
+}
+
+/* Copy as much of "buf" as the free buffers hold, flushing full chains */
+static uint32_t virtiocon_append(struct virtio_console_port *port,
+				 const uint8_t *buf, uint32_t len)
+{
+	uint32_t n, done = 0;
+	int next, sent;
+
+	while (done < len && !port->tx_busy[port->tx_fill]) {
+		n = CONSOLE_TX_BUF_SIZE - port->tx_len;
+		if (n > len - done)
+			n = len - done;
+		memcpy(tx_buf(port, port->tx_fill) + port->tx_len, buf + done, n);
+		port->tx_len += n;
+		done += n;
+
+		if (port->tx_len < CONSOLE_TX_BUF_SIZE)
+			break;
+
+		next = (port->tx_fill + 1) & TX_MASK;
+		if (next == port->tx_head || port->tx_busy[next]) {
+			/*
+			 * Out of buffers, send the filled ones to make room.
+			 * Stop if nothing went out and nothing came back,
+			 * the caller waits for the device or drops the rest.
+			 */
+			sent = __virtiocon_flush(port);
+			if (!virtiocon_tx_reclaim(port) && sent <= 0)
+				break;
+		} else {
+			port->tx_fill = next;
+			port->tx_len = 0;
+		}
+	}
+
+	return done;
+}
+
+/**
+ * Queue data for transmission. In log sink mode the data is only appended,
+ * whatever does not fit is dropped. Otherwise the data goes out before the
+ * function returns, waiting up to VIRTIO_TIMEOUT for free buffers.
+ * @param   port  port to write to
+ * @param   buf   data
+ * @param   len   length of the data
+ * @return  number of bytes queued, -ENODEV if the port was not added
+ *          by the device, -ETIMEDOUT if the device does not take any data
+ */
+int virtiocon_write(struct virtio_console_port *port, const void *buf,
+		    uint32_t len)
+{
+	char msg[48];
+	uint32_t done = 0, waited = 0;
+	int n;
+
+	virtiocon_tx_reclaim(port);
+
+	if (port->log_sink) {
+		if (port->tx_dropped) {
+			/* Mark the gap once the marker and some data fit */
+			n = snprintf(msg, sizeof(msg), "\n[%u bytes dropped]\n",
+				     port->tx_dropped);
+			if (virtiocon_tx_room(port) <= n) {
+				port->tx_dropped += len;
+				return 0;
+			}
+			virtiocon_append(port, (uint8_t *) msg, n);
+			port->tx_dropped = 0;
+		}
+		done = virtiocon_append(port, buf, len);
+		port->tx_dropped += len - done;
+		return done;
+	}
+
+	if (!port->present)
+		return -ENODEV;
+
+	for (;;) {
+		done += virtiocon_append(port, (const uint8_t *) buf + done,
+					 len - done);
+		if (done == len)
+			break;
+		if (waited++ >= VIRTIO_TIMEOUT)
+			break;
+		SLOF_msleep(1);
+		virtiocon_tx_reclaim(port);
+	}
+	__virtiocon_flush(port);
+
+	return done ? done : -ETIMEDOUT;
+}
+
+/**
+ * Send whatever has been written to the port and not sent yet
+ * @return  number of bytes handed to the device, or -EIO if the buffers
+ *          could not be mapped for the device
+ */
+int virtiocon_flush(struct virtio_console_port *port)
+{
+	virtiocon_tx_reclaim(port);
+	return __virtiocon_flush(port);
+}
+
+/**
+ * Switch the port in and out of log sink mode, see virtiocon_write()
+ */
+void virtiocon_set_log_sink(struct virtio_console_port *port, int enable)
+{
+	if (!enable)
+		virtiocon_flush(port);
+	port->log_sink = !!enable;
+}
+
+static void virtiocon_post_rx(struct virtio_device *vdev, struct vqs *vq, int id)
+{
+	uint16_t idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, id);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	__virtio_stats_posted(vdev, vq, 0, VT_REFILL);
+}
+
+/**
+ * Read received data, does not wait
+ * @param   port  port to read from
+ * @param   buf   buffer for the data
+ * @param   len   size of the buffer
+ * @return  number of bytes read, 0 if there is no data
+ */
+int virtiocon_read(struct virtio_console_port *port, void *buf, uint32_t len)
+{
+	struct virtio_device *vdev = &port->con->vdev;
+	struct vqs *vq = &vdev->vq[CONSOLE_VQ_PORT_RX(port->id)];
+	uint32_t n, total = 0;
+	int id, posted = 0;
+
+	while (total < len) {
+		if (port->rx_cur < 0) {
+			id = virtio_get_used(vdev, vq, &n);
+			if (id < 0)
+				break;
+			port->rx_cur = vq_wrap(vq, id);
+			port->rx_off = 0;
+			port->rx_len = n < CONSOLE_RX_BUF_SIZE ? n : CONSOLE_RX_BUF_SIZE;
+		}
+
+		n = port->rx_len - port->rx_off;
+		if (n > len - total)
+			n = len - total;
+		memcpy((uint8_t *) buf + total, port->rx_mem +
+		       port->rx_cur * CONSOLE_RX_BUF_SIZE + port->rx_off, n);
+		port->rx_off += n;
+		total += n;
+
+		if (port->rx_off == port->rx_len) {
+			virtiocon_post_rx(vdev, vq, port->rx_cur);
+			port->rx_cur = -1;
+			posted = 1;
+		}
+	}
+	if (posted)
+		__virtio_queue_notify(vdev, CONSOLE_VQ_PORT_RX(port->id));
+
+	return total;
+}
+
+static int virtiocon_send_ctrl(struct virtio_console *con, uint32_t id,
+			       uint16_t event, uint16_t value)
+{
+	struct virtio_device *vdev = &con->vdev;
+	struct vqs *vq = &vdev->vq[CONSOLE_VQ_CTRL_TX];
+	struct virtio_console_control *msg;
+	uint32_t len;
+	uint16_t idx;
+	int slot;
+
+	/* Consuming a used entry puts its slot back on the free list */
+	while (virtio_get_used(vdev, vq, &len) >= 0)
+		;
+
+	slot = virtio_queue_get_slot(vq);
+	if (slot < 0)
+		return -EAGAIN;
+
+	msg = &con->ctrl_tx[slot];
+	msg->id = virtio_cpu_to_modern32(vdev, id);
+	msg->event = virtio_cpu_to_modern16(vdev, event);
+	msg->value = virtio_cpu_to_modern16(vdev, value);
+
+	__virtio_free_desc(vq, slot, vdev->features);
+	if (__virtio_fill_desc(vq, slot, vdev->features, (uint64_t) msg,
+			       sizeof(*msg), 0, 0)) {
+		__virtio_free_desc(vq, slot, vdev->features);
+		virtio_queue_put_slot(vq, slot);
+		return -EIO;
+	}
+
+	idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, slot);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	virtio_stats_posted(vdev, vq, sizeof(*msg));
+
+	__virtio_queue_notify(vdev, CONSOLE_VQ_CTRL_TX);
+
+	return 0;
+}
+
+/*
+ * Answer a control message. A reply the transmit queue has no room for
+ * is kept and sent again by virtiocon_poll(), which reads no further
+ * control messages until it went out.
+ */
+static void virtiocon_reply_ctrl(struct virtio_console *con, uint32_t id,
+				 uint16_t event, uint16_t value)
+{
+	if (virtiocon_send_ctrl(con, id, event, value) == -EAGAIN) {
+		con->ctrl_retry.id = id;
+		con->ctrl_retry.event = event;
+		con->ctrl_retry.value = value;
+		con->ctrl_retry_pending = 1;
+	}
+}
+
+/**
+ * @return  non-zero while a control reply is still waiting for room
+ */
+static int virtiocon_retry_ctrl(struct virtio_console *con)
+{
+	struct virtio_console_control *msg = &con->ctrl_retry;
+
+	if (con->ctrl_retry_pending &&
+	    virtiocon_send_ctrl(con, msg->id, msg->event, msg->value) != -EAGAIN)
+		con->ctrl_retry_pending = 0;
+
+	return con->ctrl_retry_pending;
+}
+
+static void virtiocon_rx_ctrl(struct virtio_console *con, uint8_t *buf,
+			      uint32_t len)
+{
+	struct virtio_device *vdev = &con->vdev;
+	struct virtio_console_control *msg = (void *) buf;
+	struct virtio_console_port *port;
+	uint32_t id;
+	uint16_t event, value;
+
+	if (len < sizeof(*msg))
+		return;
+
+	id = virtio_modern32_to_cpu(vdev, msg->id);
+	event = virtio_modern16_to_cpu(vdev, msg->event);
+	value = virtio_modern16_to_cpu(vdev, msg->value);
+
+	if (id >= con->nr_ports) {
+		/* More ports than queues, refuse them */
+		if (event == VIRTIO_CONSOLE_PORT_ADD)
+			virtiocon_reply_ctrl(con, id, VIRTIO_CONSOLE_PORT_READY, 0);
+		return;
+	}
+	port = &con->ports[id];
+
+	switch (event) {
+	case VIRTIO_CONSOLE_PORT_ADD:
+		port->present = 1;
+		virtiocon_reply_ctrl(con, id, VIRTIO_CONSOLE_PORT_READY, 1);
+		break;
+	case VIRTIO_CONSOLE_PORT_REMOVE:
+		port->present = 0;
+		port->host_open = 0;
+		port->is_console = 0;
+		port->name[0] = 0;
+		break;
+	case VIRTIO_CONSOLE_CONSOLE_PORT:
+		port->is_console = 1;
+		virtiocon_reply_ctrl(con, id, VIRTIO_CONSOLE_PORT_OPEN, 1);
+		break;
+	case VIRTIO_CONSOLE_PORT_OPEN:
+		port->host_open = !!value;
+		break;
+	case VIRTIO_CONSOLE_PORT_NAME:
+		len -= sizeof(*msg);
+		if (len >= CONSOLE_NAME_LEN)
+			len = CONSOLE_NAME_LEN - 1;
+		memcpy(port->name, buf + sizeof(*msg), len);
+		port->name[len] = 0;
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Process the control messages the device sent, reclaim the transmit
+ * buffers it is done with and send what log sinks have collected.
+ * @return  number of control messages processed
+ */
+int virtiocon_poll(struct virtio_console *con)
+{
+	struct virtio_device *vdev = &con->vdev;
+	struct vqs *vq = &vdev->vq[CONSOLE_VQ_CTRL_RX];
+	uint32_t i, len;
+	int id, n = 0;
+
+	while (con->multiport && !virtiocon_retry_ctrl(con) &&
+	       (id = virtio_get_used(vdev, vq, &len)) >= 0) {
+		id = vq_wrap(vq, id);
+		if (len > CONSOLE_CTRL_BUF_SIZE)
+			len = CONSOLE_CTRL_BUF_SIZE;
+		virtiocon_rx_ctrl(con, con->ctrl_rx_mem + id * CONSOLE_CTRL_BUF_SIZE,
+				  len);
+		virtiocon_post_rx(vdev, vq, id);
+		n++;
+	}
+	if (n)
+		__virtio_queue_notify(vdev, CONSOLE_VQ_CTRL_RX);
+
+	for (i = 0; i < con->nr_ports; i++)
+		if (con->ports[i].log_sink)
+			virtiocon_flush(&con->ports[i]);
+		else
+			virtiocon_tx_reclaim(&con->ports[i]);
+
+	return n;
+}
+
+static void virtiocon_vq_interrupt(struct virtio_device *dev, struct vqs *vq,
+				   void *arg)
+{
+	virtiocon_poll(arg);
+}
+
+void virtiocon_handle_interrupt(struct virtio_console *con)
+{
+	virtio_handle_interrupt(&con->vdev);
+}
+
+/**
+ * @return  port "id", NULL if the device has not added it
+ */
+struct virtio_console_port *virtiocon_get_port(struct virtio_console *con,
+					       uint32_t id)
+{
+	if (id >= con->nr_ports || !con->ports[id].present)
+		return NULL;
+
+	return &con->ports[id];
+}
+
+/**
+ * @return  the port the device marked as console, else port 0
+ */
+struct virtio_console_port *virtiocon_get_console(struct virtio_console *con)
+{
+	uint32_t i;
+
+	for (i = 0; i < con->nr_ports; i++)
+		if (con->ports[i].present && con->ports[i].is_console)
+			return &con->ports[i];
+
+	return virtiocon_get_port(con, 0);
+}
+
+/**
+ * Tell the host whether the port is open on our side. Only multiport
+ * devices track this, the single port of other devices is always open.
+ */
+int virtiocon_open_port(struct virtio_console_port *port, int open)
+{
+	if (!port->con->multiport)
+		return 0;
+
+	return virtiocon_send_ctrl(port->con, port->id, VIRTIO_CONSOLE_PORT_OPEN,
+				   !!open);
+}
+
+static struct vqs *virtiocon_init_vq(struct virtio_console *con, int id)
+{
+	struct virtio_device *vdev = &con->vdev;
+	struct vqs *vq;
+
+	vq = virtio_queue_init_vq(vdev, id);
+	if (!vq)
+		return NULL;
+
+	vq->avail->flags = virtio_cpu_to_modern16(vdev, 0);
+	virtio_queue_set_handler(vdev, id, virtiocon_vq_interrupt, con);
+
+	return vq;
+}
+
+static int virtiocon_init_port(struct virtio_console *con, uint32_t id)
+{
+	struct virtio_device *vdev = &con->vdev;
+	struct virtio_console_port *port = &con->ports[id];
+	struct vqs *vq_rx, *vq_tx;
+	int i;
+
+	port->con = con;
+	port->id = id;
+	port->rx_cur = -1;
+
+	vq_rx = virtiocon_init_vq(con, CONSOLE_VQ_PORT_RX(id));
+	vq_tx = virtiocon_init_vq(con, CONSOLE_VQ_PORT_TX(id));
+	if (!vq_rx || !vq_tx)
+		return -1;
+
+	if (vq_tx->size < CONSOLE_TX_BUFS) {
+		printf("virtio-console: Transmit queue too small (%d)\n", vq_tx->size);
+		return -1;
+	}
+
+	port->rx_bufs = vq_rx->size < CONSOLE_RX_BUFS ? vq_rx->size : CONSOLE_RX_BUFS;
+	port->rx_mem = SLOF_alloc_mem_aligned(port->rx_bufs * CONSOLE_RX_BUF_SIZE, 8, NULL);
+	port->tx_mem = SLOF_alloc_mem_aligned(CONSOLE_TX_BUFS * CONSOLE_TX_BUF_SIZE, 8, NULL);
+	if (!port->rx_mem || !port->tx_mem) {
+		printf("virtio-console: Failed to allocate buffers!\n");
+		return -1;
+	}
+
+	for (i = 0; i < port->rx_bufs; i++) {
+		if (virtio_fill_desc(vq_rx, i, vdev->features,
+				     (uint64_t) (port->rx_mem + i * CONSOLE_RX_BUF_SIZE),
+				     CONSOLE_RX_BUF_SIZE, VRING_DESC_F_WRITE, 0))
+			return -1;
+		vq_rx->avail->ring[i] = virtio_cpu_to_modern16(vdev, i);
+	}
+	sync();
+	vq_rx->avail->idx = virtio_cpu_to_modern16(vdev, port->rx_bufs);
+
+	return 0;
+}
+
+static int virtiocon_init(struct virtio_console *con)
+{
+	struct virtio_device *vdev = &con->vdev;
+	struct vqs *vq, *tx;
+	int status = VIRTIO_STAT_ACKNOWLEDGE | VIRTIO_STAT_DRIVER;
+	uint32_t i, nr;
+
+	virtio_set_status(vdev, status);
+
+	/* Device features are all accepted, see which ones were offered */
+	if (virtio_is_modern(vdev)) {
+		if (virtio_negotiate_guest_features(vdev, DRIVER_FEATURE_SUPPORT))
+			goto dev_error;
+		con->multiport = !!(vdev->features & VIRTIO_CONSOLE_F_MULTIPORT);
+		virtio_get_status(vdev, &status);
+	} else {
+		con->multiport = !!(virtio_get_host_features(vdev) &
+				    VIRTIO_CONSOLE_F_MULTIPORT);
+		virtio_set_guest_features(vdev, con->multiport ?
+					  VIRTIO_CONSOLE_F_MULTIPORT : 0);
+	}
+
+	con->nr_ports = 1;
+	if (con->multiport) {
+		con->nr_ports = virtio_get_config(vdev,
+			offsetof(struct virtio_console_config, max_nr_ports),
+			sizeof(uint32_t));
+		if (con->nr_ports > CONSOLE_MAX_PORTS)
+			con->nr_ports = CONSOLE_MAX_PORTS;
+
+		vq = virtiocon_init_vq(con, CONSOLE_VQ_CTRL_RX);
+		tx = virtiocon_init_vq(con, CONSOLE_VQ_CTRL_TX);
+		if (!vq || !tx ||
+		    virtio_queue_set_slots(vdev, CONSOLE_VQ_CTRL_TX,
+					   tx->size < CONSOLE_CTRL_BUFS ?
+					   tx->size : CONSOLE_CTRL_BUFS, 1))
+			goto dev_error;
+
+		con->ctrl_rx_mem = SLOF_alloc_mem_aligned(CONSOLE_CTRL_BUFS *
+							  CONSOLE_CTRL_BUF_SIZE, 8, NULL);
+		if (!con->ctrl_rx_mem) {
+			printf("virtio-console: Failed to allocate buffers!\n");
+			goto dev_error;
+		}
+		/* A smaller queue only takes as many buffers as it has entries */
+		nr = vq->size < CONSOLE_CTRL_BUFS ? vq->size : CONSOLE_CTRL_BUFS;
+		for (i = 0; i < nr; i++) {
+			if (virtio_fill_desc(vq, i, vdev->features, (uint64_t)
+					     (con->ctrl_rx_mem + i * CONSOLE_CTRL_BUF_SIZE),
+					     CONSOLE_CTRL_BUF_SIZE, VRING_DESC_F_WRITE, 0))
+				goto dev_error;
+			vq->avail->ring[i] = virtio_cpu_to_modern16(vdev, i);
+		}
+		sync();
+		vq->avail->idx = virtio_cpu_to_modern16(vdev, nr);
+	}
+
+	for (i = 0; i < con->nr_ports; i++)
+		if (virtiocon_init_port(con, i))
+			goto dev_error;
+
+	/* Without multiport, port 0 exists and is connected */
+	if (!con->multiport) {
+		con->ports[0].present = 1;
+		con->ports[0].host_open = 1;
+	}
+
+	status |= VIRTIO_STAT_DRIVER_OK;
+	virtio_set_status(vdev, status);
+
+	for (i = 0; i < con->nr_ports; i++)
+		virtio_queue_notify(vdev, CONSOLE_VQ_PORT_RX(i));
+
+	if (con->multiport) {
+		virtio_queue_notify(vdev, CONSOLE_VQ_CTRL_RX);
+		if (virtiocon_send_ctrl(con, 0, VIRTIO_CONSOLE_DEVICE_READY, 1))
+			goto dev_error;
+		/* Pick up the ports the device adds in response */
+		virtiocon_poll(con);
+	}
+
+	return 0;
+
+dev_error:
+	status |= VIRTIO_STAT_FAILED;
+	virtio_set_status(vdev, status);
+	return -1;
+}
+
+static void virtiocon_free(struct virtio_console *con)
+{
+	struct virtio_device *vdev = &con->vdev;
+	struct virtio_console_port *port;
+	uint32_t i;
+
+	for (i = 0; i < con->nr_ports; i++) {
+		port = &con->ports[i];
+		if (port->rx_mem)
+			SLOF_free_mem_aligned(port->rx_mem);
+		if (port->tx_mem)
+			SLOF_free_mem_aligned(port->tx_mem);
+		virtio_queue_term_vq(vdev, &vdev->vq[CONSOLE_VQ_PORT_RX(i)],
+				     CONSOLE_VQ_PORT_RX(i));
+		virtio_queue_term_vq(vdev, &vdev->vq[CONSOLE_VQ_PORT_TX(i)],
+				     CONSOLE_VQ_PORT_TX(i));
+	}
+
+	if (con->multiport) {
+		if (con->ctrl_rx_mem)
+			SLOF_free_mem_aligned(con->ctrl_rx_mem);
+		virtio_queue_term_vq(vdev, &vdev->vq[CONSOLE_VQ_CTRL_RX],
+				     CONSOLE_VQ_CTRL_RX);
+		virtio_queue_term_vq(vdev, &vdev->vq[CONSOLE_VQ_CTRL_TX],
+				     CONSOLE_VQ_CTRL_TX);
+	}
+	SLOF_free_mem(con, sizeof(*con));
+}
+
+struct virtio_console *virtiocon_open(struct virtio_device *dev)
+{
+	struct virtio_console *con;
+
+	if (!dev)
+		return NULL;
+
+	con = SLOF_alloc_mem(sizeof(*con));
+	if (!con) {
+		printf("Unable to allocate virtio-console driver\n");
+		return NULL;
+	}
+	memset(con, 0, sizeof(*con));
+
+	/* make a copy of the device structure */
+	memcpy(&con->vdev, dev, sizeof(struct virtio_device));
+
+	virtio_reset_device(&con->vdev);
+	virtio_set_status(&con->vdev, VIRTIO_STAT_ACKNOWLEDGE);
+
+	if (virtiocon_init(con)) {
+		virtiocon_free(con);
+		return NULL;
+	}
+
+	return con;
+}
+
+void virtiocon_close(struct virtio_console *con)
+{
+	uint32_t i;
+
+	if (!con)
+		return;
+
+	/* Last chance for the log sinks */
+	for (i = 0; i < con->nr_ports; i++) {
+		virtiocon_flush(&con->ports[i]);
+		virtio_queue_quiesce(&con->vdev, CONSOLE_VQ_PORT_TX(i),
+				     CONSOLE_QUIESCE_MS);
+	}
+
+	/* Quiesce and reset device */
+	virtio_set_status(&con->vdev, VIRTIO_STAT_FAILED);
+	virtio_reset_device(&con->vdev);
+
+	virtiocon_free(con);
+}
@@ -0,0 +1,127 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#ifndef _VIRTIO_CONSOLE_H
+#define _VIRTIO_CONSOLE_H
+
+#include <stdint.h>
+#include "virtio.h"
+
+/*
+ * Queue layout: port 0 uses queues 0 and 1, the control queues follow and
+ * port n > 0 uses queues 2 + 2n and 3 + 2n.
+ */
+enum {
+	CONSOLE_VQ_RX = 0,	/* Port 0, from the host */
+	CONSOLE_VQ_TX = 1,	/* Port 0, to the host */
+	CONSOLE_VQ_CTRL_RX = 2,	/* Control messages from the host */
+	CONSOLE_VQ_CTRL_TX = 3,	/* Control messages to the host */
+};
+
+#define CONSOLE_VQ_PORT_RX(n)	((n) ? 2 + 2 * (n) : CONSOLE_VQ_RX)
+#define CONSOLE_VQ_PORT_TX(n)	((n) ? 3 + 2 * (n) : CONSOLE_VQ_TX)
+
+/* VIRTIO_CONSOLE Feature bits */
+#define VIRTIO_CONSOLE_F_SIZE		(1 << 0)
+#define VIRTIO_CONSOLE_F_MULTIPORT	(1 << 1)
+#define VIRTIO_CONSOLE_F_EMERG_WRITE	(1 << 2)
+
+struct virtio_console_config {
+	uint16_t cols;
+	uint16_t rows;
+	uint32_t max_nr_ports;
+	uint32_t emerg_wr;
+} __attribute__((packed));
+
+/* As per VirtIO spec Version 1.2: 5.3.6.2 Multiport Device Operation */
+struct virtio_console_control {
+	uint32_t id;		/* Port number */
+	uint16_t event;
+	uint16_t value;
+} __attribute__((packed));
+
+/* Control events */
+#define VIRTIO_CONSOLE_DEVICE_READY	0
+#define VIRTIO_CONSOLE_PORT_ADD		1
+#define VIRTIO_CONSOLE_PORT_REMOVE	2
+#define VIRTIO_CONSOLE_PORT_READY	3
+#define VIRTIO_CONSOLE_CONSOLE_PORT	4
+#define VIRTIO_CONSOLE_RESIZE		5
+#define VIRTIO_CONSOLE_PORT_OPEN	6
+#define VIRTIO_CONSOLE_PORT_NAME	7
+
+#if VIRTIO_MAX_VQS < 4
+#error "virtio-console needs VIRTIO_MAX_VQS >= 4 for the control queues"
+#endif
+
+/* Driver limits, raise VIRTIO_MAX_VQS for more ports */
+#define CONSOLE_MAX_PORTS	((VIRTIO_MAX_VQS - 2) / 2)
+#define CONSOLE_RX_BUFS		16
+#define CONSOLE_RX_BUF_SIZE	1024
+#define CONSOLE_TX_BUFS		8	/* Power of 2 */
+#define CONSOLE_TX_BUF_SIZE	4096
+#define CONSOLE_CTRL_BUFS	8
+#define CONSOLE_CTRL_BUF_SIZE	128	/* Control message and port name */
+#define CONSOLE_NAME_LEN	32
+#define CONSOLE_QUIESCE_MS	100	/* Wait for output on close */
+
+struct virtio_console;
+
+struct virtio_console_port {
+	struct virtio_console *con;
+	uint32_t id;
+	uint8_t present;	/* Added by the device */
+	uint8_t is_console;
+	uint8_t host_open;	/* The host side is connected */
+	uint8_t log_sink;	/* Writes never wait, see virtiocon_set_log_sink() */
+	char name[CONSOLE_NAME_LEN];
+
+	/* Receive ring, the buffer being read is not posted */
+	uint16_t rx_bufs;
+	int16_t rx_cur;		/* Buffer being read, -1 if none */
+	uint32_t rx_off;
+	uint32_t rx_len;
+	uint8_t *rx_mem;
+
+	/*
+	 * Transmit buffers are filled in order. Filled buffers up to tx_fill
+	 * go to the device as one descriptor chain per flush.
+	 */
+	uint16_t tx_head;	/* First buffer not handed to the device */
+	uint16_t tx_fill;	/* Buffer being filled */
+	uint32_t tx_len;	/* Bytes in tx_fill */
+	uint8_t tx_busy[CONSOLE_TX_BUFS];	/* Owned by the device */
+	uint8_t tx_chain[CONSOLE_TX_BUFS];	/* Length of the chain at a head */
+	uint8_t *tx_mem;
+	uint32_t tx_dropped;	/* Log sink bytes lost to a full ring */
+};
+
+struct virtio_console {
+	struct virtio_device vdev;
+	uint8_t multiport;
+	uint32_t nr_ports;
+	uint8_t *ctrl_rx_mem;
+	struct virtio_console_control ctrl_tx[CONSOLE_CTRL_BUFS];
+	struct virtio_console_control ctrl_retry;	/* CPU byte order */
+	uint8_t ctrl_retry_pending;
+	struct virtio_console_port ports[CONSOLE_MAX_PORTS];
+};
+
+extern struct virtio_console *virtiocon_open(struct virtio_device *dev);
+extern void virtiocon_close(struct virtio_console *con);
+extern int virtiocon_poll(struct virtio_console *con);
+extern void virtiocon_handle_interrupt(struct virtio_console *con);
+
+extern struct virtio_console_port *virtiocon_get_port(struct virtio_console *con,
+						       uint32_t id);
+extern struct virtio_console_port *virtiocon_get_console(struct virtio_console *con);
+extern int virtiocon_open_port(struct virtio_console_port *port, int open);
+extern void virtiocon_set_log_sink(struct virtio_console_port *port, int enable);
+extern int virtiocon_write(struct virtio_console_port *port, const void *buf,
+			   uint32_t len);
+extern int virtiocon_flush(struct virtio_console_port *port);
+extern int virtiocon_read(struct virtio_console_port *port, void *buf, uint32_t len);
+
+#endif /* _VIRTIO_CONSOLE_H */
@@ -0,0 +1,642 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Driver for the virtio crypto device, see the Virtio Spec 1.2 chapter 5.9.
+ * Symmetric ciphers, hashes and AEAD in session mode.
+ *
+ * Sessions are created and destroyed synchronously on the control queue.
+ * Operations go to the data queue of the calling CPU: virtiocrypto_submit()
+ * makes a whole batch available and notifies the device once, each
+ * operation then completes through its own virtio_completion, see
+ * virtiocrypto_complete(). The device reads and writes the caller's
+ * buffers directly.
+ *
+ * Like the core, the driver is not thread safe.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <cpu.h>
+#include <helpers.h>
+#include <byteorder.h>
+#include "virtio-crypto.h"
+#include "virtio-internal.h"
+#include "virtio-ring.h"
+
+#define DRIVER_FEATURE_SUPPORT	(VIRTIO_F_VERSION_1)
+
+static int virtiocrypto_status(uint32_t status)
+{
+	switch (status) {
+	case VIRTIO_CRYPTO_OK:
+		return 0;
+	case VIRTIO_CRYPTO_BADMSG:
+		return -EBADMSG;
+	case VIRTIO_CRYPTO_NOTSUPP:
+		return -EOPNOTSUPP;
+	case VIRTIO_CRYPTO_INVSESS:
+		return -EINVAL;
+	default:
+		return -EIO;
+	}
+}
+
+/* Send cr->ctrl_req, followed by "key" if any, and wait for the answer */
+static int virtiocrypto_ctrl(struct virtio_crypto *cr, const void *key,
+			     uint32_t keylen, void *resp, uint32_t resp_len)
+{
+	struct virtio_device *vdev = &cr->vdev;
+	struct vqs *vq = &vdev->vq[cr->ctrl_vq];
+	uint16_t idx;
+	int id, err;
+
+	for (id = 0; id < 3; id++)
+		__virtio_free_desc(vq, id, vdev->features);
+
+	id = 0;
+	err = __virtio_fill_desc(vq, id, vdev->features, (uint64_t) &cr->ctrl_req,
+				 sizeof(cr->ctrl_req), VRING_DESC_F_NEXT, id + 1);
+	if (keylen) {
+		id++;
+		err |= __virtio_fill_desc(vq, id, vdev->features, (uint64_t) key,
+					  keylen, VRING_DESC_F_NEXT, id + 1);
+	}
+	id++;
+	err |= __virtio_fill_desc(vq, id, vdev->features, (uint64_t) resp, resp_len,
+				  VRING_DESC_F_WRITE, 0);
+
+	/* The device could not reach a buffer, do not post the chain */
+	if (err) {
+		__virtio_free_descs(vq, 0, id + 1, vdev->features);
+		return -EIO;
+	}
+
+	idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, idx)] = 0;
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	virtio_stats_posted(vdev, vq, sizeof(cr->ctrl_req) + keylen);
+
+	__virtio_queue_notify(vdev, cr->ctrl_vq);
+
+	if (virtio_wait_used(vdev, vq, NULL, VIRTIO_TIMEOUT) < 0) {
+		cr->broken = 1;
+		return -ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+static int virtiocrypto_create_session(struct virtio_crypto *cr, uint32_t service,
+				       uint32_t algo, const void *key,
+				       uint32_t keylen,
+				       struct virtio_crypto_session *s)
+{
+	int rc;
+
+	cr->ctrl_req.header.opcode =
+		cpu_to_le32(VIRTIO_CRYPTO_OPCODE(service, 0x02));
+	cr->ctrl_req.header.algo = cpu_to_le32(algo);
+	cr->ctrl_req.header.flag = 0;
+	cr->ctrl_req.header.queue_id = 0;
+
+	memset(&cr->ctrl_input, 0, sizeof(cr->ctrl_input));
+	cr->ctrl_input.status = cpu_to_le32(VIRTIO_CRYPTO_ERR);
+
+	rc = virtiocrypto_ctrl(cr, key, keylen, &cr->ctrl_input,
+			       sizeof(cr->ctrl_input));
+	if (rc)
+		return rc;
+
+	rc = virtiocrypto_status(le32_to_cpu(cr->ctrl_input.status));
+	if (rc)
+		return rc;
+
+	s->id = le64_to_cpu(cr->ctrl_input.session_id);
+	s->service = service;
+	s->algo = algo;
+
+	return 0;
+}
+
+/* Whether the device offers "service" and takes keys of "keylen" bytes */
+static int virtiocrypto_check(struct virtio_crypto *cr, uint32_t service,
+			      uint32_t keylen)
+{
+	if (cr->broken)
+		return -EIO;
+	if (!(cr->services & (1U << service)))
+		return -EOPNOTSUPP;
+	if (cr->max_key_len && keylen > cr->max_key_len)
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * Create a cipher session
+ * @param   cr      the device
+ * @param   algo    VIRTIO_CRYPTO_CIPHER_*
+ * @param   op      VIRTIO_CRYPTO_OP_ENCRYPT or VIRTIO_CRYPTO_OP_DECRYPT
+ * @param   key     the key
+ * @param   keylen  its length
+ * @param   s       receives the session
+ * @return  0, or negative errno
+ */
+int virtiocrypto_create_cipher_session(struct virtio_crypto *cr, uint32_t algo,
+				       uint32_t op, const void *key,
+				       uint32_t keylen,
+				       struct virtio_crypto_session *s)
+{
+	struct virtio_crypto_sym_create_session_req *req;
+	int rc;
+
+	rc = virtiocrypto_check(cr, VIRTIO_CRYPTO_SERVICE_CIPHER, keylen);
+	if (rc)
+		return rc;
+
+	memset(&cr->ctrl_req, 0, sizeof(cr->ctrl_req));
+	req = &cr->ctrl_req.u.sym_create_session;
+	req->u.cipher.algo = cpu_to_le32(algo);
+	req->u.cipher.keylen = cpu_to_le32(keylen);
+	req->u.cipher.op = cpu_to_le32(op);
+	req->op_type = cpu_to_le32(VIRTIO_CRYPTO_SYM_OP_CIPHER);
+
+	s->op = op;
+	s->result_len = 0;
+	return virtiocrypto_create_session(cr, VIRTIO_CRYPTO_SERVICE_CIPHER, algo,
+					   key, keylen, s);
+}
+
+/**
+ * Create a hash session
+ * @param   cr          the device
+ * @param   algo        VIRTIO_CRYPTO_HASH_*
+ * @param   result_len  length of the digest
+ * @param   s           receives the session
+ * @return  0, or negative errno
+ */
+int virtiocrypto_create_hash_session(struct virtio_crypto *cr, uint32_t algo,
+				     uint32_t result_len,
+				     struct virtio_crypto_session *s)
+{
+	int rc;
+
+	rc = virtiocrypto_check(cr, VIRTIO_CRYPTO_SERVICE_HASH, 0);
+	if (rc)
+		return rc;
+
+	memset(&cr->ctrl_req, 0, sizeof(cr->ctrl_req));
+	cr->ctrl_req.u.hash_create_session.algo = cpu_to_le32(algo);
+	cr->ctrl_req.u.hash_create_session.hash_result_len = cpu_to_le32(result_len);
+
+	s->op = 0;
+	s->result_len = result_len;
+	return virtiocrypto_create_session(cr, VIRTIO_CRYPTO_SERVICE_HASH, algo,
+					   NULL, 0, s);
+}
+
+/**
+ * Create an AEAD session
+ * @param   cr       the device
+ * @param   algo     VIRTIO_CRYPTO_AEAD_*
+ * @param   op       VIRTIO_CRYPTO_OP_ENCRYPT or VIRTIO_CRYPTO_OP_DECRYPT
+ * @param   key      the key
+ * @param   keylen   its length
+ * @param   tag_len  length of the authentication tag
+ * @param   aad_len  length of the additional authenticated data
+ * @param   s        receives the session
+ * @return  0, or negative errno
+ */
+int virtiocrypto_create_aead_session(struct virtio_crypto *cr, uint32_t algo,
+				     uint32_t op, const void *key,
+				     uint32_t keylen, uint32_t tag_len,
+				     uint32_t aad_len,
+				     struct virtio_crypto_session *s)
+{
+	struct virtio_crypto_aead_session_para *para;
+	int rc;
+
+	rc = virtiocrypto_check(cr, VIRTIO_CRYPTO_SERVICE_AEAD, keylen);
+	if (rc)
+		return rc;
+
+	memset(&cr->ctrl_req, 0, sizeof(cr->ctrl_req));
+	para = &cr->ctrl_req.u.aead_create_session;
+	para->algo = cpu_to_le32(algo);
+	para->key_len = cpu_to_le32(keylen);
+	para->hash_result_len = cpu_to_le32(tag_len);
+	para->aad_len = cpu_to_le32(aad_len);
+	para->op = cpu_to_le32(op);
+
+	s->op = op;
+	s->result_len = tag_len;
+	return virtiocrypto_create_session(cr, VIRTIO_CRYPTO_SERVICE_AEAD, algo,
+					   key, keylen, s);
+}
+
+/**
+ * Destroy a session, it must not have operations in flight
+ * @return  0, or negative errno
+ */
+int virtiocrypto_destroy_session(struct virtio_crypto *cr,
+				 struct virtio_crypto_session *s)
+{
+	int rc;
+
+	if (cr->broken)
+		return -EIO;
+
+	memset(&cr->ctrl_req, 0, sizeof(cr->ctrl_req));
+	cr->ctrl_req.header.opcode =
+		cpu_to_le32(VIRTIO_CRYPTO_OPCODE(s->service, 0x03));
+	cr->ctrl_req.header.algo = cpu_to_le32(s->algo);
+	cr->ctrl_req.u.destroy_session.session_id = cpu_to_le64(s->id);
+
+	cr->ctrl_status.status = VIRTIO_CRYPTO_ERR;
+	rc = virtiocrypto_ctrl(cr, NULL, 0, &cr->ctrl_status,
+			       sizeof(cr->ctrl_status));
+	if (rc)
+		return rc;
+
+	return virtiocrypto_status(cr->ctrl_status.status);
+}
+
+/* Translate an operation into the request of its slot */
+static int virtiocrypto_build(struct virtio_crypto *cr,
+			      struct virtio_crypto_op *op,
+			      struct virtio_crypto_op_data_req *req)
+{
+	struct virtio_crypto_session *s = op->session;
+	uint32_t opcode;
+
+	if (!s)
+		return -EINVAL;
+	if (cr->max_size && (op->src_len > cr->max_size ||
+			     op->dst_len > cr->max_size))
+		return -EINVAL;
+
+	memset(req, 0, sizeof(*req));
+
+	switch (s->service) {
+	case VIRTIO_CRYPTO_SERVICE_CIPHER:
+		if (op->dst_len < op->src_len)
+			return -EINVAL;
+		opcode = s->op == VIRTIO_CRYPTO_OP_ENCRYPT ?
+			 VIRTIO_CRYPTO_CIPHER_ENCRYPT : VIRTIO_CRYPTO_CIPHER_DECRYPT;
+		req->u.sym_req.op_type = cpu_to_le32(VIRTIO_CRYPTO_SYM_OP_CIPHER);
+		req->u.sym_req.u.cipher.iv_len = cpu_to_le32(op->iv_len);
+		req->u.sym_req.u.cipher.src_data_len = cpu_to_le32(op->src_len);
+		req->u.sym_req.u.cipher.dst_data_len = cpu_to_le32(op->dst_len);
+		break;
+	case VIRTIO_CRYPTO_SERVICE_HASH:
+		if (op->dst_len < s->result_len)
+			return -EINVAL;
+		opcode = VIRTIO_CRYPTO_HASH;
+		req->u.hash_req.src_data_len = cpu_to_le32(op->src_len);
+		req->u.hash_req.hash_result_len = cpu_to_le32(s->result_len);
+		break;
+	case VIRTIO_CRYPTO_SERVICE_AEAD:
+		opcode = s->op == VIRTIO_CRYPTO_OP_ENCRYPT ?
+			 VIRTIO_CRYPTO_AEAD_ENCRYPT : VIRTIO_CRYPTO_AEAD_DECRYPT;
+		req->u.aead_req.iv_len = cpu_to_le32(op->iv_len);
+		req->u.aead_req.aad_len = cpu_to_le32(op->aad_len);
+		req->u.aead_req.src_data_len = cpu_to_le32(op->src_len);
+		req->u.aead_req.dst_data_len = cpu_to_le32(op->dst_len);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	req->header.opcode = cpu_to_le32(opcode);
+	req->header.algo = cpu_to_le32(s->algo);
+	req->header.session_id = cpu_to_le64(s->id);
+
+	return 0;
+}
+
+/*
+ * Append a buffer to the chain being built at descriptor *id
+ * @return  0, or -1 if the buffer could not be mapped for the device
+ */
+static inline int virtiocrypto_add(struct virtio_device *vdev, struct vqs *vq,
+				   int *id, const void *buf, uint32_t len,
+				   uint16_t flags)
+{
+	int rc;
+
+	if (!len)
+		return 0;
+	rc = __virtio_fill_desc(vq, *id, vdev->features, (uint64_t) buf, len,
+				flags | VRING_DESC_F_NEXT, *id + 1);
+	(*id)++;
+	return rc;
+}
+
+/**
+ * Queue a batch of operations on the data queue of the calling CPU, with
+ * a single notification of the device. Each operation completes through
+ * its own completion, see virtiocrypto_complete().
+ * @param   cr   the device
+ * @param   ops  the operations
+ * @param   n    number of operations
+ * @return  number of operations queued, fewer than n if the queue filled
+ *          up, an operation was invalid or its buffers could not be mapped;
+ *          -EAGAIN, -EINVAL or -EIO if not even the first one was queued
+ */
+int virtiocrypto_submit(struct virtio_crypto *cr, struct virtio_crypto_op *ops,
+			int n)
+{
+	struct virtio_device *vdev = &cr->vdev;
+	uint32_t q = SLOF_get_cpu() % cr->nr_queues;
+	struct virtio_crypto_dq *dq = &cr->dq[q];
+	struct vqs *vq = &vdev->vq[CRYPTO_VQ_DATA + q];
+	struct virtio_crypto_slot *slot;
+	struct virtio_crypto_op *op;
+	uint16_t avail_idx;
+	int i, s, id, head, err, rc = 0;
+
+	for (i = 0; i < n; i++) {
+		op = &ops[i];
+		s = virtio_queue_get_slot(vq);
+		if (s < 0) {
+			rc = -EAGAIN;
+			break;
+		}
+		slot = &dq->slots[s];
+		rc = virtiocrypto_build(cr, op, &slot->req);
+		if (rc) {
+			virtio_queue_put_slot(vq, s);
+			break;
+		}
+		slot->inhdr.status = VIRTIO_CRYPTO_ERR;
+
+		/*
+		 * Request and the read-only parts in the order of the service's
+		 * data_vlf: iv and source, AEAD adds aad after the source. Then
+		 * destination and status.
+		 */
+		head = id = s * CRYPTO_OP_DESCS;
+		for (; id < head + CRYPTO_OP_DESCS; id++)
+			__virtio_free_desc(vq, id, vdev->features);
+		id = head;
+		err = virtiocrypto_add(vdev, vq, &id, &slot->req, sizeof(slot->req), 0);
+		err |= virtiocrypto_add(vdev, vq, &id, op->iv, op->iv_len, 0);
+		err |= virtiocrypto_add(vdev, vq, &id, op->src, op->src_len, 0);
+		if (op->session->service == VIRTIO_CRYPTO_SERVICE_AEAD)
+			err |= virtiocrypto_add(vdev, vq, &id, op->aad, op->aad_len, 0);
+		err |= virtiocrypto_add(vdev, vq, &id, op->dst,
+					op->session->service == VIRTIO_CRYPTO_SERVICE_HASH ?
+					op->session->result_len : op->dst_len,
+					VRING_DESC_F_WRITE);
+		err |= __virtio_fill_desc(vq, id, vdev->features, (uint64_t) &slot->inhdr,
+					  sizeof(slot->inhdr), VRING_DESC_F_WRITE, 0);
+
+		/* The device could not reach a buffer, do not post the chain */
+		if (err) {
+			__virtio_free_descs(vq, head, id + 1 - head, vdev->features);
+			virtio_queue_put_slot(vq, s);
+			rc = -EIO;
+			break;
+		}
+
+		virtio_completion_init(&op->c);
+		op->c.priv = slot;
+		virtio_queue_track(vq, head, &op->c);
+
+		avail_idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+		vq->avail->ring[vq_wrap(vq, avail_idx)] = virtio_cpu_to_modern16(vdev, head);
+		sync();
+		vq->avail->idx = virtio_cpu_to_modern16(vdev, avail_idx + 1);
+		virtio_stats_posted(vdev, vq, op->src_len);
+	}
+
+	if (!i)
+		return rc;
+
+	__virtio_queue_notify(vdev, CRYPTO_VQ_DATA + q);
+
+	return i;
+}
+
+/**
+ * Complete the finished operations of the data queues serviced by the
+ * calling CPU, to be called from the queue handler or a polling task.
+ * @return  number of operations completed
+ */
+int virtiocrypto_complete(struct virtio_crypto *cr)
+{
+	struct virtio_device *vdev = &cr->vdev;
+	struct virtio_completion *c;
+	struct virtio_crypto_slot *slot;
+	struct vqs *vq;
+	uint32_t q;
+	int n = 0;
+
+	for (q = 0; q < cr->nr_queues; q++) {
+		vq = &vdev->vq[CRYPTO_VQ_DATA + q];
+		if (!virtio_queue_is_local(vq))
+			continue;
+
+		/* Using the chain returned the slot already */
+		while ((c = virtio_queue_harvest(vdev, vq))) {
+			slot = c->priv;
+			virtio_complete(c, virtiocrypto_status(slot->inhdr.status));
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Run one operation and wait for it
+ * @return  0, or negative errno
+ */
+int virtiocrypto_run(struct virtio_crypto *cr, struct virtio_crypto_op *op)
+{
+	struct virtio_device *vdev = &cr->vdev;
+	uint32_t waited = 0, q;
+	int rc;
+
+	while ((rc = virtiocrypto_submit(cr, op, 1)) == -EAGAIN) {
+		if (waited++ >= VIRTIO_TIMEOUT)
+			return -ETIMEDOUT;
+		virtiocrypto_complete(cr);
+		SLOF_msleep(1);
+	}
+	if (rc < 0)
+		return rc;
+
+	for (;;) {
+		virtiocrypto_complete(cr);
+		if (virtio_completion_is_done(&op->c))
+			return op->c.status;
+		if (waited++ >= VIRTIO_TIMEOUT)
+			break;
+		SLOF_msleep(1);
+	}
+
+	/*
+	 * The device may still write the buffers, the slot stays busy until
+	 * it uses the chain, which gives the slot back.
+	 */
+	for (q = 0; q < cr->nr_queues; q++)
+		if (virtio_queue_untrack(&vdev->vq[CRYPTO_VQ_DATA + q], &op->c) >= 0)
+			break;
+
+	return -ETIMEDOUT;
+}
+
+static void virtiocrypto_vq_interrupt(struct virtio_device *dev, struct vqs *vq,
+				      void *arg)
+{
+	virtiocrypto_complete(arg);
+}
+
+static int virtiocrypto_init_dq(struct virtio_crypto *cr, uint32_t q)
+{
+	struct virtio_device *vdev = &cr->vdev;
+	struct virtio_crypto_dq *dq = &cr->dq[q];
+	struct vqs *vq;
+
+	vq = virtio_queue_init_vq(vdev, CRYPTO_VQ_DATA + q);
+	if (!vq)
+		return -1;
+
+	dq->nr_slots = vq->size / CRYPTO_OP_DESCS;
+	dq->slots = SLOF_alloc_mem_aligned(dq->nr_slots * sizeof(dq->slots[0]), 8, NULL);
+	if (!dq->slots) {
+		printf("virtio-crypto: Failed to allocate operation slots!\n");
+		return -1;
+	}
+
+	if (virtio_queue_set_slots(vdev, CRYPTO_VQ_DATA + q, dq->nr_slots,
+				   CRYPTO_OP_DESCS) ||
+	    virtio_queue_set_completions(vdev, CRYPTO_VQ_DATA + q, 1))
+		return -1;
+
+	vq->avail->flags = virtio_cpu_to_modern16(vdev, 0);
+	virtio_queue_set_handler(vdev, CRYPTO_VQ_DATA + q, virtiocrypto_vq_interrupt, cr);
+
+	return 0;
+}
+
+static int virtiocrypto_init(struct virtio_crypto *cr)
+{
+	struct virtio_device *vdev = &cr->vdev;
+	struct vqs *vq_ctrl;
+	int status = VIRTIO_STAT_ACKNOWLEDGE | VIRTIO_STAT_DRIVER;
+	uint32_t i;
+
+	virtio_set_status(vdev, status);
+
+	/* There is no legacy interface for virtio-crypto */
+	if (!virtio_is_modern(vdev) ||
+	    virtio_negotiate_guest_features(vdev, DRIVER_FEATURE_SUPPORT))
+		goto dev_error;
+	virtio_get_status(vdev, &status);
+
+#define CRYPTO_CFG(field) virtio_get_config(vdev,			\
+		offsetof(struct virtio_crypto_config, field),		\
+		sizeof(((struct virtio_crypto_config *) 0)->field))
+	if (!(CRYPTO_CFG(status) & VIRTIO_CRYPTO_S_HW_READY)) {
+		printf("virtio-crypto: Device is not ready\n");
+		goto dev_error;
+	}
+	cr->ctrl_vq = CRYPTO_CFG(max_dataqueues);
+	cr->services = CRYPTO_CFG(crypto_services);
+	cr->max_key_len = CRYPTO_CFG(max_cipher_key_len);
+	cr->max_size = CRYPTO_CFG(max_size);
+#undef CRYPTO_CFG
+
+	/* The control queue number is fixed by the data queues of the device */
+	if (!cr->ctrl_vq || cr->ctrl_vq >= VIRTIO_MAX_VQS) {
+		printf("virtio-crypto: Unsupported number of data queues (%d)\n",
+		       cr->ctrl_vq);
+		goto dev_error;
+	}
+	cr->nr_queues = cr->ctrl_vq;
+
+	vq_ctrl = virtio_queue_init_vq(vdev, cr->ctrl_vq);
+	if (!vq_ctrl)
+		goto dev_error;
+	vq_ctrl->avail->flags = virtio_cpu_to_modern16(vdev, VRING_AVAIL_F_NO_INTERRUPT);
+
+	for (i = 0; i < cr->nr_queues; i++)
+		if (virtiocrypto_init_dq(cr, i))
+			goto dev_error;
+
+	status |= VIRTIO_STAT_DRIVER_OK;
+	virtio_set_status(vdev, status);
+
+	return 0;
+
+dev_error:
+	status |= VIRTIO_STAT_FAILED;
+	virtio_set_status(vdev, status);
+	return -1;
+}
+
+static void virtiocrypto_free(struct virtio_crypto *cr)
+{
+	struct virtio_device *vdev = &cr->vdev;
+	uint32_t i;
+
+	for (i = 0; i < cr->nr_queues; i++) {
+		if (cr->dq[i].slots)
+			SLOF_free_mem_aligned(cr->dq[i].slots);
+		virtio_queue_term_vq(vdev, &vdev->vq[CRYPTO_VQ_DATA + i],
+				     CRYPTO_VQ_DATA + i);
+	}
+
+	if (cr->ctrl_vq && cr->ctrl_vq < VIRTIO_MAX_VQS)
+		virtio_queue_term_vq(vdev, &vdev->vq[cr->ctrl_vq], cr->ctrl_vq);
+	SLOF_free_mem(cr, sizeof(*cr));
+}
+
+struct virtio_crypto *virtiocrypto_open(struct virtio_device *dev)
+{
+	struct virtio_crypto *cr;
+
+	if (!dev)
+		return NULL;
+
+	cr = SLOF_alloc_mem(sizeof(*cr));
+	if (!cr) {
+		printf("Unable to allocate virtio-crypto driver\n");
+		return NULL;
+	}
+	memset(cr, 0, sizeof(*cr));
+
+	/* make a copy of the device structure */
+	memcpy(&cr->vdev, dev, sizeof(struct virtio_device));
+
+	virtio_reset_device(&cr->vdev);
+	virtio_set_status(&cr->vdev, VIRTIO_STAT_ACKNOWLEDGE);
+
+	if (virtiocrypto_init(cr)) {
+		virtiocrypto_free(cr);
+		return NULL;
+	}
+
+	return cr;
+}
+
+void virtiocrypto_close(struct virtio_crypto *cr)
+{
+	if (!cr)
+		return;
+
+	/* Quiesce and reset device */
+	virtio_set_status(&cr->vdev, VIRTIO_STAT_FAILED);
+	virtio_reset_device(&cr->vdev);
+
+	virtiocrypto_free(cr);
+}
@@ -0,0 +1,274 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#ifndef _VIRTIO_CRYPTO_H
+#define _VIRTIO_CRYPTO_H
+
+#include <stdint.h>
+#include <byteorder.h>
+#include "virtio.h"
+
+/* Data queues come first, the control queue follows the last one */
+enum {
+	CRYPTO_VQ_DATA = 0,	/* First data queue */
+};
+
+/* Services, also the bits of virtio_crypto_config.crypto_services */
+#define VIRTIO_CRYPTO_SERVICE_CIPHER	0
+#define VIRTIO_CRYPTO_SERVICE_HASH	1
+#define VIRTIO_CRYPTO_SERVICE_MAC	2
+#define VIRTIO_CRYPTO_SERVICE_AEAD	3
+
+#define VIRTIO_CRYPTO_OPCODE(service, op)	(((service) << 8) | (op))
+
+/* Control queue opcodes */
+#define VIRTIO_CRYPTO_CIPHER_CREATE_SESSION	VIRTIO_CRYPTO_OPCODE(VIRTIO_CRYPTO_SERVICE_CIPHER, 0x02)
+#define VIRTIO_CRYPTO_CIPHER_DESTROY_SESSION	VIRTIO_CRYPTO_OPCODE(VIRTIO_CRYPTO_SERVICE_CIPHER, 0x03)
+#define VIRTIO_CRYPTO_HASH_CREATE_SESSION	VIRTIO_CRYPTO_OPCODE(VIRTIO_CRYPTO_SERVICE_HASH, 0x02)
+#define VIRTIO_CRYPTO_HASH_DESTROY_SESSION	VIRTIO_CRYPTO_OPCODE(VIRTIO_CRYPTO_SERVICE_HASH, 0x03)
+#define VIRTIO_CRYPTO_AEAD_CREATE_SESSION	VIRTIO_CRYPTO_OPCODE(VIRTIO_CRYPTO_SERVICE_AEAD, 0x02)
+#define VIRTIO_CRYPTO_AEAD_DESTROY_SESSION	VIRTIO_CRYPTO_OPCODE(VIRTIO_CRYPTO_SERVICE_AEAD, 0x03)
+
+/* Data queue opcodes */
+#define VIRTIO_CRYPTO_CIPHER_ENCRYPT		VIRTIO_CRYPTO_OPCODE(VIRTIO_CRYPTO_SERVICE_CIPHER, 0x00)
+#define VIRTIO_CRYPTO_CIPHER_DECRYPT		VIRTIO_CRYPTO_OPCODE(VIRTIO_CRYPTO_SERVICE_CIPHER, 0x01)
+#define VIRTIO_CRYPTO_HASH			VIRTIO_CRYPTO_OPCODE(VIRTIO_CRYPTO_SERVICE_HASH, 0x00)
+#define VIRTIO_CRYPTO_AEAD_ENCRYPT		VIRTIO_CRYPTO_OPCODE(VIRTIO_CRYPTO_SERVICE_AEAD, 0x00)
+#define VIRTIO_CRYPTO_AEAD_DECRYPT		VIRTIO_CRYPTO_OPCODE(VIRTIO_CRYPTO_SERVICE_AEAD, 0x01)
+
+/* Algorithms, the subset named here */
+#define VIRTIO_CRYPTO_CIPHER_AES_ECB		2
+#define VIRTIO_CRYPTO_CIPHER_AES_CBC		3
+#define VIRTIO_CRYPTO_CIPHER_AES_CTR		4
+#define VIRTIO_CRYPTO_CIPHER_AES_XTS		13
+#define VIRTIO_CRYPTO_HASH_SHA1			2
+#define VIRTIO_CRYPTO_HASH_SHA_256		4
+#define VIRTIO_CRYPTO_HASH_SHA_384		5
+#define VIRTIO_CRYPTO_HASH_SHA_512		6
+#define VIRTIO_CRYPTO_AEAD_GCM			1
+#define VIRTIO_CRYPTO_AEAD_CCM			2
+#define VIRTIO_CRYPTO_AEAD_CHACHA20_POLY1305	3
+
+#define VIRTIO_CRYPTO_OP_ENCRYPT		1
+#define VIRTIO_CRYPTO_OP_DECRYPT		2
+
+#define VIRTIO_CRYPTO_SYM_OP_CIPHER		1
+
+/* Status of a request */
+#define VIRTIO_CRYPTO_OK			0
+#define VIRTIO_CRYPTO_ERR			1
+#define VIRTIO_CRYPTO_BADMSG			2
+#define VIRTIO_CRYPTO_NOTSUPP			3
+#define VIRTIO_CRYPTO_INVSESS			4
+
+#define VIRTIO_CRYPTO_S_HW_READY		(1 << 0)
+
+/* As per VirtIO spec Version 1.2: 5.9.4 Device configuration layout */
+struct virtio_crypto_config {
+	le32 status;
+	le32 max_dataqueues;
+	le32 crypto_services;
+	le32 cipher_algo_l;
+	le32 cipher_algo_h;
+	le32 hash_algo;
+	le32 mac_algo_l;
+	le32 mac_algo_h;
+	le32 aead_algo;
+	le32 max_cipher_key_len;
+	le32 max_auth_key_len;
+	le32 akcipher_algo;
+	le64 max_size;
+} __attribute__((packed));
+
+/* Control requests, 72 bytes */
+struct virtio_crypto_ctrl_header {
+	le32 opcode;
+	le32 algo;
+	le32 flag;
+	le32 queue_id;
+};
+
+struct virtio_crypto_cipher_session_para {
+	le32 algo;
+	le32 keylen;
+	le32 op;
+	le32 padding;
+};
+
+struct virtio_crypto_sym_create_session_req {
+	union {
+		struct virtio_crypto_cipher_session_para cipher;
+		uint8_t padding[48];
+	} u;
+	le32 op_type;
+	le32 padding;
+};
+
+struct virtio_crypto_hash_session_para {
+	le32 algo;
+	le32 hash_result_len;
+	uint8_t padding[8];
+};
+
+struct virtio_crypto_aead_session_para {
+	le32 algo;
+	le32 key_len;
+	le32 hash_result_len;
+	le32 aad_len;
+	le32 op;
+	le32 padding;
+};
+
+struct virtio_crypto_destroy_session_req {
+	le64 session_id;
+};
+
+struct virtio_crypto_op_ctrl_req {
+	struct virtio_crypto_ctrl_header header;
+	union {
+		struct virtio_crypto_sym_create_session_req sym_create_session;
+		struct virtio_crypto_hash_session_para hash_create_session;
+		struct virtio_crypto_aead_session_para aead_create_session;
+		struct virtio_crypto_destroy_session_req destroy_session;
+		uint8_t padding[56];
+	} u;
+};
+
+/* Answer to a create session request */
+struct virtio_crypto_session_input {
+	le64 session_id;
+	le32 status;
+	le32 padding;
+};
+
+/* Data requests, 72 bytes */
+struct virtio_crypto_op_header {
+	le32 opcode;
+	le32 algo;
+	le64 session_id;
+	le32 flag;
+	le32 padding;
+};
+
+struct virtio_crypto_cipher_para {
+	le32 iv_len;
+	le32 src_data_len;
+	le32 dst_data_len;
+	le32 padding;
+};
+
+struct virtio_crypto_sym_data_req {
+	union {
+		struct virtio_crypto_cipher_para cipher;
+		uint8_t padding[40];
+	} u;
+	le32 op_type;
+	le32 padding;
+};
+
+struct virtio_crypto_hash_para {
+	le32 src_data_len;
+	le32 hash_result_len;
+};
+
+struct virtio_crypto_aead_para {
+	le32 iv_len;
+	le32 aad_len;
+	le32 src_data_len;
+	le32 dst_data_len;
+};
+
+struct virtio_crypto_op_data_req {
+	struct virtio_crypto_op_header header;
+	union {
+		struct virtio_crypto_sym_data_req sym_req;
+		struct virtio_crypto_hash_para hash_req;
+		struct virtio_crypto_aead_para aead_req;
+		uint8_t padding[48];
+	} u;
+};
+
+struct virtio_crypto_inhdr {
+	uint8_t status;
+};
+
+/* Driver limits */
+#define CRYPTO_MAX_DATA_QUEUES	(VIRTIO_MAX_VQS - 1)
+#define CRYPTO_OP_DESCS		6	/* Request, iv, src, aad, dst, status */
+
+/* A session, filled in by the virtiocrypto_create_*_session() functions */
+struct virtio_crypto_session {
+	uint64_t id;
+	uint32_t service;
+	uint32_t algo;
+	uint32_t op;		/* VIRTIO_CRYPTO_OP_*, ciphers and AEAD */
+	uint32_t result_len;	/* Digest or tag length */
+};
+
+/*
+ * One operation, owned by the driver from virtiocrypto_submit() until
+ * its completion is done. Unused buffers have a length of 0; a hash
+ * writes session->result_len bytes to dst.
+ */
+struct virtio_crypto_op {
+	struct virtio_crypto_session *session;
+	const void *iv;
+	uint32_t iv_len;
+	const void *aad;
+	uint32_t aad_len;
+	const void *src;
+	uint32_t src_len;
+	void *dst;
+	uint32_t dst_len;
+	struct virtio_completion c;
+};
+
+/* Per operation state of a data queue, CRYPTO_OP_DESCS descriptors each */
+struct virtio_crypto_slot {
+	struct virtio_crypto_op_data_req req;
+	struct virtio_crypto_inhdr inhdr;
+};
+
+struct virtio_crypto_dq {
+	struct virtio_crypto_slot *slots;	/* Per queue slot */
+	uint16_t nr_slots;
+};
+
+struct virtio_crypto {
+	struct virtio_device vdev;
+	uint32_t nr_queues;	/* Data queues */
+	uint32_t ctrl_vq;
+	uint32_t services;
+	uint32_t max_key_len;
+	uint64_t max_size;	/* Largest request, 0 if unlimited */
+	uint8_t broken;		/* A control request timed out */
+	struct virtio_crypto_dq dq[CRYPTO_MAX_DATA_QUEUES];
+	struct virtio_crypto_op_ctrl_req ctrl_req;
+	struct virtio_crypto_session_input ctrl_input;
+	struct virtio_crypto_inhdr ctrl_status;
+};
+
+extern struct virtio_crypto *virtiocrypto_open(struct virtio_device *dev);
+extern void virtiocrypto_close(struct virtio_crypto *cr);
+extern int virtiocrypto_create_cipher_session(struct virtio_crypto *cr,
+					      uint32_t algo, uint32_t op,
+					      const void *key, uint32_t keylen,
+					      struct virtio_crypto_session *s);
+extern int virtiocrypto_create_hash_session(struct virtio_crypto *cr,
+					    uint32_t algo, uint32_t result_len,
+					    struct virtio_crypto_session *s);
+extern int virtiocrypto_create_aead_session(struct virtio_crypto *cr,
+					    uint32_t algo, uint32_t op,
+					    const void *key, uint32_t keylen,
+					    uint32_t tag_len, uint32_t aad_len,
+					    struct virtio_crypto_session *s);
+extern int virtiocrypto_destroy_session(struct virtio_crypto *cr,
+					struct virtio_crypto_session *s);
+extern int virtiocrypto_submit(struct virtio_crypto *cr,
+			       struct virtio_crypto_op *ops, int n);
+extern int virtiocrypto_complete(struct virtio_crypto *cr);
+extern int virtiocrypto_run(struct virtio_crypto *cr, struct virtio_crypto_op *op);
+
+#endif /* _VIRTIO_CRYPTO_H */
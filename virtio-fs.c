@@ -0,0 +1,636 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Driver for the virtio file system device, see the Virtio Spec 1.2
+ * chapter 5.11. A read-only FUSE client: files are looked up by path,
+ * opened and read.
+ *
+ * When the device has a DAX window, file contents are not copied through
+ * the request queue at all. The window is cut into 2M ranges, each of
+ * which the host maps to a 2M chunk of a file with FUSE_SETUPMAPPING;
+ * reads then copy straight from the host page cache and virtiofs_mmap()
+ * hands out pointers into it. Ranges are recycled least recently used
+ * first, pinned ones excepted. Without a window, reads fall back to
+ * FUSE_READ into the caller's buffer.
+ *
+ * Requests are synchronous and like the core, the driver is not thread
+ * safe: one task owns the device and calls all functions below. Only the
+ * first request queue is used.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <cpu.h>
+#include <helpers.h>
+#include <byteorder.h>
+#include "virtio-fs.h"
+#include "virtio-internal.h"
+#include "virtio-ring.h"
+
+#define DRIVER_FEATURE_SUPPORT	(VIRTIO_F_VERSION_1)
+
+#define S_IFMT		0170000
+#define S_IFDIR		0040000
+
+/*
+ * Send a request and wait for its reply. The fixed arguments are in
+ * fs->req.in_arg and fs->req.out_arg, "in_data" and "out_data" are
+ * optional variable parts.
+ * @return  number of reply bytes after the header, or the negative
+ *          error of the reply
+ */
+static int virtiofs_request(struct virtio_fs *fs, uint32_t opcode, uint64_t nodeid,
+			    uint32_t in_len, const void *in_data, uint32_t in_data_len,
+			    uint32_t out_len, void *out_data, uint32_t out_data_len)
+{
+	struct virtio_device *vdev = &fs->vdev;
+	struct vqs *vq = &vdev->vq[FS_VQ_REQUEST];
+	uint64_t unique;
+	uint16_t idx;
+	int id, err;
+
+	if (fs->broken)
+		return -EIO;
+
+	unique = ++fs->unique;
+	fs->req.in.len = cpu_to_le32(sizeof(fs->req.in) + in_len + in_data_len);
+	fs->req.in.opcode = cpu_to_le32(opcode);
+	fs->req.in.unique = cpu_to_le64(unique);
+	fs->req.in.nodeid = cpu_to_le64(nodeid);
+	fs->req.in.uid = 0;
+	fs->req.in.gid = 0;
+	fs->req.in.pid = 0;
+	fs->req.in.padding = 0;
+	memset(&fs->req.out, 0, sizeof(fs->req.out) + out_len);
+
+	for (id = 0; id < 4; id++)
+		__virtio_free_desc(vq, id, vdev->features);
+
+	/* Header and arguments first, then room for the reply */
+	id = 0;
+	err = __virtio_fill_desc(vq, id, vdev->features, (uint64_t) &fs->req.in,
+				 sizeof(fs->req.in) + in_len, VRING_DESC_F_NEXT, id + 1);
+	if (in_data_len) {
+		id++;
+		err |= __virtio_fill_desc(vq, id, vdev->features, (uint64_t) in_data,
+					  in_data_len, VRING_DESC_F_NEXT, id + 1);
+	}
+	id++;
+	err |= __virtio_fill_desc(vq, id, vdev->features, (uint64_t) &fs->req.out,
+				  sizeof(fs->req.out) + out_len, VRING_DESC_F_WRITE |
+				  (out_data_len ? VRING_DESC_F_NEXT : 0), id + 1);
+	if (out_data_len) {
+		id++;
+		err |= __virtio_fill_desc(vq, id, vdev->features, (uint64_t) out_data,
+					  out_data_len, VRING_DESC_F_WRITE, 0);
+	}
+
+	/* The device could not reach a buffer, do not post the chain */
+	if (err) {
+		__virtio_free_descs(vq, 0, id + 1, vdev->features);
+		return -EIO;
+	}
+
+	idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, 0);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	virtio_stats_posted(vdev, vq, in_data_len);
+
+	__virtio_queue_notify(vdev, FS_VQ_REQUEST);
+
+	if (virtio_wait_used(vdev, vq, NULL, VIRTIO_TIMEOUT) < 0) {
+		fs->broken = 1;
+		return -ETIMEDOUT;
+	}
+
+	if (le64_to_cpu(fs->req.out.unique) != unique ||
+	    le32_to_cpu(fs->req.out.len) < sizeof(fs->req.out))
+		return -EIO;
+	if (fs->req.out.error)
+		return (int32_t) le32_to_cpu(fs->req.out.error);
+
+	return le32_to_cpu(fs->req.out.len) - sizeof(fs->req.out);
+}
+
+/*
+ * Drop "nlookup" references to a node, through the high priority queue.
+ * The device completes FORGETs in any order, the used ones give their
+ * slot back. If none is free or the request cannot be mapped, the host
+ * keeps the node until the file system is unmounted.
+ * @return  0 if the FORGET was posted, -EAGAIN if all slots are in flight,
+ *          -EIO if the request could not be mapped for the device
+ */
+static int virtiofs_forget(struct virtio_fs *fs, uint64_t nodeid, uint64_t nlookup)
+{
+	struct virtio_device *vdev = &fs->vdev;
+	struct vqs *vq = &vdev->vq[FS_VQ_HIPRIO];
+	struct virtio_fs_forget *f;
+	uint32_t len;
+	uint16_t idx;
+	int slot;
+
+	while (virtio_get_used(vdev, vq, &len) >= 0)
+		;
+
+	slot = virtio_queue_get_slot(vq);
+	if (slot < 0) {
+		fs->lost_forgets++;
+		return -EAGAIN;
+	}
+
+	f = &fs->forget[slot];
+	memset(&f->in, 0, sizeof(f->in));
+	f->in.len = cpu_to_le32(sizeof(*f));
+	f->in.opcode = cpu_to_le32(FUSE_FORGET);
+	f->in.unique = cpu_to_le64(++fs->unique);
+	f->in.nodeid = cpu_to_le64(nodeid);
+	f->arg.nlookup = cpu_to_le64(nlookup);
+
+	__virtio_free_desc(vq, slot, vdev->features);
+	if (__virtio_fill_desc(vq, slot, vdev->features, (uint64_t) f, sizeof(*f),
+			       0, 0)) {
+		virtio_queue_put_slot(vq, slot);
+		fs->lost_forgets++;
+		return -EIO;
+	}
+
+	idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, slot);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	virtio_stats_posted(vdev, vq, 0);
+
+	__virtio_queue_notify(vdev, FS_VQ_HIPRIO);
+
+	return 0;
+}
+
+static uint32_t virtiofs_dax_hash(struct virtio_fs_file *file, uint64_t chunk)
+{
+	return ((uintptr_t) file >> 4 ^ chunk) & (FS_DAX_BUCKETS - 1);
+}
+
+static int virtiofs_dax_find(struct virtio_fs_file *file, uint64_t chunk)
+{
+	struct virtio_fs *fs = file->fs;
+	int i;
+
+	for (i = fs->buckets[virtiofs_dax_hash(file, chunk)]; i >= 0;
+	     i = fs->ranges[i].next)
+		if (fs->ranges[i].file == file && fs->ranges[i].chunk == chunk)
+			return i;
+
+	return -1;
+}
+
+static void virtiofs_dax_unlink(struct virtio_fs *fs, int i)
+{
+	struct virtio_fs_dax_range *r = &fs->ranges[i];
+	int32_t *p = &fs->buckets[virtiofs_dax_hash(r->file, r->chunk)];
+
+	while (*p != i)
+		p = &fs->ranges[*p].next;
+	*p = r->next;
+	r->file = NULL;
+	r->refs = 0;
+}
+
+/* Unmap the ranges fs->remove[0..n) lists, "idx" are their indexes */
+static int virtiofs_dax_remove(struct virtio_fs *fs, const int *idx, int n)
+{
+	struct fuse_removemapping_in *rmi = (void *) fs->req.in_arg;
+	int i, rc;
+
+	if (!n)
+		return 0;
+
+	rmi->count = cpu_to_le32(n);
+	rc = virtiofs_request(fs, FUSE_REMOVEMAPPING, FUSE_ROOT_ID, sizeof(*rmi),
+			      fs->remove, n * sizeof(fs->remove[0]), 0, NULL, 0);
+
+	/* Forget the ranges either way, they are recycled with a new mapping */
+	for (i = 0; i < n; i++)
+		virtiofs_dax_unlink(fs, idx[i]);
+
+	return rc < 0 ? rc : 0;
+}
+
+static int virtiofs_dax_remove_one(struct virtio_fs *fs, int i)
+{
+	fs->remove[0].moffset = cpu_to_le64((uint64_t) i << FS_DAX_SHIFT);
+	fs->remove[0].len = cpu_to_le64(FS_DAX_RANGE);
+
+	return virtiofs_dax_remove(fs, &i, 1);
+}
+
+/* Get the window range holding "chunk" of the file, mapping it on a miss */
+static int virtiofs_dax_get(struct virtio_fs_file *file, uint64_t chunk)
+{
+	struct virtio_fs *fs = file->fs;
+	struct fuse_setupmapping_in *smi = (void *) fs->req.in_arg;
+	struct virtio_fs_dax_range *r;
+	uint32_t i, h;
+	int victim = -1, rc;
+
+	rc = virtiofs_dax_find(file, chunk);
+	if (rc >= 0) {
+		fs->ranges[rc].last_use = ++fs->clock;
+		return rc;
+	}
+
+	/* A free range, else the least recently used one nobody pins */
+	for (i = 0; i < fs->nr_ranges; i++) {
+		r = &fs->ranges[i];
+		if (!r->file) {
+			victim = i;
+			break;
+		}
+		if (!r->refs && (victim < 0 || fs->clock - r->last_use >
+				 fs->clock - fs->ranges[victim].last_use))
+			victim = i;
+	}
+	if (victim < 0)
+		return -ENOMEM;
+
+	if (fs->ranges[victim].file) {
+		rc = virtiofs_dax_remove_one(fs, victim);
+		if (rc)
+			return rc;
+	}
+
+	smi->fh = cpu_to_le64(file->fh);
+	smi->foffset = cpu_to_le64(chunk << FS_DAX_SHIFT);
+	smi->len = cpu_to_le64(FS_DAX_RANGE);
+	smi->flags = cpu_to_le64(FUSE_SETUPMAPPING_FLAG_READ);
+	smi->moffset = cpu_to_le64((uint64_t) victim << FS_DAX_SHIFT);
+	rc = virtiofs_request(fs, FUSE_SETUPMAPPING, file->nodeid, sizeof(*smi),
+			      NULL, 0, 0, NULL, 0);
+	if (rc < 0)
+		return rc;
+
+	r = &fs->ranges[victim];
+	h = virtiofs_dax_hash(file, chunk);
+	r->file = file;
+	r->chunk = chunk;
+	r->refs = 0;
+	r->last_use = ++fs->clock;
+	r->next = fs->buckets[h];
+	fs->buckets[h] = victim;
+
+	return victim;
+}
+
+/* Unmap every range of a file before its handle goes away */
+static void virtiofs_dax_release(struct virtio_fs_file *file)
+{
+	struct virtio_fs *fs = file->fs;
+	int idx[FS_REMOVE_BATCH];
+	uint32_t i;
+	int n = 0;
+
+	for (i = 0; i < fs->nr_ranges; i++) {
+		if (fs->ranges[i].file != file)
+			continue;
+
+		fs->remove[n].moffset = cpu_to_le64((uint64_t) i << FS_DAX_SHIFT);
+		fs->remove[n].len = cpu_to_le64(FS_DAX_RANGE);
+		idx[n++] = i;
+		if (n == FS_REMOVE_BATCH) {
+			virtiofs_dax_remove(fs, idx, n);
+			n = 0;
+		}
+	}
+	virtiofs_dax_remove(fs, idx, n);
+}
+
+/**
+ * Read from a file, through the DAX window if the device has one
+ * @param   file  open file
+ * @param   buf   destination buffer
+ * @param   off   offset in the file
+ * @param   len   number of bytes
+ * @return  number of bytes read, less than "len" at the end of the file,
+ *          or a negative error code if nothing could be read
+ */
+int virtiofs_read(struct virtio_fs_file *file, void *buf, uint64_t off,
+		  uint32_t len)
+{
+	struct virtio_fs *fs = file->fs;
+	struct fuse_read_in *ri = (void *) fs->req.in_arg;
+	uint32_t n, done = 0;
+	int rc = 0;
+
+	/* Mapped pages beyond the end of the file must not be touched */
+	if (off >= file->size)
+		return 0;
+	if (len > file->size - off)
+		len = file->size - off;
+
+	while (done < len) {
+		if (fs->dax.addr) {
+			n = FS_DAX_RANGE - (off & (FS_DAX_RANGE - 1));
+			if (n > len - done)
+				n = len - done;
+			rc = virtiofs_dax_get(file, off >> FS_DAX_SHIFT);
+			if (rc < 0)
+				break;
+			memcpy((uint8_t *) buf + done, (uint8_t *) fs->dax.addr +
+			       ((uint64_t) rc << FS_DAX_SHIFT) +
+			       (off & (FS_DAX_RANGE - 1)), n);
+		} else {
+			n = len - done < FS_MAX_READ ? len - done : FS_MAX_READ;
+			memset(ri, 0, sizeof(*ri));
+			ri->fh = cpu_to_le64(file->fh);
+			ri->offset = cpu_to_le64(off);
+			ri->size = cpu_to_le32(n);
+			rc = virtiofs_request(fs, FUSE_READ, file->nodeid, sizeof(*ri),
+					      NULL, 0, 0, (uint8_t *) buf + done, n);
+			if (rc <= 0)
+				break;
+			n = rc;
+		}
+		done += n;
+		off += n;
+	}
+
+	return done ? (int) done : rc;
+}
+
+/**
+ * Map part of a file, the returned memory is the host page cache. The
+ * part must not cross a 2M boundary of the file and stays mapped until
+ * virtiofs_munmap().
+ * @return  address of file offset "off", NULL if the device has no DAX
+ *          window, the part is invalid or every range is pinned
+ */
+void *virtiofs_mmap(struct virtio_fs_file *file, uint64_t off, uint32_t len)
+{
+	struct virtio_fs *fs = file->fs;
+	uint64_t start = off & (FS_DAX_RANGE - 1);
+	int i;
+
+	if (!fs->dax.addr || !len || start + len > FS_DAX_RANGE ||
+	    off + len > file->size)
+		return NULL;
+
+	i = virtiofs_dax_get(file, off >> FS_DAX_SHIFT);
+	if (i < 0)
+		return NULL;
+
+	fs->ranges[i].refs++;
+	return (uint8_t *) fs->dax.addr + ((uint64_t) i << FS_DAX_SHIFT) + start;
+}
+
+/**
+ * Drop a mapping of virtiofs_mmap()
+ */
+void virtiofs_munmap(struct virtio_fs_file *file, void *addr)
+{
+	struct virtio_fs *fs = file->fs;
+	uint64_t i = ((uint8_t *) addr - (uint8_t *) fs->dax.addr) >> FS_DAX_SHIFT;
+
+	if (fs->dax.addr && i < fs->nr_ranges && fs->ranges[i].file == file &&
+	    fs->ranges[i].refs)
+		fs->ranges[i].refs--;
+}
+
+/**
+ * Look up and open a regular file for reading
+ * @param   fs    the device
+ * @param   path  path relative to the root of the file system
+ * @param   file  filled in on success
+ * @return  0 on success, a negative error code otherwise
+ */
+int virtiofs_open_file(struct virtio_fs *fs, const char *path,
+		       struct virtio_fs_file *file)
+{
+	struct fuse_entry_out *e = (void *) fs->req.out_arg;
+	struct fuse_open_in *oi = (void *) fs->req.in_arg;
+	struct fuse_open_out *oo = (void *) fs->req.out_arg;
+	uint64_t nodeid = FUSE_ROOT_ID, parent;
+	char name[256];
+	size_t n;
+	int rc;
+
+	memset(file, 0, sizeof(*file));
+	file->fs = fs;
+
+	for (;;) {
+		while (*path == '/')
+			path++;
+		if (!*path)
+			break;
+
+		n = strcspn(path, "/");
+		if (n >= sizeof(name)) {
+			if (nodeid != FUSE_ROOT_ID)
+				virtiofs_forget(fs, nodeid, 1);
+			return -ENAMETOOLONG;
+		}
+		memcpy(name, path, n);
+		name[n] = 0;
+		path += n;
+
+		parent = nodeid;
+		rc = virtiofs_request(fs, FUSE_LOOKUP, parent, 0, name, n + 1,
+				      sizeof(*e), NULL, 0);
+		if (parent != FUSE_ROOT_ID)
+			virtiofs_forget(fs, parent, 1);
+		if (rc < 0)
+			return rc;
+
+		nodeid = le64_to_cpu(e->nodeid);
+		file->size = le64_to_cpu(e->attr.size);
+		file->mode = le32_to_cpu(e->attr.mode);
+	}
+
+	if (nodeid == FUSE_ROOT_ID)
+		return -EISDIR;
+	if ((file->mode & S_IFMT) == S_IFDIR) {
+		rc = -EISDIR;
+		goto forget;
+	}
+
+	memset(oi, 0, sizeof(*oi));	/* O_RDONLY */
+	rc = virtiofs_request(fs, FUSE_OPEN, nodeid, sizeof(*oi), NULL, 0,
+			      sizeof(*oo), NULL, 0);
+	if (rc < 0)
+		goto forget;
+
+	file->nodeid = nodeid;
+	file->fh = le64_to_cpu(oo->fh);
+	return 0;
+
+forget:
+	virtiofs_forget(fs, nodeid, 1);
+	return rc;
+}
+
+/**
+ * Close a file of virtiofs_open_file(), its mappings go away
+ */
+void virtiofs_close_file(struct virtio_fs_file *file)
+{
+	struct virtio_fs *fs = file->fs;
+	struct fuse_release_in *rli = (void *) fs->req.in_arg;
+
+	virtiofs_dax_release(file);
+
+	memset(rli, 0, sizeof(*rli));
+	rli->fh = cpu_to_le64(file->fh);
+	virtiofs_request(fs, FUSE_RELEASE, file->nodeid, sizeof(*rli), NULL, 0,
+			 0, NULL, 0);
+	virtiofs_forget(fs, file->nodeid, 1);
+}
+
+/**
+ * @return  the file system tag of the device, which names the mount
+ */
+const char *virtiofs_get_tag(struct virtio_fs *fs)
+{
+	return fs->tag;
+}
+
+/* Ask for the DAX window and map alignment, set up the range table */
+static int virtiofs_fuse_init(struct virtio_fs *fs)
+{
+	struct fuse_init_in *ii = (void *) fs->req.in_arg;
+	struct fuse_init_out *io = (void *) fs->req.out_arg;
+	uint32_t i;
+	int rc;
+
+	memset(ii, 0, sizeof(*ii));
+	ii->major = cpu_to_le32(FUSE_KERNEL_VERSION);
+	ii->minor = cpu_to_le32(FUSE_KERNEL_MINOR_VERSION);
+	ii->flags = cpu_to_le32(FUSE_MAP_ALIGNMENT);
+	rc = virtiofs_request(fs, FUSE_INIT, 0, sizeof(*ii), NULL, 0,
+			      sizeof(*io), NULL, 0);
+	if (rc < 0 || le32_to_cpu(io->major) != FUSE_KERNEL_VERSION) {
+		printf("virtio-fs: FUSE_INIT failed (%d)\n", rc);
+		return -1;
+	}
+	fs->max_write = le32_to_cpu(io->max_write);
+
+	/* Older replies are shorter, the missing fields read as zero */
+	if (!(le32_to_cpu(io->flags) & FUSE_MAP_ALIGNMENT) ||
+	    le16_to_cpu(io->map_alignment) > FS_DAX_SHIFT ||
+	    virtio_get_shm_region(&fs->vdev, VIRTIO_FS_SHMCAP_ID_CACHE, &fs->dax) ||
+	    fs->dax.len < FS_DAX_RANGE) {
+		fs->dax.addr = NULL;
+		return 0;
+	}
+
+	fs->nr_ranges = fs->dax.len >> FS_DAX_SHIFT;
+	fs->ranges = SLOF_alloc_mem(fs->nr_ranges * sizeof(fs->ranges[0]));
+	if (!fs->ranges) {
+		printf("virtio-fs: No memory for the DAX window, not using it\n");
+		fs->dax.addr = NULL;
+		return 0;
+	}
+	memset(fs->ranges, 0, fs->nr_ranges * sizeof(fs->ranges[0]));
+	for (i = 0; i < FS_DAX_BUCKETS; i++)
+		fs->buckets[i] = -1;
+
+	return 0;
+}
+
+static int virtiofs_init(struct virtio_fs *fs)
+{
+	struct virtio_device *vdev = &fs->vdev;
+	struct vqs *vq_hp, *vq_req;
+	int status = VIRTIO_STAT_ACKNOWLEDGE | VIRTIO_STAT_DRIVER;
+
+	virtio_set_status(vdev, status);
+
+	/* There is no legacy interface for virtio-fs */
+	if (!virtio_is_modern(vdev) ||
+	    virtio_negotiate_guest_features(vdev, DRIVER_FEATURE_SUPPORT))
+		goto dev_error;
+	virtio_get_status(vdev, &status);
+
+	__virtio_read_config(vdev, fs->tag, offsetof(struct virtio_fs_config, tag),
+			     sizeof(fs->tag) - 1);
+	fs->tag[sizeof(fs->tag) - 1] = 0;
+
+	vq_hp = virtio_queue_init_vq(vdev, FS_VQ_HIPRIO);
+	vq_req = virtio_queue_init_vq(vdev, FS_VQ_REQUEST);
+	if (!vq_hp || !vq_req || vq_hp->size < FS_FORGETS || vq_req->size < 4 ||
+	    virtio_queue_set_slots(vdev, FS_VQ_HIPRIO, FS_FORGETS, 1))
+		goto dev_error;
+
+	/* Both queues are polled */
+	vq_hp->avail->flags = virtio_cpu_to_modern16(vdev, VRING_AVAIL_F_NO_INTERRUPT);
+	vq_req->avail->flags = virtio_cpu_to_modern16(vdev, VRING_AVAIL_F_NO_INTERRUPT);
+
+	status |= VIRTIO_STAT_DRIVER_OK;
+	virtio_set_status(vdev, status);
+
+	if (virtiofs_fuse_init(fs))
+		goto dev_error;
+
+	return 0;
+
+dev_error:
+	status |= VIRTIO_STAT_FAILED;
+	virtio_set_status(vdev, status);
+	return -1;
+}
+
+static void virtiofs_free(struct virtio_fs *fs)
+{
+	struct virtio_device *vdev = &fs->vdev;
+
+	if (fs->ranges)
+		SLOF_free_mem(fs->ranges, fs->nr_ranges * sizeof(fs->ranges[0]));
+
+	virtio_queue_term_vq(vdev, &vdev->vq[FS_VQ_HIPRIO], FS_VQ_HIPRIO);
+	virtio_queue_term_vq(vdev, &vdev->vq[FS_VQ_REQUEST], FS_VQ_REQUEST);
+	SLOF_free_mem(fs, sizeof(*fs));
+}
+
+struct virtio_fs *virtiofs_open(struct virtio_device *dev)
+{
+	struct virtio_fs *fs;
+
+	if (!dev)
+		return NULL;
+
+	fs = SLOF_alloc_mem(sizeof(*fs));
+	if (!fs) {
+		printf("Unable to allocate virtio-fs driver\n");
+		return NULL;
+	}
+	memset(fs, 0, sizeof(*fs));
+
+	/* make a copy of the device structure */
+	memcpy(&fs->vdev, dev, sizeof(struct virtio_device));
+
+	virtio_reset_device(&fs->vdev);
+	virtio_set_status(&fs->vdev, VIRTIO_STAT_ACKNOWLEDGE);
+
+	if (virtiofs_init(fs)) {
+		virtiofs_free(fs);
+		return NULL;
+	}
+
+	return fs;
+}
+
+void virtiofs_close(struct virtio_fs *fs)
+{
+	if (!fs)
+		return;
+
+	/* Quiesce and reset device */
+	virtio_set_status(&fs->vdev, VIRTIO_STAT_FAILED);
+	virtio_reset_device(&fs->vdev);
+
+	virtiofs_free(fs);
+}
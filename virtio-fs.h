@@ -0,0 +1,235 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#ifndef _VIRTIO_FS_H
+#define _VIRTIO_FS_H
+
+#include <stdint.h>
+#include <byteorder.h>
+#include "virtio.h"
+
+enum {
+	FS_VQ_HIPRIO = 0,	/* FORGET requests */
+	FS_VQ_REQUEST = 1,	/* First request queue */
+};
+
+/* Shared memory region of the DAX window */
+#define VIRTIO_FS_SHMCAP_ID_CACHE	0
+
+/* As per VirtIO spec Version 1.2: 5.11.4 Device configuration layout */
+struct virtio_fs_config {
+	uint8_t tag[36];
+	le32 num_request_queues;
+	le32 notify_buf_size;
+} __attribute__((packed));
+
+/* FUSE protocol 7.31, the subset used here */
+#define FUSE_KERNEL_VERSION		7
+#define FUSE_KERNEL_MINOR_VERSION	31
+#define FUSE_ROOT_ID			1
+
+#define FUSE_MAP_ALIGNMENT		(1 << 26)
+
+#define FUSE_LOOKUP			1
+#define FUSE_FORGET			2
+#define FUSE_GETATTR			3
+#define FUSE_OPEN			14
+#define FUSE_READ			15
+#define FUSE_RELEASE			18
+#define FUSE_INIT			26
+#define FUSE_SETUPMAPPING		48
+#define FUSE_REMOVEMAPPING		49
+
+#define FUSE_SETUPMAPPING_FLAG_READ	(1ULL << 1)
+
+struct fuse_in_header {
+	le32 len;
+	le32 opcode;
+	le64 unique;
+	le64 nodeid;
+	le32 uid;
+	le32 gid;
+	le32 pid;
+	le32 padding;
+};
+
+struct fuse_out_header {
+	le32 len;
+	le32 error;		/* Negative errno */
+	le64 unique;
+};
+
+struct fuse_init_in {
+	le32 major;
+	le32 minor;
+	le32 max_readahead;
+	le32 flags;
+};
+
+struct fuse_init_out {
+	le32 major;
+	le32 minor;
+	le32 max_readahead;
+	le32 flags;
+	le16 max_background;
+	le16 congestion_threshold;
+	le32 max_write;
+	le32 time_gran;
+	le16 max_pages;
+	le16 map_alignment;	/* log2 of the DAX mapping alignment */
+	le32 flags2;
+	le32 unused[7];
+};
+
+struct fuse_attr {
+	le64 ino;
+	le64 size;
+	le64 blocks;
+	le64 atime;
+	le64 mtime;
+	le64 ctime;
+	le32 atimensec;
+	le32 mtimensec;
+	le32 ctimensec;
+	le32 mode;
+	le32 nlink;
+	le32 uid;
+	le32 gid;
+	le32 rdev;
+	le32 blksize;
+	le32 flags;
+};
+
+struct fuse_entry_out {
+	le64 nodeid;
+	le64 generation;
+	le64 entry_valid;
+	le64 attr_valid;
+	le32 entry_valid_nsec;
+	le32 attr_valid_nsec;
+	struct fuse_attr attr;
+};
+
+struct fuse_forget_in {
+	le64 nlookup;
+};
+
+struct fuse_open_in {
+	le32 flags;
+	le32 open_flags;
+};
+
+struct fuse_open_out {
+	le64 fh;
+	le32 open_flags;
+	le32 padding;
+};
+
+struct fuse_release_in {
+	le64 fh;
+	le32 flags;
+	le32 release_flags;
+	le64 lock_owner;
+};
+
+struct fuse_read_in {
+	le64 fh;
+	le64 offset;
+	le32 size;
+	le32 read_flags;
+	le64 lock_owner;
+	le32 flags;
+	le32 padding;
+};
+
+struct fuse_setupmapping_in {
+	le64 fh;
+	le64 foffset;
+	le64 len;
+	le64 flags;
+	le64 moffset;
+};
+
+struct fuse_removemapping_in {
+	le32 count;
+};
+
+struct fuse_removemapping_one {
+	le64 moffset;
+	le64 len;
+};
+
+/* Driver limits */
+#define FS_FORGETS		8	/* FORGETs in flight */
+#define FS_MAX_READ		65536	/* Per FUSE_READ request */
+#define FS_ARG_SIZE		128	/* Largest fixed argument */
+#define FS_DAX_SHIFT		21	/* 2M mapping ranges */
+#define FS_DAX_RANGE		(1ULL << FS_DAX_SHIFT)
+#define FS_DAX_BUCKETS		64	/* Power of 2 */
+#define FS_REMOVE_BATCH		32	/* Mappings per FUSE_REMOVEMAPPING */
+
+struct virtio_fs;
+
+struct virtio_fs_file {
+	struct virtio_fs *fs;
+	uint64_t nodeid;
+	uint64_t fh;
+	uint64_t size;
+	uint32_t mode;
+};
+
+/* A range of the DAX window and the file chunk mapped into it */
+struct virtio_fs_dax_range {
+	struct virtio_fs_file *file;	/* NULL while unmapped */
+	uint64_t chunk;		/* File offset >> FS_DAX_SHIFT */
+	uint32_t refs;		/* Pins from virtiofs_mmap() */
+	uint32_t last_use;
+	int32_t next;		/* Hash chain, -1 ends it */
+};
+
+struct virtio_fs_forget {
+	struct fuse_in_header in;
+	struct fuse_forget_in arg;
+};
+
+struct virtio_fs {
+	struct virtio_device vdev;
+	char tag[37];
+	uint8_t broken;		/* A request timed out, the queue is unusable */
+	uint32_t lost_forgets;	/* FORGETs not posted, the host keeps the nodes */
+	uint64_t unique;
+	uint32_t max_write;
+
+	/* The one request in flight */
+	struct {
+		struct fuse_in_header in;
+		uint8_t in_arg[FS_ARG_SIZE];
+		struct fuse_out_header out;
+		uint8_t out_arg[FS_ARG_SIZE];
+	} req;
+	struct virtio_fs_forget forget[FS_FORGETS];
+	struct fuse_removemapping_one remove[FS_REMOVE_BATCH];
+
+	/* DAX window, addr is NULL if the device has none */
+	struct virtio_shm_region dax;
+	uint32_t nr_ranges;
+	uint32_t clock;
+	struct virtio_fs_dax_range *ranges;
+	int32_t buckets[FS_DAX_BUCKETS];
+};
+
+extern struct virtio_fs *virtiofs_open(struct virtio_device *dev);
+extern void virtiofs_close(struct virtio_fs *fs);
+extern const char *virtiofs_get_tag(struct virtio_fs *fs);
+extern int virtiofs_open_file(struct virtio_fs *fs, const char *path,
+			      struct virtio_fs_file *file);
+extern void virtiofs_close_file(struct virtio_fs_file *file);
+extern int virtiofs_read(struct virtio_fs_file *file, void *buf, uint64_t off,
+			 uint32_t len);
+extern void *virtiofs_mmap(struct virtio_fs_file *file, uint64_t off,
+			   uint32_t len);
+extern void virtiofs_munmap(struct virtio_fs_file *file, void *addr);
+
+#endif /* _VIRTIO_FS_H */
@@ -15,34 +15,53 @@
 
 #include <byteorder.h>
 
+/*
+ * Building with VIRTIO_MODERN_ONLY restricts the library to VIRTIO 1.0
+ * devices. The rings are then always little-endian and the compiler drops
+ * all legacy paths and feature tests below.
+ */
+static inline int virtio_features_modern(uint64_t features)
+{
+#ifdef VIRTIO_MODERN_ONLY
+	return 1;
+#else
+	return (features & VIRTIO_F_VERSION_1) != 0;
+#endif
+}
+
+static inline int virtio_is_modern(struct virtio_device *dev)
+{
+	return virtio_features_modern(dev->features);
+}
+
 static inline uint16_t virtio_cpu_to_modern16(struct virtio_device *dev, uint16_t val)
 {
-	return (dev->features & VIRTIO_F_VERSION_1) ? cpu_to_le16(val) : val;
+	return virtio_is_modern(dev) ? cpu_to_le16(val) : val;
 }
 
 static inline uint32_t virtio_cpu_to_modern32(struct virtio_device *dev, uint32_t val)
 {
-	return (dev->features & VIRTIO_F_VERSION_1) ? cpu_to_le32(val) : val;
+	return virtio_is_modern(dev) ? cpu_to_le32(val) : val;
 }
 
 static inline uint64_t virtio_cpu_to_modern64(struct virtio_device *dev, uint64_t val)
 {
-	return (dev->features & VIRTIO_F_VERSION_1) ? cpu_to_le64(val) : val;
+	return virtio_is_modern(dev) ? cpu_to_le64(val) : val;
 }
 
 static inline uint16_t virtio_modern16_to_cpu(struct virtio_device *dev, uint16_t val)
 {
-	return (dev->features & VIRTIO_F_VERSION_1) ? le16_to_cpu(val) : val;
+	return virtio_is_modern(dev) ? le16_to_cpu(val) : val;
 }
 
 static inline uint32_t virtio_modern32_to_cpu(struct virtio_device *dev, uint32_t val)
 {
-	return (dev->features & VIRTIO_F_VERSION_1) ? le32_to_cpu(val) : val;
+	return virtio_is_modern(dev) ? le32_to_cpu(val) : val;
 }
 
 static inline uint64_t virtio_modern64_to_cpu(struct virtio_device *dev, uint64_t val)
 {
-	return (dev->features & VIRTIO_F_VERSION_1) ? le64_to_cpu(val) : val;
+	return virtio_is_modern(dev) ? le64_to_cpu(val) : val;
 }
 
 #endif /* _LIBVIRTIO_INTERNAL_H */
@@ -0,0 +1,814 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Driver for the virtio IOMMU, see the Virtio Spec 1.2 chapter 5.13, and
+ * back end of SLOF_dma_map_in() and SLOF_dma_map_out().
+ *
+ * Endpoints attached normally share one DMA domain. SLOF_dma_map_in()
+ * maps buffers into it at addresses from a local IOVA allocator, rounded
+ * out to 64K granules or the device page size. The mappings form an IOTLB
+ * cache: mapping a buffer that lies within a cached mapping costs no
+ * request, and SLOF_dma_map_out() only drops a reference. Unreferenced
+ * mappings stay until they are evicted, least recently used first, for
+ * room in the cache or in the IOVA window. Their UNMAP requests are
+ * queued and go to the device together with the next MAP, or when the
+ * batch is full, with a single notification. An UNMAP the device fails
+ * leaves its granules out of the IOVA allocator until a later reclaim
+ * gets it through.
+ *
+ * The price of the cache is that a device may still reach a buffer after
+ * it was unmapped, as with lazy IOTLB invalidation. Past idle_max
+ * unreferenced mappings, the least recently used ones are unmapped right
+ * away; with idle_max 0 (strict mode) every buffer is unmapped as soon as
+ * its last reference goes, see virtioiommu_set_idle_max().
+ *
+ * Trusted endpoints can be attached to an identity-mapped bypass domain
+ * instead. They see physical addresses, so they are meant for devices
+ * whose drivers do not map their buffers, e.g. devices which do not offer
+ * VIRTIO_F_IOMMU_PLATFORM.
+ *
+ * The first device opened serves SLOF_dma_map_in(). Requests are
+ * synchronous and like the core, the driver is not thread safe.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <cpu.h>
+#include <helpers.h>
+#include <byteorder.h>
+#include "virtio-iommu.h"
+#include "virtio-internal.h"
+#include "virtio-ring.h"
+#include "virtio-log.h"
+
+#define DRIVER_FEATURE_SUPPORT	(VIRTIO_F_VERSION_1 | \
+				 VIRTIO_IOMMU_F_INPUT_RANGE | \
+				 VIRTIO_IOMMU_F_DOMAIN_RANGE | \
+				 VIRTIO_IOMMU_F_MAP_UNMAP | \
+				 VIRTIO_IOMMU_F_BYPASS_CONFIG)
+
+#define IOMMU_CFG(iommu, field) virtio_get_config(&(iommu)->vdev,	\
+		offsetof(struct virtio_iommu_config, field),		\
+		sizeof(((struct virtio_iommu_config *) 0)->field))
+
+/* The instance behind SLOF_dma_map_in() */
+static struct virtio_iommu *virtio_iommu;
+
+static int virtioiommu_status(uint8_t status)
+{
+	switch (status) {
+	case VIRTIO_IOMMU_S_OK:
+		return 0;
+	case VIRTIO_IOMMU_S_UNSUPP:
+		return -EOPNOTSUPP;
+	case VIRTIO_IOMMU_S_INVAL:
+		return -EINVAL;
+	case VIRTIO_IOMMU_S_RANGE:
+		return -ERANGE;
+	case VIRTIO_IOMMU_S_NOENT:
+		return -ENOENT;
+	case VIRTIO_IOMMU_S_NOMEM:
+		return -ENOMEM;
+	default:
+		return -EIO;
+	}
+}
+
+static inline struct virtio_iommu_req_tail *
+virtioiommu_tail(struct virtio_iommu *iommu, int i)
+{
+	return (void *) ((uint8_t *) &iommu->reqs[i] + iommu->req_len[i] -
+			 sizeof(struct virtio_iommu_req_tail));
+}
+
+static void virtioiommu_iova_set(struct virtio_iommu *iommu, uint32_t first,
+				 uint32_t n, int16_t owner)
+{
+	while (n--)
+		iommu->iova_owner[first++] = owner;
+}
+
+/* Find n free granules in a row, @return the first one or -1 */
+static int32_t virtioiommu_iova_alloc(struct virtio_iommu *iommu, uint32_t n,
+				      int16_t owner)
+{
+	uint32_t i = iommu->iova_next, run = 0, scanned;
+
+	for (scanned = 0; scanned < iommu->nr_granules + n; scanned++, i++) {
+		if (i >= iommu->nr_granules) {
+			i = 0;
+			run = 0;
+		}
+		if (iommu->iova_owner[i] != IOMMU_IOVA_FREE) {
+			run = 0;
+			continue;
+		}
+		if (++run == n) {
+			virtioiommu_iova_set(iommu, i + 1 - n, n, owner);
+			iommu->iova_next = i + 1;
+			return i + 1 - n;
+		}
+	}
+
+	return -1;
+}
+
+/* Send the queued requests with one notification and wait for all of them */
+static int virtioiommu_flush(struct virtio_iommu *iommu)
+{
+	struct virtio_device *vdev = &iommu->vdev;
+	struct vqs *vq = &vdev->vq[IOMMU_VQ_REQUEST];
+	struct virtio_iommu_req_unmap *unmap;
+	uint32_t first, n_gran;
+	uint16_t idx;
+	int i, id, n = iommu->nr_queued, rc = 0, err;
+
+	if (!n)
+		return 0;
+	iommu->nr_queued = 0;
+	if (iommu->broken)
+		return -EIO;
+
+	/*
+	 * The request, then the tail the device writes. A batch the device
+	 * cannot read is not posted, its MAPs fail and the granules of its
+	 * UNMAPs stay unmapping.
+	 */
+	for (i = 0; i < n; i++) {
+		id = i * 2;
+		__virtio_free_desc(vq, id, vdev->features);
+		__virtio_free_desc(vq, id + 1, vdev->features);
+		err = __virtio_fill_desc(vq, id, vdev->features, (uint64_t) &iommu->reqs[i],
+					 iommu->req_len[i] - sizeof(struct virtio_iommu_req_tail),
+					 VRING_DESC_F_NEXT, id + 1);
+		err |= __virtio_fill_desc(vq, id + 1, vdev->features,
+					  (uint64_t) virtioiommu_tail(iommu, i),
+					  sizeof(struct virtio_iommu_req_tail),
+					  VRING_DESC_F_WRITE, 0);
+		if (err) {
+			__virtio_free_descs(vq, 0, id + 2, vdev->features);
+			return -EIO;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		id = i * 2;
+		idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+		vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, id);
+		sync();
+		vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+		virtio_stats_posted(vdev, vq, iommu->req_len[i] -
+				    sizeof(struct virtio_iommu_req_tail));
+	}
+
+	__virtio_queue_notify(vdev, IOMMU_VQ_REQUEST);
+
+	for (i = 0; i < n; i++) {
+		if (virtio_wait_used(vdev, vq, NULL, VIRTIO_TIMEOUT) < 0) {
+			iommu->broken = 1;
+			return -ETIMEDOUT;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		err = virtioiommu_status(virtioiommu_tail(iommu, i)->status);
+		if (iommu->reqs[i].head.type == VIRTIO_IOMMU_T_UNMAP &&
+		    (!err || err == -ENOENT)) {
+			/* Nothing maps the granules any more, they can be reused */
+			unmap = &iommu->reqs[i].unmap;
+			first = (le64_to_cpu(unmap->virt_start) - iommu->iova_base) >>
+				iommu->shift;
+			n_gran = (le64_to_cpu(unmap->virt_end) + 1 -
+				  le64_to_cpu(unmap->virt_start)) >> iommu->shift;
+			if (le32_to_cpu(unmap->domain) == iommu->dma_domain)
+				virtioiommu_iova_set(iommu, first, n_gran,
+						     IOMMU_IOVA_FREE);
+			err = 0;
+		} else if (iommu->reqs[i].head.type == VIRTIO_IOMMU_T_UNMAP) {
+			/* The granules stay unmapping, virtioiommu_reclaim() retries */
+			virtio_log(VIRTIO_LOG_ERR, VLOG_IOMMU_UNMAP_FAILED,
+				   le64_to_cpu(iommu->reqs[i].unmap.virt_start),
+				   virtioiommu_tail(iommu, i)->status);
+		}
+		if (err && !rc)
+			rc = err;
+	}
+
+	return rc;
+}
+
+/* Add a request to the batch, @return it or NULL if the device is broken */
+static union virtio_iommu_req *virtioiommu_queue(struct virtio_iommu *iommu,
+						 uint8_t type, uint16_t len)
+{
+	union virtio_iommu_req *req;
+
+	if (iommu->nr_queued == iommu->batch_max)
+		virtioiommu_flush(iommu);
+	if (iommu->broken)
+		return NULL;
+
+	req = &iommu->reqs[iommu->nr_queued];
+	iommu->req_len[iommu->nr_queued++] = len;
+	memset(req, 0, len);
+	req->head.type = type;
+	/* Stays an error if the device never answers */
+	virtioiommu_tail(iommu, iommu->nr_queued - 1)->status = VIRTIO_IOMMU_S_IOERR;
+
+	return req;
+}
+
+static union virtio_iommu_req *virtioiommu_queue_map(struct virtio_iommu *iommu,
+						     uint32_t domain, uint64_t iova,
+						     uint64_t end, uint64_t pa)
+{
+	union virtio_iommu_req *req;
+
+	req = virtioiommu_queue(iommu, VIRTIO_IOMMU_T_MAP, sizeof(req->map));
+	if (!req)
+		return NULL;
+
+	req->map.domain = cpu_to_le32(domain);
+	req->map.virt_start = cpu_to_le64(iova);
+	req->map.virt_end = cpu_to_le64(end);
+	req->map.phys_start = cpu_to_le64(pa);
+	req->map.flags = cpu_to_le32(VIRTIO_IOMMU_MAP_F_READ | VIRTIO_IOMMU_MAP_F_WRITE);
+
+	return req;
+}
+
+static inline int virtioiommu_bucket(struct virtio_iommu *iommu, uint64_t pa)
+{
+	return (pa >> iommu->shift) & (IOMMU_HASH_BUCKETS - 1);
+}
+
+/* Hash the granules of a mapping, starting at IOVA granule g */
+static void virtioiommu_hash(struct virtio_iommu *iommu,
+			     struct virtio_iommu_mapping *m, int32_t g)
+{
+	uint64_t off;
+	int b;
+
+	for (off = 0; off < m->len; off += 1ULL << iommu->shift, g++) {
+		b = virtioiommu_bucket(iommu, m->pa + off);
+		iommu->iova_chain[g] = iommu->buckets[b];
+		iommu->buckets[b] = g;
+	}
+}
+
+static void virtioiommu_unhash(struct virtio_iommu *iommu,
+			       struct virtio_iommu_mapping *m, int32_t g)
+{
+	uint64_t off;
+	int32_t *link;
+
+	for (off = 0; off < m->len; off += 1ULL << iommu->shift, g++) {
+		for (link = &iommu->buckets[virtioiommu_bucket(iommu, m->pa + off)];
+		     *link != g; link = &iommu->iova_chain[*link])
+			;
+		*link = iommu->iova_chain[g];
+	}
+}
+
+/* Drop an idle mapping from the cache, its unmap is queued */
+static void virtioiommu_evict(struct virtio_iommu *iommu, int i)
+{
+	struct virtio_iommu_mapping *m = &iommu->map[i];
+	union virtio_iommu_req *req;
+
+	virtioiommu_unhash(iommu, m, (m->iova - iommu->iova_base) >> iommu->shift);
+	m->valid = 0;
+	iommu->nr_idle--;
+
+	virtioiommu_iova_set(iommu, (m->iova - iommu->iova_base) >> iommu->shift,
+			     m->len >> iommu->shift, IOMMU_IOVA_UNMAPPING);
+
+	req = virtioiommu_queue(iommu, VIRTIO_IOMMU_T_UNMAP, sizeof(req->unmap));
+	if (!req)
+		return;
+	req->unmap.domain = cpu_to_le32(iommu->dma_domain);
+	req->unmap.virt_start = cpu_to_le64(m->iova);
+	req->unmap.virt_end = cpu_to_le64(m->iova + m->len - 1);
+}
+
+/*
+ * The least recently used idle mapping, or a free cache entry if "free"
+ * is set and there is one
+ * @return  its index, -1 if there is none
+ */
+static int virtioiommu_lru(struct virtio_iommu *iommu, int free)
+{
+	int i, victim = -1;
+
+	for (i = 0; i < IOMMU_CACHE_ENTRIES; i++) {
+		if (!iommu->map[i].valid) {
+			if (free)
+				return i;
+			continue;
+		}
+		if (!iommu->map[i].refs &&
+		    (victim < 0 || (int32_t) (iommu->map[i].last_use -
+					      iommu->map[victim].last_use) < 0))
+			victim = i;
+	}
+
+	return victim;
+}
+
+/* A free cache entry, evicting the least recently used idle mapping */
+static int virtioiommu_get_entry(struct virtio_iommu *iommu)
+{
+	int i = virtioiommu_lru(iommu, 1);
+
+	if (i >= 0 && iommu->map[i].valid)
+		virtioiommu_evict(iommu, i);
+	return i;
+}
+
+/* Unmap the least recently used idle mappings, down to "keep" of them */
+static void virtioiommu_trim(struct virtio_iommu *iommu, uint32_t keep)
+{
+	while (iommu->nr_idle > keep)
+		virtioiommu_evict(iommu, virtioiommu_lru(iommu, 0));
+	virtioiommu_flush(iommu);
+}
+
+/* Queue UNMAPs for the granules earlier UNMAPs failed to free */
+static void virtioiommu_retry_unmaps(struct virtio_iommu *iommu)
+{
+	union virtio_iommu_req *req;
+	uint32_t g, first;
+
+	for (g = 0; g < iommu->nr_granules; g++) {
+		if (iommu->iova_owner[g] != IOMMU_IOVA_UNMAPPING)
+			continue;
+
+		/* A run of them is made of whole mappings, one UNMAP covers it */
+		for (first = g; g + 1 < iommu->nr_granules &&
+		     iommu->iova_owner[g + 1] == IOMMU_IOVA_UNMAPPING; g++)
+			;
+		req = virtioiommu_queue(iommu, VIRTIO_IOMMU_T_UNMAP, sizeof(req->unmap));
+		if (!req)
+			return;
+		req->unmap.domain = cpu_to_le32(iommu->dma_domain);
+		req->unmap.virt_start = cpu_to_le64(iommu->iova_base +
+						    ((uint64_t) first << iommu->shift));
+		req->unmap.virt_end = cpu_to_le64(iommu->iova_base +
+						  ((uint64_t) (g + 1) << iommu->shift) - 1);
+	}
+}
+
+/* Unmap every idle mapping to make room in the IOVA window */
+static void virtioiommu_reclaim(struct virtio_iommu *iommu)
+{
+	virtioiommu_trim(iommu, 0);
+
+	/* Whatever is still unmapping now had its UNMAP fail, try again */
+	virtioiommu_retry_unmaps(iommu);
+	virtioiommu_flush(iommu);
+}
+
+/**
+ * Map a buffer into the DMA domain, see SLOF_dma_map_in()
+ * @return  the address for the device, virt itself if no virtio-iommu is
+ *          open, 0 if the buffer cannot be mapped
+ */
+long virtioiommu_dma_map_in(void *virt, long size, int cacheable)
+{
+	struct virtio_iommu *iommu = virtio_iommu;
+	struct virtio_iommu_mapping *m;
+	union virtio_iommu_req *req;
+	uint64_t pa = (uint64_t) virt, start, len, iova;
+	int32_t i, g;
+	int b;
+
+	(void) cacheable;
+
+	if (!iommu)
+		return (long) virt;
+	if (size <= 0)
+		size = 1;
+
+	/* Any mapping holding pa has one of its granules in this bucket */
+	b = virtioiommu_bucket(iommu, pa);
+	for (g = iommu->buckets[b]; g >= 0; g = iommu->iova_chain[g]) {
+		m = &iommu->map[iommu->iova_owner[g]];
+		if (m->pa <= pa && pa + size <= m->pa + m->len) {
+			iommu->hits++;
+			if (!m->refs++)
+				iommu->nr_idle--;
+			m->last_use = ++iommu->clock;
+			return m->iova + (pa - m->pa);
+		}
+	}
+	iommu->misses++;
+
+	start = pa & ~((1ULL << iommu->shift) - 1);
+	len = (pa + size - start + (1ULL << iommu->shift) - 1) &
+	      ~((1ULL << iommu->shift) - 1);
+
+	i = virtioiommu_get_entry(iommu);
+	if (i < 0)
+		goto fail;
+
+	g = virtioiommu_iova_alloc(iommu, len >> iommu->shift, i);
+	if (g < 0) {
+		virtioiommu_reclaim(iommu);
+		g = virtioiommu_iova_alloc(iommu, len >> iommu->shift, i);
+		if (g < 0)
+			goto fail;
+	}
+	iova = iommu->iova_base + ((uint64_t) g << iommu->shift);
+
+	/* Goes out together with the unmaps queued so far */
+	req = virtioiommu_queue_map(iommu, iommu->dma_domain, iova,
+				    iova + len - 1, start);
+	if (req)
+		virtioiommu_flush(iommu);
+	if (!req || req->map.tail.status != VIRTIO_IOMMU_S_OK) {
+		virtioiommu_iova_set(iommu, g, len >> iommu->shift, IOMMU_IOVA_FREE);
+		goto fail;
+	}
+
+	m = &iommu->map[i];
+	m->pa = start;
+	m->len = len;
+	m->iova = iova;
+	m->refs = 1;
+	m->last_use = ++iommu->clock;
+	m->valid = 1;
+	virtioiommu_hash(iommu, m, g);
+
+	return iova + (pa - start);
+
+fail:
+	virtio_log(VIRTIO_LOG_ERR, VLOG_IOMMU_MAP_FAILED, pa, size);
+	return 0;
+}
+
+/**
+ * Release a buffer mapped by virtioiommu_dma_map_in(), see
+ * SLOF_dma_map_out(). The mapping stays cached, unless there are more
+ * than idle_max idle mappings then.
+ */
+void virtioiommu_dma_map_out(long phys, void *virt, long size)
+{
+	struct virtio_iommu *iommu = virtio_iommu;
+	uint64_t iova = (uint64_t) phys, g;
+	int16_t i;
+
+	(void) virt;
+	(void) size;
+
+	if (!iommu || iova < iommu->iova_base)
+		return;
+
+	g = (iova - iommu->iova_base) >> iommu->shift;
+	if (g >= iommu->nr_granules)
+		return;
+
+	i = iommu->iova_owner[g];
+	if (i < 0 || !iommu->map[i].refs || --iommu->map[i].refs)
+		return;
+
+	/* Above the bound, unmap down to half of it to batch the UNMAPs */
+	if (++iommu->nr_idle > iommu->idle_max)
+		virtioiommu_trim(iommu, iommu->idle_max / 2);
+}
+
+/**
+ * Bound the number of unreferenced mappings the IOTLB cache keeps, which
+ * a device can still reach. 0 selects strict mode: SLOF_dma_map_out()
+ * unmaps a buffer as soon as its last reference goes, at the cost of an
+ * UNMAP request every time.
+ * @param   iommu  the device
+ * @param   max    idle mappings kept, IOMMU_IDLE_MAX by default
+ */
+void virtioiommu_set_idle_max(struct virtio_iommu *iommu, uint32_t max)
+{
+	iommu->idle_max = max;
+	if (iommu->nr_idle > max)
+		virtioiommu_trim(iommu, max);
+}
+
+static struct virtio_iommu_endpoint *
+virtioiommu_find_endpoint(struct virtio_iommu *iommu, uint32_t endpoint)
+{
+	int i;
+
+	for (i = 0; i < IOMMU_MAX_ENDPOINTS; i++)
+		if (iommu->endpoints[i].attached &&
+		    iommu->endpoints[i].id == endpoint)
+			return &iommu->endpoints[i];
+
+	return NULL;
+}
+
+/**
+ * Attach an endpoint. Devices whose drivers map their buffers with
+ * SLOF_dma_map_in() must be attached to the DMA domain before they open.
+ * @param   iommu     the device
+ * @param   endpoint  endpoint ID, e.g. the PCI requester ID
+ * @param   bypass    attach to the identity-mapped domain, for trusted
+ *                    devices which use physical addresses
+ * @return  0, or negative errno
+ */
+int virtioiommu_attach(struct virtio_iommu *iommu, uint32_t endpoint, int bypass)
+{
+	struct virtio_iommu_endpoint *ep;
+	union virtio_iommu_req *req;
+	uint32_t domain = iommu->dma_domain;
+	int i, rc;
+
+	ep = virtioiommu_find_endpoint(iommu, endpoint);
+	for (i = 0; !ep && i < IOMMU_MAX_ENDPOINTS; i++)
+		if (!iommu->endpoints[i].attached)
+			ep = &iommu->endpoints[i];
+	if (!ep)
+		return -ENOSPC;
+
+	if (bypass) {
+		if (!iommu->identity_domain)
+			return -EOPNOTSUPP;
+		domain = iommu->identity_domain;
+	}
+
+	/* Attaching moves the endpoint out of its previous domain */
+	req = virtioiommu_queue(iommu, VIRTIO_IOMMU_T_ATTACH, sizeof(req->attach));
+	if (!req)
+		return -EIO;
+	req->attach.domain = cpu_to_le32(domain);
+	req->attach.endpoint = cpu_to_le32(endpoint);
+	if (bypass && iommu->bypass_config)
+		req->attach.flags = cpu_to_le32(VIRTIO_IOMMU_ATTACH_F_BYPASS);
+	virtioiommu_flush(iommu);
+	rc = virtioiommu_status(req->attach.tail.status);
+	if (rc)
+		return rc;
+
+	ep->id = endpoint;
+	ep->domain = domain;
+	ep->attached = 1;
+
+	/* Without bypass support, the domain maps the whole input range 1:1 */
+	if (bypass && !iommu->bypass_config && !iommu->identity_ready) {
+		req = virtioiommu_queue_map(iommu, domain, iommu->input_start,
+					    iommu->input_end, iommu->input_start);
+		if (!req)
+			return -EIO;
+		virtioiommu_flush(iommu);
+		rc = virtioiommu_status(req->map.tail.status);
+		if (rc)
+			return rc;
+		iommu->identity_ready = 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Detach an endpoint, its DMA is blocked afterwards
+ * @return  0, or negative errno
+ */
+int virtioiommu_detach(struct virtio_iommu *iommu, uint32_t endpoint)
+{
+	struct virtio_iommu_endpoint *ep;
+	union virtio_iommu_req *req;
+	int rc;
+
+	ep = virtioiommu_find_endpoint(iommu, endpoint);
+	if (!ep)
+		return -ENOENT;
+
+	req = virtioiommu_queue(iommu, VIRTIO_IOMMU_T_DETACH, sizeof(req->detach));
+	if (!req)
+		return -EIO;
+	req->detach.domain = cpu_to_le32(ep->domain);
+	req->detach.endpoint = cpu_to_le32(endpoint);
+	virtioiommu_flush(iommu);
+	rc = virtioiommu_status(req->detach.tail.status);
+	if (rc)
+		return rc;
+
+	ep->attached = 0;
+	return 0;
+}
+
+static void virtioiommu_post_event(struct virtio_iommu *iommu, int id)
+{
+	struct virtio_device *vdev = &iommu->vdev;
+	struct vqs *vq = &vdev->vq[IOMMU_VQ_EVENT];
+	uint16_t idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, id);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+}
+
+/**
+ * Report the faults the device recorded, to be called from the queue
+ * handler or a polling task
+ * @return  number of faults
+ */
+int virtioiommu_poll(struct virtio_iommu *iommu)
+{
+	struct virtio_device *vdev = &iommu->vdev;
+	struct vqs *vq = &vdev->vq[IOMMU_VQ_EVENT];
+	struct virtio_iommu_fault *f;
+	uint32_t len;
+	int id, n = 0;
+
+	while ((id = virtio_get_used(vdev, vq, &len)) >= 0) {
+		id = vq_wrap(vq, id);
+		f = &iommu->events[id];
+		virtio_log(VIRTIO_LOG_ERR, VLOG_IOMMU_FAULT,
+			   le64_to_cpu(f->address), le32_to_cpu(f->endpoint));
+		virtioiommu_post_event(iommu, id);
+		n++;
+	}
+	if (n)
+		__virtio_queue_notify(vdev, IOMMU_VQ_EVENT);
+
+	return n;
+}
+
+static void virtioiommu_vq_interrupt(struct virtio_device *dev, struct vqs *vq,
+				     void *arg)
+{
+	virtioiommu_poll(arg);
+}
+
+void virtioiommu_handle_interrupt(struct virtio_iommu *iommu)
+{
+	virtio_handle_interrupt(&iommu->vdev);
+}
+
+static int virtioiommu_init(struct virtio_iommu *iommu)
+{
+	struct virtio_device *vdev = &iommu->vdev;
+	struct vqs *vq_req, *vq_ev;
+	int status = VIRTIO_STAT_ACKNOWLEDGE | VIRTIO_STAT_DRIVER;
+	uint64_t page_mask, window;
+	uint32_t domain_start = 0, domain_end = ~0U, i;
+
+	virtio_set_status(vdev, status);
+
+	/* There is no legacy interface for virtio-iommu */
+	if (!virtio_is_modern(vdev) ||
+	    virtio_negotiate_guest_features(vdev, DRIVER_FEATURE_SUPPORT))
+		goto dev_error;
+	virtio_get_status(vdev, &status);
+
+	page_mask = IOMMU_CFG(iommu, page_size_mask);
+	if (!(vdev->features & VIRTIO_IOMMU_F_MAP_UNMAP) || !page_mask) {
+		printf("virtio-iommu: Device cannot map\n");
+		goto dev_error;
+	}
+	iommu->shift = __builtin_ctzll(page_mask);
+	if (iommu->shift < IOMMU_GRANULE_SHIFT)
+		iommu->shift = IOMMU_GRANULE_SHIFT;
+	iommu->bypass_config = !!(vdev->features & VIRTIO_IOMMU_F_BYPASS_CONFIG);
+
+	iommu->input_start = 0;
+	iommu->input_end = ~0ULL;
+	if (vdev->features & VIRTIO_IOMMU_F_INPUT_RANGE) {
+		iommu->input_start = IOMMU_CFG(iommu, input_start);
+		iommu->input_end = IOMMU_CFG(iommu, input_end);
+	}
+	if (vdev->features & VIRTIO_IOMMU_F_DOMAIN_RANGE) {
+		domain_start = IOMMU_CFG(iommu, domain_start);
+		domain_end = IOMMU_CFG(iommu, domain_end);
+	}
+	iommu->dma_domain = domain_start ? domain_start : 1;
+	iommu->identity_domain = iommu->dma_domain < domain_end ?
+				 iommu->dma_domain + 1 : 0;
+
+	/* Address 0 stays unmapped, failed mappings fault */
+	iommu->iova_base = (iommu->input_start + (1ULL << iommu->shift) - 1) &
+			   ~((1ULL << iommu->shift) - 1);
+	if (!iommu->iova_base)
+		iommu->iova_base = 1ULL << iommu->shift;
+	window = iommu->input_end - iommu->iova_base + 1;
+	if (iommu->iova_base > iommu->input_end || !window || window > IOMMU_IOVA_SPACE)
+		window = iommu->iova_base > iommu->input_end ? 0 : IOMMU_IOVA_SPACE;
+	iommu->nr_granules = window >> iommu->shift;
+	if (iommu->dma_domain > domain_end || !iommu->nr_granules) {
+		printf("virtio-iommu: Unsupported domain or input range\n");
+		goto dev_error;
+	}
+
+	iommu->iova_owner = SLOF_alloc_mem(iommu->nr_granules * sizeof(int16_t));
+	iommu->iova_chain = SLOF_alloc_mem(iommu->nr_granules * sizeof(int32_t));
+	if (!iommu->iova_owner || !iommu->iova_chain) {
+		printf("virtio-iommu: Failed to allocate buffers!\n");
+		goto dev_error;
+	}
+	virtioiommu_iova_set(iommu, 0, iommu->nr_granules, IOMMU_IOVA_FREE);
+	for (i = 0; i < IOMMU_HASH_BUCKETS; i++)
+		iommu->buckets[i] = -1;
+
+	vq_req = virtio_queue_init_vq(vdev, IOMMU_VQ_REQUEST);
+	vq_ev = virtio_queue_init_vq(vdev, IOMMU_VQ_EVENT);
+	if (!vq_req || !vq_ev)
+		goto dev_error;
+
+	iommu->batch_max = vq_req->size / 2 < IOMMU_BATCH ? vq_req->size / 2 : IOMMU_BATCH;
+	iommu->idle_max = IOMMU_IDLE_MAX;
+	vq_req->avail->flags = virtio_cpu_to_modern16(vdev, VRING_AVAIL_F_NO_INTERRUPT);
+
+	for (i = 0; i < IOMMU_EVENTS && i < vq_ev->size; i++) {
+		if (virtio_fill_desc(vq_ev, i, vdev->features, (uint64_t) &iommu->events[i],
+				     sizeof(iommu->events[i]), VRING_DESC_F_WRITE, 0))
+			goto dev_error;
+		vq_ev->avail->ring[i] = virtio_cpu_to_modern16(vdev, i);
+	}
+	sync();
+	vq_ev->avail->flags = virtio_cpu_to_modern16(vdev, 0);
+	vq_ev->avail->idx = virtio_cpu_to_modern16(vdev, i);
+
+	virtio_queue_set_handler(vdev, IOMMU_VQ_EVENT, virtioiommu_vq_interrupt, iommu);
+
+	/* Endpoints not attached to a domain must not reach memory */
+	if (iommu->bypass_config)
+		virtio_set_config(vdev, offsetof(struct virtio_iommu_config, bypass),
+				  sizeof(uint8_t), 0);
+
+	status |= VIRTIO_STAT_DRIVER_OK;
+	virtio_set_status(vdev, status);
+
+	virtio_queue_notify(vdev, IOMMU_VQ_EVENT);
+
+	return 0;
+
+dev_error:
+	status |= VIRTIO_STAT_FAILED;
+	virtio_set_status(vdev, status);
+	return -1;
+}
+
+static void virtioiommu_free(struct virtio_iommu *iommu)
+{
+	struct virtio_device *vdev = &iommu->vdev;
+
+	if (iommu->iova_owner)
+		SLOF_free_mem(iommu->iova_owner, iommu->nr_granules * sizeof(int16_t));
+	if (iommu->iova_chain)
+		SLOF_free_mem(iommu->iova_chain, iommu->nr_granules * sizeof(int32_t));
+
+	virtio_queue_term_vq(vdev, &vdev->vq[IOMMU_VQ_REQUEST], IOMMU_VQ_REQUEST);
+	virtio_queue_term_vq(vdev, &vdev->vq[IOMMU_VQ_EVENT], IOMMU_VQ_EVENT);
+	SLOF_free_mem(iommu, sizeof(*iommu));
+}
+
+struct virtio_iommu *virtioiommu_open(struct virtio_device *dev)
+{
+	struct virtio_iommu *iommu;
+
+	if (!dev)
+		return NULL;
+
+	iommu = SLOF_alloc_mem(sizeof(*iommu));
+	if (!iommu) {
+		printf("Unable to allocate virtio-iommu driver\n");
+		return NULL;
+	}
+	memset(iommu, 0, sizeof(*iommu));
+
+	/* make a copy of the device structure */
+	memcpy(&iommu->vdev, dev, sizeof(struct virtio_device));
+
+	virtio_reset_device(&iommu->vdev);
+	virtio_set_status(&iommu->vdev, VIRTIO_STAT_ACKNOWLEDGE);
+
+	if (virtioiommu_init(iommu)) {
+		virtioiommu_free(iommu);
+		return NULL;
+	}
+
+	if (!virtio_iommu)
+		virtio_iommu = iommu;
+
+	return iommu;
+}
+
+/* The devices behind the IOMMU must be closed first */
+void virtioiommu_close(struct virtio_iommu *iommu)
+{
+	if (!iommu)
+		return;
+
+	if (virtio_iommu == iommu)
+		virtio_iommu = NULL;
+
+	/* Quiesce and reset device */
+	virtio_set_status(&iommu->vdev, VIRTIO_STAT_FAILED);
+	virtio_reset_device(&iommu->vdev);
+
+	virtioiommu_free(iommu);
+}
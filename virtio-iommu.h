@@ -0,0 +1,209 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#ifndef _VIRTIO_IOMMU_H
+#define _VIRTIO_IOMMU_H
+
+#include <stdint.h>
+#include <byteorder.h>
+#include "virtio.h"
+
+enum {
+	IOMMU_VQ_REQUEST = 0,	/* Attach, map and unmap requests */
+	IOMMU_VQ_EVENT = 1,	/* Fault reports */
+};
+
+/* VIRTIO_IOMMU Feature bits */
+#define VIRTIO_IOMMU_F_INPUT_RANGE	(1 << 0)
+#define VIRTIO_IOMMU_F_DOMAIN_RANGE	(1 << 1)
+#define VIRTIO_IOMMU_F_MAP_UNMAP	(1 << 2)
+#define VIRTIO_IOMMU_F_BYPASS		(1 << 3)
+#define VIRTIO_IOMMU_F_PROBE		(1 << 4)
+#define VIRTIO_IOMMU_F_MMIO		(1 << 5)
+#define VIRTIO_IOMMU_F_BYPASS_CONFIG	(1 << 6)
+
+/* As per VirtIO spec Version 1.2: 5.13.4 Device configuration layout */
+struct virtio_iommu_config {
+	le64 page_size_mask;
+	le64 input_start;
+	le64 input_end;
+	le32 domain_start;
+	le32 domain_end;
+	le32 probe_size;
+	uint8_t bypass;
+	uint8_t reserved[3];
+} __attribute__((packed));
+
+/* Request types */
+#define VIRTIO_IOMMU_T_ATTACH		0x01
+#define VIRTIO_IOMMU_T_DETACH		0x02
+#define VIRTIO_IOMMU_T_MAP		0x03
+#define VIRTIO_IOMMU_T_UNMAP		0x04
+
+/* Request status */
+#define VIRTIO_IOMMU_S_OK		0x00
+#define VIRTIO_IOMMU_S_IOERR		0x01
+#define VIRTIO_IOMMU_S_UNSUPP		0x02
+#define VIRTIO_IOMMU_S_DEVERR		0x03
+#define VIRTIO_IOMMU_S_INVAL		0x04
+#define VIRTIO_IOMMU_S_RANGE		0x05
+#define VIRTIO_IOMMU_S_NOENT		0x06
+#define VIRTIO_IOMMU_S_FAULT		0x07
+#define VIRTIO_IOMMU_S_NOMEM		0x08
+
+struct virtio_iommu_req_head {
+	uint8_t type;
+	uint8_t reserved[3];
+};
+
+/* Written by the device, ends every request */
+struct virtio_iommu_req_tail {
+	uint8_t status;
+	uint8_t reserved[3];
+};
+
+#define VIRTIO_IOMMU_ATTACH_F_BYPASS	(1 << 0)
+
+struct virtio_iommu_req_attach {
+	struct virtio_iommu_req_head head;
+	le32 domain;
+	le32 endpoint;
+	le32 flags;
+	uint8_t reserved[4];
+	struct virtio_iommu_req_tail tail;
+};
+
+struct virtio_iommu_req_detach {
+	struct virtio_iommu_req_head head;
+	le32 domain;
+	le32 endpoint;
+	uint8_t reserved[8];
+	struct virtio_iommu_req_tail tail;
+};
+
+#define VIRTIO_IOMMU_MAP_F_READ		(1 << 0)
+#define VIRTIO_IOMMU_MAP_F_WRITE	(1 << 1)
+
+struct virtio_iommu_req_map {
+	struct virtio_iommu_req_head head;
+	le32 domain;
+	le64 virt_start;
+	le64 virt_end;		/* Inclusive */
+	le64 phys_start;
+	le32 flags;
+	struct virtio_iommu_req_tail tail;
+} __attribute__((packed));
+
+struct virtio_iommu_req_unmap {
+	struct virtio_iommu_req_head head;
+	le32 domain;
+	le64 virt_start;
+	le64 virt_end;		/* Inclusive */
+	uint8_t reserved[4];
+	struct virtio_iommu_req_tail tail;
+} __attribute__((packed));
+
+union virtio_iommu_req {
+	struct virtio_iommu_req_head head;
+	struct virtio_iommu_req_attach attach;
+	struct virtio_iommu_req_detach detach;
+	struct virtio_iommu_req_map map;
+	struct virtio_iommu_req_unmap unmap;
+};
+
+struct virtio_iommu_fault {
+	uint8_t reason;
+	uint8_t reserved[3];
+	le32 flags;
+	le32 endpoint;
+	uint8_t reserved2[4];
+	le64 address;
+};
+
+/* Driver limits */
+#define IOMMU_GRANULE_SHIFT	16	/* Mappings cover 64K granules at least */
+#define IOMMU_IOVA_SPACE	(1ULL << 30)	/* Window for DMA mappings */
+#define IOMMU_CACHE_ENTRIES	256	/* Mappings kept in the IOTLB cache */
+#define IOMMU_IDLE_MAX		32	/* Unreferenced ones, default */
+#define IOMMU_HASH_BUCKETS	256	/* Power of 2 */
+#define IOMMU_BATCH		32	/* Requests per notification */
+#define IOMMU_MAX_ENDPOINTS	16
+#define IOMMU_EVENTS		8
+
+/* IOVA granule states besides the index of the owning mapping */
+#define IOMMU_IOVA_FREE		-1
+#define IOMMU_IOVA_UNMAPPING	-2	/* Unmap queued, not reusable yet */
+
+/* A mapping of the DMA domain, cached while no buffer uses it */
+struct virtio_iommu_mapping {
+	uint64_t pa;		/* Granule aligned */
+	uint64_t len;
+	uint64_t iova;
+	uint32_t refs;		/* Buffers mapped in it, see SLOF_dma_map_in() */
+	uint32_t last_use;
+	uint8_t valid;
+};
+
+struct virtio_iommu_endpoint {
+	uint32_t id;
+	uint32_t domain;
+	uint8_t attached;
+};
+
+struct virtio_iommu {
+	struct virtio_device vdev;
+	uint8_t broken;		/* A request timed out, the queue is unusable */
+	uint8_t bypass_config;	/* VIRTIO_IOMMU_F_BYPASS_CONFIG negotiated */
+	uint8_t identity_ready;	/* The identity domain maps the input range */
+	uint32_t shift;		/* Granule of the mappings */
+	uint64_t input_start;
+	uint64_t input_end;
+	uint32_t dma_domain;
+	uint32_t identity_domain;	/* 0 if the device has no room for it */
+
+	/* IOVA allocator, one owner per granule of the window */
+	uint64_t iova_base;
+	uint32_t nr_granules;
+	uint32_t iova_next;	/* Where the next search starts */
+	int16_t *iova_owner;
+
+	/*
+	 * IOTLB cache. Every granule of a cached mapping is hashed by the
+	 * physical address it maps, the buckets and iova_chain link the IOVA
+	 * granules, iova_owner leads to the mapping.
+	 */
+	uint32_t clock;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t nr_idle;	/* Mappings without references */
+	uint32_t idle_max;	/* See virtioiommu_set_idle_max() */
+	struct virtio_iommu_mapping map[IOMMU_CACHE_ENTRIES];
+	int32_t buckets[IOMMU_HASH_BUCKETS];
+	int32_t *iova_chain;	/* Next granule in the bucket, -1 ends it */
+
+	/* Requests queued for the next notification */
+	uint16_t batch_max;
+	uint16_t nr_queued;
+	uint16_t req_len[IOMMU_BATCH];
+	union virtio_iommu_req reqs[IOMMU_BATCH];
+
+	struct virtio_iommu_endpoint endpoints[IOMMU_MAX_ENDPOINTS];
+	struct virtio_iommu_fault events[IOMMU_EVENTS];
+};
+
+extern struct virtio_iommu *virtioiommu_open(struct virtio_device *dev);
+extern void virtioiommu_close(struct virtio_iommu *iommu);
+extern int virtioiommu_attach(struct virtio_iommu *iommu, uint32_t endpoint,
+			      int bypass);
+extern int virtioiommu_detach(struct virtio_iommu *iommu, uint32_t endpoint);
+extern int virtioiommu_poll(struct virtio_iommu *iommu);
+extern void virtioiommu_set_idle_max(struct virtio_iommu *iommu, uint32_t max);
+extern void virtioiommu_handle_interrupt(struct virtio_iommu *iommu);
+
+/* Back ends of SLOF_dma_map_in() and SLOF_dma_map_out() */
+extern long virtioiommu_dma_map_in(void *virt, long size, int cacheable);
+extern void virtioiommu_dma_map_out(long phys, void *virt, long size);
+
+#endif /* _VIRTIO_IOMMU_H */
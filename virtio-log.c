@@ -0,0 +1,141 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <cpu.h>
+#include "helpers.h"
+#include "virtio-log.h"
+
+struct virtio_log_entry {
+	uint32_t seq;		/* Position + 1 once the entry is complete */
+	uint16_t code;
+	uint8_t level;
+	uint64_t arg0;
+	uint32_t arg1;
+};
+
+struct virtio_log_limit {
+	uint64_t start;		/* Ticks at the start of the interval */
+	uint32_t count;		/* Entries posted in the interval */
+	uint32_t suppressed;	/* Entries refused since the last drain */
+};
+
+static const char * const virtio_log_msg[VLOG_CODES] = {
+	[VLOG_NET_TX_TOO_BIG]	= "virtio-net: Packet too big (%llu > %u bytes)",
+	[VLOG_NET_RX_TRUNCATED]	= "virtio-net: Receive buffer not big enough (%llu > %u bytes)",
+	[VLOG_BLK_UNALIGNED]	= "virtio-blk: Unaligned block size %llu (sector size %u)",
+	[VLOG_BLK_BEYOND_END]	= "virtio-blk: Access beyond end of device (block %llu, count %u)",
+	[VLOG_IOMMU_NO_SETUP]	= "virtio: IOMMU setup has not been done (descriptor %llu)",
+	[VLOG_SCSI_BEYOND_END]	= "virtio-scsi: Access beyond end of LUN (block %llu, count %u)",
+	[VLOG_IOMMU_FAULT]	= "virtio-iommu: Fault at 0x%llx (endpoint %u)",
+	[VLOG_IOMMU_MAP_FAILED]	= "virtio-iommu: Cannot map 0x%llx (%u bytes)",
+	[VLOG_IOMMU_UNMAP_FAILED] = "virtio-iommu: Cannot unmap 0x%llx (status %u)",
+};
+
+static const char * const virtio_log_level_name[] = {
+	"error", "warning", "info", "debug"
+};
+
+int virtio_log_level = VIRTIO_LOG_WARN;
+
+static struct virtio_log_entry virtio_log_ring[VIRTIO_LOG_ENTRIES];
+static struct virtio_log_limit virtio_log_limit[VLOG_CODES];
+static uint32_t virtio_log_head;	/* Next position to post */
+static uint32_t virtio_log_tail;	/* Next position to drain */
+static uint32_t virtio_log_lost;	/* Entries refused because the ring was full */
+
+/* Whether another entry of "code" may be posted in the current interval */
+static int virtio_log_allowed(int code)
+{
+	struct virtio_log_limit *lim = &virtio_log_limit[code];
+	uint64_t now = get_ticks();
+	uint64_t start = __atomic_load_n(&lim->start, __ATOMIC_RELAXED);
+
+	if (now - start >= get_tick_freq() * VIRTIO_LOG_INTERVAL / 1000 &&
+	    __atomic_compare_exchange_n(&lim->start, &start, now, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		__atomic_store_n(&lim->count, 0, __ATOMIC_RELAXED);
+
+	if (__atomic_fetch_add(&lim->count, 1, __ATOMIC_RELAXED) < VIRTIO_LOG_BURST)
+		return 1;
+
+	__atomic_fetch_add(&lim->suppressed, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/**
+ * Post an entry to the log ring. Never blocks, the entry is dropped when
+ * the code exceeds its rate or the ring is full. Use virtio_log().
+ * @param   level  VIRTIO_LOG_*
+ * @param   code   VLOG_*
+ * @param   arg0   first message argument
+ * @param   arg1   second message argument
+ */
+void __virtio_log(int level, int code, uint64_t arg0, uint32_t arg1)
+{
+	struct virtio_log_entry *e;
+	uint32_t head;
+
+	if (code <= 0 || code >= VLOG_CODES || !virtio_log_allowed(code))
+		return;
+
+	head = __atomic_load_n(&virtio_log_head, __ATOMIC_RELAXED);
+	do {
+		if (head - __atomic_load_n(&virtio_log_tail, __ATOMIC_ACQUIRE) >=
+		    VIRTIO_LOG_ENTRIES) {
+			__atomic_fetch_add(&virtio_log_lost, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&virtio_log_head, &head, head + 1, 1,
+					      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	e = &virtio_log_ring[head & (VIRTIO_LOG_ENTRIES - 1)];
+	e->code = code;
+	e->level = level;
+	e->arg0 = arg0;
+	e->arg1 = arg1;
+	__atomic_store_n(&e->seq, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Print the pending log entries and the number of entries which were
+ * suppressed or lost since the last call. Only one caller at a time.
+ * @return  number of entries printed
+ */
+int virtio_log_drain(void)
+{
+	struct virtio_log_entry *e;
+	uint32_t tail, n;
+	int i, printed = 0;
+
+	tail = __atomic_load_n(&virtio_log_tail, __ATOMIC_RELAXED);
+	for (;;) {
+		e = &virtio_log_ring[tail & (VIRTIO_LOG_ENTRIES - 1)];
+		if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != tail + 1)
+			break;
+
+		printf("%s: ", virtio_log_level_name[e->level & 3]);
+		printf(virtio_log_msg[e->code], (unsigned long long) e->arg0, e->arg1);
+		printf("\n");
+
+		tail++;
+		__atomic_store_n(&virtio_log_tail, tail, __ATOMIC_RELEASE);
+		printed++;
+	}
+
+	for (i = 1; i < VLOG_CODES; i++) {
+		n = __atomic_exchange_n(&virtio_log_limit[i].suppressed, 0,
+					__ATOMIC_RELAXED);
+		if (n)
+			printf("virtio: %u messages suppressed (code %d)\n", n, i);
+	}
+
+	n = __atomic_exchange_n(&virtio_log_lost, 0, __ATOMIC_RELAXED);
+	if (n)
+		printf("virtio: %u messages lost, log ring full\n", n);
+
+	return printed;
+}
@@ -0,0 +1,56 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Driver diagnostics. Data paths must not print, a slow console would stall
+ * them, so they post a code and two arguments to a lock-free ring instead.
+ * virtio_log_drain() prints the pending entries and must be called from a
+ * context which may block, e.g. the idle loop or a housekeeping task.
+ */
+
+#ifndef _VIRTIO_LOG_H
+#define _VIRTIO_LOG_H
+
+#include <stdint.h>
+
+/* Levels */
+#define VIRTIO_LOG_ERR		0
+#define VIRTIO_LOG_WARN		1
+#define VIRTIO_LOG_INFO		2
+#define VIRTIO_LOG_DEBUG	3
+
+/* Codes, see the message table in virtio-log.c */
+#define VLOG_NET_TX_TOO_BIG	1	/* packet length, buffer size */
+#define VLOG_NET_RX_TRUNCATED	2	/* packet length, buffer size */
+#define VLOG_BLK_UNALIGNED	3	/* block size, sector size */
+#define VLOG_BLK_BEYOND_END	4	/* first block, block count */
+#define VLOG_IOMMU_NO_SETUP	5	/* descriptor index, unused */
+#define VLOG_SCSI_BEYOND_END	6	/* first block, block count */
+#define VLOG_IOMMU_FAULT	7	/* address, endpoint */
+#define VLOG_IOMMU_MAP_FAILED	8	/* physical address, length */
+#define VLOG_IOMMU_UNMAP_FAILED	9	/* IOVA, status */
+#define VLOG_CODES		10
+
+/* Number of entries in the ring, must be a power of 2 */
+#ifndef VIRTIO_LOG_ENTRIES
+#define VIRTIO_LOG_ENTRIES	64
+#endif
+
+/* At most VIRTIO_LOG_BURST entries per code every VIRTIO_LOG_INTERVAL ms */
+#define VIRTIO_LOG_BURST	10
+#define VIRTIO_LOG_INTERVAL	1000
+
+/* Entries above this level are discarded when posted */
+extern int virtio_log_level;
+
+extern void __virtio_log(int level, int code, uint64_t arg0, uint32_t arg1);
+extern int virtio_log_drain(void);
+
+#define virtio_log(level, code, arg0, arg1) do {			\
+		if ((level) <= virtio_log_level)			\
+			__virtio_log(level, code, arg0, arg1);		\
+	} while (0)
+
+#endif /* _VIRTIO_LOG_H */
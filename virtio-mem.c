@@ -0,0 +1,351 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Driver for the virtio memory device, see the Virtio Spec 1.2 chapter 5.15.
+ *
+ * The device region is made of blocks the driver plugs and unplugs to
+ * follow the size the host asks for, virtiomem_poll() sends at most one
+ * plug or unplug request per call. Plugged blocks are handed to the
+ * aligned allocator with SLOF_add_mem_range(), SLOF_alloc_mem() does not
+ * get them; to shrink, blocks are taken back from the top of the region,
+ * but only those the allocator can give up with SLOF_remove_mem_range().
+ * Blocks the allocator did not take are unplugged first.
+ *
+ * Requests are synchronous and like the core, the driver is not thread
+ * safe.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <cpu.h>
+#include <helpers.h>
+#include <byteorder.h>
+#include "virtio-mem.h"
+#include "virtio-internal.h"
+#include "virtio-ring.h"
+
+#define DRIVER_FEATURE_SUPPORT	(VIRTIO_F_VERSION_1 | \
+				 VIRTIO_MEM_F_UNPLUGGED_INACCESSIBLE)
+
+#define MEM_CFG(vm, field) virtio_get_config(&(vm)->vdev,		\
+		offsetof(struct virtio_mem_config, field),		\
+		sizeof(((struct virtio_mem_config *) 0)->field))
+
+static inline int virtiomem_test(const uint8_t *map, uint32_t blk)
+{
+	return map[blk / 8] & (1 << (blk % 8));
+}
+
+static inline int virtiomem_is_plugged(struct virtio_mem *vm, uint32_t blk)
+{
+	return virtiomem_test(vm->plugged, blk);
+}
+
+static void virtiomem_mark(uint8_t *map, uint32_t blk, uint32_t n, int set)
+{
+	for (; n; n--, blk++) {
+		if (set)
+			map[blk / 8] |= 1 << (blk % 8);
+		else
+			map[blk / 8] &= ~(1 << (blk % 8));
+	}
+}
+
+static void *virtiomem_block_addr(struct virtio_mem *vm, uint32_t blk)
+{
+	return SLOF_translate_my_address((void *) (vm->addr + blk * vm->block_size));
+}
+
+/* Send vm->req and wait, @return the response type or negative errno */
+static int virtiomem_send(struct virtio_mem *vm, uint16_t type, uint32_t blk,
+			  uint32_t n)
+{
+	struct virtio_device *vdev = &vm->vdev;
+	struct vqs *vq = &vdev->vq[MEM_VQ_REQUEST];
+	uint16_t idx;
+	int err;
+
+	if (vm->broken)
+		return -EIO;
+
+	memset(&vm->req, 0, sizeof(vm->req));
+	vm->req.type = cpu_to_le16(type);
+	vm->req.addr = cpu_to_le64(vm->addr + blk * vm->block_size);
+	vm->req.nb_blocks = cpu_to_le16(n);
+	memset(&vm->resp, 0, sizeof(vm->resp));
+	vm->resp.type = cpu_to_le16(VIRTIO_MEM_RESP_ERROR);
+
+	__virtio_free_desc(vq, 0, vdev->features);
+	__virtio_free_desc(vq, 1, vdev->features);
+	err = __virtio_fill_desc(vq, 0, vdev->features, (uint64_t) &vm->req,
+				 sizeof(vm->req), VRING_DESC_F_NEXT, 1);
+	err |= __virtio_fill_desc(vq, 1, vdev->features, (uint64_t) &vm->resp,
+				  sizeof(vm->resp), VRING_DESC_F_WRITE, 0);
+	if (err) {
+		__virtio_free_descs(vq, 0, 2, vdev->features);
+		return -EIO;
+	}
+
+	idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, idx)] = 0;
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	virtio_stats_posted(vdev, vq, sizeof(vm->req));
+
+	__virtio_queue_notify(vdev, MEM_VQ_REQUEST);
+
+	if (virtio_wait_used(vdev, vq, NULL, VIRTIO_TIMEOUT) < 0) {
+		vm->broken = 1;
+		return -ETIMEDOUT;
+	}
+
+	return le16_to_cpu(vm->resp.type);
+}
+
+static int virtiomem_resp_error(int resp)
+{
+	switch (resp) {
+	case VIRTIO_MEM_RESP_ACK:
+		return 0;
+	case VIRTIO_MEM_RESP_NACK:
+		return -ENOSPC;
+	case VIRTIO_MEM_RESP_BUSY:
+		return -EBUSY;
+	default:
+		return resp < 0 ? resp : -EIO;
+	}
+}
+
+/* Plug the first run of unplugged blocks in the usable region */
+static int virtiomem_plug(struct virtio_mem *vm, uint32_t wanted, uint32_t usable)
+{
+	uint32_t blk, n = 0, i;
+	int rc;
+
+	for (blk = 0; blk < usable && virtiomem_is_plugged(vm, blk); blk++)
+		;
+	while (blk + n < usable && n < wanted && n < MEM_MAX_BLOCKS_PER_REQ &&
+	       !virtiomem_is_plugged(vm, blk + n))
+		n++;
+	if (!n)
+		return -ENOSPC;
+
+	rc = virtiomem_resp_error(virtiomem_send(vm, VIRTIO_MEM_REQ_PLUG, blk, n));
+	if (rc)
+		return rc;
+	virtiomem_mark(vm->plugged, blk, n, 1);
+	vm->nr_plugged += n;
+
+	for (i = 0; i < n; i++) {
+		if (SLOF_add_mem_range(virtiomem_block_addr(vm, blk + i),
+				       vm->block_size))
+			break;
+		virtiomem_mark(vm->added, blk + i, 1, 1);
+	}
+	if (i == n)
+		return n;
+
+	/*
+	 * The allocator is full, the rest goes back to the host. If the host
+	 * refuses, virtiomem_unplug() picks the blocks up when shrinking.
+	 */
+	if (!virtiomem_resp_error(virtiomem_send(vm, VIRTIO_MEM_REQ_UNPLUG,
+						 blk + i, n - i))) {
+		virtiomem_mark(vm->plugged, blk + i, n - i, 0);
+		vm->nr_plugged -= n - i;
+	}
+	return i ? (int) i : -ENOMEM;
+}
+
+/*
+ * Unplug the topmost run of plugged blocks the allocator gives up or never
+ * had. The added bits stay set until the host acknowledges, so a refused
+ * request hands back exactly the blocks taken from the allocator.
+ */
+static int virtiomem_unplug(struct virtio_mem *vm, uint32_t wanted)
+{
+	uint32_t blk, n = 0, i;
+	int rc;
+
+	blk = vm->nr_blocks;
+	while (blk > 0 && n < wanted && n < MEM_MAX_BLOCKS_PER_REQ) {
+		blk--;
+		if (virtiomem_is_plugged(vm, blk) &&
+		    (!virtiomem_test(vm->added, blk) ||
+		     !SLOF_remove_mem_range(virtiomem_block_addr(vm, blk),
+					    vm->block_size))) {
+			n++;
+			continue;
+		}
+		if (n) {
+			blk++;
+			break;
+		}
+	}
+	if (!n)
+		return -EBUSY;
+
+	rc = virtiomem_resp_error(virtiomem_send(vm, VIRTIO_MEM_REQ_UNPLUG, blk, n));
+	if (rc) {
+		for (i = 0; i < n; i++)
+			if (virtiomem_test(vm->added, blk + i) &&
+			    SLOF_add_mem_range(virtiomem_block_addr(vm, blk + i),
+					       vm->block_size))
+				virtiomem_mark(vm->added, blk + i, 1, 0);
+		return rc;
+	}
+	virtiomem_mark(vm->plugged, blk, n, 0);
+	virtiomem_mark(vm->added, blk, n, 0);
+	vm->nr_plugged -= n;
+
+	return n;
+}
+
+/**
+ * Move the plugged size one request towards the size the host asks for
+ * @return  number of blocks plugged or unplugged, or negative errno:
+ *          -EBUSY if no block can be unplugged right now, -ENOMEM if the
+ *          allocators do not take more memory
+ */
+int virtiomem_poll(struct virtio_mem *vm)
+{
+	uint64_t requested, usable;
+	uint32_t target;
+	int rc;
+
+	if (vm->broken)
+		return -EIO;
+
+	requested = MEM_CFG(vm, requested_size);
+	usable = MEM_CFG(vm, usable_region_size) / vm->block_size;
+	target = requested / vm->block_size;
+	if (usable > vm->nr_blocks)
+		usable = vm->nr_blocks;
+	if (target > usable)
+		target = usable;
+
+	if (target > vm->nr_plugged) {
+		/* Do not retry until the host asks for something else */
+		if (requested == vm->stuck_size)
+			return -ENOMEM;
+		rc = virtiomem_plug(vm, target - vm->nr_plugged, usable);
+		if (rc == -ENOMEM)
+			vm->stuck_size = requested;
+		return rc;
+	}
+	if (target < vm->nr_plugged)
+		return virtiomem_unplug(vm, vm->nr_plugged - target);
+
+	return 0;
+}
+
+static int virtiomem_init(struct virtio_mem *vm)
+{
+	struct virtio_device *vdev = &vm->vdev;
+	int status = VIRTIO_STAT_ACKNOWLEDGE | VIRTIO_STAT_DRIVER;
+	uint64_t region_size;
+
+	virtio_set_status(vdev, status);
+
+	/* There is no legacy interface for virtio-mem */
+	if (!virtio_is_modern(vdev) ||
+	    virtio_negotiate_guest_features(vdev, DRIVER_FEATURE_SUPPORT))
+		goto dev_error;
+	virtio_get_status(vdev, &status);
+
+	vm->block_size = MEM_CFG(vm, block_size);
+	vm->addr = MEM_CFG(vm, addr);
+	region_size = MEM_CFG(vm, region_size);
+	if (!vm->block_size || region_size / vm->block_size >= (1ULL << 31)) {
+		printf("virtio-mem: Unsupported region layout\n");
+		goto dev_error;
+	}
+	vm->nr_blocks = region_size / vm->block_size;
+
+	/* The plugged and added bitmaps share one allocation */
+	vm->plugged = SLOF_alloc_mem(2 * ((vm->nr_blocks + 7) / 8));
+	if (!vm->plugged) {
+		printf("virtio-mem: Failed to allocate buffers!\n");
+		goto dev_error;
+	}
+	memset(vm->plugged, 0, 2 * ((vm->nr_blocks + 7) / 8));
+	vm->added = vm->plugged + (vm->nr_blocks + 7) / 8;
+
+	if (!virtio_queue_init_vq(vdev, MEM_VQ_REQUEST))
+		goto dev_error;
+
+	status |= VIRTIO_STAT_DRIVER_OK;
+	virtio_set_status(vdev, status);
+
+	/* Blocks plugged before, e.g. across a reboot, are unknown to us */
+	if (MEM_CFG(vm, plugged_size) &&
+	    virtiomem_send(vm, VIRTIO_MEM_REQ_UNPLUG_ALL, 0, 0) != VIRTIO_MEM_RESP_ACK) {
+		printf("virtio-mem: Failed to unplug all memory\n");
+		goto dev_error;
+	}
+
+	return 0;
+
+dev_error:
+	status |= VIRTIO_STAT_FAILED;
+	virtio_set_status(vdev, status);
+	return -1;
+}
+
+static void virtiomem_free(struct virtio_mem *vm)
+{
+	struct virtio_device *vdev = &vm->vdev;
+
+	if (vm->plugged)
+		SLOF_free_mem(vm->plugged, 2 * ((vm->nr_blocks + 7) / 8));
+
+	virtio_queue_term_vq(vdev, &vdev->vq[MEM_VQ_REQUEST], MEM_VQ_REQUEST);
+	SLOF_free_mem(vm, sizeof(*vm));
+}
+
+struct virtio_mem *virtiomem_open(struct virtio_device *dev)
+{
+	struct virtio_mem *vm;
+
+	if (!dev)
+		return NULL;
+
+	vm = SLOF_alloc_mem(sizeof(*vm));
+	if (!vm) {
+		printf("Unable to allocate virtio-mem driver\n");
+		return NULL;
+	}
+	memset(vm, 0, sizeof(*vm));
+
+	/* make a copy of the device structure */
+	memcpy(&vm->vdev, dev, sizeof(struct virtio_device));
+
+	virtio_reset_device(&vm->vdev);
+	virtio_set_status(&vm->vdev, VIRTIO_STAT_ACKNOWLEDGE);
+
+	if (virtiomem_init(vm)) {
+		virtiomem_free(vm);
+		return NULL;
+	}
+
+	return vm;
+}
+
+/* Plugged blocks stay plugged and with the allocators */
+void virtiomem_close(struct virtio_mem *vm)
+{
+	if (!vm)
+		return;
+
+	/* Quiesce and reset device */
+	virtio_set_status(&vm->vdev, VIRTIO_STAT_FAILED);
+	virtio_reset_device(&vm->vdev);
+
+	virtiomem_free(vm);
+}
@@ -0,0 +1,78 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#ifndef _VIRTIO_MEM_H
+#define _VIRTIO_MEM_H
+
+#include <stdint.h>
+#include <byteorder.h>
+#include "virtio.h"
+
+enum {
+	MEM_VQ_REQUEST = 0,	/* Guest requests */
+};
+
+/* VIRTIO_MEM Feature bits */
+#define VIRTIO_MEM_F_ACPI_PXM			(1 << 0)
+#define VIRTIO_MEM_F_UNPLUGGED_INACCESSIBLE	(1 << 1)
+
+/* As per VirtIO spec Version 1.2: 5.15.4 Device configuration layout */
+struct virtio_mem_config {
+	le64 block_size;
+	le16 node_id;
+	uint8_t padding[6];
+	le64 addr;
+	le64 region_size;
+	le64 usable_region_size;
+	le64 plugged_size;
+	le64 requested_size;
+} __attribute__((packed));
+
+#define VIRTIO_MEM_REQ_PLUG		0
+#define VIRTIO_MEM_REQ_UNPLUG		1
+#define VIRTIO_MEM_REQ_UNPLUG_ALL	2
+#define VIRTIO_MEM_REQ_STATE		3
+
+struct virtio_mem_req {
+	le16 type;
+	le16 padding[3];
+	le64 addr;		/* Plug, unplug and state requests */
+	le16 nb_blocks;
+	le16 padding2[3];
+};
+
+#define VIRTIO_MEM_RESP_ACK		0
+#define VIRTIO_MEM_RESP_NACK		1
+#define VIRTIO_MEM_RESP_BUSY		2
+#define VIRTIO_MEM_RESP_ERROR		3
+
+struct virtio_mem_resp {
+	le16 type;
+	le16 padding[3];
+	le16 state;		/* State requests */
+};
+
+/* Driver limits */
+#define MEM_MAX_BLOCKS_PER_REQ	256
+
+struct virtio_mem {
+	struct virtio_device vdev;
+	uint8_t broken;		/* A request timed out, the queue is unusable */
+	uint64_t block_size;
+	uint64_t addr;		/* Guest physical address of the region */
+	uint32_t nr_blocks;
+	uint32_t nr_plugged;
+	uint64_t stuck_size;	/* Requested size the allocators could not take */
+	uint8_t *plugged;	/* Bitmap of plugged blocks */
+	uint8_t *added;		/* Bitmap of blocks the allocator has */
+	struct virtio_mem_req req;
+	struct virtio_mem_resp resp;
+};
+
+extern struct virtio_mem *virtiomem_open(struct virtio_device *dev);
+extern void virtiomem_close(struct virtio_mem *vm);
+extern int virtiomem_poll(struct virtio_mem *vm);
+
+#endif /* _VIRTIO_MEM_H */
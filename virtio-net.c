@@ -26,11 +26,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <helpers.h>
 #include <cache.h>
 #include <byteorder.h>
 #include "virtio-net.h"
 #include "virtio-internal.h"
+#include "virtio-ring.h"
 
 #ifdef __CHERI_PURE_CAPABILITY__
 #include <cheri/cheri-utility.h>
@@ -46,7 +48,11 @@
 
 // #define sync()  asm volatile ("fence o, i" ::: "memory")
 
-#define DRIVER_FEATURE_SUPPORT  (VIRTIO_NET_F_MAC | VIRTIO_F_VERSION_1)
+#define DRIVER_FEATURE_SUPPORT  (VIRTIO_NET_F_MAC | VIRTIO_F_VERSION_1 | \
+				 VIRTIO_F_IN_ORDER | VIRTIO_F_NOTIFICATION_DATA)
+
+/* How long virtionet_suspend() waits for pending transmissions */
+#define VIRTIONET_QUIESCE_MS	100
 
 /* See Virtio Spec, appendix C, "Device Operation" */
 struct virtio_net_hdr {
@@ -71,8 +77,8 @@ struct virtio_net_hdr_v1 {
 	le16  num_buffers;
 };
 
-static uint16_t last_rx_idx;	/* Last index in RX "used" ring */
-static uint16_t last_tx_idx;	/* Last index in TX "used" ring */
+/* Sent packets need no offloads, the legacy header is a prefix of this */
+static const struct virtio_net_hdr_v1 tx_hdr;
 
 /**
  * Module init for virtio via PCI.
@@ -152,7 +158,7 @@ static int virtionet_init(struct virtio_net *vnet)
 	virtio_set_status(vdev, status);
 
 	/* Device specific setup */
-	if (vdev->features & VIRTIO_F_VERSION_1) {
+	if (virtio_is_modern(vdev)) {
 		if (virtio_negotiate_guest_features(vdev, DRIVER_FEATURE_SUPPORT))
 			goto dev_error;
 		net_hdr_size = sizeof(struct virtio_net_hdr_v1);
@@ -182,7 +188,7 @@ static int virtionet_init(struct virtio_net *vnet)
 	 * and those form a single buffer.
 	*/
 	vq_rx->buf_mem = SLOF_alloc_mem_aligned((BUFFER_ENTRY_SIZE+net_hdr_size)
-				   * queue_size / 2 , 8, &vq_rx->pa);
+				   * queue_size / 2 , 8, NULL);
 	if (!vq_rx->buf_mem) {
 		printf("virtionet: Failed to allocate rx buffers!\n");
 		goto dev_error;
@@ -190,7 +196,7 @@ static int virtionet_init(struct virtio_net *vnet)
 
 	/* Allocate memory for half of queue_size for the transmit buffers. */
 	vq_tx->buf_mem = SLOF_alloc_mem_aligned((BUFFER_ENTRY_SIZE)
-				    * queue_size / 2, 8, &vq_tx->pa);
+				    * queue_size / 2, 8, NULL);
 	if (!vq_tx->buf_mem) {
 		printf("virtionet: Failed to allocate tx buffers!\n");
 		goto dev_error;
@@ -202,12 +208,14 @@ static int virtionet_init(struct virtio_net *vnet)
 			+ i * (BUFFER_ENTRY_SIZE+net_hdr_size);
 		uint32_t id = i*2;
 		/* Descriptor for net_hdr: */
-		virtio_fill_desc(vq_rx, id, vdev->features, addr, net_hdr_size,
-				 VRING_DESC_F_NEXT | VRING_DESC_F_WRITE, id + 1);
+		if (virtio_fill_desc(vq_rx, id, vdev->features, addr, net_hdr_size,
+				     VRING_DESC_F_NEXT | VRING_DESC_F_WRITE, id + 1))
+			goto dev_error;
 
 		/* Descriptor for data: */
-		virtio_fill_desc(vq_rx, id + 1, vdev->features, addr + net_hdr_size,
-				 BUFFER_ENTRY_SIZE, VRING_DESC_F_WRITE, 0);
+		if (virtio_fill_desc(vq_rx, id + 1, vdev->features, addr + net_hdr_size,
+				     BUFFER_ENTRY_SIZE, VRING_DESC_F_WRITE, 0))
+			goto dev_error;
 
 		vq_rx->avail->ring[i] = virtio_cpu_to_modern16(vdev, id);
 	}
@@ -216,7 +224,21 @@ static int virtionet_init(struct virtio_net *vnet)
 	vq_rx->avail->flags = virtio_cpu_to_modern16(vdev, 0);
 	vq_rx->avail->idx = virtio_cpu_to_modern16(vdev, queue_size / 2);
 
-	last_rx_idx = virtio_modern16_to_cpu(vdev, vq_rx->used->idx);
+	vq_rx->last_used_idx = virtio_modern16_to_cpu(vdev, vq_rx->used->idx);
+
+	/* A transmit chain always uses the same header and buffer, so they are
+	 * mapped once here and virtionet_xmit() only sets the length */
+	for (i = 0; i < vq_tx->size / 2; i++) {
+		uint32_t id = i * 2;
+		uint8_t *addr = vq_tx->buf_mem +
+				((id & (vq_tx->size / 2 - 1)) / 2) * BUFFER_ENTRY_SIZE;
+
+		if (virtio_fill_desc(vq_tx, id, vdev->features, (uint64_t) &tx_hdr,
+				     net_hdr_size, VRING_DESC_F_NEXT, id + 1) ||
+		    virtio_fill_desc(vq_tx, id + 1, vdev->features, (uint64_t) addr,
+				     BUFFER_ENTRY_SIZE, 0, 0))
+			goto dev_error;
+	}
 
 	vq_tx->avail->flags = virtio_cpu_to_modern16(vdev, VRING_AVAIL_F_NO_INTERRUPT);
 	vq_tx->avail->idx = 0;
@@ -286,74 +308,76 @@ static int virtionet_term(struct virtio_net *vnet)
 
 /**
  * Transmit a packet
+ * @return  number of bytes queued, -EMSGSIZE if the packet does not fit a
+ *          buffer, -EAGAIN if a multi-producer queue is full
  */
 static int virtionet_xmit(struct virtio_net *vnet, char *buf, int len)
 {
 	int id, idx;
-	const static struct virtio_net_hdr_v1 nethdr_v1 = {0};
-	const static struct virtio_net_hdr nethdr_legacy = {0};
-	const void *nethdr = &nethdr_legacy;
 	struct virtio_device *vdev = &vnet->vdev;
 	struct vqs *vq_tx = &vdev->vq[VQ_TX];
 
 	if (len > BUFFER_ENTRY_SIZE) {
-		printf("virtionet: Packet too big!\n");
-		return 0;
+		virtio_log(VIRTIO_LOG_WARN, VLOG_NET_TX_TOO_BIG, len, BUFFER_ENTRY_SIZE);
+		return -EMSGSIZE;
 	}
 
 	dprintf("\nvirtionet_xmit(packet at %p, %d bytes)\n", vq_tx->buf_mem, len);
 
-	if (vdev->features & VIRTIO_F_VERSION_1)
-		nethdr = &nethdr_v1;
-
 	/* Determine descriptor index */
-	idx = virtio_modern16_to_cpu(vdev, vq_tx->avail->idx);
-	id = (idx * 2) % vq_tx->size;
-	uint32_t buf_index = (idx * 2) % (vq_tx->size / 2);
+	if (vq_tx->mp_ready) {
+		/* The size / 4 TX buffers are reused in avail order */
+		idx = virtio_queue_reserve(vdev, vq_tx, vq_tx->size / 4);
+		if (idx < 0)
+			return -EAGAIN;
+	} else {
+		idx = virtio_modern16_to_cpu(vdev, vq_tx->avail->idx);
+	}
+	id = vq_wrap(vq_tx, idx * 2);
+	uint32_t buf_index = (idx * 2) & (vq_tx->size / 2 - 1);
 
 	uint8_t *buf_addr = vq_tx->buf_mem + ((buf_index / 2) * (BUFFER_ENTRY_SIZE));
 	memcpy(buf_addr, buf, len);
 
-	virtio_free_desc(vq_tx, id, vdev->features);
-	virtio_free_desc(vq_tx, id + 1, vdev->features);
+	/* The chain was mapped by virtionet_init(), only the length changes */
+	vq_tx->desc[id + 1].len = virtio_cpu_to_modern32(vdev, len);
 
-	/* Set up virtqueue descriptor for header */
-	virtio_fill_desc(vq_tx, id, vdev->features, (uint64_t)nethdr,
-			 net_hdr_size, VRING_DESC_F_NEXT, id + 1);
+	if (vq_tx->mp_ready) {
+		int kick = virtio_queue_publish(vdev, vq_tx, idx, id);
 
-	/* Set up virtqueue descriptor for data */
-	virtio_fill_desc(vq_tx, id + 1, vdev->features, ((uint64_t) buf_addr),  len, 0, 0);
+		virtio_stats_posted(vdev, vq_tx, len);
+		if (kick)
+			__virtio_queue_notify(vdev, VQ_TX);
+		return len;
+	}
 
-	vq_tx->avail->ring[idx % vq_tx->size] = virtio_cpu_to_modern16(vdev, id);
+	vq_tx->avail->ring[vq_wrap(vq_tx, idx)] = virtio_cpu_to_modern16(vdev, id);
 	sync();
 	vq_tx->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
 	sync();
+	virtio_stats_posted(vdev, vq_tx, len);
 
-	/* Tell HV that TX queue is ready */
-
-	last_tx_idx = (vq_tx->used->idx);
+	/* Descriptors are reused in ring order, so reclaiming the chains the
+	 * device is done with only needs the cursor to follow the used index */
+	vq_tx->last_used_idx = virtio_modern16_to_cpu(vdev, vq_tx->used->idx);
 
-	virtio_queue_notify(vdev, VQ_TX);
+	/* Tell HV that TX queue is ready */
+	__virtio_queue_notify(vdev, VQ_TX);
 
 	return len;
 }
 
 size_t virtionet_receive_check(struct virtio_net *vnet)
 {
-	uint32_t idx;
 	uint32_t len = 0;
 	struct virtio_device *vdev = &vnet->vdev;
 	struct vqs *vq_rx = &vdev->vq[VQ_RX];
 
-	idx = virtio_modern16_to_cpu(vdev, vq_rx->used->idx);
-
-	if (last_rx_idx == idx) {
+	if (virtio_peek_used(vdev, vq_rx, &len) < 0) {
 		/* Nothing received yet */
 		return 0;
 	}
 
-	len = virtio_modern32_to_cpu(vdev, vq_rx->used->ring[last_rx_idx % vq_rx->size].len);
-
 	return len;
 }
 
@@ -363,28 +387,25 @@ size_t virtionet_receive_check(struct virtio_net *vnet)
 static int virtionet_receive(struct virtio_net *vnet, char *buf, int maxlen)
 {
 	uint32_t len = 0;
-	uint32_t id, idx;
+	int id;
 	uint16_t avail_idx;
 	struct virtio_device *vdev = &vnet->vdev;
 	struct vqs *vq_rx = &vnet->vdev.vq[VQ_RX];
 	void *dev_buf_addr = NULL;
 
-	idx = virtio_modern16_to_cpu(vdev, vq_rx->used->idx);
-
-	if (last_rx_idx == idx) {
+	id = virtio_get_used(vdev, vq_rx, &len);
+	if (id < 0) {
 		/* Nothing received yet */
 		return 0;
 	}
 
-	id = (virtio_modern32_to_cpu(vdev, vq_rx->used->ring[last_rx_idx % vq_rx->size].id) + 1)
-		% vq_rx->size;
-	len = virtio_modern32_to_cpu(vdev, vq_rx->used->ring[last_rx_idx % vq_rx->size].len)
-		- net_hdr_size;
-	dprintf("virtionet_receive() last_rx_idx=%i, vq_rx->used->idx=%i,"
-		" id=%i len=%i\n", last_rx_idx, vq_rx->used->idx, id, len);
+	id = vq_wrap(vq_rx, id + 1);
+	len -= net_hdr_size;
+	dprintf("virtionet_receive() last_used_idx=%i, vq_rx->used->idx=%i,"
+		" id=%i len=%i\n", vq_rx->last_used_idx, vq_rx->used->idx, id, len);
 
 	if (len > (uint32_t)maxlen) {
-		printf("virtio-net: Receive buffer not big enough!\n");
+		virtio_log(VIRTIO_LOG_WARN, VLOG_NET_RX_TRUNCATED, len, maxlen);
 		len = maxlen;
 	}
 
@@ -401,7 +422,7 @@ static int virtionet_receive(struct virtio_net *vnet, char *buf, int maxlen)
 #endif
 
 	// Get the buffer address from the device
-	dev_buf_addr = (void *) virtio_desc_addr(vdev, VQ_RX, id);
+	dev_buf_addr = (void *) __virtio_desc_addr(vdev, VQ_RX, id);
 
 #ifdef __CHERI_PURE_CAPABILITY__
 	// Get/infer the buffer capability from the address received from device
@@ -413,15 +434,14 @@ static int virtionet_receive(struct virtio_net *vnet, char *buf, int maxlen)
 	memcpy(buf, dev_buf_addr, len);
 
 	/* Move indices to next entries */
-	last_rx_idx = last_rx_idx + 1;
-
 	avail_idx = virtio_modern16_to_cpu(vdev, vq_rx->avail->idx);
-	vq_rx->avail->ring[avail_idx % vq_rx->size] = virtio_cpu_to_modern16(vdev, id - 1);
+	vq_rx->avail->ring[vq_wrap(vq_rx, avail_idx)] = virtio_cpu_to_modern16(vdev, id - 1);
 	sync();
 	vq_rx->avail->idx = virtio_cpu_to_modern16(vdev, avail_idx + 1);
+	__virtio_stats_posted(vdev, vq_rx, 0, VT_REFILL);
 
 	/* Tell HV that RX queue entry is ready */
-	virtio_queue_notify(vdev, VQ_RX);
+	__virtio_queue_notify(vdev, VQ_RX);
 
 	return len;
 }
@@ -437,6 +457,7 @@ struct virtio_net *virtionet_open(struct virtio_device *dev)
 	}
 
 	vnet->driver.running = 0;
+	vnet->rx_handler = NULL;
 
 #ifdef VIRTIO_USE_PCI
 	if (virtionet_init_pci(vnet, dev))
@@ -470,19 +491,98 @@ int virtionet_read(struct virtio_net *vnet, char *buf, int len)
 {
 	if (vnet && buf)
 		return virtionet_receive(vnet, buf, len);
-	return -1;
+	return -EINVAL;
 }
 
 int virtionet_write(struct virtio_net *vnet, char *buf, int len)
 {
 	if (vnet && buf)
 		return virtionet_xmit(vnet, buf, len);
-	return -1;
+	return -EINVAL;
+}
+
+/**
+ * Suspend the device, keeping the queues and buffers for virtionet_resume().
+ * Transmit slots are derived from the avail index, so pending transmissions
+ * have to complete first.
+ * @return  0 on success, -EBUSY if transmissions did not complete, or an
+ *          error of virtio_suspend()
+ */
+int virtionet_suspend(struct virtio_net *vnet)
+{
+	if (virtio_queue_quiesce(&vnet->vdev, VQ_TX, VIRTIONET_QUIESCE_MS))
+		return -EBUSY;
+
+	return virtio_suspend(&vnet->vdev);
+}
+
+/**
+ * Resume the device. Receive buffers posted before the suspend are posted
+ * again, packets received but not read yet are kept.
+ */
+int virtionet_resume(struct virtio_net *vnet)
+{
+	return virtio_resume(&vnet->vdev);
 }
 
 void virtionet_handle_interrupt(struct virtio_net *vnet)
 {
-	uint32_t int_status = 0;
-	virtio_get_interrupt_status(&vnet->vdev, &int_status);
-	virtio_interrupt_ack(&vnet->vdev, int_status);
+	virtio_handle_interrupt(&vnet->vdev);
+}
+
+/**
+ * Allow virtionet_write() to be called from several tasks concurrently.
+ * Receiving is still single owner.
+ */
+int virtionet_set_tx_mp(struct virtio_net *vnet, int enable)
+{
+	return virtio_queue_set_mp(&vnet->vdev, VQ_TX, enable);
+}
+
+/**
+ * Pin both queues of the device to a CPU, see virtio_queue_set_affinity()
+ */
+int virtionet_set_affinity(struct virtio_net *vnet, int cpu)
+{
+	int rc;
+
+	rc = virtio_queue_set_affinity(&vnet->vdev, VQ_RX, cpu);
+	if (!rc)
+		rc = virtio_queue_set_affinity(&vnet->vdev, VQ_TX, cpu);
+
+	/* Both queues or neither */
+	if (rc) {
+		virtio_queue_set_affinity(&vnet->vdev, VQ_RX, VIRTIO_CPU_ANY);
+		virtio_queue_set_affinity(&vnet->vdev, VQ_TX, VIRTIO_CPU_ANY);
+	}
+
+	return rc;
+}
+
+static void virtionet_rx_interrupt(struct virtio_device *dev, struct vqs *vq,
+				   void *arg)
+{
+	struct virtio_net *vnet = arg;
+
+	vnet->rx_handler(vnet, vnet->rx_arg);
+}
+
+/**
+ * Install a callback that virtionet_handle_interrupt() runs when packets
+ * have been received, e.g. to read them or to wake up a polling task.
+ * Passing a NULL handler removes it again.
+ */
+void virtionet_set_rx_handler(struct virtio_net *vnet,
+			      virtionet_rx_handler_t handler, void *arg)
+{
+	/* The queue handler must never run without an rx_handler */
+	if (!handler) {
+		virtio_queue_set_handler(&vnet->vdev, VQ_RX, NULL, vnet);
+		vnet->rx_handler = NULL;
+		return;
+	}
+
+	vnet->rx_handler = handler;
+	vnet->rx_arg = arg;
+	virtio_queue_set_handler(&vnet->vdev, VQ_RX, virtionet_rx_interrupt, vnet);
 }
@@ -29,9 +29,15 @@ enum {
 	VQ_TX = 1,	/* Transmit Queue */
 };
 
+struct virtio_net;
+
+typedef void (*virtionet_rx_handler_t)(struct virtio_net *vnet, void *arg);
+
 struct virtio_net {
 	net_driver_t driver;
 	struct virtio_device vdev;
+	virtionet_rx_handler_t rx_handler;
+	void *rx_arg;
 };
 
 /* VIRTIO_NET Feature bits */
@@ -41,7 +47,13 @@ extern struct virtio_net *virtionet_open(struct virtio_device *dev);
 extern void virtionet_close(struct virtio_net *vnet);
 extern int virtionet_read(struct virtio_net *vnet, char *buf, int len);
 extern int virtionet_write(struct virtio_net *vnet, char *buf, int len);
+extern int virtionet_suspend(struct virtio_net *vnet);
+extern int virtionet_resume(struct virtio_net *vnet);
 extern void virtionet_handle_interrupt(struct virtio_net *vnet);
+extern int virtionet_set_tx_mp(struct virtio_net *vnet, int enable);
+extern int virtionet_set_affinity(struct virtio_net *vnet, int cpu);
+extern void virtionet_set_rx_handler(struct virtio_net *vnet,
+				     virtionet_rx_handler_t handler, void *arg);
 extern size_t virtionet_receive_check(struct virtio_net *vnet);
 
 #endif
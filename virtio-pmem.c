@@ -0,0 +1,295 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Driver for the virtio persistent memory device, see the Virtio Spec 1.2
+ * chapter 5.19.
+ *
+ * The device memory is mapped into the guest and is accessed with plain
+ * loads and stores, virtiopmem_get_addr() hands out the mapping. Stores
+ * become persistent once a flush request that was made after them
+ * completes: the host then writes its backing file out. Several flushes
+ * can be in flight, each one covers the stores before it was posted.
+ *
+ * Like the core, the driver is not thread safe.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <helpers.h>
+#include <byteorder.h>
+#include "virtio-pmem.h"
+#include "virtio-internal.h"
+#include "virtio-ring.h"
+
+#define DRIVER_FEATURE_SUPPORT	(VIRTIO_F_VERSION_1 | VIRTIO_PMEM_F_SHMEM_REGION)
+
+/**
+ * @param   pmem  the device
+ * @param   size  receives the size of the mapping
+ * @return  the persistent memory as mapped into the guest
+ */
+void *virtiopmem_get_addr(struct virtio_pmem *pmem, uint64_t *size)
+{
+	if (size)
+		*size = pmem->size;
+	return pmem->addr;
+}
+
+/**
+ * Copy into the persistent memory, the data is only persistent after a
+ * following flush
+ * @return  0, or -EINVAL if the range is outside of the device
+ */
+int virtiopmem_write(struct virtio_pmem *pmem, uint64_t off, const void *buf,
+		     uint64_t len)
+{
+	if (off > pmem->size || len > pmem->size - off)
+		return -EINVAL;
+
+	memcpy(pmem->addr + off, buf, len);
+	return 0;
+}
+
+/**
+ * Copy out of the persistent memory
+ * @return  0, or -EINVAL if the range is outside of the device
+ */
+int virtiopmem_read(struct virtio_pmem *pmem, uint64_t off, void *buf,
+		    uint64_t len)
+{
+	if (off > pmem->size || len > pmem->size - off)
+		return -EINVAL;
+
+	memcpy(buf, pmem->addr + off, len);
+	return 0;
+}
+
+/**
+ * Ask the host to make all stores so far persistent
+ * @param   pmem  the device
+ * @param   c     completed with 0 or -EIO when the host is done
+ * @return  0, -EAGAIN if all flush slots are busy, or -EIO if the request
+ *          could not be mapped for the device
+ */
+int virtiopmem_flush_async(struct virtio_pmem *pmem, struct virtio_completion *c)
+{
+	struct virtio_device *vdev = &pmem->vdev;
+	struct vqs *vq = &vdev->vq[PMEM_VQ_REQUEST];
+	struct virtio_pmem_slot *slot;
+	uint16_t avail_idx;
+	int s, id, err;
+
+	s = virtio_queue_get_slot(vq);
+	if (s < 0)
+		return -EAGAIN;
+	slot = &pmem->slots[s];
+
+	slot->req.type = cpu_to_le32(VIRTIO_PMEM_REQ_TYPE_FLUSH);
+	slot->resp.ret = 0;
+
+	/* Request, response */
+	id = s * 2;
+	__virtio_free_desc(vq, id, vdev->features);
+	__virtio_free_desc(vq, id + 1, vdev->features);
+	err = __virtio_fill_desc(vq, id, vdev->features, (uint64_t) &slot->req,
+				 sizeof(slot->req), VRING_DESC_F_NEXT, id + 1);
+	err |= __virtio_fill_desc(vq, id + 1, vdev->features, (uint64_t) &slot->resp,
+				  sizeof(slot->resp), VRING_DESC_F_WRITE, 0);
+	if (err) {
+		__virtio_free_descs(vq, id, 2, vdev->features);
+		virtio_queue_put_slot(vq, s);
+		return -EIO;
+	}
+
+	virtio_completion_init(c);
+	c->priv = slot;
+	virtio_queue_track(vq, id, c);
+
+	/* The barrier also orders the caller's stores before the request */
+	avail_idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, avail_idx)] = virtio_cpu_to_modern16(vdev, id);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, avail_idx + 1);
+	virtio_stats_posted(vdev, vq, 0);
+
+	__virtio_queue_notify(vdev, PMEM_VQ_REQUEST);
+
+	return 0;
+}
+
+/**
+ * Complete the finished flush requests, to be called from the queue
+ * handler or a polling task.
+ * @return  number of requests completed
+ */
+int virtiopmem_complete(struct virtio_pmem *pmem)
+{
+	struct virtio_device *vdev = &pmem->vdev;
+	struct vqs *vq = &vdev->vq[PMEM_VQ_REQUEST];
+	struct virtio_completion *c;
+	struct virtio_pmem_slot *slot;
+	int n = 0;
+
+	if (!virtio_queue_is_local(vq))
+		return 0;
+
+	/* Using the chain returned the slot already */
+	while ((c = virtio_queue_harvest(vdev, vq))) {
+		slot = c->priv;
+		virtio_complete(c, slot->resp.ret ? -EIO : 0);
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ * Make all stores so far persistent and wait for the host
+ * @return  0, -EIO if the host failed, -ETIMEDOUT if it did not answer
+ */
+int virtiopmem_flush(struct virtio_pmem *pmem)
+{
+	struct vqs *vq = &pmem->vdev.vq[PMEM_VQ_REQUEST];
+	struct virtio_completion c;
+	uint32_t waited = 0;
+	int rc;
+
+	while ((rc = virtiopmem_flush_async(pmem, &c)) == -EAGAIN) {
+		if (waited++ >= VIRTIO_TIMEOUT)
+			return -ETIMEDOUT;
+		virtiopmem_complete(pmem);
+		SLOF_msleep(1);
+	}
+
+	for (;;) {
+		virtiopmem_complete(pmem);
+		if (virtio_completion_is_done(&c))
+			return c.status;
+		if (waited++ >= VIRTIO_TIMEOUT)
+			break;
+		SLOF_msleep(1);
+	}
+
+	/*
+	 * The device may still answer, the slot stays busy until it does.
+	 * Using the chain then gives the slot back.
+	 */
+	virtio_queue_untrack(vq, &c);
+
+	return -ETIMEDOUT;
+}
+
+static void virtiopmem_vq_interrupt(struct virtio_device *dev, struct vqs *vq,
+				    void *arg)
+{
+	virtiopmem_complete(arg);
+}
+
+static int virtiopmem_init(struct virtio_pmem *pmem)
+{
+	struct virtio_device *vdev = &pmem->vdev;
+	struct virtio_shm_region shm;
+	struct vqs *vq;
+	int status = VIRTIO_STAT_ACKNOWLEDGE | VIRTIO_STAT_DRIVER;
+
+	virtio_set_status(vdev, status);
+
+	/* There is no legacy interface for virtio-pmem */
+	if (!virtio_is_modern(vdev) ||
+	    virtio_negotiate_guest_features(vdev, DRIVER_FEATURE_SUPPORT))
+		goto dev_error;
+	virtio_get_status(vdev, &status);
+
+	if (vdev->features & VIRTIO_PMEM_F_SHMEM_REGION) {
+		if (virtio_get_shm_region(vdev, VIRTIO_PMEM_SHMEM_REGION_ID, &shm))
+			goto dev_error;
+		pmem->start = shm.pa;
+		pmem->size = shm.len;
+		pmem->addr = shm.addr;
+	} else {
+		pmem->start = virtio_get_config(vdev,
+			offsetof(struct virtio_pmem_config, start), sizeof(uint64_t));
+		pmem->size = virtio_get_config(vdev,
+			offsetof(struct virtio_pmem_config, size), sizeof(uint64_t));
+		pmem->addr = SLOF_translate_my_address((void *) pmem->start);
+	}
+	if (!pmem->size || !pmem->addr) {
+		printf("virtio-pmem: No memory region!\n");
+		goto dev_error;
+	}
+
+	vq = virtio_queue_init_vq(vdev, PMEM_VQ_REQUEST);
+	if (!vq)
+		goto dev_error;
+
+	if (virtio_queue_set_slots(vdev, PMEM_VQ_REQUEST, PMEM_FLUSHES, 2) ||
+	    virtio_queue_set_completions(vdev, PMEM_VQ_REQUEST, 1))
+		goto dev_error;
+
+	vq->avail->flags = virtio_cpu_to_modern16(vdev, 0);
+	virtio_queue_set_handler(vdev, PMEM_VQ_REQUEST, virtiopmem_vq_interrupt, pmem);
+
+	status |= VIRTIO_STAT_DRIVER_OK;
+	virtio_set_status(vdev, status);
+
+	return 0;
+
+dev_error:
+	status |= VIRTIO_STAT_FAILED;
+	virtio_set_status(vdev, status);
+	return -1;
+}
+
+static void virtiopmem_free(struct virtio_pmem *pmem)
+{
+	struct virtio_device *vdev = &pmem->vdev;
+
+	virtio_queue_term_vq(vdev, &vdev->vq[PMEM_VQ_REQUEST], PMEM_VQ_REQUEST);
+	SLOF_free_mem(pmem, sizeof(*pmem));
+}
+
+struct virtio_pmem *virtiopmem_open(struct virtio_device *dev)
+{
+	struct virtio_pmem *pmem;
+
+	if (!dev)
+		return NULL;
+
+	pmem = SLOF_alloc_mem(sizeof(*pmem));
+	if (!pmem) {
+		printf("Unable to allocate virtio-pmem driver\n");
+		return NULL;
+	}
+	memset(pmem, 0, sizeof(*pmem));
+
+	/* make a copy of the device structure */
+	memcpy(&pmem->vdev, dev, sizeof(struct virtio_device));
+
+	virtio_reset_device(&pmem->vdev);
+	virtio_set_status(&pmem->vdev, VIRTIO_STAT_ACKNOWLEDGE);
+
+	if (virtiopmem_init(pmem)) {
+		virtiopmem_free(pmem);
+		return NULL;
+	}
+
+	return pmem;
+}
+
+void virtiopmem_close(struct virtio_pmem *pmem)
+{
+	if (!pmem)
+		return;
+
+	/* Quiesce and reset device */
+	virtio_set_status(&pmem->vdev, VIRTIO_STAT_FAILED);
+	virtio_reset_device(&pmem->vdev);
+
+	virtiopmem_free(pmem);
+}
@@ -0,0 +1,67 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#ifndef _VIRTIO_PMEM_H
+#define _VIRTIO_PMEM_H
+
+#include <stdint.h>
+#include <byteorder.h>
+#include "virtio.h"
+
+enum {
+	PMEM_VQ_REQUEST = 0,	/* Flush requests */
+};
+
+/* VIRTIO_PMEM Feature bits */
+#define VIRTIO_PMEM_F_SHMEM_REGION	(1 << 0)
+
+/* Shared memory region of the persistent memory, with the feature above */
+#define VIRTIO_PMEM_SHMEM_REGION_ID	0
+
+/* As per VirtIO spec Version 1.2: 5.19.4 Device configuration layout */
+struct virtio_pmem_config {
+	le64 start;
+	le64 size;
+};
+
+#define VIRTIO_PMEM_REQ_TYPE_FLUSH	0
+
+struct virtio_pmem_req {
+	le32 type;
+};
+
+struct virtio_pmem_resp {
+	le32 ret;		/* 0 on success */
+};
+
+/* Driver limits */
+#define PMEM_FLUSHES		8	/* Flush requests in flight */
+
+struct virtio_pmem_slot {
+	struct virtio_pmem_req req;
+	struct virtio_pmem_resp resp;
+};
+
+struct virtio_pmem {
+	struct virtio_device vdev;
+	uint64_t start;		/* Guest physical address of the region */
+	uint64_t size;
+	uint8_t *addr;		/* Where loads and stores go */
+	struct virtio_pmem_slot slots[PMEM_FLUSHES];	/* Per queue slot */
+};
+
+extern struct virtio_pmem *virtiopmem_open(struct virtio_device *dev);
+extern void virtiopmem_close(struct virtio_pmem *pmem);
+extern void *virtiopmem_get_addr(struct virtio_pmem *pmem, uint64_t *size);
+extern int virtiopmem_write(struct virtio_pmem *pmem, uint64_t off,
+			    const void *buf, uint64_t len);
+extern int virtiopmem_read(struct virtio_pmem *pmem, uint64_t off, void *buf,
+			   uint64_t len);
+extern int virtiopmem_flush_async(struct virtio_pmem *pmem,
+				  struct virtio_completion *c);
+extern int virtiopmem_flush(struct virtio_pmem *pmem);
+extern int virtiopmem_complete(struct virtio_pmem *pmem);
+
+#endif /* _VIRTIO_PMEM_H */
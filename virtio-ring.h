@@ -0,0 +1,273 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Inline versions of the per-descriptor virtqueue operations for the driver
+ * hot paths. The out-of-line virtio_fill_desc() & co. in virtio.c wrap these.
+ * Split virtqueue sizes are always a power of 2, so ring positions are
+ * wrapped with a mask instead of a modulo.
+ */
+
+#ifndef _VIRTIO_RING_H
+#define _VIRTIO_RING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <cpu.h>
+#include <cache.h>
+#include <byteorder.h>
+#include "virtio.h"
+#include "helpers.h"
+#include "virtio-internal.h"
+#include "virtio-trace.h"
+#include "virtio-log.h"
+
+#ifdef VIRTIO_USE_MMIO
+#include "virtio_mmio.h"
+#endif
+
+/* Wrap a free running index to a ring position */
+static inline uint32_t vq_wrap(struct vqs *vq, uint32_t idx)
+{
+	return idx & (vq->size - 1);
+}
+
+/*
+ * Fill a descriptor. If the buffer cannot be mapped for the device, the
+ * descriptor is left empty and the chain must not be made available.
+ * @return  0, or -1 if the buffer could not be mapped
+ */
+static inline int __virtio_fill_desc(struct vqs *vq, int id, uint64_t features,
+				     uint64_t addr, uint32_t len,
+				     uint16_t flags, uint16_t next)
+{
+	struct vring_desc *desc;
+	int rc = 0;
+
+	id = vq_wrap(vq, id);
+	desc = &vq->desc[id];
+	next = vq_wrap(vq, next);
+
+	if (virtio_features_modern(features)) {
+		if (features & VIRTIO_F_IOMMU_PLATFORM) {
+			void *gpa = (void *) addr;
+
+			if (!vq->desc_gpas) {
+				virtio_log(VIRTIO_LOG_ERR, VLOG_IOMMU_NO_SETUP, id, 0);
+				addr = 0;
+			} else {
+				addr = SLOF_dma_map_in(gpa, len, 0);
+				vq->desc_gpas[id] = addr ? gpa : NULL;
+			}
+			if (!addr) {
+				len = 0;
+				rc = -1;
+			}
+		}
+		desc->addr = cpu_to_le64(addr);
+		desc->len = cpu_to_le32(len);
+		desc->flags = cpu_to_le16(flags);
+		desc->next = cpu_to_le16(next);
+	} else {
+		desc->addr = addr;
+		desc->len = len;
+		desc->flags = flags;
+		desc->next = next;
+	}
+
+	return rc;
+}
+
+static inline void __virtio_free_desc(struct vqs *vq, int id, uint64_t features)
+{
+	struct vring_desc *desc;
+
+	if (!virtio_features_modern(features) ||
+	    !(features & VIRTIO_F_IOMMU_PLATFORM) || !vq->desc_gpas)
+		return;
+
+	id = vq_wrap(vq, id);
+	desc = &vq->desc[id];
+
+	if (!vq->desc_gpas[id])
+		return;
+
+	SLOF_dma_map_out(le64_to_cpu(desc->addr), 0, le32_to_cpu(desc->len));
+	vq->desc_gpas[id] = NULL;
+}
+
+/* Free the descriptors first .. first + n - 1 of a chain not posted */
+static inline void __virtio_free_descs(struct vqs *vq, int first, int n,
+				       uint64_t features)
+{
+	while (n--)
+		__virtio_free_desc(vq, first++, features);
+}
+
+static inline size_t __virtio_desc_addr(struct virtio_device *vdev, int queue, int id)
+{
+	struct vqs *vq = &vdev->vq[queue];
+
+	if (vq->desc_gpas)
+		return (size_t) vq->desc_gpas[id];
+
+	return (size_t) virtio_modern64_to_cpu(vdev, vq->desc[id].addr);
+}
+
+/*
+ * Statistics updates, see struct virtio_vq_stats. The owner brackets its
+ * writes with a writer count and bumps the sequence count when done.
+ * An update interrupting another one on the same CPU is finished before
+ * the interrupted one goes on, so plain increments of both counts are
+ * safe, and readers retry as long as any of the two is running.
+ * Producers of a multi-producer queue and the interrupt dispatchers use
+ * atomic adds outside of this.
+ */
+static inline void vq_stats_begin(struct vqs *vq)
+{
+	__atomic_store_n(&vq->stats.writers, vq->stats.writers + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void vq_stats_end(struct vqs *vq)
+{
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&vq->stats.seq, vq->stats.seq + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&vq->stats.writers, vq->stats.writers - 1, __ATOMIC_RELEASE);
+}
+
+#define vq_stat_add_atomic(vq, field, n)				\
+	__atomic_fetch_add(&(vq)->stats.field, (n), __ATOMIC_RELAXED)
+
+#define vq_stat_add(vq, field, n) do {					\
+		if ((vq)->mp_ready) {					\
+			vq_stat_add_atomic(vq, field, n);		\
+		} else {						\
+			vq_stats_begin(vq);				\
+			(vq)->stats.field += (n);			\
+			vq_stats_end(vq);				\
+		}							\
+	} while (0)
+
+/*
+ * Account a chain made available to the device, traced as event "type".
+ * "bytes" is the payload for the device to read, what it writes is counted
+ * when the chain is used.
+ */
+static inline void __virtio_stats_posted(struct virtio_device *dev, struct vqs *vq,
+					 uint32_t bytes, uint8_t type)
+{
+	uint16_t inflight = virtio_modern16_to_cpu(dev, vq->avail->idx) -
+			    virtio_modern16_to_cpu(dev, vq->used->idx);
+	uint32_t max;
+
+#ifdef VIRTIO_TRACE
+	uint16_t idx = virtio_modern16_to_cpu(dev, vq->avail->idx) - 1;
+
+	virtio_trace(type, vq - dev->vq,
+		     virtio_modern16_to_cpu(dev, vq->avail->ring[vq_wrap(vq, idx)]),
+		     bytes);
+#endif
+
+	if (vq->mp_ready) {
+		vq_stat_add_atomic(vq, posted, 1);
+		vq_stat_add_atomic(vq, bytes, bytes);
+		max = __atomic_load_n(&vq->stats.max_inflight, __ATOMIC_RELAXED);
+		while (inflight > max &&
+		       !__atomic_compare_exchange_n(&vq->stats.max_inflight, &max,
+						    inflight, 1, __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED))
+			;
+		return;
+	}
+
+	vq_stats_begin(vq);
+	vq->stats.posted++;
+	vq->stats.bytes += bytes;
+	if (inflight > vq->stats.max_inflight)
+		vq->stats.max_inflight = inflight;
+	vq_stats_end(vq);
+}
+
+static inline void virtio_stats_posted(struct virtio_device *dev, struct vqs *vq,
+				       uint32_t bytes)
+{
+	__virtio_stats_posted(dev, vq, bytes, VT_ADD);
+}
+
+/* Attach a completion to a chain, before the chain is made available */
+static inline void virtio_queue_track(struct vqs *vq, int head,
+				      struct virtio_completion *c)
+{
+	vq->tokens[vq_wrap(vq, head)] = c;
+}
+
+/* Return a request slot, see virtio_queue_set_slots() */
+static inline void virtio_queue_put_slot(struct vqs *vq, int slot)
+{
+	vq->slot_next[slot] = vq->slot_free;
+	vq->slot_free = slot;
+}
+
+/* Whether the calling CPU is the one servicing the queue */
+static inline int virtio_queue_is_local(struct vqs *vq)
+{
+	return vq->cpu == VIRTIO_CPU_ANY || vq->cpu == SLOF_get_cpu();
+}
+
+/* Whether the device has used buffers the driver did not consume yet */
+static inline int virtio_used_pending(struct virtio_device *dev, struct vqs *vq)
+{
+	return vq->last_used_idx != virtio_modern16_to_cpu(dev, vq->used->idx);
+}
+
+/*
+ * Value written to the notification register. With VIRTIO_F_NOTIFICATION_DATA
+ * the kick also carries the next "avail" index, so the device does not need
+ * to fetch it from the ring. Only split rings are used here, so there is no
+ * wrap counter and the whole 16-bit index is passed.
+ */
+static inline uint32_t virtio_notify_data(struct virtio_device *dev, int queue)
+{
+	uint32_t data = queue;
+
+	if (dev->features & VIRTIO_F_NOTIFICATION_DATA)
+		data |= (uint32_t) virtio_modern16_to_cpu(dev,
+					dev->vq[queue].avail->idx) << 16;
+
+	return data;
+}
+
+static inline void __virtio_queue_notify(struct virtio_device *dev, int queue)
+{
+	struct vqs *vq = &dev->vq[queue];
+
+	/* Let the new avail index be visible before checking the used flags */
+	sync();
+	if (!(dev->features & VIRTIO_F_RING_EVENT_IDX) &&
+	    (virtio_modern16_to_cpu(dev, vq->used->flags) & VRING_USED_F_NO_NOTIFY)) {
+		vq_stat_add(vq, kicks_suppressed, 1);
+		virtio_trace(VT_KICK, queue,
+			     virtio_modern16_to_cpu(dev, vq->avail->idx), 1);
+		return;
+	}
+	vq_stat_add(vq, kicks, 1);
+	virtio_trace(VT_KICK, queue, virtio_modern16_to_cpu(dev, vq->avail->idx), 0);
+
+#ifdef VIRTIO_USE_PCI
+	void *addr = vq->notify_addr;
+
+	if (dev->features & VIRTIO_F_NOTIFICATION_DATA)
+		ci_write_32(addr, cpu_to_le32(virtio_notify_data(dev, queue)));
+	else
+		ci_write_16(addr, cpu_to_le16(queue));
+#elif VIRTIO_USE_MMIO
+	virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_QUEUE_NOTIFY,
+			    virtio_notify_data(dev, queue));
+#endif
+}
+
+#endif /* _VIRTIO_RING_H */
@@ -0,0 +1,226 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Driver for the virtio entropy device, see the Virtio Spec 1.2 chapter 5.4.
+ *
+ * All request buffers are posted at open time, so the device fills the pool
+ * before anybody asks. A read copies from buffers the device already
+ * completed and reposts each buffer as soon as it is used up, which keeps
+ * the device refilling in the background; a caller only waits for the
+ * device when the pool runs dry. Bytes handed out are cleared from the
+ * pool so they do not linger in memory.
+ *
+ * Like the core, the driver is not thread safe.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <helpers.h>
+#include "virtio-rng.h"
+#include "virtio-internal.h"
+#include "virtio-ring.h"
+
+#define DRIVER_FEATURE_SUPPORT	(VIRTIO_F_VERSION_1)
+
+/* Give a used up buffer back to the device */
+static void virtiorng_post(struct virtio_rng *rng, int id)
+{
+	struct virtio_device *vdev = &rng->vdev;
+	struct vqs *vq = &vdev->vq[RNG_VQ_REQUEST];
+	uint16_t idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, id);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	__virtio_stats_posted(vdev, vq, 0, VT_REFILL);
+}
+
+/**
+ * @return  number of random bytes a read can return without waiting
+ */
+uint32_t virtiorng_available(struct virtio_rng *rng)
+{
+	struct virtio_device *vdev = &rng->vdev;
+	struct vqs *vq = &vdev->vq[RNG_VQ_REQUEST];
+	uint32_t avail = 0;
+
+	if (rng->cur >= 0)
+		avail = rng->len - rng->off;
+
+	return avail + virtio_used_bytes(vdev, vq, RNG_BUF_SIZE);
+}
+
+/**
+ * Get random bytes from the pool
+ * @param   rng         the device
+ * @param   buf         buffer for the bytes
+ * @param   len         number of bytes wanted
+ * @param   timeout_ms  how long to wait for the device when the pool is
+ *                      empty, 0 to return what is there
+ * @return  number of bytes read, -ETIMEDOUT if none arrived in time
+ */
+int virtiorng_read(struct virtio_rng *rng, void *buf, uint32_t len,
+		   uint32_t timeout_ms)
+{
+	struct virtio_device *vdev = &rng->vdev;
+	struct vqs *vq = &vdev->vq[RNG_VQ_REQUEST];
+	uint8_t *src;
+	uint32_t n, total = 0;
+	int id, posted = 0;
+
+	while (total < len) {
+		if (rng->cur < 0) {
+			id = virtio_get_used(vdev, vq, &n);
+			if (id < 0) {
+				if (!timeout_ms)
+					break;
+				/* Let the device work on what we reposted */
+				if (posted) {
+					__virtio_queue_notify(vdev, RNG_VQ_REQUEST);
+					posted = 0;
+				}
+				timeout_ms--;
+				SLOF_msleep(1);
+				continue;
+			}
+			rng->cur = vq_wrap(vq, id);
+			rng->off = 0;
+			rng->len = n < RNG_BUF_SIZE ? n : RNG_BUF_SIZE;
+		}
+
+		n = rng->len - rng->off;
+		if (n > len - total)
+			n = len - total;
+		src = rng->mem + rng->cur * RNG_BUF_SIZE + rng->off;
+		memcpy((uint8_t *) buf + total, src, n);
+		memset(src, 0, n);
+		rng->off += n;
+		total += n;
+
+		if (rng->off == rng->len) {
+			virtiorng_post(rng, rng->cur);
+			rng->cur = -1;
+			posted = 1;
+		}
+	}
+	if (posted)
+		__virtio_queue_notify(vdev, RNG_VQ_REQUEST);
+
+	if (!total && len && timeout_ms)
+		return -ETIMEDOUT;
+
+	return total;
+}
+
+static int virtiorng_init(struct virtio_rng *rng)
+{
+	struct virtio_device *vdev = &rng->vdev;
+	struct vqs *vq;
+	int status = VIRTIO_STAT_ACKNOWLEDGE | VIRTIO_STAT_DRIVER;
+	int i;
+
+	virtio_set_status(vdev, status);
+
+	if (virtio_is_modern(vdev)) {
+		if (virtio_negotiate_guest_features(vdev, DRIVER_FEATURE_SUPPORT))
+			goto dev_error;
+		virtio_get_status(vdev, &status);
+	} else {
+		virtio_set_guest_features(vdev, 0);
+	}
+
+	vq = virtio_queue_init_vq(vdev, RNG_VQ_REQUEST);
+	if (!vq)
+		goto dev_error;
+
+	rng->cur = -1;
+	rng->bufs = vq->size < RNG_BUFS ? vq->size : RNG_BUFS;
+	rng->mem = SLOF_alloc_mem_aligned(rng->bufs * RNG_BUF_SIZE, 8, NULL);
+	if (!rng->mem) {
+		printf("virtio-rng: Failed to allocate buffers!\n");
+		goto dev_error;
+	}
+
+	/* Every buffer is a request, all of them go out at once */
+	for (i = 0; i < rng->bufs; i++) {
+		if (virtio_fill_desc(vq, i, vdev->features,
+				     (uint64_t) (rng->mem + i * RNG_BUF_SIZE),
+				     RNG_BUF_SIZE, VRING_DESC_F_WRITE, 0))
+			goto dev_error;
+		vq->avail->ring[i] = virtio_cpu_to_modern16(vdev, i);
+	}
+	sync();
+
+	vq->avail->flags = virtio_cpu_to_modern16(vdev, VRING_AVAIL_F_NO_INTERRUPT);
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, rng->bufs);
+
+	status |= VIRTIO_STAT_DRIVER_OK;
+	virtio_set_status(vdev, status);
+
+	virtio_queue_notify(vdev, RNG_VQ_REQUEST);
+
+	return 0;
+
+dev_error:
+	status |= VIRTIO_STAT_FAILED;
+	virtio_set_status(vdev, status);
+	return -1;
+}
+
+static void virtiorng_free(struct virtio_rng *rng)
+{
+	struct virtio_device *vdev = &rng->vdev;
+
+	if (rng->mem) {
+		memset(rng->mem, 0, rng->bufs * RNG_BUF_SIZE);
+		SLOF_free_mem_aligned(rng->mem);
+	}
+
+	virtio_queue_term_vq(vdev, &vdev->vq[RNG_VQ_REQUEST], RNG_VQ_REQUEST);
+	SLOF_free_mem(rng, sizeof(*rng));
+}
+
+struct virtio_rng *virtiorng_open(struct virtio_device *dev)
+{
+	struct virtio_rng *rng;
+
+	if (!dev)
+		return NULL;
+
+	rng = SLOF_alloc_mem(sizeof(*rng));
+	if (!rng) {
+		printf("Unable to allocate virtio-rng driver\n");
+		return NULL;
+	}
+	memset(rng, 0, sizeof(*rng));
+
+	/* make a copy of the device structure */
+	memcpy(&rng->vdev, dev, sizeof(struct virtio_device));
+
+	virtio_reset_device(&rng->vdev);
+	virtio_set_status(&rng->vdev, VIRTIO_STAT_ACKNOWLEDGE);
+
+	if (virtiorng_init(rng)) {
+		virtiorng_free(rng);
+		return NULL;
+	}
+
+	return rng;
+}
+
+void virtiorng_close(struct virtio_rng *rng)
+{
+	if (!rng)
+		return;
+
+	/* Quiesce and reset device */
+	virtio_set_status(&rng->vdev, VIRTIO_STAT_FAILED);
+	virtio_reset_device(&rng->vdev);
+
+	virtiorng_free(rng);
+}
@@ -0,0 +1,35 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#ifndef _VIRTIO_RNG_H
+#define _VIRTIO_RNG_H
+
+#include <stdint.h>
+#include "virtio.h"
+
+enum {
+	RNG_VQ_REQUEST = 0,	/* The only queue */
+};
+
+/* Driver limits, the pool holds RNG_BUFS * RNG_BUF_SIZE bytes */
+#define RNG_BUFS		8
+#define RNG_BUF_SIZE		1024
+
+struct virtio_rng {
+	struct virtio_device vdev;
+	uint16_t bufs;
+	int16_t cur;		/* Buffer being consumed, -1 if none */
+	uint32_t off;
+	uint32_t len;
+	uint8_t *mem;
+};
+
+extern struct virtio_rng *virtiorng_open(struct virtio_device *dev);
+extern void virtiorng_close(struct virtio_rng *rng);
+extern uint32_t virtiorng_available(struct virtio_rng *rng);
+extern int virtiorng_read(struct virtio_rng *rng, void *buf, uint32_t len,
+			  uint32_t timeout_ms);
+
+#endif /* _VIRTIO_RNG_H */
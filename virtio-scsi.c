@@ -0,0 +1,654 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Driver for the virtio SCSI host bus adapter, see the Virtio Spec 1.2
+ * chapter 5.6.
+ *
+ * Every request queue has a pool of command slots, one per three
+ * descriptors, see virtio_queue_set_slots(). A slot carries its own tag,
+ * so commands to any LUN complete in whatever order the targets finish
+ * them (simple task attribute, i.e. tagged command queueing). A CPU
+ * submits to request queue cpu % nr_queues. With a queue per CPU and an
+ * MSI-X vector per queue, pin queue n to CPU n with
+ * virtio_queue_set_affinity() so its interrupt and completions stay
+ * there; CPUs sharing a queue must serialize their calls. Block transfers
+ * use the asynchronous interface of virtio-blk:
+ * virtioscsi_transfer_async() queues and virtioscsi_complete() delivers
+ * the completions.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <helpers.h>
+#include "virtio-scsi.h"
+#include "virtio-blk.h"
+#include "virtio-internal.h"
+#include "virtio-ring.h"
+
+#define DRIVER_FEATURE_SUPPORT	(VIRTIO_F_VERSION_1)
+
+#define DEFAULT_SECTOR_SIZE	512
+
+/* SCSI status and sense keys */
+#define SAM_STAT_GOOD			0x00
+#define SAM_STAT_CHECK_CONDITION	0x02
+#define SAM_STAT_BUSY			0x08
+#define SAM_STAT_TASK_SET_FULL		0x28
+#define SENSE_NOT_READY			0x02
+#define SENSE_UNIT_ATTENTION		0x06
+
+/* Command retries while a LUN reports a unit attention */
+#define SCSI_OPEN_RETRIES	3
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* Turn the outcome of a command into 0 or a negative error code */
+static int virtioscsi_status(struct virtio_scsi_cmd_resp *resp)
+{
+	uint8_t key;
+
+	switch (resp->response) {
+	case VIRTIO_SCSI_S_OK:
+		break;
+	case VIRTIO_SCSI_S_BAD_TARGET:
+	case VIRTIO_SCSI_S_INCORRECT_LUN:
+		return -ENODEV;
+	case VIRTIO_SCSI_S_BUSY:
+	case VIRTIO_SCSI_S_RESET:
+		return -EAGAIN;
+	default:
+		return -EIO;
+	}
+
+	switch (resp->status) {
+	case SAM_STAT_GOOD:
+		return 0;
+	case SAM_STAT_BUSY:
+	case SAM_STAT_TASK_SET_FULL:
+		return -EAGAIN;
+	case SAM_STAT_CHECK_CONDITION:
+		/* Fixed or descriptor format sense data */
+		if ((resp->sense[0] & 0x7e) == 0x72)
+			key = resp->sense[1] & 0xf;
+		else
+			key = resp->sense[2] & 0xf;
+		if (key == SENSE_UNIT_ATTENTION || key == SENSE_NOT_READY)
+			return -EAGAIN;
+		return -EIO;
+	default:
+		return -EIO;
+	}
+}
+
+/**
+ * Queue a SCSI command which completes through "c", see
+ * virtioscsi_complete()
+ * @param   lun      logical unit
+ * @param   cdb      command descriptor block
+ * @param   cdb_len  its length, at most VIRTIO_SCSI_CDB_SIZE
+ * @param   buf      data buffer, NULL if the command transfers no data
+ * @param   len      length of the data
+ * @param   write    whether the data goes to the device
+ * @param   c        completion, its status is 0 or a negative error code
+ * @return  0 if the command was queued, -EAGAIN if the queue or the LUN
+ *          have too many commands in flight, -EINVAL if the CDB is too long,
+ *          -EIO if a buffer could not be mapped for the device
+ */
+int virtioscsi_command(struct virtio_scsi_lun *lun, const uint8_t *cdb,
+		       int cdb_len, void *buf, uint32_t len, int write,
+		       struct virtio_completion *c)
+{
+	struct virtio_scsi *scsi = lun->scsi;
+	struct virtio_device *vdev = &scsi->vdev;
+	uint32_t q = SLOF_get_cpu() % scsi->nr_queues;
+	struct virtio_scsi_rq *rq = &scsi->rq[q];
+	struct vqs *vq = &vdev->vq[SCSI_VQ_REQUEST + q];
+	struct virtio_scsi_slot *slot;
+	uint16_t avail_idx;
+	int s, id, err;
+
+	if (cdb_len > VIRTIO_SCSI_CDB_SIZE)
+		return -EINVAL;
+
+	if (lun->inflight >= scsi->cmd_per_lun) {
+		vq_stat_add(vq, ring_full, 1);
+		return -EAGAIN;
+	}
+	s = virtio_queue_get_slot(vq);
+	if (s < 0)
+		return -EAGAIN;
+	slot = &rq->slots[s];
+
+	memcpy(slot->req.lun, lun->addr, sizeof(slot->req.lun));
+	slot->req.tag = virtio_cpu_to_modern64(vdev, (uint64_t) q << 16 | s);
+	slot->req.task_attr = VIRTIO_SCSI_S_SIMPLE;
+	slot->req.prio = 0;
+	slot->req.crn = 0;
+	memset(slot->req.cdb, 0, sizeof(slot->req.cdb));
+	memcpy(slot->req.cdb, cdb, cdb_len);
+	slot->lun = lun;
+
+	/* Request, data-out, response, data-in */
+	id = s * 3;
+	__virtio_free_desc(vq, id, vdev->features);
+	__virtio_free_desc(vq, id + 1, vdev->features);
+	__virtio_free_desc(vq, id + 2, vdev->features);
+	err = __virtio_fill_desc(vq, id, vdev->features, (uint64_t) &slot->req,
+				 sizeof(slot->req), VRING_DESC_F_NEXT, id + 1);
+	if (len && write) {
+		err |= __virtio_fill_desc(vq, id + 1, vdev->features, (uint64_t) buf,
+					  len, VRING_DESC_F_NEXT, id + 2);
+		err |= __virtio_fill_desc(vq, id + 2, vdev->features,
+					  (uint64_t) &slot->resp, sizeof(slot->resp),
+					  VRING_DESC_F_WRITE, 0);
+	} else if (len) {
+		err |= __virtio_fill_desc(vq, id + 1, vdev->features,
+					  (uint64_t) &slot->resp, sizeof(slot->resp),
+					  VRING_DESC_F_WRITE | VRING_DESC_F_NEXT, id + 2);
+		err |= __virtio_fill_desc(vq, id + 2, vdev->features, (uint64_t) buf,
+					  len, VRING_DESC_F_WRITE, 0);
+	} else {
+		err |= __virtio_fill_desc(vq, id + 1, vdev->features,
+					  (uint64_t) &slot->resp, sizeof(slot->resp),
+					  VRING_DESC_F_WRITE, 0);
+	}
+
+	/* The device could not reach a buffer, do not post the chain */
+	if (err) {
+		__virtio_free_descs(vq, id, 3, vdev->features);
+		virtio_queue_put_slot(vq, s);
+		return -EIO;
+	}
+
+	virtio_completion_init(c);
+	c->priv = slot;
+	virtio_queue_track(vq, id, c);
+	lun->inflight++;
+
+	avail_idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, avail_idx)] = virtio_cpu_to_modern16(vdev, id);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, avail_idx + 1);
+	virtio_stats_posted(vdev, vq, write ? len : 0);
+
+	__virtio_queue_notify(vdev, SCSI_VQ_REQUEST + q);
+
+	return 0;
+}
+
+static void virtioscsi_post_event(struct virtio_scsi *scsi, int id)
+{
+	struct virtio_device *vdev = &scsi->vdev;
+	struct vqs *vq = &vdev->vq[SCSI_VQ_EVENT];
+	uint16_t idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, id);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+}
+
+static void virtioscsi_events(struct virtio_scsi *scsi)
+{
+	struct virtio_device *vdev = &scsi->vdev;
+	struct vqs *vq = &vdev->vq[SCSI_VQ_EVENT];
+	uint32_t len, event;
+	int id, n = 0;
+
+	while ((id = virtio_get_used(vdev, vq, &len)) >= 0) {
+		id = vq_wrap(vq, id);
+		event = virtio_modern32_to_cpu(vdev, scsi->event[id].event);
+		/* LUNs come and go or change capacity, they need a rescan */
+		if (event & VIRTIO_SCSI_T_EVENTS_MISSED ||
+		    event == VIRTIO_SCSI_T_TRANSPORT_RESET ||
+		    event == VIRTIO_SCSI_T_PARAM_CHANGE)
+			scsi->rescan = 1;
+		virtioscsi_post_event(scsi, id);
+		n++;
+	}
+	if (n)
+		__virtio_queue_notify(vdev, SCSI_VQ_EVENT);
+}
+
+/**
+ * Complete the finished commands of the request queues serviced by the
+ * calling CPU and process device events, to be called from the queue
+ * handler or a polling task.
+ * @return  number of commands completed
+ */
+int virtioscsi_complete(struct virtio_scsi *scsi)
+{
+	struct virtio_device *vdev = &scsi->vdev;
+	struct virtio_completion *c;
+	struct virtio_scsi_slot *slot;
+	struct vqs *vq;
+	uint32_t q;
+	int n = 0;
+
+	for (q = 0; q < scsi->nr_queues; q++) {
+		vq = &vdev->vq[SCSI_VQ_REQUEST + q];
+		if (!virtio_queue_is_local(vq))
+			continue;
+
+		/* Using the chain returned the slot already */
+		while ((c = virtio_queue_harvest(vdev, vq))) {
+			slot = c->priv;
+			slot->lun->inflight--;
+			virtio_complete(c, virtioscsi_status(&slot->resp));
+			n++;
+		}
+	}
+
+	if (virtio_queue_is_local(&vdev->vq[SCSI_VQ_EVENT]))
+		virtioscsi_events(scsi);
+
+	return n;
+}
+
+/* Wait for a command of this CPU, give up on it if the device hangs */
+static int virtioscsi_wait(struct virtio_scsi *scsi, struct virtio_completion *c)
+{
+	struct virtio_device *vdev = &scsi->vdev;
+	struct virtio_scsi_slot *slot;
+	uint32_t waited = 0, q;
+
+	for (;;) {
+		virtioscsi_complete(scsi);
+		if (virtio_completion_is_done(c))
+			return c->status;
+		if (waited++ >= VIRTIO_TIMEOUT)
+			break;
+		SLOF_msleep(1);
+	}
+
+	/*
+	 * The LUN gets its share back. The slot stays with the device until
+	 * it uses the chain, which puts the slot back on the free list.
+	 */
+	slot = c->priv;
+	slot->lun->inflight--;
+	slot->lun = NULL;
+	for (q = 0; q < scsi->nr_queues; q++)
+		if (virtio_queue_untrack(&vdev->vq[SCSI_VQ_REQUEST + q], c) >= 0)
+			break;
+
+	return -ETIMEDOUT;
+}
+
+static int virtioscsi_build_rw(struct virtio_scsi_lun *lun, uint8_t *cdb,
+			       uint64_t blocknum, long cnt, unsigned int type)
+{
+	memset(cdb, 0, 16);
+
+	if (type == VIRTIO_BLK_T_FLUSH) {
+		cdb[0] = 0x35;		/* SYNCHRONIZE CACHE (10) */
+		return 10;
+	}
+
+	if (blocknum + cnt <= 0xffffffffULL && cnt <= 0xffff) {
+		cdb[0] = (type & 1) ? 0x2a : 0x28;	/* WRITE / READ (10) */
+		put_be32(&cdb[2], blocknum);
+		cdb[7] = cnt >> 8;
+		cdb[8] = cnt;
+		return 10;
+	}
+
+	cdb[0] = (type & 1) ? 0x8a : 0x88;	/* WRITE / READ (16) */
+	put_be32(&cdb[2], blocknum >> 32);
+	put_be32(&cdb[6], blocknum);
+	put_be32(&cdb[10], cnt);
+	return 16;
+}
+
+/**
+ * Queue a block transfer which completes through "c", like
+ * virtioblk_transfer_async(). Completions are delivered by
+ * virtioscsi_complete().
+ * @param   lun       logical unit
+ * @param   buf       data buffer
+ * @param   blocknum  first block
+ * @param   cnt       number of blocks
+ * @param   type      VIRTIO_BLK_T_IN, VIRTIO_BLK_T_OUT or VIRTIO_BLK_T_FLUSH
+ * @param   c         completion
+ * @return  0 if the request was queued, -EAGAIN if too many requests are in
+ *          flight, another negative error code if the request is invalid
+ */
+int virtioscsi_transfer_async(struct virtio_scsi_lun *lun, char *buf,
+			      uint64_t blocknum, long cnt, unsigned int type,
+			      struct virtio_completion *c)
+{
+	uint8_t cdb[16];
+	int cdb_len;
+
+	if (type == VIRTIO_BLK_T_FLUSH) {
+		cnt = 0;
+	} else if (blocknum + cnt > lun->blocks) {
+		virtio_log(VIRTIO_LOG_ERR, VLOG_SCSI_BEYOND_END, blocknum, cnt);
+		return -EINVAL;
+	} else if (cnt * lun->blk_size / DEFAULT_SECTOR_SIZE > lun->scsi->max_sectors) {
+		return -EINVAL;
+	}
+
+	cdb_len = virtioscsi_build_rw(lun, cdb, blocknum, cnt, type);
+
+	return virtioscsi_command(lun, cdb, cdb_len, cnt ? buf : NULL,
+				  cnt * lun->blk_size, type & 1, c);
+}
+
+/**
+ * Read / write blocks and wait for the result
+ * @return  0 on success, a negative error code otherwise
+ */
+int virtioscsi_transfer(struct virtio_scsi_lun *lun, char *buf,
+			uint64_t blocknum, long cnt, unsigned int type)
+{
+	struct virtio_completion c;
+	int rc;
+
+	rc = virtioscsi_transfer_async(lun, buf, blocknum, cnt, type, &c);
+	if (rc)
+		return rc;
+
+	return virtioscsi_wait(lun->scsi, &c);
+}
+
+/* Run a command without data-out and wait for it, retrying unit attentions */
+static int virtioscsi_command_sync(struct virtio_scsi_lun *lun,
+				   const uint8_t *cdb, int cdb_len,
+				   void *buf, uint32_t len)
+{
+	struct virtio_completion c;
+	int rc, tries = SCSI_OPEN_RETRIES;
+
+	do {
+		rc = virtioscsi_command(lun, cdb, cdb_len, buf, len, 0, &c);
+		if (!rc)
+			rc = virtioscsi_wait(lun->scsi, &c);
+	} while (rc == -EAGAIN && --tries);
+
+	return rc;
+}
+
+/**
+ * Look up a logical unit and read its capacity
+ * @param   scsi    the adapter
+ * @param   target  target number, at most max_target
+ * @param   lun     LUN number, below 16384
+ * @param   l       filled in on success
+ * @return  0 on success, -ENODEV if there is no such LUN, another negative
+ *          error code if it does not respond
+ */
+int virtioscsi_open_lun(struct virtio_scsi *scsi, uint16_t target,
+			uint32_t lun, struct virtio_scsi_lun *l)
+{
+	static const uint8_t tur[6] = { 0x00 };			/* TEST UNIT READY */
+	static const uint8_t cap10[10] = { 0x25 };		/* READ CAPACITY (10) */
+	static const uint8_t cap16[16] = { 0x9e, 0x10, [13] = 32 }; /* (16) */
+	uint8_t *cap = scsi->scratch;
+	int rc;
+
+	if (target > scsi->max_target || lun > scsi->max_lun || lun >= 16384)
+		return -ENODEV;
+
+	memset(l, 0, sizeof(*l));
+	l->scsi = scsi;
+	l->addr[0] = 1;
+	l->addr[1] = target;
+	l->addr[2] = 0x40 | lun >> 8;
+	l->addr[3] = lun;
+
+	rc = virtioscsi_command_sync(l, tur, sizeof(tur), NULL, 0);
+	if (rc)
+		return rc;
+
+	rc = virtioscsi_command_sync(l, cap10, sizeof(cap10), cap, 8);
+	if (rc)
+		return rc;
+	l->blocks = (uint64_t) get_be32(cap) + 1;
+	l->blk_size = get_be32(cap + 4);
+
+	if (l->blocks == 0x100000000ULL) {
+		rc = virtioscsi_command_sync(l, cap16, sizeof(cap16), cap, 32);
+		if (rc)
+			return rc;
+		l->blocks = ((uint64_t) get_be32(cap) << 32 | get_be32(cap + 4)) + 1;
+		l->blk_size = get_be32(cap + 8);
+	}
+
+	if (!l->blk_size || l->blk_size % DEFAULT_SECTOR_SIZE) {
+		virtio_log(VIRTIO_LOG_ERR, VLOG_BLK_UNALIGNED, l->blk_size,
+			   DEFAULT_SECTOR_SIZE);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * Reset a logical unit, which aborts its commands in flight. They complete
+ * with an error afterwards.
+ * @return  0 on success, -ETIMEDOUT if the device does not answer, -EIO if
+ *          it refuses
+ */
+int virtioscsi_reset_lun(struct virtio_scsi_lun *lun)
+{
+	struct virtio_scsi *scsi = lun->scsi;
+	struct virtio_device *vdev = &scsi->vdev;
+	struct vqs *vq = &vdev->vq[SCSI_VQ_CTRL];
+	uint32_t len, waited = 0;
+	uint16_t avail_idx;
+
+	scsi->tmf_req.type = virtio_cpu_to_modern32(vdev, VIRTIO_SCSI_T_TMF);
+	scsi->tmf_req.subtype = virtio_cpu_to_modern32(vdev,
+					VIRTIO_SCSI_T_TMF_LOGICAL_UNIT_RESET);
+	memcpy(scsi->tmf_req.lun, lun->addr, sizeof(lun->addr));
+	scsi->tmf_req.tag = 0;
+	scsi->tmf_resp.response = 0xff;
+
+	virtio_free_desc(vq, 0, vdev->features);
+	virtio_free_desc(vq, 1, vdev->features);
+	if (virtio_fill_desc(vq, 0, vdev->features, (uint64_t) &scsi->tmf_req,
+			     sizeof(scsi->tmf_req), VRING_DESC_F_NEXT, 1) ||
+	    virtio_fill_desc(vq, 1, vdev->features, (uint64_t) &scsi->tmf_resp,
+			     sizeof(scsi->tmf_resp), VRING_DESC_F_WRITE, 0)) {
+		virtio_free_desc(vq, 0, vdev->features);
+		return -EIO;
+	}
+
+	avail_idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, avail_idx)] = virtio_cpu_to_modern16(vdev, 0);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, avail_idx + 1);
+	virtio_queue_notify(vdev, SCSI_VQ_CTRL);
+
+	while (virtio_get_used(vdev, vq, &len) < 0) {
+		if (waited++ >= VIRTIO_TIMEOUT)
+			return -ETIMEDOUT;
+		SLOF_msleep(1);
+	}
+
+	if (scsi->tmf_resp.response != VIRTIO_SCSI_S_OK &&
+	    scsi->tmf_resp.response != VIRTIO_SCSI_S_FUNCTION_SUCCEEDED)
+		return -EIO;
+
+	return 0;
+}
+
+static void virtioscsi_vq_interrupt(struct virtio_device *dev, struct vqs *vq,
+				    void *arg)
+{
+	virtioscsi_complete(arg);
+}
+
+static int virtioscsi_init_rq(struct virtio_scsi *scsi, uint32_t q)
+{
+	struct virtio_device *vdev = &scsi->vdev;
+	struct virtio_scsi_rq *rq = &scsi->rq[q];
+	struct vqs *vq;
+
+	vq = virtio_queue_init_vq(vdev, SCSI_VQ_REQUEST + q);
+	if (!vq)
+		return -1;
+
+	rq->nr_slots = vq->size / 3;
+	rq->slots = SLOF_alloc_mem_aligned(rq->nr_slots * sizeof(rq->slots[0]), 8, NULL);
+	if (!rq->slots) {
+		printf("virtio-scsi: Failed to allocate command slots!\n");
+		return -1;
+	}
+
+	if (virtio_queue_set_slots(vdev, SCSI_VQ_REQUEST + q, rq->nr_slots, 3) ||
+	    virtio_queue_set_completions(vdev, SCSI_VQ_REQUEST + q, 1))
+		return -1;
+
+	vq->avail->flags = virtio_cpu_to_modern16(vdev, 0);
+	virtio_queue_set_handler(vdev, SCSI_VQ_REQUEST + q, virtioscsi_vq_interrupt, scsi);
+
+	return 0;
+}
+
+static int virtioscsi_init(struct virtio_scsi *scsi)
+{
+	struct virtio_device *vdev = &scsi->vdev;
+	struct vqs *vq_ctrl, *vq_ev;
+	int status = VIRTIO_STAT_ACKNOWLEDGE | VIRTIO_STAT_DRIVER;
+	uint32_t i;
+
+	virtio_set_status(vdev, status);
+
+	if (virtio_is_modern(vdev)) {
+		/* Protection information changes the request layout */
+		if (virtio_negotiate_guest_features_mask(vdev, DRIVER_FEATURE_SUPPORT,
+							 VIRTIO_SCSI_F_T10_PI))
+			goto dev_error;
+		virtio_get_status(vdev, &status);
+	} else {
+		virtio_set_guest_features(vdev, virtio_get_host_features(vdev) &
+					  (VIRTIO_SCSI_F_HOTPLUG | VIRTIO_SCSI_F_CHANGE));
+	}
+
+#define SCSI_CFG(field) virtio_get_config(vdev,				\
+		offsetof(struct virtio_scsi_config, field),		\
+		sizeof(((struct virtio_scsi_config *) 0)->field))
+	scsi->nr_queues = SCSI_CFG(num_queues);
+	scsi->max_sectors = SCSI_CFG(max_sectors);
+	scsi->cmd_per_lun = SCSI_CFG(cmd_per_lun);
+	scsi->max_target = SCSI_CFG(max_target);
+	scsi->max_lun = SCSI_CFG(max_lun);
+#undef SCSI_CFG
+
+	if (!scsi->nr_queues)
+		scsi->nr_queues = 1;
+	if (scsi->nr_queues > SCSI_MAX_REQ_QUEUES)
+		scsi->nr_queues = SCSI_MAX_REQ_QUEUES;
+	if (!scsi->cmd_per_lun)
+		scsi->cmd_per_lun = ~0U;
+
+	vq_ctrl = virtio_queue_init_vq(vdev, SCSI_VQ_CTRL);
+	vq_ev = virtio_queue_init_vq(vdev, SCSI_VQ_EVENT);
+	if (!vq_ctrl || !vq_ev)
+		goto dev_error;
+
+	for (i = 0; i < scsi->nr_queues; i++)
+		if (virtioscsi_init_rq(scsi, i))
+			goto dev_error;
+
+	for (i = 0; i < SCSI_EVENTS && i < vq_ev->size; i++) {
+		if (virtio_fill_desc(vq_ev, i, vdev->features, (uint64_t) &scsi->event[i],
+				     sizeof(scsi->event[i]), VRING_DESC_F_WRITE, 0))
+			goto dev_error;
+		vq_ev->avail->ring[i] = virtio_cpu_to_modern16(vdev, i);
+	}
+	sync();
+
+	vq_ev->avail->flags = virtio_cpu_to_modern16(vdev, 0);
+	vq_ev->avail->idx = virtio_cpu_to_modern16(vdev, i);
+	vq_ctrl->avail->flags = virtio_cpu_to_modern16(vdev, VRING_AVAIL_F_NO_INTERRUPT);
+
+	virtio_queue_set_handler(vdev, SCSI_VQ_EVENT, virtioscsi_vq_interrupt, scsi);
+
+	status |= VIRTIO_STAT_DRIVER_OK;
+	virtio_set_status(vdev, status);
+
+	virtio_queue_notify(vdev, SCSI_VQ_EVENT);
+
+	return 0;
+
+dev_error:
+	status |= VIRTIO_STAT_FAILED;
+	virtio_set_status(vdev, status);
+	return -1;
+}
+
+static void virtioscsi_free(struct virtio_scsi *scsi)
+{
+	struct virtio_device *vdev = &scsi->vdev;
+	uint32_t i;
+
+	for (i = 0; i < scsi->nr_queues; i++) {
+		if (scsi->rq[i].slots)
+			SLOF_free_mem_aligned(scsi->rq[i].slots);
+		virtio_queue_term_vq(vdev, &vdev->vq[SCSI_VQ_REQUEST + i],
+				     SCSI_VQ_REQUEST + i);
+	}
+
+	virtio_queue_term_vq(vdev, &vdev->vq[SCSI_VQ_CTRL], SCSI_VQ_CTRL);
+	virtio_queue_term_vq(vdev, &vdev->vq[SCSI_VQ_EVENT], SCSI_VQ_EVENT);
+	SLOF_free_mem(scsi, sizeof(*scsi));
+}
+
+struct virtio_scsi *virtioscsi_open(struct virtio_device *dev)
+{
+	struct virtio_scsi *scsi;
+
+	if (!dev)
+		return NULL;
+
+	scsi = SLOF_alloc_mem(sizeof(*scsi));
+	if (!scsi) {
+		printf("Unable to allocate virtio-scsi driver\n");
+		return NULL;
+	}
+	memset(scsi, 0, sizeof(*scsi));
+
+	/* make a copy of the device structure */
+	memcpy(&scsi->vdev, dev, sizeof(struct virtio_device));
+
+	virtio_reset_device(&scsi->vdev);
+	virtio_set_status(&scsi->vdev, VIRTIO_STAT_ACKNOWLEDGE);
+
+	if (virtioscsi_init(scsi)) {
+		virtioscsi_free(scsi);
+		return NULL;
+	}
+
+	return scsi;
+}
+
+void virtioscsi_close(struct virtio_scsi *scsi)
+{
+	if (!scsi)
+		return;
+
+	/* Quiesce and reset device */
+	virtio_set_status(&scsi->vdev, VIRTIO_STAT_FAILED);
+	virtio_reset_device(&scsi->vdev);
+
+	virtioscsi_free(scsi);
+}
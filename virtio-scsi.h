@@ -0,0 +1,167 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#ifndef _VIRTIO_SCSI_H
+#define _VIRTIO_SCSI_H
+
+#include <stdint.h>
+#include "virtio.h"
+
+enum {
+	SCSI_VQ_CTRL = 0,	/* Task management */
+	SCSI_VQ_EVENT = 1,	/* Hotplug and parameter change events */
+	SCSI_VQ_REQUEST = 2,	/* First request queue */
+};
+
+/* VIRTIO_SCSI Feature bits */
+#define VIRTIO_SCSI_F_INOUT		(1 << 0)
+#define VIRTIO_SCSI_F_HOTPLUG		(1 << 1)
+#define VIRTIO_SCSI_F_CHANGE		(1 << 2)
+#define VIRTIO_SCSI_F_T10_PI		(1 << 3)
+
+#define VIRTIO_SCSI_CDB_SIZE		32
+#define VIRTIO_SCSI_SENSE_SIZE		96
+
+/* As per VirtIO spec Version 1.2: 5.6.4 Device configuration layout */
+struct virtio_scsi_config {
+	uint32_t num_queues;
+	uint32_t seg_max;
+	uint32_t max_sectors;
+	uint32_t cmd_per_lun;
+	uint32_t event_info_size;
+	uint32_t sense_size;
+	uint32_t cdb_size;
+	uint16_t max_channel;
+	uint16_t max_target;
+	uint32_t max_lun;
+} __attribute__((packed));
+
+/* SCSI command request, followed by data-out */
+struct virtio_scsi_cmd_req {
+	uint8_t lun[8];
+	uint64_t tag;
+	uint8_t task_attr;
+	uint8_t prio;
+	uint8_t crn;
+	uint8_t cdb[VIRTIO_SCSI_CDB_SIZE];
+} __attribute__((packed));
+
+/* Response, followed by data-in */
+struct virtio_scsi_cmd_resp {
+	uint32_t sense_len;
+	uint32_t resid;
+	uint16_t status_qualifier;
+	uint8_t status;
+	uint8_t response;
+	uint8_t sense[VIRTIO_SCSI_SENSE_SIZE];
+} __attribute__((packed));
+
+/* Task management request */
+struct virtio_scsi_ctrl_tmf_req {
+	uint32_t type;
+	uint32_t subtype;
+	uint8_t lun[8];
+	uint64_t tag;
+} __attribute__((packed));
+
+struct virtio_scsi_ctrl_tmf_resp {
+	uint8_t response;
+} __attribute__((packed));
+
+struct virtio_scsi_event {
+	uint32_t event;
+	uint8_t lun[8];
+	uint32_t reason;
+} __attribute__((packed));
+
+/* Response codes */
+#define VIRTIO_SCSI_S_OK			0
+#define VIRTIO_SCSI_S_OVERRUN			1
+#define VIRTIO_SCSI_S_ABORTED			2
+#define VIRTIO_SCSI_S_BAD_TARGET		3
+#define VIRTIO_SCSI_S_RESET			4
+#define VIRTIO_SCSI_S_BUSY			5
+#define VIRTIO_SCSI_S_TRANSPORT_FAILURE		6
+#define VIRTIO_SCSI_S_TARGET_FAILURE		7
+#define VIRTIO_SCSI_S_NEXUS_FAILURE		8
+#define VIRTIO_SCSI_S_FAILURE			9
+#define VIRTIO_SCSI_S_FUNCTION_SUCCEEDED	10
+#define VIRTIO_SCSI_S_FUNCTION_REJECTED		11
+#define VIRTIO_SCSI_S_INCORRECT_LUN		12
+
+/* Control queue types and task management functions */
+#define VIRTIO_SCSI_T_TMF			0
+#define VIRTIO_SCSI_T_TMF_ABORT_TASK		0
+#define VIRTIO_SCSI_T_TMF_LOGICAL_UNIT_RESET	5
+
+/* Events */
+#define VIRTIO_SCSI_T_EVENTS_MISSED		0x80000000
+#define VIRTIO_SCSI_T_NO_EVENT			0
+#define VIRTIO_SCSI_T_TRANSPORT_RESET		1
+#define VIRTIO_SCSI_T_ASYNC_NOTIFY		2
+#define VIRTIO_SCSI_T_PARAM_CHANGE		3
+
+/* Task attributes */
+#define VIRTIO_SCSI_S_SIMPLE			0
+#define VIRTIO_SCSI_S_ORDERED			1
+
+/* Driver limits */
+#define SCSI_MAX_REQ_QUEUES	(VIRTIO_MAX_VQS - SCSI_VQ_REQUEST)
+#define SCSI_EVENTS		8
+
+struct virtio_scsi;
+
+/* A logical unit, filled in by virtioscsi_open_lun() */
+struct virtio_scsi_lun {
+	struct virtio_scsi *scsi;
+	uint8_t addr[8];	/* Single level LUN structure */
+	uint32_t blk_size;
+	uint64_t blocks;
+	uint32_t inflight;	/* Commands in flight, at most cmd_per_lun */
+};
+
+/* Per command state, tagged with its queue and slot */
+struct virtio_scsi_slot {
+	struct virtio_scsi_cmd_req req;
+	struct virtio_scsi_cmd_resp resp;
+	struct virtio_scsi_lun *lun;	/* NULL once the waiter timed out */
+};
+
+struct virtio_scsi_rq {
+	struct virtio_scsi_slot *slots;	/* One per three descriptors */
+	uint16_t nr_slots;
+};
+
+struct virtio_scsi {
+	struct virtio_device vdev;
+	uint32_t nr_queues;	/* Request queues */
+	uint32_t max_sectors;
+	uint32_t cmd_per_lun;
+	uint16_t max_target;
+	uint32_t max_lun;
+	uint8_t rescan;		/* LUNs were added or removed, or events lost */
+	struct virtio_scsi_rq rq[SCSI_MAX_REQ_QUEUES];
+	struct virtio_scsi_event event[SCSI_EVENTS];
+	struct virtio_scsi_ctrl_tmf_req tmf_req;
+	struct virtio_scsi_ctrl_tmf_resp tmf_resp;
+	uint8_t scratch[32];	/* Data of discovery commands */
+};
+
+extern struct virtio_scsi *virtioscsi_open(struct virtio_device *dev);
+extern void virtioscsi_close(struct virtio_scsi *scsi);
+extern int virtioscsi_open_lun(struct virtio_scsi *scsi, uint16_t target,
+			       uint32_t lun, struct virtio_scsi_lun *l);
+extern int virtioscsi_reset_lun(struct virtio_scsi_lun *lun);
+extern int virtioscsi_command(struct virtio_scsi_lun *lun, const uint8_t *cdb,
+			      int cdb_len, void *buf, uint32_t len, int write,
+			      struct virtio_completion *c);
+extern int virtioscsi_transfer(struct virtio_scsi_lun *lun, char *buf,
+			       uint64_t blocknum, long cnt, unsigned int type);
+extern int virtioscsi_transfer_async(struct virtio_scsi_lun *lun, char *buf,
+				     uint64_t blocknum, long cnt, unsigned int type,
+				     struct virtio_completion *c);
+extern int virtioscsi_complete(struct virtio_scsi *scsi);
+
+#endif /* _VIRTIO_SCSI_H */
@@ -0,0 +1,34 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#include <stdint.h>
+#include <cpu.h>
+#include "virtio-trace.h"
+
+#ifdef VIRTIO_TRACE
+
+struct virtio_trace_buf virtio_trace_buf = {
+	.magic = VIRTIO_TRACE_MAGIC,
+	.version = VIRTIO_TRACE_VERSION,
+	.event_size = sizeof(struct virtio_trace_event),
+	.entries = VIRTIO_TRACE_ENTRIES,
+};
+
+/**
+ * Get the trace buffer for dumping. The buffer keeps recording, so stop
+ * the traffic first for a consistent dump.
+ * @param   size  receives the number of bytes to dump
+ * @return  pointer to the trace buffer
+ */
+struct virtio_trace_buf *virtio_trace_get(uint32_t *size)
+{
+	virtio_trace_buf.freq = get_tick_freq();
+	if (size)
+		*size = sizeof(virtio_trace_buf);
+
+	return &virtio_trace_buf;
+}
+
+#endif /* VIRTIO_TRACE */
@@ -0,0 +1,84 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Virtqueue event trace. When built with VIRTIO_TRACE, ring events are
+ * stored as fixed size binary records in a wrapping buffer, which can be
+ * dumped with virtio_trace_get() and turned into text with
+ * tools/virtio-trace-decode. Without VIRTIO_TRACE the hooks compile away.
+ *
+ * The layout below is the dump format, so it only depends on <stdint.h>
+ * and is shared with the hosted decoder.
+ */
+
+#ifndef _VIRTIO_TRACE_H
+#define _VIRTIO_TRACE_H
+
+#include <stdint.h>
+
+#define VIRTIO_TRACE_MAGIC	0x43525456	/* "VTRC" */
+#define VIRTIO_TRACE_VERSION	1
+
+/* Number of records kept, must be a power of 2 */
+#ifndef VIRTIO_TRACE_ENTRIES
+#define VIRTIO_TRACE_ENTRIES	4096
+#endif
+
+/* Event types */
+#define VT_ADD		1	/* Chain made available, len = bytes */
+#define VT_KICK		2	/* Device notified, head = avail idx, len = 1 if suppressed */
+#define VT_USED		3	/* Used chain harvested, len = used length */
+#define VT_IRQ		4	/* Queue handler run, head = used idx, len = ISR status or vector */
+#define VT_REFILL	5	/* Receive buffer reposted */
+
+struct virtio_trace_event {
+	uint64_t ts;		/* Counter ticks, see virtio_trace_buf.freq */
+	uint8_t type;
+	uint8_t queue;
+	uint16_t head;
+	uint32_t len;
+};
+
+struct virtio_trace_buf {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t event_size;
+	uint32_t entries;
+	uint32_t pos;		/* Free running count of records written */
+	uint64_t freq;		/* Counter ticks per second */
+	struct virtio_trace_event ev[VIRTIO_TRACE_ENTRIES];
+};
+
+#ifdef VIRTIO_TRACE
+
+#include <cpu.h>
+
+extern struct virtio_trace_buf virtio_trace_buf;
+extern struct virtio_trace_buf *virtio_trace_get(uint32_t *size);
+
+/*
+ * Record an event. Writers on different CPUs claim slots with one atomic
+ * add; a record overwritten while being read shows up as a torn entry in
+ * the dump and is the only cost of staying lock free.
+ */
+static inline void virtio_trace(uint8_t type, int queue, uint16_t head, uint32_t len)
+{
+	uint32_t pos = __atomic_fetch_add(&virtio_trace_buf.pos, 1, __ATOMIC_RELAXED);
+	struct virtio_trace_event *ev = &virtio_trace_buf.ev[pos & (VIRTIO_TRACE_ENTRIES - 1)];
+
+	ev->ts = get_ticks();
+	ev->type = type;
+	ev->queue = queue;
+	ev->head = head;
+	ev->len = len;
+}
+
+#else
+
+#define virtio_trace(type, queue, head, len) do { } while (0)
+
+#endif /* VIRTIO_TRACE */
+
+#endif /* _VIRTIO_TRACE_H */
@@ -0,0 +1,800 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+/*
+ * Driver for the virtio socket device, see the Virtio Spec 1.2 chapter 5.10.
+ * Stream and seqpacket sockets to the host without an IP stack in between.
+ *
+ * Received payload is copied once, from the receive buffers of the queue
+ * into the buffer of its socket, so the queue buffers can be reposted at
+ * once. Sending either copies into a transmit slot or, when a completion
+ * is passed, hands the caller's buffer to the device directly.
+ *
+ * Like the core, the driver is not thread safe: one task owns the device
+ * and calls all functions below, virtiovsock_poll() included.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <helpers.h>
+#include <byteorder.h>
+#include "virtio-vsock.h"
+#include "virtio-internal.h"
+#include "virtio-ring.h"
+
+#define DRIVER_FEATURE_SUPPORT	(VIRTIO_F_VERSION_1)
+
+#define RX_ENTRY_SIZE	(sizeof(struct virtio_vsock_hdr) + VSOCK_RX_BUF_SIZE)
+
+static int virtiovsock_xmit(struct virtio_vsock *vs, struct virtio_vsock_hdr *hdr,
+			    const void *buf, uint32_t len,
+			    struct virtio_completion *c)
+{
+	struct virtio_device *vdev = &vs->vdev;
+	struct vqs *vq = &vdev->vq[VSOCK_VQ_TX];
+	uint16_t idx;
+	int slot, id, err;
+
+	/* Reclaim the slots the device is done with */
+	virtio_queue_complete_all(vdev, vq);
+
+	/* Zero-copy sends may complete out of order, slots come from a free list */
+	slot = virtio_queue_get_slot(vq);
+	if (slot < 0)
+		return -EAGAIN;
+	id = slot * 2;
+
+	vs->tx_hdr[slot] = *hdr;
+	if (len && !c) {
+		memcpy(vs->tx_mem + slot * VSOCK_TX_BUF_SIZE, buf, len);
+		buf = vs->tx_mem + slot * VSOCK_TX_BUF_SIZE;
+	}
+
+	__virtio_free_desc(vq, id, vdev->features);
+	__virtio_free_desc(vq, id + 1, vdev->features);
+
+	err = __virtio_fill_desc(vq, id, vdev->features, (uint64_t) &vs->tx_hdr[slot],
+				 sizeof(struct virtio_vsock_hdr),
+				 len ? VRING_DESC_F_NEXT : 0, id + 1);
+	if (len)
+		err |= __virtio_fill_desc(vq, id + 1, vdev->features, (uint64_t) buf,
+					  len, 0, 0);
+
+	/* The device could not reach a buffer, do not post the chain */
+	if (err) {
+		__virtio_free_descs(vq, id, 2, vdev->features);
+		virtio_queue_put_slot(vq, slot);
+		return -EIO;
+	}
+
+	if (c)
+		virtio_queue_track(vq, id, c);
+
+	idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, id);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	virtio_stats_posted(vdev, vq, len);
+
+	__virtio_queue_notify(vdev, VSOCK_VQ_TX);
+
+	return len;
+}
+
+/* Build the header of a packet of "sock", which also carries our credit */
+static void virtiovsock_fill_hdr(struct virtio_vsock_sock *sock,
+				 struct virtio_vsock_hdr *hdr, uint16_t op,
+				 uint32_t len, uint32_t flags)
+{
+	hdr->src_cid = cpu_to_le64(sock->vs->guest_cid);
+	hdr->dst_cid = cpu_to_le64(sock->peer_cid);
+	hdr->src_port = cpu_to_le32(sock->local_port);
+	hdr->dst_port = cpu_to_le32(sock->peer_port);
+	hdr->len = cpu_to_le32(len);
+	hdr->type = cpu_to_le16(sock->type);
+	hdr->op = cpu_to_le16(op);
+	hdr->flags = cpu_to_le32(flags);
+	hdr->buf_alloc = cpu_to_le32(sock->buf_alloc);
+	hdr->fwd_cnt = cpu_to_le32(sock->fwd_cnt);
+}
+
+/* Send a packet without payload */
+static int virtiovsock_send_ctrl(struct virtio_vsock_sock *sock, uint16_t op,
+				 uint32_t flags)
+{
+	struct virtio_vsock_hdr hdr;
+	int rc;
+
+	virtiovsock_fill_hdr(sock, &hdr, op, 0, flags);
+	rc = virtiovsock_xmit(sock->vs, &hdr, NULL, 0, NULL);
+	if (!rc)
+		sock->last_fwd_cnt = sock->fwd_cnt;
+
+	return rc;
+}
+
+/* Answer a packet no socket wants with a reset */
+static void virtiovsock_reply_rst(struct virtio_vsock *vs,
+				  struct virtio_vsock_hdr *pkt)
+{
+	struct virtio_vsock_hdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.src_cid = cpu_to_le64(vs->guest_cid);
+	hdr.dst_cid = pkt->src_cid;
+	hdr.src_port = pkt->dst_port;
+	hdr.dst_port = pkt->src_port;
+	hdr.type = pkt->type;
+	hdr.op = cpu_to_le16(VIRTIO_VSOCK_OP_RST);
+	virtiovsock_xmit(vs, &hdr, NULL, 0, NULL);
+}
+
+static struct virtio_vsock_sock *virtiovsock_alloc_sock(struct virtio_vsock *vs,
+							int type)
+{
+	struct virtio_vsock_sock *sock;
+	int i;
+
+	for (i = 0; i < VSOCK_MAX_SOCKS; i++) {
+		sock = &vs->socks[i];
+		if (sock->state != VSOCK_SS_FREE)
+			continue;
+
+		memset(sock, 0, sizeof(*sock));
+		sock->vs = vs;
+		sock->type = type;
+		sock->state = VSOCK_SS_CLOSED;
+		sock->buf_alloc = VSOCK_SOCK_BUF_SIZE;
+		sock->rx_buf = vs->sock_mem + i * VSOCK_SOCK_BUF_SIZE;
+		return sock;
+	}
+
+	return NULL;
+}
+
+static struct virtio_vsock_sock *virtiovsock_lookup(struct virtio_vsock *vs,
+						    struct virtio_vsock_hdr *hdr)
+{
+	struct virtio_vsock_sock *sock, *listener = NULL;
+	uint64_t src_cid = le64_to_cpu(hdr->src_cid);
+	uint32_t src_port = le32_to_cpu(hdr->src_port);
+	uint32_t dst_port = le32_to_cpu(hdr->dst_port);
+	int i;
+
+	for (i = 0; i < VSOCK_MAX_SOCKS; i++) {
+		sock = &vs->socks[i];
+		if (sock->local_port != dst_port)
+			continue;
+		if (sock->state == VSOCK_SS_LISTEN)
+			listener = sock;
+		else if ((sock->state == VSOCK_SS_CONNECTING ||
+			  sock->state == VSOCK_SS_CONNECTED) &&
+			 sock->peer_cid == src_cid && sock->peer_port == src_port)
+			return sock;
+	}
+
+	return listener;
+}
+
+static void virtiovsock_set_closed(struct virtio_vsock_sock *sock, int error)
+{
+	sock->state = VSOCK_SS_CLOSED;
+	sock->error = error;
+}
+
+/* Connection request to a listening socket */
+static void virtiovsock_rx_request(struct virtio_vsock_sock *listener,
+				   struct virtio_vsock_hdr *hdr)
+{
+	struct virtio_vsock *vs = listener->vs;
+	struct virtio_vsock_sock *sock;
+
+	sock = virtiovsock_alloc_sock(vs, listener->type);
+	if (!sock) {
+		virtiovsock_reply_rst(vs, hdr);
+		return;
+	}
+
+	sock->parent = listener;
+	sock->accept_pending = 1;
+	sock->state = VSOCK_SS_CONNECTED;
+	sock->local_port = listener->local_port;
+	sock->peer_cid = le64_to_cpu(hdr->src_cid);
+	sock->peer_port = le32_to_cpu(hdr->src_port);
+	sock->peer_buf_alloc = le32_to_cpu(hdr->buf_alloc);
+	sock->peer_fwd_cnt = le32_to_cpu(hdr->fwd_cnt);
+
+	if (virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_RESPONSE, 0))
+		sock->state = VSOCK_SS_FREE;
+}
+
+/* Payload for a connected socket */
+static void virtiovsock_rx_data(struct virtio_vsock_sock *sock,
+				struct virtio_vsock_hdr *hdr, uint8_t *data,
+				uint32_t len)
+{
+	uint32_t pos, n;
+
+	/* The peer must not send more than our credit allows */
+	if (sock->rx_cnt - sock->fwd_cnt + len > sock->buf_alloc) {
+		virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_RST, 0);
+		virtiovsock_set_closed(sock, -EPROTO);
+		return;
+	}
+
+	pos = sock->rx_cnt & (sock->buf_alloc - 1);
+	n = len < sock->buf_alloc - pos ? len : sock->buf_alloc - pos;
+	memcpy(sock->rx_buf + pos, data, n);
+	memcpy(sock->rx_buf, data + n, len - n);
+	sock->rx_cnt += len;
+
+	if (sock->type == VIRTIO_VSOCK_TYPE_SEQPACKET &&
+	    (le32_to_cpu(hdr->flags) & VIRTIO_VSOCK_SEQ_EOM)) {
+		if ((uint8_t) (sock->msg_tail - sock->msg_head) >= VSOCK_MAX_MSGS) {
+			virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_RST, 0);
+			virtiovsock_set_closed(sock, -ENOBUFS);
+			return;
+		}
+		sock->msg_end[sock->msg_tail++ % VSOCK_MAX_MSGS] = sock->rx_cnt;
+	}
+}
+
+static void virtiovsock_rx_pkt(struct virtio_vsock *vs,
+			       struct virtio_vsock_hdr *hdr, uint32_t used_len)
+{
+	struct virtio_vsock_sock *sock;
+	uint32_t len = le32_to_cpu(hdr->len);
+	uint16_t op = le16_to_cpu(hdr->op);
+
+	/* The device may not claim to have written past the buffer */
+	if (used_len < sizeof(*hdr) || used_len > RX_ENTRY_SIZE ||
+	    len > used_len - sizeof(*hdr) ||
+	    le64_to_cpu(hdr->dst_cid) != vs->guest_cid)
+		return;
+
+	sock = virtiovsock_lookup(vs, hdr);
+	if (sock && sock->state == VSOCK_SS_LISTEN) {
+		if (op == VIRTIO_VSOCK_OP_REQUEST &&
+		    le16_to_cpu(hdr->type) == sock->type)
+			virtiovsock_rx_request(sock, hdr);
+		else if (op != VIRTIO_VSOCK_OP_RST)
+			virtiovsock_reply_rst(vs, hdr);
+		return;
+	}
+	if (!sock) {
+		if (op != VIRTIO_VSOCK_OP_RST)
+			virtiovsock_reply_rst(vs, hdr);
+		return;
+	}
+
+	/* Every packet updates the peer's credit */
+	sock->peer_buf_alloc = le32_to_cpu(hdr->buf_alloc);
+	sock->peer_fwd_cnt = le32_to_cpu(hdr->fwd_cnt);
+
+	switch (op) {
+	case VIRTIO_VSOCK_OP_RESPONSE:
+		if (sock->state == VSOCK_SS_CONNECTING) {
+			sock->state = VSOCK_SS_CONNECTED;
+		} else {
+			virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_RST, 0);
+			virtiovsock_set_closed(sock, -EPROTO);
+		}
+		break;
+	case VIRTIO_VSOCK_OP_RW:
+		if (sock->state == VSOCK_SS_CONNECTED)
+			virtiovsock_rx_data(sock, hdr, (uint8_t *) (hdr + 1), len);
+		break;
+	case VIRTIO_VSOCK_OP_CREDIT_REQUEST:
+		virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_CREDIT_UPDATE, 0);
+		break;
+	case VIRTIO_VSOCK_OP_SHUTDOWN:
+		sock->peer_shutdown |= le32_to_cpu(hdr->flags) &
+			(VIRTIO_VSOCK_SHUTDOWN_RCV | VIRTIO_VSOCK_SHUTDOWN_SEND);
+		if (sock->peer_shutdown == (VIRTIO_VSOCK_SHUTDOWN_RCV |
+					    VIRTIO_VSOCK_SHUTDOWN_SEND)) {
+			virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_RST, 0);
+			virtiovsock_set_closed(sock, 0);
+		}
+		break;
+	case VIRTIO_VSOCK_OP_RST:
+		virtiovsock_set_closed(sock, sock->state == VSOCK_SS_CONNECTING ?
+				       -ECONNREFUSED : -ECONNRESET);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Give a receive buffer back to the device */
+static void virtiovsock_post_rx(struct virtio_vsock *vs, int id)
+{
+	struct virtio_device *vdev = &vs->vdev;
+	struct vqs *vq = &vdev->vq[VSOCK_VQ_RX];
+	uint16_t idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, id);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+	__virtio_stats_posted(vdev, vq, 0, VT_REFILL);
+}
+
+static void virtiovsock_post_event(struct virtio_vsock *vs, int id)
+{
+	struct virtio_device *vdev = &vs->vdev;
+	struct vqs *vq = &vdev->vq[VSOCK_VQ_EVENT];
+	uint16_t idx = virtio_modern16_to_cpu(vdev, vq->avail->idx);
+
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(vdev, id);
+	sync();
+	vq->avail->idx = virtio_cpu_to_modern16(vdev, idx + 1);
+}
+
+/* The host was migrated or restarted, connections are gone */
+static void virtiovsock_transport_reset(struct virtio_vsock *vs)
+{
+	int i;
+
+	vs->guest_cid = virtio_get_config(&vs->vdev, 0, sizeof(vs->guest_cid));
+
+	for (i = 0; i < VSOCK_MAX_SOCKS; i++) {
+		struct virtio_vsock_sock *sock = &vs->socks[i];
+
+		if (sock->state == VSOCK_SS_CONNECTING ||
+		    sock->state == VSOCK_SS_CONNECTED)
+			virtiovsock_set_closed(sock, -ECONNRESET);
+	}
+}
+
+/**
+ * Process the packets and events the device delivered and reclaim the
+ * transmit slots it is done with.
+ * @return  number of packets and events processed
+ */
+int virtiovsock_poll(struct virtio_vsock *vs)
+{
+	struct virtio_device *vdev = &vs->vdev;
+	struct vqs *vq_rx = &vdev->vq[VSOCK_VQ_RX];
+	struct vqs *vq_ev = &vdev->vq[VSOCK_VQ_EVENT];
+	uint32_t len;
+	int id, rx = 0, ev = 0;
+
+	while ((id = virtio_get_used(vdev, vq_rx, &len)) >= 0) {
+		id = vq_wrap(vq_rx, id);
+		virtiovsock_rx_pkt(vs, (struct virtio_vsock_hdr *)
+				   (vs->rx_mem + id * RX_ENTRY_SIZE), len);
+		virtiovsock_post_rx(vs, id);
+		rx++;
+	}
+	if (rx)
+		__virtio_queue_notify(vdev, VSOCK_VQ_RX);
+
+	while ((id = virtio_get_used(vdev, vq_ev, &len)) >= 0) {
+		id = vq_wrap(vq_ev, id);
+		if (len >= sizeof(vs->event[0]) &&
+		    le32_to_cpu(vs->event[id].id) == VIRTIO_VSOCK_EVENT_TRANSPORT_RESET)
+			virtiovsock_transport_reset(vs);
+		virtiovsock_post_event(vs, id);
+		ev++;
+	}
+	if (ev)
+		__virtio_queue_notify(vdev, VSOCK_VQ_EVENT);
+
+	virtio_queue_complete_all(vdev, &vdev->vq[VSOCK_VQ_TX]);
+
+	if ((rx || ev) && vs->handler)
+		vs->handler(vs, vs->handler_arg);
+
+	return rx + ev;
+}
+
+static void virtiovsock_vq_interrupt(struct virtio_device *dev, struct vqs *vq,
+				     void *arg)
+{
+	virtiovsock_poll(arg);
+}
+
+void virtiovsock_handle_interrupt(struct virtio_vsock *vs)
+{
+	virtio_handle_interrupt(&vs->vdev);
+}
+
+/**
+ * Install a callback that runs after virtiovsock_poll() processed
+ * packets, e.g. to wake up tasks waiting on sockets.
+ */
+void virtiovsock_set_handler(struct virtio_vsock *vs,
+			     virtiovsock_handler_t handler, void *arg)
+{
+	vs->handler = handler;
+	vs->handler_arg = arg;
+}
+
+uint64_t virtiovsock_get_cid(struct virtio_vsock *vs)
+{
+	return vs->guest_cid;
+}
+
+static int virtiovsock_init(struct virtio_vsock *vs)
+{
+	struct virtio_device *vdev = &vs->vdev;
+	struct vqs *vq_rx, *vq_tx, *vq_ev;
+	int status = VIRTIO_STAT_ACKNOWLEDGE | VIRTIO_STAT_DRIVER;
+	int i;
+
+	virtio_set_status(vdev, status);
+
+	/* There is no legacy interface for vsock */
+	if (!virtio_is_modern(vdev) ||
+	    virtio_negotiate_guest_features(vdev, DRIVER_FEATURE_SUPPORT))
+		goto dev_error;
+	virtio_get_status(vdev, &status);
+
+	vs->guest_cid = virtio_get_config(vdev, 0, sizeof(vs->guest_cid));
+	vs->next_port = VSOCK_PORT_EPHEMERAL;
+
+	vq_rx = virtio_queue_init_vq(vdev, VSOCK_VQ_RX);
+	vq_tx = virtio_queue_init_vq(vdev, VSOCK_VQ_TX);
+	vq_ev = virtio_queue_init_vq(vdev, VSOCK_VQ_EVENT);
+	if (!vq_rx || !vq_tx || !vq_ev)
+		goto dev_error;
+
+	vs->rx_bufs = vq_rx->size < VSOCK_RX_BUFS ? vq_rx->size : VSOCK_RX_BUFS;
+	vs->tx_slots = vq_tx->size / 2 < VSOCK_TX_SLOTS ? vq_tx->size / 2 : VSOCK_TX_SLOTS;
+
+	vs->rx_mem = SLOF_alloc_mem_aligned(vs->rx_bufs * RX_ENTRY_SIZE, 8, NULL);
+	vs->tx_hdr = SLOF_alloc_mem_aligned(vs->tx_slots * sizeof(vs->tx_hdr[0]), 8, NULL);
+	vs->tx_mem = SLOF_alloc_mem_aligned(vs->tx_slots * VSOCK_TX_BUF_SIZE, 8, NULL);
+	vs->sock_mem = SLOF_alloc_mem(VSOCK_MAX_SOCKS * VSOCK_SOCK_BUF_SIZE);
+	if (!vs->rx_mem || !vs->tx_hdr || !vs->tx_mem || !vs->sock_mem) {
+		printf("virtio-vsock: Failed to allocate buffers!\n");
+		goto dev_error;
+	}
+
+	if (virtio_queue_set_completions(vdev, VSOCK_VQ_TX, 1) ||
+	    virtio_queue_set_slots(vdev, VSOCK_VQ_TX, vs->tx_slots, 2))
+		goto dev_error;
+
+	/* One descriptor per receive buffer, for header and payload */
+	for (i = 0; i < vs->rx_bufs; i++) {
+		if (virtio_fill_desc(vq_rx, i, vdev->features,
+				     (uint64_t) (vs->rx_mem + i * RX_ENTRY_SIZE),
+				     RX_ENTRY_SIZE, VRING_DESC_F_WRITE, 0))
+			goto dev_error;
+		vq_rx->avail->ring[i] = virtio_cpu_to_modern16(vdev, i);
+	}
+	for (i = 0; i < VSOCK_EVENTS && i < vq_ev->size; i++) {
+		if (virtio_fill_desc(vq_ev, i, vdev->features, (uint64_t) &vs->event[i],
+				     sizeof(vs->event[i]), VRING_DESC_F_WRITE, 0))
+			goto dev_error;
+		vq_ev->avail->ring[i] = virtio_cpu_to_modern16(vdev, i);
+	}
+	sync();
+
+	vq_rx->avail->flags = virtio_cpu_to_modern16(vdev, 0);
+	vq_rx->avail->idx = virtio_cpu_to_modern16(vdev, vs->rx_bufs);
+	vq_ev->avail->flags = virtio_cpu_to_modern16(vdev, 0);
+	vq_ev->avail->idx = virtio_cpu_to_modern16(vdev, i);
+	vq_tx->avail->flags = virtio_cpu_to_modern16(vdev, 0);
+
+	virtio_queue_set_handler(vdev, VSOCK_VQ_RX, virtiovsock_vq_interrupt, vs);
+	virtio_queue_set_handler(vdev, VSOCK_VQ_TX, virtiovsock_vq_interrupt, vs);
+	virtio_queue_set_handler(vdev, VSOCK_VQ_EVENT, virtiovsock_vq_interrupt, vs);
+
+	status |= VIRTIO_STAT_DRIVER_OK;
+	virtio_set_status(vdev, status);
+
+	virtio_queue_notify(vdev, VSOCK_VQ_RX);
+	virtio_queue_notify(vdev, VSOCK_VQ_EVENT);
+
+	return 0;
+
+dev_error:
+	status |= VIRTIO_STAT_FAILED;
+	virtio_set_status(vdev, status);
+	return -1;
+}
+
+static void virtiovsock_free(struct virtio_vsock *vs)
+{
+	struct virtio_device *vdev = &vs->vdev;
+
+	if (vs->rx_mem)
+		SLOF_free_mem_aligned(vs->rx_mem);
+	if (vs->tx_hdr)
+		SLOF_free_mem_aligned(vs->tx_hdr);
+	if (vs->tx_mem)
+		SLOF_free_mem_aligned(vs->tx_mem);
+	if (vs->sock_mem)
+		SLOF_free_mem(vs->sock_mem, VSOCK_MAX_SOCKS * VSOCK_SOCK_BUF_SIZE);
+
+	virtio_queue_term_vq(vdev, &vdev->vq[VSOCK_VQ_RX], VSOCK_VQ_RX);
+	virtio_queue_term_vq(vdev, &vdev->vq[VSOCK_VQ_TX], VSOCK_VQ_TX);
+	virtio_queue_term_vq(vdev, &vdev->vq[VSOCK_VQ_EVENT], VSOCK_VQ_EVENT);
+	SLOF_free_mem(vs, sizeof(*vs));
+}
+
+struct virtio_vsock *virtiovsock_open(struct virtio_device *dev)
+{
+	struct virtio_vsock *vs;
+
+	if (!dev)
+		return NULL;
+
+	vs = SLOF_alloc_mem(sizeof(*vs));
+	if (!vs) {
+		printf("Unable to allocate virtio-vsock driver\n");
+		return NULL;
+	}
+	memset(vs, 0, sizeof(*vs));
+
+	/* make a copy of the device structure */
+	memcpy(&vs->vdev, dev, sizeof(struct virtio_device));
+
+	virtio_reset_device(&vs->vdev);
+	virtio_set_status(&vs->vdev, VIRTIO_STAT_ACKNOWLEDGE);
+
+	if (virtiovsock_init(vs)) {
+		virtiovsock_free(vs);
+		return NULL;
+	}
+
+	return vs;
+}
+
+void virtiovsock_close(struct virtio_vsock *vs)
+{
+	int i;
+
+	if (!vs)
+		return;
+
+	for (i = 0; i < VSOCK_MAX_SOCKS; i++)
+		if (vs->socks[i].state != VSOCK_SS_FREE)
+			virtiovsock_release(&vs->socks[i]);
+
+	/* Quiesce and reset device */
+	virtio_set_status(&vs->vdev, VIRTIO_STAT_FAILED);
+	virtio_reset_device(&vs->vdev);
+
+	virtiovsock_free(vs);
+}
+
+/**
+ * Create a socket
+ * @param   vs    the device
+ * @param   type  VIRTIO_VSOCK_TYPE_STREAM or VIRTIO_VSOCK_TYPE_SEQPACKET
+ * @return  the socket, NULL if the type is not supported or all sockets
+ *          are in use
+ */
+struct virtio_vsock_sock *virtiovsock_socket(struct virtio_vsock *vs, int type)
+{
+	if (type != VIRTIO_VSOCK_TYPE_STREAM &&
+	    !(type == VIRTIO_VSOCK_TYPE_SEQPACKET &&
+	      (vs->vdev.features & VIRTIO_VSOCK_F_SEQPACKET)))
+		return NULL;
+
+	return virtiovsock_alloc_sock(vs, type);
+}
+
+/**
+ * Start connecting to a peer. The socket becomes VSOCK_SS_CONNECTED when
+ * the peer accepts, or VSOCK_SS_CLOSED with sock->error set.
+ * @return  0 if the request was sent, a negative error code otherwise
+ */
+int virtiovsock_connect(struct virtio_vsock_sock *sock, uint64_t cid,
+			uint32_t port)
+{
+	int rc;
+
+	if (sock->state != VSOCK_SS_CLOSED)
+		return -EISCONN;
+
+	sock->peer_cid = cid;
+	sock->peer_port = port;
+	sock->local_port = sock->vs->next_port++;
+	if (sock->vs->next_port < VSOCK_PORT_EPHEMERAL)
+		sock->vs->next_port = VSOCK_PORT_EPHEMERAL;
+
+	rc = virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_REQUEST, 0);
+	if (rc)
+		return rc;
+
+	sock->error = 0;
+	sock->state = VSOCK_SS_CONNECTING;
+	return 0;
+}
+
+/**
+ * Accept connections on a port
+ */
+int virtiovsock_listen(struct virtio_vsock_sock *sock, uint32_t port)
+{
+	int i;
+
+	if (sock->state != VSOCK_SS_CLOSED)
+		return -EISCONN;
+
+	for (i = 0; i < VSOCK_MAX_SOCKS; i++)
+		if (sock->vs->socks[i].state == VSOCK_SS_LISTEN &&
+		    sock->vs->socks[i].local_port == port)
+			return -EADDRINUSE;
+
+	sock->local_port = port;
+	sock->state = VSOCK_SS_LISTEN;
+	return 0;
+}
+
+/**
+ * Get the next connection a listening socket accepted
+ * @return  the connected socket, NULL if there is none yet
+ */
+struct virtio_vsock_sock *virtiovsock_accept(struct virtio_vsock_sock *sock)
+{
+	struct virtio_vsock_sock *child;
+	int i;
+
+	for (i = 0; i < VSOCK_MAX_SOCKS; i++) {
+		child = &sock->vs->socks[i];
+		if (child->accept_pending && child->parent == sock) {
+			child->accept_pending = 0;
+			return child;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Send data. Without a completion the data is copied and may be reused
+ * right away. With a completion the device reads "buf" directly, which
+ * must stay untouched until "c" is done. A seqpacket message is sent
+ * whole or not at all.
+ * @return  number of bytes sent, -EAGAIN if the peer has no room or no
+ *          transmit slot is free, another negative error code on failure
+ */
+int virtiovsock_send(struct virtio_vsock_sock *sock, const void *buf,
+		     uint32_t len, struct virtio_completion *c)
+{
+	struct virtio_vsock_hdr hdr;
+	uint32_t credit, max, flags = 0;
+	int rc;
+
+	if (sock->state != VSOCK_SS_CONNECTED)
+		return sock->error ? sock->error : -ENOTCONN;
+	if ((sock->local_shutdown & VIRTIO_VSOCK_SHUTDOWN_SEND) ||
+	    (sock->peer_shutdown & VIRTIO_VSOCK_SHUTDOWN_RCV))
+		return -EPIPE;
+
+	/* The peer may have shrunk its buffer below what is in flight */
+	credit = sock->tx_cnt - sock->peer_fwd_cnt;
+	credit = credit < sock->peer_buf_alloc ? sock->peer_buf_alloc - credit : 0;
+	max = c ? VSOCK_MAX_PKT_SIZE : VSOCK_TX_BUF_SIZE;
+
+	if (sock->type == VIRTIO_VSOCK_TYPE_SEQPACKET) {
+		if (len > max)
+			return -EMSGSIZE;
+		if (len > credit) {
+			virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_CREDIT_REQUEST, 0);
+			return -EAGAIN;
+		}
+		flags = VIRTIO_VSOCK_SEQ_EOM | VIRTIO_VSOCK_SEQ_EOR;
+	} else {
+		if (len > credit)
+			len = credit;
+		if (len > max)
+			len = max;
+		if (!len) {
+			virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_CREDIT_REQUEST, 0);
+			return -EAGAIN;
+		}
+	}
+
+	if (c)
+		virtio_completion_init(c);
+
+	virtiovsock_fill_hdr(sock, &hdr, VIRTIO_VSOCK_OP_RW, len, flags);
+	rc = virtiovsock_xmit(sock->vs, &hdr, buf, len, c);
+	if (rc < 0)
+		return rc;
+
+	sock->last_fwd_cnt = sock->fwd_cnt;
+	sock->tx_cnt += len;
+	return len;
+}
+
+/**
+ * Receive data. On seqpacket sockets one message is returned per call,
+ * the part of it which does not fit "buf" is discarded.
+ * @return  number of bytes received, 0 at the end of the stream, -EAGAIN
+ *          if nothing is pending, another negative error code on failure
+ */
+int virtiovsock_recv(struct virtio_vsock_sock *sock, void *buf, uint32_t len)
+{
+	uint32_t pending = sock->rx_cnt - sock->fwd_cnt;
+	uint32_t pos, n, consume;
+
+	if (sock->type == VIRTIO_VSOCK_TYPE_SEQPACKET) {
+		/* Only whole messages */
+		pending = sock->msg_head != sock->msg_tail ?
+			  sock->msg_end[sock->msg_head % VSOCK_MAX_MSGS] - sock->fwd_cnt : 0;
+	}
+
+	if (!pending) {
+		if (sock->state == VSOCK_SS_LISTEN)
+			return -ENOTCONN;
+		if (sock->state == VSOCK_SS_CONNECTING ||
+		    (sock->state == VSOCK_SS_CONNECTED &&
+		     !(sock->peer_shutdown & VIRTIO_VSOCK_SHUTDOWN_SEND)))
+			return -EAGAIN;
+		/* End of stream, or why the connection broke */
+		return sock->error;
+	}
+
+	n = len < pending ? len : pending;
+	consume = n;
+	if (sock->type == VIRTIO_VSOCK_TYPE_SEQPACKET) {
+		consume = pending;
+		sock->msg_head++;
+	}
+
+	pos = sock->fwd_cnt & (sock->buf_alloc - 1);
+	if (n > sock->buf_alloc - pos) {
+		memcpy(buf, sock->rx_buf + pos, sock->buf_alloc - pos);
+		memcpy((uint8_t *) buf + sock->buf_alloc - pos, sock->rx_buf,
+		       n - (sock->buf_alloc - pos));
+	} else {
+		memcpy(buf, sock->rx_buf + pos, n);
+	}
+	sock->fwd_cnt += consume;
+
+	/* Tell the peer about the room before it runs out of credit */
+	if (sock->state == VSOCK_SS_CONNECTED &&
+	    sock->fwd_cnt - sock->last_fwd_cnt >= sock->buf_alloc / 2)
+		virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_CREDIT_UPDATE, 0);
+
+	return n;
+}
+
+/**
+ * Shut down one or both directions of a connection
+ * @param   how  VIRTIO_VSOCK_SHUTDOWN_RCV and/or VIRTIO_VSOCK_SHUTDOWN_SEND
+ */
+int virtiovsock_shutdown(struct virtio_vsock_sock *sock, int how)
+{
+	if (sock->state != VSOCK_SS_CONNECTED)
+		return -ENOTCONN;
+
+	how &= VIRTIO_VSOCK_SHUTDOWN_RCV | VIRTIO_VSOCK_SHUTDOWN_SEND;
+	sock->local_shutdown |= how;
+
+	return virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_SHUTDOWN, how);
+}
+
+/**
+ * Close a socket. Connections are reset, a listener also resets the
+ * connections it accepted but nobody picked up.
+ */
+void virtiovsock_release(struct virtio_vsock_sock *sock)
+{
+	int i;
+
+	if (sock->state == VSOCK_SS_LISTEN) {
+		for (i = 0; i < VSOCK_MAX_SOCKS; i++) {
+			struct virtio_vsock_sock *child = &sock->vs->socks[i];
+
+			if (child->accept_pending && child->parent == sock)
+				virtiovsock_release(child);
+		}
+	}
+
+	if (sock->state == VSOCK_SS_CONNECTING ||
+	    sock->state == VSOCK_SS_CONNECTED)
+		virtiovsock_send_ctrl(sock, VIRTIO_VSOCK_OP_RST, 0);
+
+	sock->accept_pending = 0;
+	sock->state = VSOCK_SS_FREE;
+}
@@ -0,0 +1,156 @@
+/******************************************************************************
+ * Copyright (c) 2026 libvirtio contributors
+ * SPDX-License-Identifier: BSD-2-Clause
+ *****************************************************************************/
+
+#ifndef _VIRTIO_VSOCK_H
+#define _VIRTIO_VSOCK_H
+
+#include <stdint.h>
+#include <byteorder.h>
+#include "virtio.h"
+
+enum {
+	VSOCK_VQ_RX = 0,	/* Packets from the host */
+	VSOCK_VQ_TX = 1,	/* Packets to the host */
+	VSOCK_VQ_EVENT = 2,	/* Transport events */
+};
+
+/* VIRTIO_VSOCK Feature bits */
+#define VIRTIO_VSOCK_F_SEQPACKET	(1 << 1)
+
+/* Well known CIDs */
+#define VSOCK_CID_HOST		2
+
+/* As per VirtIO spec Version 1.2: 5.10.6 Device Operation */
+struct virtio_vsock_hdr {
+	le64 src_cid;
+	le64 dst_cid;
+	le32 src_port;
+	le32 dst_port;
+	le32 len;
+	le16 type;
+	le16 op;
+	le32 flags;
+	le32 buf_alloc;
+	le32 fwd_cnt;
+} __attribute__((packed));
+
+struct virtio_vsock_event {
+	le32 id;
+} __attribute__((packed));
+
+/* Socket types */
+#define VIRTIO_VSOCK_TYPE_STREAM	1
+#define VIRTIO_VSOCK_TYPE_SEQPACKET	2
+
+/* Operations */
+#define VIRTIO_VSOCK_OP_INVALID		0
+#define VIRTIO_VSOCK_OP_REQUEST		1
+#define VIRTIO_VSOCK_OP_RESPONSE	2
+#define VIRTIO_VSOCK_OP_RST		3
+#define VIRTIO_VSOCK_OP_SHUTDOWN	4
+#define VIRTIO_VSOCK_OP_RW		5
+#define VIRTIO_VSOCK_OP_CREDIT_UPDATE	6
+#define VIRTIO_VSOCK_OP_CREDIT_REQUEST	7
+
+/* Flags of VIRTIO_VSOCK_OP_SHUTDOWN, also "how" of virtiovsock_shutdown() */
+#define VIRTIO_VSOCK_SHUTDOWN_RCV	1
+#define VIRTIO_VSOCK_SHUTDOWN_SEND	2
+
+/* Flags of VIRTIO_VSOCK_OP_RW on seqpacket sockets */
+#define VIRTIO_VSOCK_SEQ_EOM		1
+#define VIRTIO_VSOCK_SEQ_EOR		2
+
+/* Event ids */
+#define VIRTIO_VSOCK_EVENT_TRANSPORT_RESET	0
+
+/* Driver limits */
+#define VSOCK_MAX_SOCKS		16
+#define VSOCK_SOCK_BUF_SIZE	16384	/* Receive buffer per socket, power of 2 */
+#define VSOCK_MAX_MSGS		32	/* Pending seqpacket messages per socket */
+#define VSOCK_RX_BUFS		64
+#define VSOCK_RX_BUF_SIZE	4096	/* Payload per receive buffer */
+#define VSOCK_TX_SLOTS		32
+#define VSOCK_TX_BUF_SIZE	4096	/* Payload per copying transmission */
+#define VSOCK_MAX_PKT_SIZE	65536	/* Payload per zero-copy transmission */
+#define VSOCK_EVENTS		4
+#define VSOCK_PORT_EPHEMERAL	49152
+
+/* Socket states */
+enum {
+	VSOCK_SS_FREE = 0,
+	VSOCK_SS_CLOSED,
+	VSOCK_SS_LISTEN,
+	VSOCK_SS_CONNECTING,
+	VSOCK_SS_CONNECTED,
+};
+
+struct virtio_vsock;
+
+struct virtio_vsock_sock {
+	struct virtio_vsock *vs;
+	struct virtio_vsock_sock *parent;	/* Listener of an accepted socket */
+	uint16_t type;
+	uint8_t state;
+	uint8_t accept_pending;
+	uint8_t peer_shutdown;	/* VIRTIO_VSOCK_SHUTDOWN_* sent by the peer */
+	uint8_t local_shutdown;
+	int error;		/* Why the socket was closed */
+	uint64_t peer_cid;
+	uint32_t local_port;
+	uint32_t peer_port;
+
+	/* Credit accounting, see 5.10.6.3 */
+	uint32_t buf_alloc;	/* Size of rx_buf */
+	uint32_t fwd_cnt;	/* Bytes the application consumed */
+	uint32_t last_fwd_cnt;	/* fwd_cnt last told to the peer */
+	uint32_t rx_cnt;	/* Bytes received, data is [fwd_cnt, rx_cnt) */
+	uint32_t peer_buf_alloc;
+	uint32_t peer_fwd_cnt;
+	uint32_t tx_cnt;	/* Bytes sent */
+
+	uint8_t *rx_buf;
+	uint32_t msg_end[VSOCK_MAX_MSGS];	/* Seqpacket: rx_cnt at each EOM */
+	uint8_t msg_head;
+	uint8_t msg_tail;
+};
+
+typedef void (*virtiovsock_handler_t)(struct virtio_vsock *vs, void *arg);
+
+struct virtio_vsock {
+	struct virtio_device vdev;
+	uint64_t guest_cid;
+	uint32_t next_port;
+	uint16_t rx_bufs;
+	uint16_t tx_slots;
+	uint8_t *rx_mem;	/* rx_bufs receive buffers, header + payload */
+	struct virtio_vsock_hdr *tx_hdr;	/* Per transmit slot */
+	uint8_t *tx_mem;	/* Per transmit slot, payload of copying sends */
+	struct virtio_vsock_event event[VSOCK_EVENTS];
+	uint8_t *sock_mem;	/* Receive buffers of the sockets */
+	virtiovsock_handler_t handler;
+	void *handler_arg;
+	struct virtio_vsock_sock socks[VSOCK_MAX_SOCKS];
+};
+
+extern struct virtio_vsock *virtiovsock_open(struct virtio_device *dev);
+extern void virtiovsock_close(struct virtio_vsock *vs);
+extern uint64_t virtiovsock_get_cid(struct virtio_vsock *vs);
+extern int virtiovsock_poll(struct virtio_vsock *vs);
+extern void virtiovsock_handle_interrupt(struct virtio_vsock *vs);
+extern void virtiovsock_set_handler(struct virtio_vsock *vs,
+				    virtiovsock_handler_t handler, void *arg);
+
+extern struct virtio_vsock_sock *virtiovsock_socket(struct virtio_vsock *vs, int type);
+extern int virtiovsock_connect(struct virtio_vsock_sock *sock, uint64_t cid,
+			       uint32_t port);
+extern int virtiovsock_listen(struct virtio_vsock_sock *sock, uint32_t port);
+extern struct virtio_vsock_sock *virtiovsock_accept(struct virtio_vsock_sock *sock);
+extern int virtiovsock_send(struct virtio_vsock_sock *sock, const void *buf,
+			    uint32_t len, struct virtio_completion *c);
+extern int virtiovsock_recv(struct virtio_vsock_sock *sock, void *buf, uint32_t len);
+extern int virtiovsock_shutdown(struct virtio_vsock_sock *sock, int how);
+extern void virtiovsock_release(struct virtio_vsock_sock *sock);
+
+#endif /* _VIRTIO_VSOCK_H */
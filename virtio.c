@@ -19,12 +19,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stddef.h>
+#include <errno.h>
 #include <cpu.h>
 #include <cache.h>
 #include <byteorder.h>
 #include "virtio.h"
 #include "helpers.h"
 #include "virtio-internal.h"
+#include "virtio-ring.h"
 
 #ifdef VIRTIO_USE_MMIO
 #include "virtio_mmio.h"
@@ -51,10 +53,29 @@
 #define PCI_BASE_ADDR_MEM_MASK	(~0x0fUL)
 #define PCI_BASE_ADDR_IO_MASK	(~0x03UL)
 
+#define PCI_COMMAND_REG		0x04
+#define PCI_COMMAND_IO		0x1
+#define PCI_COMMAND_MEMORY	0x2
+#define PCI_COMMAND_MASTER	0x4
 #define PCI_BASE_ADDR_REG_0	0x10
 #define PCI_CONFIG_CAP_REG	0x34
 
 #define PCI_CAP_ID_VNDR		0x9
+#define PCI_CAP_ID_MSIX		0x11
+
+/* MSI-X capability and table layout */
+#define PCI_MSIX_FLAGS			2
+#define PCI_MSIX_FLAGS_QSIZE		0x07ff
+#define PCI_MSIX_FLAGS_MASKALL		0x4000
+#define PCI_MSIX_FLAGS_ENABLE		0x8000
+#define PCI_MSIX_TABLE			4
+#define PCI_MSIX_TABLE_BIR		0x7
+#define PCI_MSIX_ENTRY_SIZE		16
+#define PCI_MSIX_ENTRY_LOWER_ADDR	0
+#define PCI_MSIX_ENTRY_UPPER_ADDR	4
+#define PCI_MSIX_ENTRY_DATA		8
+#define PCI_MSIX_ENTRY_VECTOR_CTRL	12
+#define PCI_MSIX_ENTRY_CTRL_MASKBIT	1
 
 /* Common configuration */
 #define VIRTIO_PCI_CAP_COMMON_CFG       1
@@ -66,6 +87,8 @@
 #define VIRTIO_PCI_CAP_DEVICE_CFG       4
 /* PCI configuration access */
 #define VIRTIO_PCI_CAP_PCI_CFG          5
+/* Shared memory region, struct virtio_pci_cap64 */
+#define VIRTIO_PCI_CAP_SHARED_MEMORY_CFG 8
 
 #define VIRTIO_PCI_CAP_VNDR     0	  /* Generic PCI field: PCI_CAP_ID_VNDR */
 #define VIRTIO_PCI_CAP_NEXT     1	  /* Generic PCI field: next ptr. */
@@ -74,6 +97,10 @@
 #define VIRTIO_PCI_CAP_BAR      4	  /* Where to find it. */
 #define VIRTIO_PCI_CAP_OFFSET   8	  /* Offset within bar. */
 #define VIRTIO_PCI_CAP_LENGTH  12	  /* Length of the structure, in bytes. */
+#define VIRTIO_PCI_NOTIFY_CAP_MULT 16	  /* notify_off_multiplier */
+#define VIRTIO_PCI_CAP_ID       5	  /* Shared memory region id */
+#define VIRTIO_PCI_CAP_OFFSET_HI 16	  /* struct virtio_pci_cap64 */
+#define VIRTIO_PCI_CAP_LENGTH_HI 20
 
 struct virtio_dev_common {
 	le32 dev_features_sel;
@@ -96,6 +123,28 @@ struct virtio_dev_common {
 } __attribute__ ((packed));
 
 #ifdef VIRTIO_USE_PCI
+/* Accessors for the memory mapped config space of the PCI function */
+static uint8_t virtio_pci_cfg_read8(struct virtio_device *dev, int offset)
+{
+	return ci_read_8(dev->pci_cfg + offset);
+}
+
+static uint16_t virtio_pci_cfg_read16(struct virtio_device *dev, int offset)
+{
+	return le16_to_cpu(ci_read_16(dev->pci_cfg + offset));
+}
+
+static uint32_t virtio_pci_cfg_read32(struct virtio_device *dev, int offset)
+{
+	return le32_to_cpu(ci_read_32(dev->pci_cfg + offset));
+}
+
+static void virtio_pci_cfg_write16(struct virtio_device *dev, int offset,
+				   uint16_t val)
+{
+	ci_write_16(dev->pci_cfg + offset, cpu_to_le16(val));
+}
+
 /* virtio 1.0 Spec: 4.1.3 PCI Device Layout
  *
  * Fields of different sizes are present in the device configuration regions.
@@ -112,20 +161,31 @@ static void virtio_pci_write64(void *addr, uint64_t val)
 	ci_write_32(addr + 4, cpu_to_le32(hi));
 }
 
-static void virtio_cap_set_base_addr(struct virtio_cap *cap, uint32_t offset)
+/* Bus address of a BAR */
+static uint64_t virtio_pci_bar_addr(struct virtio_device *dev, uint8_t bar,
+				    uint8_t *is_io)
 {
 	uint64_t addr;
 
-	addr = SLOF_pci_config_read32(PCI_BASE_ADDR_REG_0 + 4 * cap->bar);
+	addr = virtio_pci_cfg_read32(dev, PCI_BASE_ADDR_REG_0 + 4 * bar);
 	if (addr & PCI_BASE_ADDR_SPACE_IO) {
-		addr = addr & PCI_BASE_ADDR_IO_MASK;
-		cap->is_io = 1;
-	} else {
-		if (addr & PCI_BASE_ADDR_SPACE_64BIT)
-			addr |= SLOF_pci_config_read32(PCI_BASE_ADDR_REG_0 + 4 * (cap->bar + 1)) << 32;
-		addr = addr & PCI_BASE_ADDR_MEM_MASK;
-		cap->is_io = 0;
+		*is_io = 1;
+		return addr & PCI_BASE_ADDR_IO_MASK;
 	}
+
+	if (addr & PCI_BASE_ADDR_SPACE_64BIT)
+		addr |= (uint64_t) virtio_pci_cfg_read32(dev,
+				PCI_BASE_ADDR_REG_0 + 4 * (bar + 1)) << 32;
+	*is_io = 0;
+	return addr & PCI_BASE_ADDR_MEM_MASK;
+}
+
+static void virtio_cap_set_base_addr(struct virtio_device *dev,
+				     struct virtio_cap *cap, uint32_t offset)
+{
+	uint64_t addr;
+
+	addr = virtio_pci_bar_addr(dev, cap->bar, &cap->is_io);
 	addr = (uint64_t)SLOF_translate_my_address((void *)addr);
 	cap->addr = (void *)addr + offset;
 }
@@ -135,10 +195,11 @@ static void virtio_process_cap(struct virtio_device *dev, uint8_t cap_ptr)
 	struct virtio_cap *cap;
 	uint8_t cfg_type, bar;
 	uint32_t offset;
+	int i;
 
-	cfg_type = SLOF_pci_config_read8(cap_ptr + VIRTIO_PCI_CAP_CFG_TYPE);
-	bar = SLOF_pci_config_read8(cap_ptr + VIRTIO_PCI_CAP_BAR);
-	offset = SLOF_pci_config_read32(cap_ptr + VIRTIO_PCI_CAP_OFFSET);
+	cfg_type = virtio_pci_cfg_read8(dev, cap_ptr + VIRTIO_PCI_CAP_CFG_TYPE);
+	bar = virtio_pci_cfg_read8(dev, cap_ptr + VIRTIO_PCI_CAP_BAR);
+	offset = virtio_pci_cfg_read32(dev, cap_ptr + VIRTIO_PCI_CAP_OFFSET);
 
 	switch(cfg_type) {
 	case VIRTIO_PCI_CAP_COMMON_CFG:
@@ -146,7 +207,8 @@ static void virtio_process_cap(struct virtio_device *dev, uint8_t cap_ptr)
 		break;
 	case VIRTIO_PCI_CAP_NOTIFY_CFG:
 		cap = &dev->notify;
-		dev->notify_off_mul = SLOF_pci_config_read32(cap_ptr + sizeof(struct virtio_cap));
+		dev->notify_off_mul = virtio_pci_cfg_read32(dev,
+					cap_ptr + VIRTIO_PCI_NOTIFY_CAP_MULT);
 		break;
 	case VIRTIO_PCI_CAP_ISR_CFG:
 		cap = &dev->isr;
@@ -154,14 +216,38 @@ static void virtio_process_cap(struct virtio_device *dev, uint8_t cap_ptr)
 	case VIRTIO_PCI_CAP_DEVICE_CFG:
 		cap = &dev->device;
 		break;
+	case VIRTIO_PCI_CAP_SHARED_MEMORY_CFG:
+		/* Only decoded when the driver asks for a region */
+		for (i = 0; i < VIRTIO_MAX_SHM; i++) {
+			if (!dev->shm_cap[i]) {
+				dev->shm_cap[i] = cap_ptr;
+				break;
+			}
+		}
+		return;
 	default:
 		return;
 	}
 
+	/* Several capabilities of a type may exist, the first is preferred */
+	if (cap->cap_id)
+		return;
+
 	cap->bar = bar;
-	virtio_cap_set_base_addr(cap, offset);
+	virtio_cap_set_base_addr(dev, cap, offset);
 	cap->cap_id = cfg_type;
 }
+
+/**
+ * Select a queue in the common configuration structure
+ */
+static void virtio_pci_select_queue(struct virtio_device *dev, int queue)
+{
+	void *addr = dev->common.addr + offset_of(struct virtio_dev_common, q_select);
+
+	ci_write_16(addr, cpu_to_le16(queue));
+	eieio();
+}
 #endif
 
 #ifdef VIRTIO_USE_MMIO
@@ -215,6 +301,7 @@ struct virtio_device *virtio_setup_vd(void *device_base)
 {
 #ifdef VIRTIO_USE_PCI
 	uint8_t cap_ptr, cap_vndr;
+	uint16_t cmd;
 	struct virtio_device *dev;
 
 	dev = SLOF_alloc_mem(sizeof(struct virtio_device));
@@ -222,23 +309,39 @@ struct virtio_device *virtio_setup_vd(void *device_base)
 		printf("Failed to allocate memory");
 		return NULL;
 	}
+	memset(dev, 0, sizeof(struct virtio_device));
+
+	/* device_base points to the memory mapped config space of the function */
+	dev->pci_cfg = device_base;
+	dev->config_vector = VIRTIO_MSI_NO_VECTOR;
+
+	cmd = virtio_pci_cfg_read16(dev, PCI_COMMAND_REG);
+	cmd |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+	virtio_pci_cfg_write16(dev, PCI_COMMAND_REG, cmd);
 
-	cap_ptr = SLOF_pci_config_read8(PCI_CONFIG_CAP_REG);
+	cap_ptr = virtio_pci_cfg_read8(dev, PCI_CONFIG_CAP_REG);
 	while (cap_ptr != 0) {
-		cap_vndr = SLOF_pci_config_read8(cap_ptr + VIRTIO_PCI_CAP_VNDR);
+		cap_vndr = virtio_pci_cfg_read8(dev, cap_ptr + VIRTIO_PCI_CAP_VNDR);
 		if (cap_vndr == PCI_CAP_ID_VNDR)
 			virtio_process_cap(dev, cap_ptr);
-		cap_ptr = SLOF_pci_config_read8(cap_ptr+VIRTIO_PCI_CAP_NEXT);
+		else if (cap_vndr == PCI_CAP_ID_MSIX)
+			dev->msix_cap = cap_ptr;
+		cap_ptr = virtio_pci_cfg_read8(dev, cap_ptr + VIRTIO_PCI_CAP_NEXT);
 	}
 
 	if (dev->common.cap_id && dev->notify.cap_id &&
 	    dev->isr.cap_id && dev->device.cap_id) {
 		dev->features = VIRTIO_F_VERSION_1;
 	} else {
+#ifdef VIRTIO_MODERN_ONLY
+		printf("Legacy virtio device is not supported\n");
+		SLOF_free_mem(dev, sizeof(struct virtio_device));
+		return NULL;
+#endif
 		dev->features = 0;
 		dev->legacy.cap_id = 0;
 		dev->legacy.bar = 0;
-		virtio_cap_set_base_addr(&dev->legacy, 0);
+		virtio_cap_set_base_addr(dev, &dev->legacy, 0);
 	}
 	return dev;
 #elif VIRTIO_USE_MMIO
@@ -250,6 +353,7 @@ struct virtio_device *virtio_setup_vd(void *device_base)
 		printf("Failed to allocate memory");
 		return NULL;
 	}
+	memset(dev, 0, sizeof(struct virtio_device));
 	dev->mmio_base = device_base;
 
 	// Read the full 64-bit device features field
@@ -258,6 +362,11 @@ struct virtio_device *virtio_setup_vd(void *device_base)
 		dev->features = VIRTIO_F_VERSION_1;
 		dev->mmio_base = device_base;
 	} else {
+#ifdef VIRTIO_MODERN_ONLY
+		printf("Legacy virtio device is not supported\n");
+		SLOF_free_mem(dev, sizeof(struct virtio_device));
+		return NULL;
+#endif
 		dev->features = 0;
 		virtio_mmio_write32(device_base, VIRTIO_MMIO_GUEST_PAGE_SIZE, 0x1000);
 	}
@@ -280,16 +389,30 @@ unsigned long virtio_vring_size(unsigned int qsize)
 
 unsigned int virtio_get_qsize_max(struct virtio_device *dev, int queue)
 {
+#ifdef VIRTIO_USE_PCI
+	/* Before it gets written, the queue size reads as the maximum */
+	return virtio_get_qsize(dev, queue);
+#elif VIRTIO_USE_MMIO
 	virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_QUEUE_SEL, queue);
 	sync();
 
 	return virtio_mmio_read32(dev->mmio_base, VIRTIO_MMIO_QUEUE_NUM_MAX);
+#endif
 }
 
 void virtio_set_qsize(struct virtio_device *dev, uint32_t q, uint32_t qs)
 {
+#ifdef VIRTIO_USE_PCI
+	/* Legacy devices have a fixed queue size */
+	if (virtio_is_modern(dev)) {
+		virtio_pci_select_queue(dev, q);
+		ci_write_16(dev->common.addr + offset_of(struct virtio_dev_common, q_size),
+			    cpu_to_le16(qs));
+	}
+#elif VIRTIO_USE_MMIO
     virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_QUEUE_SEL, q);
     virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_QUEUE_NUM, qs);
+#endif
 }
 
 /**
@@ -303,11 +426,10 @@ unsigned int virtio_get_qsize(struct virtio_device *dev, int queue)
 #ifdef VIRTIO_USE_PCI
 	unsigned int size = 0;
 
-	if (dev->features & VIRTIO_F_VERSION_1) {
-		void *addr = dev->common.addr + offset_of(struct virtio_dev_common, q_select);
-		ci_write_16(addr, cpu_to_le16(queue));
-		eieio();
-		addr = dev->common.addr + offset_of(struct virtio_dev_common, q_size);
+	if (virtio_is_modern(dev)) {
+		void *addr = dev->common.addr + offset_of(struct virtio_dev_common, q_size);
+
+		virtio_pci_select_queue(dev, queue);
 		size = le16_to_cpu(ci_read_16(addr));
 	}
 	else {
@@ -323,7 +445,7 @@ unsigned int virtio_get_qsize(struct virtio_device *dev, int queue)
 	virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_QUEUE_SEL, queue);
 	sync();
 
-	if (dev->features & VIRTIO_F_VERSION_1) {
+	if (virtio_is_modern(dev)) {
 		return virtio_mmio_read32(dev->mmio_base, VIRTIO_MMIO_QUEUE_NUM);
 	} else {
 		// FIXME: This is always reading 0 even if it's written with a different
@@ -372,67 +494,192 @@ struct vring_used *virtio_get_vring_used(struct virtio_device *dev, int queue)
 
 /**
  * Fill the virtio ring descriptor depending on the legacy mode or virtio 1.0
+ * @return  0, or -1 if the buffer could not be mapped for the device
  */
-void virtio_fill_desc(struct vqs *vq, int id, uint64_t features,
-                      uint64_t addr, uint32_t len,
-                      uint16_t flags, uint16_t next)
+int virtio_fill_desc(struct vqs *vq, int id, uint64_t features,
+                     uint64_t addr, uint32_t len,
+                     uint16_t flags, uint16_t next)
 {
-	struct vring_desc *desc;
+	return __virtio_fill_desc(vq, id, features, addr, len, flags, next);
+}
 
-	id %= vq->size;
-	desc = &vq->desc[id];
-	next %= vq->size;
+void virtio_free_desc(struct vqs *vq, int id, uint64_t features)
+{
+	__virtio_free_desc(vq, id, features);
+}
 
-	if (features & VIRTIO_F_VERSION_1) {
-		if (features & VIRTIO_F_IOMMU_PLATFORM) {
-			void *gpa = (void *) addr;
+/**
+ * Sum up the device-writable length of a descriptor chain
+ */
+static uint32_t virtio_chain_len(struct virtio_device *dev, struct vqs *vq, int id)
+{
+	uint32_t len = 0, i;
+	uint16_t flags;
+
+	for (i = 0; i < vq->size; i++) {
+		flags = virtio_modern16_to_cpu(dev, vq->desc[id].flags);
+		if (flags & VRING_DESC_F_WRITE)
+			len += virtio_modern32_to_cpu(dev, vq->desc[id].len);
+		if (!(flags & VRING_DESC_F_NEXT))
+			break;
+		id = vq_wrap(vq, virtio_modern16_to_cpu(dev, vq->desc[id].next));
+	}
 
-			if (!vq->desc_gpas) {
-				fprintf(stderr, "IOMMU setup has not been done!\n");
-				return;
-			}
+	return len;
+}
 
-			addr = SLOF_dma_map_in(gpa, len, 0);
-			vq->desc_gpas[id] = gpa;
-		}
-		desc->addr = cpu_to_le64(addr);
-		desc->len = cpu_to_le32(len);
-		desc->flags = cpu_to_le16(flags);
-		desc->next = cpu_to_le16(next);
-	} else {
-		desc->addr = addr;
-		desc->len = len;
-		desc->flags = flags;
-		desc->next = next;
+/**
+ * Read the used buffer at ring position "pos".
+ * With VIRTIO_F_IN_ORDER the device uses buffers in the order they were made
+ * available, so the head id comes from our own "avail" ring. The device may
+ * also describe a whole batch with a single used entry carrying the id of
+ * the last buffer, hence the used ring is only read once per batch and the
+ * lengths of the skipped buffers are those of their descriptor chains.
+ * "batch_last" and "batch_len" hold the batch being walked, "batch_last"
+ * is VQ_NO_BATCH again once "pos" closes it.
+ */
+static int virtio_used_at(struct virtio_device *dev, struct vqs *vq,
+			  uint16_t pos, uint16_t *batch_last,
+			  uint32_t *batch_len, uint32_t *len)
+{
+	struct vring_used_elem *elem = &vq->used->ring[pos];
+	int id;
+
+	if (!(dev->features & VIRTIO_F_IN_ORDER)) {
+		if (len)
+			*len = virtio_modern32_to_cpu(dev, elem->len);
+		return virtio_modern32_to_cpu(dev, elem->id);
+	}
+
+	id = virtio_modern16_to_cpu(dev, vq->avail->ring[pos]);
+	if (*batch_last == VQ_NO_BATCH) {
+		*batch_last = virtio_modern32_to_cpu(dev, elem->id);
+		*batch_len = virtio_modern32_to_cpu(dev, elem->len);
 	}
+
+	if (id == *batch_last) {
+		if (len)
+			*len = *batch_len;
+		*batch_last = VQ_NO_BATCH;
+	} else if (len) {
+		*len = virtio_chain_len(dev, vq, id);
+	}
+
+	return id;
 }
 
-void virtio_free_desc(struct vqs *vq, int id, uint64_t features)
+/**
+ * Look up the next used buffer, optionally consuming it
+ */
+static int __virtio_used(struct virtio_device *dev, struct vqs *vq,
+			 uint32_t *len, int consume)
 {
-	struct vring_desc *desc;
+	uint16_t batch_last = vq->batch_last;
+	uint32_t batch_len = vq->batch_len;
+	int id;
 
-	id %= vq->size;
-	desc = &vq->desc[id];
+	if (vq->last_used_idx == virtio_modern16_to_cpu(dev, vq->used->idx))
+		return -1;
 
-	if (!(features & VIRTIO_F_VERSION_1) ||
-	    !(features & VIRTIO_F_IOMMU_PLATFORM))
-		return;
+	/* Do not read the ring entries before the index covering them */
+	sync();
 
-	if (!vq->desc_gpas[id])
-		return;
+	id = virtio_used_at(dev, vq, vq_wrap(vq, vq->last_used_idx),
+			    &batch_last, &batch_len, len);
+	/* A peek leaves the batch alone, the same entry is read again */
+	if (!consume)
+		return id;
+	vq->batch_last = batch_last;
+	vq->batch_len = batch_len;
+
+	virtio_trace(VT_USED, vq - dev->vq, id, len ? *len : 0);
+	vq->last_used_idx++;
+	if (vq->slot_next)
+		virtio_queue_put_slot(vq, vq_wrap(vq, id) / vq->slot_descs);
+	vq_stats_begin(vq);
+	vq->stats.completions++;
+	if (len)
+		vq->stats.bytes += *len;
+	vq_stats_end(vq);
+
+	return id;
+}
+
+/**
+ * Consume the next buffer from the "used" ring
+ * @param   dev  pointer to virtio device information
+ * @param   vq   virtqueue to harvest
+ * @param   len  returns the number of bytes written by the device (may be NULL)
+ * @return  head descriptor id of the used chain, -1 if nothing has been used
+ */
+int virtio_get_used(struct virtio_device *dev, struct vqs *vq, uint32_t *len)
+{
+	return __virtio_used(dev, vq, len, 1);
+}
 
-	SLOF_dma_map_out(le64_to_cpu(desc->addr), 0, le32_to_cpu(desc->len));
-	vq->desc_gpas[id] = NULL;
+/**
+ * Same as virtio_get_used() but leaves the buffer in the "used" ring
+ */
+int virtio_peek_used(struct virtio_device *dev, struct vqs *vq, uint32_t *len)
+{
+	return __virtio_used(dev, vq, len, 0);
 }
 
-size_t virtio_desc_addr(struct virtio_device *vdev, int queue, int id)
+/**
+ * Sum up the lengths of all buffers waiting in the "used" ring without
+ * consuming them, in-order batches are resolved like virtio_get_used() does
+ * @param   dev      pointer to virtio device information
+ * @param   vq       virtqueue to look at
+ * @param   max_len  limit for the length of a single buffer
+ * @return  number of bytes the device wrote into the waiting buffers
+ */
+uint32_t virtio_used_bytes(struct virtio_device *dev, struct vqs *vq,
+			   uint32_t max_len)
 {
-	struct vqs *vq = &vdev->vq[queue];
+	uint16_t idx, used_idx = virtio_modern16_to_cpu(dev, vq->used->idx);
+	uint16_t batch_last = vq->batch_last;
+	uint32_t batch_len = vq->batch_len, len, bytes = 0;
+
+	sync();
 
-	if (vq->desc_gpas)
-		return (size_t) vq->desc_gpas[id];
+	for (idx = vq->last_used_idx; idx != used_idx; idx++) {
+		virtio_used_at(dev, vq, vq_wrap(vq, idx), &batch_last,
+			       &batch_len, &len);
+		bytes += len < max_len ? len : max_len;
+	}
 
-	return (size_t) virtio_modern64_to_cpu(vdev, vq->desc[id].addr);
+	return bytes;
+}
+
+/**
+ * Busy-wait for the next used buffer of a synchronous request. Answers to
+ * such requests take microseconds, so there is no sleeping in between.
+ * After a timeout the device may still access the buffers of the request,
+ * callers have to stop reusing them.
+ * @param   dev         pointer to virtio device information
+ * @param   vq          virtqueue the request was posted to
+ * @param   len         returns the number of bytes written by the device
+ *                      (may be NULL)
+ * @param   timeout_ms  how long to wait
+ * @return  head descriptor id of the used chain, -ETIMEDOUT if nothing was
+ *          used in time
+ */
+int virtio_wait_used(struct virtio_device *dev, struct vqs *vq, uint32_t *len,
+		     uint32_t timeout_ms)
+{
+	uint64_t deadline = get_ticks() + get_tick_freq() * timeout_ms / 1000;
+	int id;
+
+	while ((id = virtio_get_used(dev, vq, len)) < 0)
+		if (get_ticks() > deadline)
+			return -ETIMEDOUT;
+
+	return id;
+}
+
+size_t virtio_desc_addr(struct virtio_device *vdev, int queue, int id)
+{
+	return __virtio_desc_addr(vdev, queue, id);
 }
 
 /**
@@ -446,8 +693,14 @@ void virtio_reset_device(struct virtio_device *dev)
 
 void virtio_queue_ready(struct virtio_device *dev, int queue)
 {
-#if VIRTIO_USE_MMIO
-	if (dev->features & VIRTIO_F_VERSION_1) {
+#ifdef VIRTIO_USE_PCI
+	if (virtio_is_modern(dev)) {
+		virtio_pci_select_queue(dev, queue);
+		ci_write_16(dev->common.addr + offset_of(struct virtio_dev_common, q_enable),
+			    cpu_to_le16(1));
+	}
+#elif VIRTIO_USE_MMIO
+	if (virtio_is_modern(dev)) {
 		virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_QUEUE_SEL, queue);
 		sync();
 		virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_QUEUE_READY, 1);
@@ -460,37 +713,23 @@ void virtio_queue_ready(struct virtio_device *dev, int queue)
  */
 void virtio_queue_notify(struct virtio_device *dev, int queue)
 {
-#ifdef VIRTIO_USE_PCI
-	if (dev->features & VIRTIO_F_VERSION_1) {
-		void *q_sel = dev->common.addr + offset_of(struct virtio_dev_common, q_select);
-		void *q_ntfy = dev->common.addr + offset_of(struct virtio_dev_common, q_notify_off);
-		void *addr;
-		uint16_t q_notify_off;
-
-		ci_write_16(q_sel, cpu_to_le16(queue));
-		eieio();
-		q_notify_off = le16_to_cpu(ci_read_16(q_ntfy));
-		addr = dev->notify.addr + q_notify_off * dev->notify_off_mul;
-		ci_write_16(addr, cpu_to_le16(queue));
-	} else {
-		ci_write_16(dev->legacy.addr+VIRTIOHDR_QUEUE_NOTIFY, cpu_to_le16(queue));
-	}
-#elif VIRTIO_USE_MMIO
-	virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_QUEUE_NOTIFY, queue);
-#endif
+	__virtio_queue_notify(dev, queue);
 }
 
 /**
  * Set queue address
+ * @return  0, or -1 if MSI-X is in use and the device takes no vector for
+ *          the queue, which would then never interrupt
  */
-static void virtio_set_qaddr(struct virtio_device *dev, int queue, struct vqs *vq)
+static int virtio_set_qaddr(struct virtio_device *dev, int queue, struct vqs *vq)
 {
 #ifdef VIRTIO_USE_PCI
-	if (dev->features & VIRTIO_F_VERSION_1) {
-		uint64_t q_desc = qaddr;
+	if (virtio_is_modern(dev)) {
+		uint64_t q_desc = vq->pa;
 		uint64_t q_avail;
 		uint64_t q_used;
 		uint32_t q_size = virtio_get_qsize(dev, queue);
+		uint16_t q_notify_off, vector;
 
 		if (dev->features & VIRTIO_F_IOMMU_PLATFORM) {
 			unsigned long cb;
@@ -512,21 +751,42 @@ static void virtio_set_qaddr(struct virtio_device *dev, int queue, struct vqs *v
 		virtio_pci_write64(dev->common.addr + offset_of(struct virtio_dev_common, q_avail), q_avail);
 		q_used = VQ_ALIGN(q_avail + sizeof(struct vring_avail) + sizeof(uint16_t) * q_size);
 		virtio_pci_write64(dev->common.addr + offset_of(struct virtio_dev_common, q_used), q_used);
-		ci_write_16(dev->common.addr + offset_of(struct virtio_dev_common, q_enable), cpu_to_le16(1));
+
+		/*
+		 * Queue interrupts go to their own vector if MSI-X is in use. A
+		 * device short of resources may refuse it, the queue then shares
+		 * the configuration vector.
+		 */
+		if (dev->msix_vectors) {
+			vector = dev->msix_vectors > 1 ?
+				 1 + queue % (dev->msix_vectors - 1) : 0;
+			if (virtio_set_queue_vector(dev, queue, vector)) {
+				printf("virtio: Queue %d refused MSI-X vector %d\n",
+				       queue, vector);
+				if (!vector || virtio_set_queue_vector(dev, queue, 0))
+					return -1;
+			}
+		}
+
+		/* Resolve the notification address once instead of on every kick */
+		q_notify_off = le16_to_cpu(ci_read_16(dev->common.addr +
+				offset_of(struct virtio_dev_common, q_notify_off)));
+		vq->notify_addr = dev->notify.addr + q_notify_off * dev->notify_off_mul;
 	} else {
-		uint32_t val = qaddr;
+		uint32_t val = vq->pa;
 		val = val >> 12;
 		ci_write_16(dev->legacy.addr+VIRTIOHDR_QUEUE_SELECT,
 			    cpu_to_le16(queue));
 		eieio();
 		ci_write_32(dev->legacy.addr+VIRTIOHDR_QUEUE_ADDRESS,
 			    cpu_to_le32(val));
+		vq->notify_addr = dev->legacy.addr+VIRTIOHDR_QUEUE_NOTIFY;
 	}
 #elif VIRTIO_USE_MMIO
 	virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_QUEUE_SEL, queue);
 	sync();
 
-	if (dev->features & VIRTIO_F_VERSION_1) {
+	if (virtio_is_modern(dev)) {
 		uint64_t q_desc = vq->pa + ((uint64_t)vq->desc - (uint64_t)vq->desc);
 		uint64_t q_avail = vq->pa + ((uint64_t)vq->avail - (uint64_t)vq->desc);
 		uint64_t q_used = vq->pa + ((uint64_t)vq->used - (uint64_t)vq->desc);
@@ -548,6 +808,8 @@ static void virtio_set_qaddr(struct virtio_device *dev, int queue, struct vqs *v
 		virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_QUEUE_ALIGN, 0x1000);
 	}
 #endif
+
+	return 0;
 }
 
 static inline void virtq_init(struct vqs *vq, unsigned int num, void *p,
@@ -578,6 +840,9 @@ struct vqs *virtio_queue_init_vq(struct virtio_device *dev, unsigned int id)
 	vq = &dev->vq[id];
 
 	memset(vq, 0, sizeof(*vq));
+	vq->batch_last = VQ_NO_BATCH;
+	vq->msix_vector = VIRTIO_MSI_NO_VECTOR;
+	vq->cpu = VIRTIO_CPU_ANY;
 
 	vq->size = virtio_get_qsize_max(dev, id);
 	vq->desc = SLOF_alloc_mem_aligned(virtio_vring_size(vq->size), 4096, &vq->pa);
@@ -611,8 +876,11 @@ struct vqs *virtio_queue_init_vq(struct virtio_device *dev, unsigned int id)
 
 	memset(vq->desc, 0, virtio_vring_size(vq->size));
 	virtio_set_qsize(dev, id, vq->size);
-	virtio_set_qaddr(dev, id, vq);
-	virtio_queue_ready(dev, 0);
+	if (virtio_set_qaddr(dev, id, vq)) {
+		virtio_queue_term_vq(dev, vq, id);
+		return NULL;
+	}
+	virtio_queue_ready(dev, id);
 	vq->avail->flags = virtio_cpu_to_modern16(dev, VRING_AVAIL_F_NO_INTERRUPT);
 	vq->avail->idx = 0;
 	if (dev->features & VIRTIO_F_IOMMU_PLATFORM)
@@ -624,6 +892,12 @@ struct vqs *virtio_queue_init_vq(struct virtio_device *dev, unsigned int id)
 
 void virtio_queue_term_vq(struct virtio_device *dev, struct vqs *vq, unsigned int id)
 {
+	if (vq->tokens)
+		SLOF_free_mem(vq->tokens, vq->size * sizeof(vq->tokens[0]));
+	if (vq->mp_ready)
+		SLOF_free_mem(vq->mp_ready, vq->size * sizeof(vq->mp_ready[0]));
+	if (vq->slot_next)
+		SLOF_free_mem(vq->slot_next, vq->size * sizeof(vq->slot_next[0]));
 	if (vq->desc_gpas) {
 		uint32_t i;
 
@@ -659,7 +933,7 @@ void virtio_queue_term_vq(struct virtio_device *dev, struct vqs *vq, unsigned in
 void virtio_set_status(struct virtio_device *dev, int status)
 {
 #ifdef VIRTIO_USE_PCI
-	if (dev->features & VIRTIO_F_VERSION_1) {
+	if (virtio_is_modern(dev)) {
 		ci_write_8(dev->common.addr +
 			   offset_of(struct virtio_dev_common, dev_status), status);
 	} else {
@@ -676,7 +950,7 @@ void virtio_set_status(struct virtio_device *dev, int status)
 void virtio_get_status(struct virtio_device *dev, int *status)
 {
 #ifdef VIRTIO_USE_PCI
-	if (dev->features & VIRTIO_F_VERSION_1) {
+	if (virtio_is_modern(dev)) {
 		*status = ci_read_8(dev->common.addr +
 				    offset_of(struct virtio_dev_common, dev_status));
 	} else {
@@ -692,7 +966,13 @@ void virtio_get_status(struct virtio_device *dev, int *status)
  */
 void virtio_get_interrupt_status(struct virtio_device *dev, uint32_t *status)
 {
-#if VIRTIO_USE_MMIO
+#ifdef VIRTIO_USE_PCI
+	/* Reading the ISR status also acknowledges the interrupt */
+	if (virtio_is_modern(dev))
+		*status = ci_read_8(dev->isr.addr);
+	else
+		*status = ci_read_8(dev->legacy.addr+VIRTIOHDR_ISR_STATUS);
+#elif VIRTIO_USE_MMIO
 	*status = virtio_mmio_read32(dev->mmio_base, VIRTIO_MMIO_INTERRUPT_STATUS);
 #endif
 }
@@ -706,6 +986,625 @@ void virtio_interrupt_ack(struct virtio_device *dev, uint32_t ack)
 	virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_INTERRUPT_ACK, ack);
 #endif
 }
+
+#ifdef VIRTIO_USE_PCI
+/**
+ * Switch the device to MSI-X. Vector 0 is used for configuration changes and
+ * every queue set up afterwards gets a vector of its own (shared round robin
+ * if the device has fewer vectors than queues, and shared with configuration
+ * changes if it has only one). All table entries are masked
+ * until the platform programs them with virtio_msix_set_entry().
+ * Must be called before the queues are initialized.
+ * @param   dev  pointer to virtio device information
+ * @return  number of vectors, or -1 if the device has no MSI-X support
+ */
+int virtio_msix_enable(struct virtio_device *dev)
+{
+	struct virtio_cap table;
+	uint16_t ctrl;
+	uint32_t off;
+	int i;
+
+	if (!dev->msix_cap || !virtio_is_modern(dev))
+		return -1;
+
+	ctrl = virtio_pci_cfg_read16(dev, dev->msix_cap + PCI_MSIX_FLAGS);
+	off = virtio_pci_cfg_read32(dev, dev->msix_cap + PCI_MSIX_TABLE);
+
+	memset(&table, 0, sizeof(table));
+	table.bar = off & PCI_MSIX_TABLE_BIR;
+	virtio_cap_set_base_addr(dev, &table, off & ~PCI_MSIX_TABLE_BIR);
+	dev->msix_table = table.addr;
+	dev->msix_vectors = (ctrl & PCI_MSIX_FLAGS_QSIZE) + 1;
+
+	for (i = 0; i < dev->msix_vectors; i++)
+		ci_write_32(dev->msix_table + i * PCI_MSIX_ENTRY_SIZE +
+			    PCI_MSIX_ENTRY_VECTOR_CTRL,
+			    cpu_to_le32(PCI_MSIX_ENTRY_CTRL_MASKBIT));
+
+	ctrl &= ~PCI_MSIX_FLAGS_MASKALL;
+	ctrl |= PCI_MSIX_FLAGS_ENABLE;
+	virtio_pci_cfg_write16(dev, dev->msix_cap + PCI_MSIX_FLAGS, ctrl);
+
+	if (virtio_set_config_vector(dev, 0)) {
+		/* Back to INTx, which MSI-X enable turned off */
+		ctrl &= ~PCI_MSIX_FLAGS_ENABLE;
+		virtio_pci_cfg_write16(dev, dev->msix_cap + PCI_MSIX_FLAGS, ctrl);
+		dev->msix_vectors = 0;
+		dev->msix_table = NULL;
+		return -1;
+	}
+
+	return dev->msix_vectors;
+}
+
+/**
+ * Program the message of an MSI-X vector and unmask it
+ */
+void virtio_msix_set_entry(struct virtio_device *dev, uint16_t vector,
+			   uint64_t addr, uint32_t data)
+{
+	void *entry = dev->msix_table + vector * PCI_MSIX_ENTRY_SIZE;
+
+	if (vector >= dev->msix_vectors)
+		return;
+
+	ci_write_32(entry + PCI_MSIX_ENTRY_LOWER_ADDR, cpu_to_le32(addr & 0xFFFFFFFF));
+	ci_write_32(entry + PCI_MSIX_ENTRY_UPPER_ADDR, cpu_to_le32(addr >> 32));
+	ci_write_32(entry + PCI_MSIX_ENTRY_DATA, cpu_to_le32(data));
+	eieio();
+	ci_write_32(entry + PCI_MSIX_ENTRY_VECTOR_CTRL, 0);
+}
+
+/**
+ * Route configuration change interrupts to an MSI-X vector
+ * @return  0 on success, -1 if the device refused the vector
+ */
+int virtio_set_config_vector(struct virtio_device *dev, uint16_t vector)
+{
+	void *addr = dev->common.addr + offset_of(struct virtio_dev_common, msix_config);
+
+	ci_write_16(addr, cpu_to_le16(vector));
+	if (le16_to_cpu(ci_read_16(addr)) != vector)
+		return -1;
+
+	dev->config_vector = vector;
+	return 0;
+}
+
+/**
+ * Route the interrupts of a queue to an MSI-X vector
+ * @return  0 on success, -1 if the device refused the vector
+ */
+int virtio_set_queue_vector(struct virtio_device *dev, int queue,
+			    uint16_t vector)
+{
+	void *addr = dev->common.addr + offset_of(struct virtio_dev_common, q_msix_vec);
+
+	virtio_pci_select_queue(dev, queue);
+	ci_write_16(addr, cpu_to_le16(vector));
+	if (le16_to_cpu(ci_read_16(addr)) != vector)
+		return -1;
+
+	dev->vq[queue].msix_vector = vector;
+	return 0;
+}
+
+/**
+ * MSI-X interrupt entry point. Unlike virtio_handle_interrupt() there is
+ * no shared status register to read, the vector tells what happened. On a
+ * device with a single vector the config handler runs on queue interrupts
+ * too and must tolerate finding nothing changed.
+ * @param   dev     pointer to virtio device information
+ * @param   vector  the MSI-X vector which fired
+ */
+void virtio_handle_vector(struct virtio_device *dev, uint16_t vector)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(dev->vq); i++) {
+		struct vqs *vq = &dev->vq[i];
+
+		if (vq->msix_vector == vector && vq->handler && vq->desc &&
+		    virtio_used_pending(dev, vq)) {
+			vq_stat_add_atomic(vq, interrupts, 1);
+			virtio_trace(VT_IRQ, i,
+				     virtio_modern16_to_cpu(dev, vq->used->idx),
+				     vector);
+			vq->handler(dev, vq, vq->handler_arg);
+		}
+	}
+
+	if (vector == dev->config_vector && dev->config_handler)
+		dev->config_handler(dev, dev->config_arg);
+}
+#endif
+
+/**
+ * Register the callback run by virtio_handle_interrupt() when the device
+ * used buffers of a queue. Must be called after virtio_queue_init_vq().
+ */
+void virtio_queue_set_handler(struct virtio_device *dev, int queue,
+			      virtio_queue_handler_t handler, void *arg)
+{
+	struct vqs *vq = &dev->vq[queue];
+
+	vq->handler_arg = arg;
+	vq->handler = handler;
+}
+
+/**
+ * Register the callback run on a configuration change interrupt
+ */
+void virtio_set_config_handler(struct virtio_device *dev,
+			       virtio_config_handler_t handler, void *arg)
+{
+	dev->config_arg = arg;
+	dev->config_handler = handler;
+}
+
+/**
+ * Interrupt dispatcher. Reads and acks the interrupt status once, then runs
+ * the handlers of the queues which have pending used buffers and, on a
+ * configuration change, the config handler.
+ * @param   dev  pointer to virtio device information
+ * @return  the interrupt status bits that have been handled
+ */
+uint32_t virtio_handle_interrupt(struct virtio_device *dev)
+{
+	uint32_t status = 0;
+	unsigned int i;
+
+	virtio_get_interrupt_status(dev, &status);
+	if (!status)
+		return 0;
+	virtio_interrupt_ack(dev, status);
+
+	if (status & VIRTIO_INT_VRING) {
+		for (i = 0; i < ARRAY_SIZE(dev->vq); i++) {
+			struct vqs *vq = &dev->vq[i];
+
+			if (vq->handler && vq->desc &&
+			    virtio_queue_is_local(vq) &&
+			    virtio_used_pending(dev, vq)) {
+				vq_stat_add_atomic(vq, interrupts, 1);
+				virtio_trace(VT_IRQ, i,
+					     virtio_modern16_to_cpu(dev, vq->used->idx),
+					     status);
+				vq->handler(dev, vq, vq->handler_arg);
+			}
+		}
+	}
+
+	if ((status & VIRTIO_INT_CONFIG) && dev->config_handler)
+		dev->config_handler(dev, dev->config_arg);
+
+	return status;
+}
+
+/* Whether two queues raise the same interrupt */
+static int virtio_irq_shared(struct vqs *a, struct vqs *b)
+{
+#ifdef VIRTIO_USE_PCI
+	/* Without MSI-X both have no vector and share the INTx line */
+	return a->msix_vector == b->msix_vector;
+#elif VIRTIO_USE_MMIO
+	return 1;
+#endif
+}
+
+/**
+ * Pin a queue to a CPU. The queue is then only meant to be serviced there:
+ * completion handler, buffers and statistics stay in that CPU's cache.
+ * The queue's interrupt is routed to the CPU, as only then can the
+ * dispatchers tell the CPUs apart. virtio_handle_interrupt() does not run
+ * the handlers of queues pinned to other CPUs.
+ *
+ * Only queues with an MSI-X vector of their own can be pinned one by one.
+ * An interrupt line or vector shared by several queues, e.g. the single
+ * line of virtio-mmio, takes all of them along: they are pinned together,
+ * and pinning one of them to another CPU than the rest is refused.
+ *
+ * Routing needs the platform hooks SLOF_irq_set_affinity() and
+ * SLOF_get_cpu(). Where they are stubs, nothing can be pinned and queues
+ * are serviced on any CPU.
+ * @param   dev    pointer to virtio device information
+ * @param   queue  virtio queue number
+ * @param   cpu    CPU number, or VIRTIO_CPU_ANY to unpin
+ * @return  0 if the queue has been pinned, -EBUSY if a queue sharing its
+ *          interrupt is pinned elsewhere, -EOPNOTSUPP if the platform
+ *          cannot route the interrupt
+ */
+int virtio_queue_set_affinity(struct virtio_device *dev, int queue, int cpu)
+{
+	struct vqs *vq = &dev->vq[queue];
+	unsigned int i;
+	int rc = 0;
+
+	if (cpu != VIRTIO_CPU_ANY) {
+		for (i = 0; i < ARRAY_SIZE(dev->vq); i++)
+			if (&dev->vq[i] != vq && dev->vq[i].desc &&
+			    virtio_irq_shared(&dev->vq[i], vq) &&
+			    dev->vq[i].cpu != VIRTIO_CPU_ANY &&
+			    dev->vq[i].cpu != cpu)
+				return -EBUSY;
+#ifdef VIRTIO_USE_PCI
+		rc = SLOF_irq_set_affinity(dev->pci_cfg, vq->msix_vector, cpu);
+#elif VIRTIO_USE_MMIO
+		rc = SLOF_irq_set_affinity(dev->mmio_base, VIRTIO_MSI_NO_VECTOR, cpu);
+#endif
+		if (rc)
+			return -EOPNOTSUPP;
+	}
+
+	/* The queues sharing the interrupt are serviced where it goes */
+	for (i = 0; i < ARRAY_SIZE(dev->vq); i++)
+		if (&dev->vq[i] == vq ||
+		    (dev->vq[i].desc && virtio_irq_shared(&dev->vq[i], vq)))
+			dev->vq[i].cpu = cpu;
+
+	return 0;
+}
+
+/**
+ * Get the CPU a queue is pinned to, VIRTIO_CPU_ANY if there is none
+ */
+int virtio_queue_get_affinity(struct virtio_device *dev, int queue)
+{
+	return dev->vq[queue].cpu;
+}
+
+/**
+ * Take a consistent snapshot of the statistics of a queue. May be called
+ * from any CPU, it never blocks the queue owner.
+ * @param   dev    pointer to virtio device information
+ * @param   queue  virtio queue number
+ * @param   stats  receives the counters
+ */
+void virtio_queue_get_stats(struct virtio_device *dev, int queue,
+			    struct virtio_vq_stats *stats)
+{
+	struct virtio_vq_stats *s = &dev->vq[queue].stats;
+	uint32_t seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&s->writers, __ATOMIC_ACQUIRE)) {
+			cpu_relax();
+			continue;
+		}
+		stats->max_inflight = __atomic_load_n(&s->max_inflight, __ATOMIC_RELAXED);
+		stats->posted = __atomic_load_n(&s->posted, __ATOMIC_RELAXED);
+		stats->completions = __atomic_load_n(&s->completions, __ATOMIC_RELAXED);
+		stats->kicks = __atomic_load_n(&s->kicks, __ATOMIC_RELAXED);
+		stats->kicks_suppressed = __atomic_load_n(&s->kicks_suppressed, __ATOMIC_RELAXED);
+		stats->interrupts = __atomic_load_n(&s->interrupts, __ATOMIC_RELAXED);
+		stats->bytes = __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+		stats->ring_full = __atomic_load_n(&s->ring_full, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (!__atomic_load_n(&s->writers, __ATOMIC_RELAXED) &&
+		    __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+
+	stats->seq = seq;
+	stats->writers = 0;
+}
+
+/**
+ * Prepare a completion for a new request
+ */
+void virtio_completion_init(struct virtio_completion *c)
+{
+	c->done = 0;
+	c->woken = 0;
+	c->status = 0;
+	c->len = 0;
+	c->waker = NULL;
+	c->waker_arg = NULL;
+}
+
+/* Call the waker unless the other side of a race already did */
+static void virtio_completion_wake(struct virtio_completion *c)
+{
+	if (!__atomic_exchange_n(&c->woken, 1, __ATOMIC_ACQ_REL))
+		c->waker(c, c->waker_arg);
+}
+
+/**
+ * Register the function to call when the request completes. If it has
+ * completed already, the waker is called right away.
+ */
+void virtio_completion_set_waker(struct virtio_completion *c,
+				 virtio_waker_t waker, void *arg)
+{
+	c->waker_arg = arg;
+	__atomic_store_n(&c->waker, waker, __ATOMIC_SEQ_CST);
+	if (waker && __atomic_load_n(&c->done, __ATOMIC_SEQ_CST))
+		virtio_completion_wake(c);
+}
+
+/**
+ * Whether the request completed. c->status and c->len are valid then.
+ */
+int virtio_completion_is_done(struct virtio_completion *c)
+{
+	return __atomic_load_n(&c->done, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Complete a request and call its waker
+ * @param   c       completion attached to the request
+ * @param   status  0 or a negative error code
+ */
+void virtio_complete(struct virtio_completion *c, int status)
+{
+	c->status = status;
+	__atomic_store_n(&c->done, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&c->waker, __ATOMIC_SEQ_CST))
+		virtio_completion_wake(c);
+}
+
+/**
+ * Enable completion tracking on a queue. The queue's used buffers must
+ * then only be consumed with virtio_queue_harvest() and
+ * virtio_queue_complete_all().
+ * @return  0 on success, -1 if memory allocation failed
+ */
+int virtio_queue_set_completions(struct virtio_device *dev, int queue,
+				 int enable)
+{
+	struct vqs *vq = &dev->vq[queue];
+
+	if (!enable) {
+		if (vq->tokens)
+			SLOF_free_mem(vq->tokens, vq->size * sizeof(vq->tokens[0]));
+		vq->tokens = NULL;
+		return 0;
+	}
+
+	if (!vq->tokens) {
+		vq->tokens = SLOF_alloc_mem(vq->size * sizeof(vq->tokens[0]));
+		if (!vq->tokens)
+			return -1;
+	}
+	memset(vq->tokens, 0, vq->size * sizeof(vq->tokens[0]));
+
+	return 0;
+}
+
+/**
+ * Consume used buffers up to the next one with a completion attached
+ * @param   dev  pointer to virtio device information
+ * @param   vq   virtqueue with completion tracking enabled
+ * @return  the completion with len filled in, which the caller finishes
+ *          with virtio_complete(), or NULL if nothing more was used
+ */
+struct virtio_completion *virtio_queue_harvest(struct virtio_device *dev,
+					       struct vqs *vq)
+{
+	struct virtio_completion *c;
+	uint32_t len;
+	int id;
+
+	while ((id = virtio_get_used(dev, vq, &len)) >= 0) {
+		id = vq_wrap(vq, id);
+		c = vq->tokens[id];
+		if (!c)
+			continue;
+
+		vq->tokens[id] = NULL;
+		c->len = len;
+		return c;
+	}
+
+	return NULL;
+}
+
+/**
+ * Stop tracking a request whose waiter gave up. Its buffers stay with the
+ * device, which may still use them, but the completion is not touched any
+ * more.
+ * @return  head descriptor id the completion was tracked at, -1 if it was
+ *          not tracked on this queue
+ */
+int virtio_queue_untrack(struct vqs *vq, struct virtio_completion *c)
+{
+	unsigned int i;
+
+	for (i = 0; i < vq->size; i++)
+		if (vq->tokens[i] == c) {
+			vq->tokens[i] = NULL;
+			return i;
+		}
+
+	return -1;
+}
+
+/**
+ * Complete every used request of a queue successfully, for devices which
+ * report no status of their own
+ * @return  number of requests completed
+ */
+int virtio_queue_complete_all(struct virtio_device *dev, struct vqs *vq)
+{
+	struct virtio_completion *c;
+	int n = 0;
+
+	while ((c = virtio_queue_harvest(dev, vq))) {
+		virtio_complete(c, 0);
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ * Give a queue a free list of request slots, for drivers whose requests
+ * complete out of order. Slot n owns the descriptors n * descs up to
+ * (n + 1) * descs - 1 and is taken with virtio_queue_get_slot(). It is
+ * free again once its chain has been consumed from the used ring, see
+ * virtio_get_used() and virtio_queue_harvest().
+ * @param   dev    pointer to virtio device information
+ * @param   queue  virtio queue number
+ * @param   nr     number of slots, at most the queue size / descs
+ * @param   descs  descriptors per slot, 0 to remove the slots
+ * @return  0 on success, -1 if memory allocation failed
+ */
+int virtio_queue_set_slots(struct virtio_device *dev, int queue,
+			   unsigned int nr, unsigned int descs)
+{
+	struct vqs *vq = &dev->vq[queue];
+	unsigned int i;
+
+	if (!descs) {
+		if (vq->slot_next)
+			SLOF_free_mem(vq->slot_next, vq->size * sizeof(vq->slot_next[0]));
+		vq->slot_next = NULL;
+		return 0;
+	}
+
+	if (!vq->slot_next) {
+		vq->slot_next = SLOF_alloc_mem(vq->size * sizeof(vq->slot_next[0]));
+		if (!vq->slot_next)
+			return -1;
+	}
+
+	if (nr > vq->size / descs)
+		nr = vq->size / descs;
+	for (i = 0; i < nr; i++)
+		vq->slot_next[i] = i + 1 < nr ? i + 1 : -1;
+	vq->slot_free = nr ? 0 : -1;
+	vq->slot_descs = descs;
+
+	return 0;
+}
+
+/**
+ * Take a free request slot, see virtio_queue_set_slots()
+ * @return  the slot, -1 if all slots are in flight
+ */
+int virtio_queue_get_slot(struct vqs *vq)
+{
+	int slot = vq->slot_free;
+
+	if (slot < 0) {
+		vq_stat_add(vq, ring_full, 1);
+		return -1;
+	}
+	vq->slot_free = vq->slot_next[slot];
+
+	return slot;
+}
+
+/**
+ * Switch a queue between single-owner and multi-producer submission.
+ * Must not race with submissions, i.e. be called while the queue is idle.
+ * @return  0 on success, -1 if memory allocation failed
+ */
+int virtio_queue_set_mp(struct virtio_device *dev, int queue, int enable)
+{
+	struct vqs *vq = &dev->vq[queue];
+	uint16_t idx;
+	uint32_t i;
+
+	if (!enable) {
+		if (vq->mp_ready)
+			SLOF_free_mem(vq->mp_ready, vq->size * sizeof(vq->mp_ready[0]));
+		vq->mp_ready = NULL;
+		return 0;
+	}
+
+	if (!vq->mp_ready) {
+		vq->mp_ready = SLOF_alloc_mem(vq->size * sizeof(vq->mp_ready[0]));
+		if (!vq->mp_ready)
+			return -1;
+	}
+	vq->reserve_idx = virtio_modern16_to_cpu(dev, vq->avail->idx);
+	vq->publish_idx = vq->reserve_idx;
+
+	/* Mark each slot unfilled for the next index landing in it, a plain 0
+	 * would read as filled for index 0xffff */
+	for (i = 0; i < vq->size; i++) {
+		idx = vq->reserve_idx + i;
+		vq->mp_ready[vq_wrap(vq, idx)] = idx;
+	}
+
+	return 0;
+}
+
+/**
+ * Multi-producer submission: reserve the next avail slot
+ * @param   dev    pointer to virtio device information
+ * @param   vq     virtqueue in multi-producer mode
+ * @param   limit  number of slots the driver can have in flight
+ * @return  the reserved avail index, -1 if the ring is full
+ */
+int virtio_queue_reserve(struct virtio_device *dev, struct vqs *vq,
+			 unsigned int limit)
+{
+	uint16_t idx, used;
+
+	idx = __atomic_load_n(&vq->reserve_idx, __ATOMIC_RELAXED);
+	do {
+		used = virtio_modern16_to_cpu(dev, vq->used->idx);
+		if ((uint16_t) (idx - used) >= limit) {
+			vq_stat_add(vq, ring_full, 1);
+			return -1;
+		}
+	} while (!__atomic_compare_exchange_n(&vq->reserve_idx, &idx, idx + 1, 1,
+					      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	return idx;
+}
+
+/**
+ * Multi-producer submission: hand a filled slot over to the device. The
+ * producer completing a contiguous run of filled slots advances avail->idx
+ * over all of them; a slot behind a still unfilled one gets published by
+ * the producer of the latter.
+ * @param   dev   pointer to virtio device information
+ * @param   vq    virtqueue in multi-producer mode
+ * @param   idx   avail index returned by virtio_queue_reserve()
+ * @param   head  first descriptor of the chain
+ * @return  1 if avail->idx was advanced and the device should be notified
+ */
+int virtio_queue_publish(struct virtio_device *dev, struct vqs *vq,
+			 uint16_t idx, uint16_t head)
+{
+	uint16_t pub, end, cur;
+
+	vq->avail->ring[vq_wrap(vq, idx)] = virtio_cpu_to_modern16(dev, head);
+
+	/* Sequentially consistent, so that of two producers finishing at the
+	 * same time at least one sees the other's slot as filled */
+	__atomic_store_n(&vq->mp_ready[vq_wrap(vq, idx)], (uint16_t) (idx + 1),
+			 __ATOMIC_SEQ_CST);
+
+	pub = __atomic_load_n(&vq->publish_idx, __ATOMIC_SEQ_CST);
+	do {
+		end = pub;
+		while (__atomic_load_n(&vq->mp_ready[vq_wrap(vq, end)],
+				       __ATOMIC_SEQ_CST) == (uint16_t) (end + 1))
+			end++;
+		if (end == pub)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&vq->publish_idx, &pub, end, 0,
+					      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+	/* Descriptors and ring entries must be visible before the index */
+	sync();
+
+	/* A later run may have been published already, never move back */
+	cur = __atomic_load_n(&vq->avail->idx, __ATOMIC_RELAXED);
+	while ((int16_t) (end - virtio_modern16_to_cpu(dev, cur)) > 0 &&
+	       !__atomic_compare_exchange_n(&vq->avail->idx, &cur,
+					    virtio_cpu_to_modern16(dev, end), 0,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	return 1;
+}
 /**
  * Set guest feature bits
  */
@@ -713,7 +1612,7 @@ void virtio_set_guest_features(struct virtio_device *dev, uint64_t features)
 
 {
 #ifdef VIRTIO_USE_PCI
-	if (dev->features & VIRTIO_F_VERSION_1) {
+	if (virtio_is_modern(dev)) {
 		uint32_t f1 = (features >> 32) & 0xFFFFFFFF;
 		uint32_t f0 = features & 0xFFFFFFFF;
 		void *addr = dev->common.addr;
@@ -752,7 +1651,7 @@ uint64_t virtio_get_host_features(struct virtio_device *dev)
 {
 #ifdef VIRTIO_USE_PCI
 	uint64_t features = 0;
-	if (dev->features & VIRTIO_F_VERSION_1) {
+	if (virtio_is_modern(dev)) {
 		uint32_t f0 = 0, f1 = 0;
 		void *addr = dev->common.addr;
 
@@ -782,6 +1681,17 @@ uint64_t virtio_get_host_features(struct virtio_device *dev)
 }
 
 int virtio_negotiate_guest_features(struct virtio_device *dev, uint64_t features)
+{
+	return virtio_negotiate_guest_features_mask(dev, features, 0);
+}
+
+/**
+ * Same as virtio_negotiate_guest_features() for drivers which cannot
+ * handle some of the features a device may offer
+ * @param   refused  device features which are never accepted
+ */
+int virtio_negotiate_guest_features_mask(struct virtio_device *dev,
+					 uint64_t features, uint64_t refused)
 {
 	uint64_t host_features = 0;
 	int status;
@@ -793,6 +1703,14 @@ int virtio_negotiate_guest_features(struct virtio_device *dev, uint64_t features
 		return -1;
 	}
 	host_features &= ~BIT(12); // ~ VIRTIO_BLK_F_MQ
+	host_features &= ~refused;
+
+	/*
+	 * Optional ring features change how the rings are used, so they are
+	 * only accepted if the driver asked for them and the device offers them
+	 */
+	features &= host_features | ~VIRTIO_F_OPTIONAL;
+	host_features &= features | ~VIRTIO_F_OPTIONAL;
 	features |= host_features;
 
 	if (host_features & VIRTIO_F_IOMMU_PLATFORM)
@@ -819,6 +1737,209 @@ int virtio_negotiate_guest_features(struct virtio_device *dev, uint64_t features
 	return 0;
 }
 
+/**
+ * Wait until the device has used every chain made available on a queue,
+ * e.g. to let transmissions finish before virtio_suspend().
+ * @param   dev         pointer to virtio device information
+ * @param   queue       virtio queue number
+ * @param   timeout_ms  how long to wait
+ * @return  0 when the queue is idle, -EBUSY on timeout
+ */
+int virtio_queue_quiesce(struct virtio_device *dev, int queue,
+			 uint32_t timeout_ms)
+{
+	struct vqs *vq = &dev->vq[queue];
+
+	for (;;) {
+		if (vq->avail->idx == vq->used->idx &&
+		    (!vq->mp_ready || vq->reserve_idx == vq->publish_idx))
+			return 0;
+		if (!timeout_ms--)
+			return -EBUSY;
+		SLOF_msleep(1);
+	}
+}
+
+static void virtio_reverse16(uint16_t *a, uint32_t n)
+{
+	uint16_t t;
+	uint32_t i;
+
+	for (i = 0; i < n / 2; i++) {
+		t = a[i];
+		a[i] = a[n - 1 - i];
+		a[n - 1 - i] = t;
+	}
+}
+
+static void virtio_reverse_used(struct vring_used_elem *a, uint32_t n)
+{
+	struct vring_used_elem t;
+	uint32_t i;
+
+	for (i = 0; i < n / 2; i++) {
+		t = a[i];
+		a[i] = a[n - 1 - i];
+		a[n - 1 - i] = t;
+	}
+}
+
+/*
+ * A device restarts a queue at index 0. Rebase the ring so that the chains
+ * it has not used yet start at position 0 of the avail ring, and the used
+ * entries the driver has not consumed yet end just before it. Both rings
+ * are rotated in place, descriptors stay where they are.
+ */
+static void virtio_ring_rebase(struct virtio_device *dev, struct vqs *vq)
+{
+	uint16_t used_idx = virtio_modern16_to_cpu(dev, vq->used->idx);
+	uint16_t avail_idx = virtio_modern16_to_cpu(dev, vq->avail->idx);
+	uint32_t shift = vq_wrap(vq, used_idx);
+	struct vring_used *used = vq->used;
+
+#ifdef __CHERI_PURE_CAPABILITY__
+	/* vq->used is load-only, the device is reset so we may write it now */
+	used = cheri_derive_data_cap(vq->desc,
+				     (ptraddr_t) vq->used,
+				     sizeof(struct vring_used) + sizeof(struct vring_used_elem) * vq->size,
+				     __CHERI_CAP_PERMISSION_PERMIT_LOAD__ |
+				     __CHERI_CAP_PERMISSION_PERMIT_STORE__);
+#endif
+
+	/* Rotate left by "shift" positions with three reversals */
+	virtio_reverse16(vq->avail->ring, shift);
+	virtio_reverse16(vq->avail->ring + shift, vq->size - shift);
+	virtio_reverse16(vq->avail->ring, vq->size);
+	virtio_reverse_used(used->ring, shift);
+	virtio_reverse_used(used->ring + shift, vq->size - shift);
+	virtio_reverse_used(used->ring, vq->size);
+
+	vq->avail->idx = virtio_cpu_to_modern16(dev, avail_idx - used_idx);
+	used->flags = 0;
+	used->idx = 0;
+	vq->last_used_idx -= used_idx;
+}
+
+/**
+ * Suspend a device. It is reset, so it stops accessing the rings, but the
+ * rings, buffers and all driver state stay in place for virtio_resume().
+ * The driver must not submit to the queues until then.
+ * @param   dev  pointer to virtio device information
+ * @return  0 on success, -EBUSY if a multi-producer submission is under way,
+ *          -ETIMEDOUT if the device does not complete the reset
+ */
+int virtio_suspend(struct virtio_device *dev)
+{
+	uint32_t timeout_ms = VIRTIO_TIMEOUT;
+	unsigned int i;
+	int status;
+
+	for (i = 0; i < ARRAY_SIZE(dev->vq); i++) {
+		struct vqs *vq = &dev->vq[i];
+
+		if (vq->desc && vq->mp_ready && vq->reserve_idx != vq->publish_idx)
+			return -EBUSY;
+	}
+
+	virtio_reset_device(dev);
+	for (;;) {
+		virtio_get_status(dev, &status);
+		if (!status)
+			return 0;
+		if (!timeout_ms--)
+			return -ETIMEDOUT;
+		SLOF_msleep(1);
+	}
+}
+
+/**
+ * Resume a device suspended with virtio_suspend(). The features are
+ * negotiated again and the rings are handed back to the device at the same
+ * addresses. Chains which were in flight at suspend time are submitted
+ * again, used buffers which were not consumed yet are kept. Queues whose
+ * descriptors are picked from the avail index should be idle at suspend
+ * time, see virtio_queue_quiesce(), as the ring positions move.
+ * @param   dev  pointer to virtio device information
+ * @return  0 on success, -1 if the device refused the previous features
+ *          or the interrupt vector of a queue
+ */
+int virtio_resume(struct virtio_device *dev)
+{
+	int status = VIRTIO_STAT_ACKNOWLEDGE | VIRTIO_STAT_DRIVER;
+	uint64_t features = dev->features;
+	unsigned int i;
+#ifdef VIRTIO_USE_PCI
+	uint16_t vector;
+#endif
+
+	virtio_set_status(dev, VIRTIO_STAT_ACKNOWLEDGE);
+	virtio_set_status(dev, status);
+
+	if (virtio_is_modern(dev)) {
+		/* The rings are laid out for the previous features */
+		if (virtio_negotiate_guest_features(dev, features) ||
+		    dev->features != features) {
+			dev->features = features;
+			virtio_set_status(dev, status | VIRTIO_STAT_FAILED);
+			return -1;
+		}
+		status |= VIRTIO_STAT_FEATURES_OK;
+	} else {
+		virtio_set_guest_features(dev, features);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(dev->vq); i++) {
+		struct vqs *vq = &dev->vq[i];
+
+		if (!vq->desc)
+			continue;
+#ifdef VIRTIO_USE_PCI
+		vector = vq->msix_vector;
+#endif
+
+		virtio_ring_rebase(dev, vq);
+		if (vq->mp_ready)
+			virtio_queue_set_mp(dev, i, 1);
+
+		/* virtio_set_qaddr() maps the ring again */
+		if (vq->bus_desc)
+			SLOF_dma_map_out(vq->bus_desc, 0, virtio_vring_size(vq->size));
+
+		virtio_set_qsize(dev, i, vq->size);
+		if (virtio_set_qaddr(dev, i, vq))
+			goto failed;
+#ifdef VIRTIO_USE_PCI
+		/* Keep a vector chosen by the driver, not the default one */
+		if (virtio_is_modern(dev) && vector != VIRTIO_MSI_NO_VECTOR &&
+		    virtio_set_queue_vector(dev, i, vector))
+			goto failed;
+#endif
+		virtio_queue_ready(dev, i);
+	}
+
+#ifdef VIRTIO_USE_PCI
+	if (virtio_is_modern(dev) && dev->config_vector != VIRTIO_MSI_NO_VECTOR)
+		virtio_set_config_vector(dev, dev->config_vector);
+#endif
+
+	status |= VIRTIO_STAT_DRIVER_OK;
+	virtio_set_status(dev, status);
+
+	/* Hand the chains which were in flight to the device again */
+	for (i = 0; i < ARRAY_SIZE(dev->vq); i++) {
+		struct vqs *vq = &dev->vq[i];
+
+		if (vq->desc && vq->avail->idx)
+			virtio_queue_notify(dev, i);
+	}
+
+	return 0;
+
+failed:
+	virtio_set_status(dev, status | VIRTIO_STAT_FAILED);
+	return -1;
+}
+
 /**
  * Get additional config values
  */
@@ -829,7 +1950,7 @@ uint64_t virtio_get_config(struct virtio_device *dev, int offset, int size)
 	uint32_t hi, lo;
 	void *confbase;
 
-	if (dev->features & VIRTIO_F_VERSION_1)
+	if (virtio_is_modern(dev))
 		confbase = dev->device.addr;
 	else
 		confbase = dev->legacy.addr+VIRTIOHDR_DEVICE_CONFIG;
@@ -840,12 +1961,12 @@ uint64_t virtio_get_config(struct virtio_device *dev, int offset, int size)
 		break;
 	case 2:
 		val = ci_read_16(confbase+offset);
-		if (dev->features & VIRTIO_F_VERSION_1)
+		if (virtio_is_modern(dev))
 			val = le16_to_cpu(val);
 		break;
 	case 4:
 		val = ci_read_32(confbase+offset);
-		if (dev->features & VIRTIO_F_VERSION_1)
+		if (virtio_is_modern(dev))
 			val = le32_to_cpu(val);
 		break;
 	case 8:
@@ -854,7 +1975,7 @@ uint64_t virtio_get_config(struct virtio_device *dev, int offset, int size)
 		 */
 		lo = ci_read_32(confbase+offset);
 		hi = ci_read_32(confbase+offset+4);
-		if (dev->features & VIRTIO_F_VERSION_1)
+		if (virtio_is_modern(dev))
 			val = (uint64_t)le32_to_cpu(hi) << 32 | le32_to_cpu(lo);
 		else
 			val = (uint64_t)hi << 32 | lo;
@@ -889,6 +2010,112 @@ uint64_t virtio_get_config(struct virtio_device *dev, int offset, int size)
 #endif
 }
 
+/**
+ * Set a config value, for the few fields a driver may write
+ * @param   dev     pointer to virtio device information
+ * @param   offset  offset in the device config space
+ * @param   size    1, 2 or 4
+ * @param   val     value in CPU byte order
+ */
+void virtio_set_config(struct virtio_device *dev, int offset, int size,
+		       uint32_t val)
+{
+#ifdef VIRTIO_USE_PCI
+	void *confbase;
+
+	if (virtio_is_modern(dev))
+		confbase = dev->device.addr;
+	else
+		confbase = dev->legacy.addr+VIRTIOHDR_DEVICE_CONFIG;
+
+	switch (size) {
+	case 1:
+		ci_write_8(confbase+offset, val);
+		break;
+	case 2:
+		ci_write_16(confbase+offset,
+			    virtio_is_modern(dev) ? cpu_to_le16(val) : val);
+		break;
+	case 4:
+		ci_write_32(confbase+offset,
+			    virtio_is_modern(dev) ? cpu_to_le32(val) : val);
+		break;
+	}
+#elif VIRTIO_USE_MMIO
+	switch (size) {
+	case 1:
+		virtio_mmio_write8(dev->mmio_base, VIRTIO_MMIO_CONFIG + offset, val);
+		break;
+	case 2:
+		virtio_mmio_write16(dev->mmio_base, VIRTIO_MMIO_CONFIG + offset, val);
+		break;
+	case 4:
+		virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_CONFIG + offset, val);
+		break;
+	}
+#endif
+}
+
+/**
+ * Look up a shared memory region of the device and map it
+ * @param   dev  pointer to virtio device information
+ * @param   id   device specific region id
+ * @param   shm  receives the region
+ * @return  0 on success, -1 if the device has no such region
+ */
+int virtio_get_shm_region(struct virtio_device *dev, uint8_t id,
+			  struct virtio_shm_region *shm)
+{
+#ifdef VIRTIO_USE_PCI
+	uint8_t cap_ptr, is_io;
+	uint64_t offset;
+	int i;
+
+	for (i = 0; i < VIRTIO_MAX_SHM && dev->shm_cap[i]; i++) {
+		cap_ptr = dev->shm_cap[i];
+		if (virtio_pci_cfg_read8(dev, cap_ptr + VIRTIO_PCI_CAP_ID) != id)
+			continue;
+
+		offset = virtio_pci_cfg_read32(dev, cap_ptr + VIRTIO_PCI_CAP_OFFSET) |
+			 (uint64_t) virtio_pci_cfg_read32(dev,
+					cap_ptr + VIRTIO_PCI_CAP_OFFSET_HI) << 32;
+		shm->len = virtio_pci_cfg_read32(dev, cap_ptr + VIRTIO_PCI_CAP_LENGTH) |
+			   (uint64_t) virtio_pci_cfg_read32(dev,
+					cap_ptr + VIRTIO_PCI_CAP_LENGTH_HI) << 32;
+		shm->pa = virtio_pci_bar_addr(dev,
+				virtio_pci_cfg_read8(dev, cap_ptr + VIRTIO_PCI_CAP_BAR),
+				&is_io);
+		if (is_io || !shm->len)
+			return -1;
+
+		shm->pa += offset;
+		shm->addr = SLOF_translate_my_address((void *) shm->pa);
+		return 0;
+	}
+
+	return -1;
+#elif VIRTIO_USE_MMIO
+	if (!virtio_is_modern(dev))
+		return -1;
+
+	virtio_mmio_write32(dev->mmio_base, VIRTIO_MMIO_SHM_SEL, id);
+	sync();
+	shm->len = virtio_mmio_read32(dev->mmio_base, VIRTIO_MMIO_SHM_LEN_LOW) |
+		   (uint64_t) virtio_mmio_read32(dev->mmio_base,
+						 VIRTIO_MMIO_SHM_LEN_HIGH) << 32;
+
+	/* A length of all ones means there is no such region */
+	if (shm->len == ~0ULL || !shm->len)
+		return -1;
+
+	shm->pa = virtio_mmio_read32(dev->mmio_base, VIRTIO_MMIO_SHM_BASE_LOW) |
+		  (uint64_t) virtio_mmio_read32(dev->mmio_base,
+						VIRTIO_MMIO_SHM_BASE_HIGH) << 32;
+	shm->addr = SLOF_translate_my_address((void *) shm->pa);
+	return 0;
+#endif
+}
+
 /**
  * Get config blob
  */
@@ -900,7 +2127,7 @@ int __virtio_read_config(struct virtio_device *dev, void *dst,
 	unsigned char *buf = dst;
 	int i;
 
-	if (dev->features & VIRTIO_F_VERSION_1)
+	if (virtio_is_modern(dev))
 		confbase = dev->device.addr;
 	else
 		confbase = dev->legacy.addr+VIRTIOHDR_DEVICE_CONFIG;
@@ -32,22 +32,45 @@
 #define VIRTIO_F_RING_EVENT_IDX		BIT(29)
 #define VIRTIO_F_VERSION_1		((uint64_t) BIT(32))
 #define VIRTIO_F_IOMMU_PLATFORM        ((uint64_t) BIT(33))
+#define VIRTIO_F_IN_ORDER		((uint64_t) BIT(35))
+#define VIRTIO_F_NOTIFICATION_DATA	((uint64_t) BIT(38))
+
+/* Ring features a driver has to ask for, see virtio_negotiate_guest_features() */
+#define VIRTIO_F_OPTIONAL		(VIRTIO_F_IN_ORDER | VIRTIO_F_NOTIFICATION_DATA)
 
 #define VIRTIO_TIMEOUT		        5000 /* 5 sec timeout */
 
+/*
+ * Virtqueues per device, set by the VIRTIO_MAX_VQS build option. Every
+ * struct virtio_device carries this many, so it is a build wide choice:
+ * the balloon needs 4 for stats and free page reporting, multiport
+ * console 4 plus 2 per extra port, and the multiqueue scsi, crypto and
+ * fs drivers use what is left after their fixed queues.
+ */
+#ifndef VIRTIO_MAX_VQS
+#define VIRTIO_MAX_VQS			8
+#endif
+
+/* vqs.cpu value of a queue which is not pinned to a CPU */
+#define VIRTIO_CPU_ANY			(-1)
+
+/* MSI-X vector value meaning "no interrupt" */
+#define VIRTIO_MSI_NO_VECTOR		0xffff
+
 /* Definitions for vring_desc.flags */
 #define VRING_DESC_F_NEXT	1	/* buffer continues via the next field */
 #define VRING_DESC_F_WRITE	2	/* buffer is write-only (otherwise read-only) */
 #define VRING_DESC_F_INDIRECT	4	/* buffer contains a list of buffer descriptors */
 
-#ifdef VIRTIO_USE_PCI
-#error "VIRTIO_USE_PCI isn't yet supported by FreeRTOS"
-#endif
-
-#ifndef VIRTIO_USE_MMIO
+/* Transport: VIRTIO_USE_PCI (modern virtio-pci) or VIRTIO_USE_MMIO (default) */
+#if !defined(VIRTIO_USE_PCI) && !defined(VIRTIO_USE_MMIO)
 #define VIRTIO_USE_MMIO 1
 #endif
 
+/* Interrupt status bits (MMIO InterruptStatus / PCI ISR status) */
+#define VIRTIO_INT_VRING		1	/* a virtqueue has been used */
+#define VIRTIO_INT_CONFIG		2	/* the device configuration changed */
+
 /* Descriptor table entry - see Virtio Spec chapter 2.3.2 */
 struct vring_desc {
 	uint64_t addr;		/* Address (guest-physical) */
@@ -80,6 +103,33 @@ struct vring_used {
 	struct vring_used_elem ring[];
 };
 
+struct virtio_device;
+struct vqs;
+
+/* Interrupt callbacks, see virtio_handle_interrupt() */
+typedef void (*virtio_queue_handler_t)(struct virtio_device *dev,
+				       struct vqs *vq, void *arg);
+typedef void (*virtio_config_handler_t)(struct virtio_device *dev, void *arg);
+
+/*
+ * Completion of a request, for callers which do not want to poll. The
+ * submitter attaches it to the head of the chain, the queue handler
+ * harvests it with virtio_queue_harvest() and completes it, which calls
+ * the waker once, e.g. to make a task or coroutine runnable again.
+ */
+struct virtio_completion;
+typedef void (*virtio_waker_t)(struct virtio_completion *c, void *arg);
+
+struct virtio_completion {
+	int done;
+	int woken;
+	int status;		/* 0 or a negative error code */
+	uint32_t len;		/* Bytes written by the device */
+	virtio_waker_t waker;
+	void *waker_arg;
+	void *priv;		/* Driver private, e.g. the request */
+};
+
 /* Structure shared with SLOF and is 16bytes */
 struct virtio_cap {
 	void *addr;
@@ -88,6 +138,52 @@ struct virtio_cap {
 	uint8_t cap_id;
 };
 
+/* Shared memory region, see virtio_get_shm_region() */
+struct virtio_shm_region {
+	uint64_t pa;		/* Physical address of the region */
+	uint64_t len;
+	void *addr;		/* Where the driver accesses it */
+};
+
+/* PCI: number of shared memory capabilities recorded per device */
+#define VIRTIO_MAX_SHM		4
+
+/* Cache line size used to keep per queue data apart */
+#define VIRTIO_CACHE_LINE		64
+
+/*
+ * Per queue counters. They are written without atomics by the CPU owning
+ * the queue and read with virtio_queue_get_stats(), which retries while
+ * an update is in progress or the sequence count changed. Updates of the
+ * owner may nest, e.g. a completion handler running in interrupt context
+ * while the owner posts a request. In multi-producer mode the submission
+ * side counters are updated with atomic adds instead, and interrupts
+ * always are, as the dispatcher may run on any CPU.
+ */
+struct virtio_vq_stats {
+	uint32_t seq;			/* Updates completed */
+	uint32_t writers;		/* Updates in progress, nested included */
+	uint32_t max_inflight;		/* Most chains in flight at once */
+	uint64_t posted;		/* Chains made available */
+	uint64_t completions;		/* Used chains consumed */
+	uint64_t kicks;			/* Device notifications */
+	uint64_t kicks_suppressed;	/* Skipped due to VRING_USED_F_NO_NOTIFY */
+	uint64_t interrupts;		/* Handler runs for the queue */
+	uint64_t bytes;			/* Payload the device read or wrote */
+	uint64_t ring_full;		/* Submissions refused, no free slot */
+} __attribute__((aligned(VIRTIO_CACHE_LINE)));
+
+/*
+ * Concurrency model: a queue has a single owner (see vqs.cpu) and nothing
+ * in here is locked, so only the owner may add buffers, harvest the used
+ * ring or notify the device. A queue fed by several producers can be
+ * switched to multi-producer submission with virtio_queue_set_mp(): each
+ * producer then reserves an avail slot with virtio_queue_reserve(), fills
+ * the descriptors of that slot and hands it over with virtio_queue_publish().
+ * Slots are made visible to the device strictly in reservation order, and
+ * whichever producer completes a contiguous run publishes it, so nobody
+ * waits for a preempted producer.
+ */
 struct vqs {
 	uint32_t size;
 	void *buf_mem;
@@ -97,10 +193,30 @@ struct vqs {
 	struct vring_used *used;
 	void **desc_gpas; /* to get gpa from desc->addr (which is ioba) */
 	uint64_t bus_desc;
+	uint16_t last_used_idx;	/* Next entry to consume in the "used" ring */
+	uint16_t batch_last;	/* Head id closing the current in-order batch */
+	uint32_t batch_len;	/* Length reported for batch_last */
+	virtio_queue_handler_t handler;	/* Called when the queue got used */
+	void *handler_arg;
+	void *notify_addr;	/* PCI: queue notification address */
+	uint16_t msix_vector;	/* PCI: MSI-X vector of the queue */
+	int cpu;		/* CPU owning the queue or VIRTIO_CPU_ANY */
+	uint16_t *mp_ready;	/* MP: per slot, avail index + 1 once filled */
+	uint16_t reserve_idx;	/* MP: next avail index to hand out */
+	uint16_t publish_idx;	/* MP: avail index published so far */
+	struct virtio_completion **tokens; /* Per head, pending completion */
+	int16_t *slot_next;	/* Per slot, next free slot or -1 */
+	int16_t slot_free;	/* First free slot, -1 if none */
+	uint16_t slot_descs;	/* Descriptors per slot, slot n starts at n * slot_descs */
+	struct virtio_vq_stats stats;
 };
 
+/* vqs.batch_last value while no in-order batch is pending */
+#define VQ_NO_BATCH	0xffff
+
 #ifdef VIRTIO_USE_PCI
 struct virtio_device {
+	void *pci_cfg;		/* Memory mapped (ECAM) PCI config space */
 	uint64_t features;
 	struct virtio_cap legacy;
 	struct virtio_cap common;
@@ -109,13 +225,22 @@ struct virtio_device {
 	struct virtio_cap device;
 	struct virtio_cap pci;
 	uint32_t notify_off_mul;
-	struct vqs vq[3];
+	uint8_t msix_cap;	/* Offset of the MSI-X capability, 0 if none */
+	uint8_t shm_cap[VIRTIO_MAX_SHM]; /* Offsets of the shared memory capabilities */
+	uint16_t msix_vectors;	/* Vectors enabled by virtio_msix_enable() */
+	uint16_t config_vector;
+	void *msix_table;
+	virtio_config_handler_t config_handler;
+	void *config_arg;
+	struct vqs vq[VIRTIO_MAX_VQS];
 };
 #elif VIRTIO_USE_MMIO
 	struct virtio_device {
 	uint32_t     *mmio_base;
 	uint64_t     features;
-	struct vqs   vq[3];
+	virtio_config_handler_t config_handler;
+	void         *config_arg;
+	struct vqs   vq[VIRTIO_MAX_VQS];
 };
 #endif
 
@@ -134,10 +259,16 @@ extern void virtio_set_qsize(struct virtio_device *dev, uint32_t q, uint32_t qs)
 extern struct vring_desc *virtio_get_vring_desc(struct virtio_device *dev, int queue);
 extern struct vring_avail *virtio_get_vring_avail(struct virtio_device *dev, int queue);
 extern struct vring_used *virtio_get_vring_used(struct virtio_device *dev, int queue);
-extern void virtio_fill_desc(struct vqs *vq, int id, uint64_t features,
-                             uint64_t addr, uint32_t len,
-                             uint16_t flags, uint16_t next);
+extern int virtio_fill_desc(struct vqs *vq, int id, uint64_t features,
+                            uint64_t addr, uint32_t len,
+                            uint16_t flags, uint16_t next);
 extern void virtio_free_desc(struct vqs *vq, int id, uint64_t features);
+extern int virtio_get_used(struct virtio_device *dev, struct vqs *vq, uint32_t *len);
+extern int virtio_peek_used(struct virtio_device *dev, struct vqs *vq, uint32_t *len);
+extern uint32_t virtio_used_bytes(struct virtio_device *dev, struct vqs *vq,
+				  uint32_t max_len);
+extern int virtio_wait_used(struct virtio_device *dev, struct vqs *vq,
+			    uint32_t *len, uint32_t timeout_ms);
 size_t virtio_desc_addr(struct virtio_device *vdev, int queue, int id);
 extern struct vqs *virtio_queue_init_vq(struct virtio_device *dev, unsigned int id);
 extern void virtio_queue_term_vq(struct virtio_device *dev, struct vqs *vq, unsigned int id);
@@ -150,12 +281,60 @@ extern void virtio_get_status(struct virtio_device *dev, int *status);
 extern void virtio_set_guest_features(struct virtio_device *dev, uint64_t features);
 extern uint64_t virtio_get_host_features(struct virtio_device *dev);
 extern int virtio_negotiate_guest_features(struct virtio_device *dev, uint64_t features);
+extern int virtio_negotiate_guest_features_mask(struct virtio_device *dev,
+						uint64_t features, uint64_t refused);
+extern int virtio_queue_quiesce(struct virtio_device *dev, int queue,
+				uint32_t timeout_ms);
+extern int virtio_suspend(struct virtio_device *dev);
+extern int virtio_resume(struct virtio_device *dev);
 extern uint64_t virtio_get_config(struct virtio_device *dev, int offset, int size);
+extern void virtio_set_config(struct virtio_device *dev, int offset, int size,
+			      uint32_t val);
+extern int virtio_get_shm_region(struct virtio_device *dev, uint8_t id,
+				 struct virtio_shm_region *shm);
 extern int __virtio_read_config(struct virtio_device *dev, void *dst,
 				int offset, int len);
 
 extern void virtio_get_interrupt_status(struct virtio_device *dev, uint32_t *status);
 extern void virtio_interrupt_ack(struct virtio_device *dev, uint32_t ack);
+extern void virtio_queue_set_handler(struct virtio_device *dev, int queue,
+				     virtio_queue_handler_t handler, void *arg);
+extern void virtio_set_config_handler(struct virtio_device *dev,
+				      virtio_config_handler_t handler, void *arg);
+extern uint32_t virtio_handle_interrupt(struct virtio_device *dev);
+extern int virtio_queue_set_affinity(struct virtio_device *dev, int queue, int cpu);
+extern int virtio_queue_get_affinity(struct virtio_device *dev, int queue);
+extern void virtio_queue_get_stats(struct virtio_device *dev, int queue,
+				   struct virtio_vq_stats *stats);
+extern void virtio_completion_init(struct virtio_completion *c);
+extern void virtio_completion_set_waker(struct virtio_completion *c,
+					virtio_waker_t waker, void *arg);
+extern int virtio_completion_is_done(struct virtio_completion *c);
+extern void virtio_complete(struct virtio_completion *c, int status);
+extern int virtio_queue_set_completions(struct virtio_device *dev, int queue,
+					int enable);
+extern struct virtio_completion *virtio_queue_harvest(struct virtio_device *dev,
+						      struct vqs *vq);
+extern int virtio_queue_untrack(struct vqs *vq, struct virtio_completion *c);
+extern int virtio_queue_complete_all(struct virtio_device *dev, struct vqs *vq);
+extern int virtio_queue_set_slots(struct virtio_device *dev, int queue,
+				  unsigned int nr, unsigned int descs);
+extern int virtio_queue_get_slot(struct vqs *vq);
+extern int virtio_queue_set_mp(struct virtio_device *dev, int queue, int enable);
+extern int virtio_queue_reserve(struct virtio_device *dev, struct vqs *vq,
+				unsigned int limit);
+extern int virtio_queue_publish(struct virtio_device *dev, struct vqs *vq,
+				uint16_t idx, uint16_t head);
+
+#ifdef VIRTIO_USE_PCI
+extern int virtio_msix_enable(struct virtio_device *dev);
+extern void virtio_msix_set_entry(struct virtio_device *dev, uint16_t vector,
+				  uint64_t addr, uint32_t data);
+extern int virtio_set_config_vector(struct virtio_device *dev, uint16_t vector);
+extern int virtio_set_queue_vector(struct virtio_device *dev, int queue,
+				   uint16_t vector);
+extern void virtio_handle_vector(struct virtio_device *dev, uint16_t vector);
+#endif
 extern void virtio_queue_ready(struct virtio_device *dev, int queue);
 extern uint32_t virtio_read_queue_ready(struct virtio_device *dev, uint32_t queue);
 
@@ -58,6 +58,11 @@
 #define	VIRTIO_MMIO_QUEUE_AVAIL_HIGH	0x094	/* requires version 2 */
 #define	VIRTIO_MMIO_QUEUE_USED_LOW	0x0a0	/* requires version 2 */
 #define	VIRTIO_MMIO_QUEUE_USED_HIGH	0x0a4	/* requires version 2 */
+#define	VIRTIO_MMIO_SHM_SEL		0x0ac	/* requires version 2 */
+#define	VIRTIO_MMIO_SHM_LEN_LOW		0x0b0	/* requires version 2 */
+#define	VIRTIO_MMIO_SHM_LEN_HIGH	0x0b4	/* requires version 2 */
+#define	VIRTIO_MMIO_SHM_BASE_LOW	0x0b8	/* requires version 2 */
+#define	VIRTIO_MMIO_SHM_BASE_HIGH	0x0bc	/* requires version 2 */
 #define	VIRTIO_MMIO_CONFIG_GENERATION	0x100	/* requires version 2 */
 #define	VIRTIO_MMIO_CONFIG		0x100
 #define	VIRTIO_MMIO_INT_VRING		(1 << 0)
@@ -83,4 +88,14 @@ static inline void virtio_mmio_write32(uint32_t *base, size_t offset, uint32_t v
 {
 	*((volatile uint32_t*) (((uintptr_t) base) + offset)) = val;
 }
+
+static inline void virtio_mmio_write16(uint32_t *base, size_t offset, uint16_t val)
+{
+	*((volatile uint16_t*) (((uintptr_t) base) + offset)) = val;
+}
+
+static inline void virtio_mmio_write8(uint32_t *base, size_t offset, uint8_t val)
+{
+	*((volatile uint8_t*) (((uintptr_t) base) + offset)) = val;
+}
 #endif /* _VIRTIO_MMIO_H */